@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _ECBOR_IO_H_
+#define _ECBOR_IO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ecbor.h>
+
+/*
+ * Shared memory ring layout, see ecbor_ring.c
+ */
+typedef struct ecbor_ring_header ecbor_ring_header_t;
+
+/*
+ * Single producer, single consumer message ring in shared memory; each
+ * process (or thread) uses its own view of the ring
+ */
+typedef struct {
+  /* shared memory object and its mapping */
+  int fd;
+  ecbor_ring_header_t *header;
+  size_t map_size;
+
+  /* message area and its capacity (a power of two) */
+  uint8_t *data;
+  size_t capacity;
+
+  /* producer: position and size of the reserved record */
+  uint64_t reserved_position;
+  size_t reserved_size;
+
+  /* consumer: position after the message being read */
+  uint64_t read_next;
+
+  /* producer: messages committed since the consumer was last woken, and the
+     number of messages a sleeping consumer is woken for */
+  size_t pending_wakes;
+  size_t wake_batch;
+
+  /* number of polls before going to sleep */
+  unsigned int spin_count;
+} ecbor_ring_t;
+
+/*
+ * Access hints for mapped files
+ */
+#define ECBOR_MAP_SEQUENTIAL  0x01  /* aggressive read-ahead */
+#define ECBOR_MAP_RANDOM      0x02  /* no read-ahead */
+#define ECBOR_MAP_WILLNEED    0x04  /* start reading now */
+#define ECBOR_MAP_HUGEPAGES   0x08  /* back with huge pages where supported */
+#define ECBOR_MAP_POPULATE    0x10  /* prefault the whole file when mapping */
+#define ECBOR_MAP_DONTNEED    0x20  /* drop pages from the mapping */
+
+/*
+ * Read-only mapping of a whole file
+ */
+typedef struct {
+  /* file contents */
+  const uint8_t *data;
+  size_t size;
+} ecbor_file_map_t;
+
+/*
+ * File mapping routines
+ */
+extern ecbor_error_t
+ecbor_map_file (ecbor_file_map_t *map, const char *path, unsigned int flags);
+
+extern ecbor_error_t
+ecbor_advise_file (ecbor_file_map_t *map, size_t offset, size_t length,
+                   unsigned int flags);
+
+extern ecbor_error_t
+ecbor_unmap_file (ecbor_file_map_t *map);
+
+/*
+ * Prefetching reader backends
+ */
+#define ECBOR_READER_URING    1   /* io_uring reads */
+#define ECBOR_READER_THREAD   2   /* reads on a worker thread */
+
+/*
+ * Prefetching reader flags
+ */
+#define ECBOR_READER_NO_URING 0x01  /* always use the worker thread */
+
+/* Smallest block size accepted by the reader */
+#define ECBOR_READER_MIN_BLOCK 16
+
+/*
+ * Reader of CBOR sequences which keeps a number of blocks in flight and hands
+ * out windows holding whole items only, see ecbor_reader.c
+ */
+typedef struct ecbor_reader ecbor_reader_t;
+
+/*
+ * JSON output of tags
+ */
+typedef enum {
+  ECBOR_JSON_TAGS_DROP      = 0,  /* write the tagged item only */
+  ECBOR_JSON_TAGS_WRAP      = 1,  /* write {"tag":<number>,"value":<item>} */
+  ECBOR_JSON_TAGS_REJECT    = 2   /* fail with CURRENTLY_NOT_SUPPORTED */
+} ecbor_json_tag_policy_t;
+
+/*
+ * JSON output of map keys other than text strings
+ */
+typedef enum {
+  ECBOR_JSON_KEYS_STRINGIFY = 0,  /* scalars written as strings */
+  ECBOR_JSON_KEYS_SKIP      = 1,  /* pair left out */
+  ECBOR_JSON_KEYS_REJECT    = 2   /* fail with INVALID_KEY_VALUE_PAIR */
+} ecbor_json_key_policy_t;
+
+/*
+ * Open container while transcoding to JSON
+ */
+typedef struct {
+  /* items left, for definite containers */
+  uint64_t remaining;
+
+  /* ECBOR_TYPE_ARRAY, ECBOR_TYPE_MAP or ECBOR_TYPE_TAG (wrapped tag) */
+  uint8_t type;
+  uint8_t is_indefinite;
+
+  /* whether a member was written, and whether a map value comes next */
+  uint8_t has_output;
+  uint8_t at_value;
+} ecbor_json_frame_t;
+
+/*
+ * CBOR to JSON transcoding context
+ */
+typedef struct {
+  /* output buffer, position and remaining bytes */
+  uint8_t *base;
+  uint8_t *out_position;
+  size_t bytes_left;
+
+  /* flush callback, if any, and its user data */
+  ecbor_flush_callback_t flush;
+  void *flush_data;
+
+  ecbor_json_tag_policy_t tags;
+  ecbor_json_key_policy_t keys;
+
+  /* open containers; <muted> is the depth of the map whose pair is being
+     skipped, or 0 */
+  ecbor_json_frame_t stack[ECBOR_MAX_NESTING_DEPTH];
+  size_t depth;
+  size_t muted;
+} ecbor_json_context_t;
+
+/*
+ * Sidecar index builder options
+ */
+typedef struct {
+  /* records per index entry; 1 indexes every record */
+  uint64_t stride;
+
+  /* optional path to an integer key within each record (see ecbor_locate()),
+     whose minimum and maximum are kept for each entry */
+  const ecbor_item_t *key_path;
+  size_t key_path_length;
+
+  /* builder threads, 0 for one per online CPU */
+  unsigned int threads;
+} ecbor_index_options_t;
+
+/*
+ * Sidecar offset index of a CBOR sequence file, opened for lookups
+ */
+typedef struct {
+  /* mapped index and data files */
+  ecbor_file_map_t index_map;
+  ecbor_file_map_t data_map;
+
+  /* index entries, one per block of <stride> records */
+  const uint8_t *entries;
+  size_t entry_size;
+  uint64_t block_count;
+  uint64_t stride;
+
+  /* indexed records, and the bytes of the data file they span */
+  uint64_t record_count;
+  size_t indexed_size;
+} ecbor_index_t;
+
+/*
+ * Decoder refill callback reading from the file descriptor <user_data> points
+ * to (see ecbor_set_refill_callback())
+ */
+extern ecbor_error_t
+ecbor_fd_refill (void *user_data, uint8_t *buffer, size_t size,
+                 size_t *filled);
+
+/*
+ * CBOR to JSON transcoding routines
+ */
+extern ecbor_error_t
+ecbor_initialize_json (ecbor_json_context_t *context, uint8_t *buffer,
+                       size_t buffer_size);
+
+extern ecbor_error_t
+ecbor_set_json_flush_callback (ecbor_json_context_t *context,
+                               ecbor_flush_callback_t flush, void *user_data);
+
+extern ecbor_error_t
+ecbor_set_json_policy (ecbor_json_context_t *context,
+                       ecbor_json_tag_policy_t tags,
+                       ecbor_json_key_policy_t keys);
+
+extern ecbor_error_t
+ecbor_json_transcode (ecbor_json_context_t *context,
+                      ecbor_decode_context_t *input);
+
+extern ecbor_error_t
+ecbor_get_json_size (ecbor_json_context_t *context, size_t *size);
+
+extern ecbor_error_t
+ecbor_json_flush (ecbor_json_context_t *context);
+
+/*
+ * JSON to CBOR encoding routine; <json_position> (optional) receives the
+ * offset at which parsing stopped
+ */
+extern ecbor_error_t
+ecbor_json_encode (ecbor_encode_context_t *context, const uint8_t *json,
+                   size_t json_size, size_t *json_position);
+
+/*
+ * Sidecar index routines
+ */
+extern ecbor_error_t
+ecbor_index_build (const char *data_path, const char *index_path,
+                   const ecbor_index_options_t *options);
+
+extern ecbor_error_t
+ecbor_index_update (const char *data_path, const char *index_path,
+                    const ecbor_index_options_t *options);
+
+extern ecbor_error_t
+ecbor_index_open (ecbor_index_t *index, const char *data_path,
+                  const char *index_path);
+
+extern ecbor_error_t
+ecbor_index_close (ecbor_index_t *index);
+
+extern ecbor_error_t
+ecbor_index_get_record (const ecbor_index_t *index, uint64_t record,
+                        const uint8_t **data, size_t *size);
+
+extern ecbor_error_t
+ecbor_index_find_offset (const ecbor_index_t *index, size_t offset,
+                         uint64_t *record);
+
+extern ecbor_error_t
+ecbor_index_get_block (const ecbor_index_t *index, uint64_t block,
+                       uint64_t *first_record, size_t *offset,
+                       int64_t *key_min, int64_t *key_max);
+
+/*
+ * Prefetching reader routines
+ */
+extern ecbor_error_t
+ecbor_reader_open (ecbor_reader_t **reader, int fd, size_t block_size,
+                   unsigned int depth, unsigned int flags);
+
+extern ecbor_error_t
+ecbor_reader_next (ecbor_reader_t *reader, const uint8_t **window,
+                   size_t *size);
+
+extern ecbor_error_t
+ecbor_reader_get_backend (const ecbor_reader_t *reader,
+                          unsigned int *backend);
+
+extern ecbor_error_t
+ecbor_reader_close (ecbor_reader_t *reader);
+
+/*
+ * Shared memory ring routines
+ */
+extern ecbor_error_t
+ecbor_ring_create (ecbor_ring_t *ring, const char *name, size_t capacity);
+
+extern ecbor_error_t
+ecbor_ring_attach (ecbor_ring_t *ring, int fd);
+
+extern ecbor_error_t
+ecbor_ring_close (ecbor_ring_t *ring);
+
+extern ecbor_error_t
+ecbor_ring_set_wake_batch (ecbor_ring_t *ring, size_t messages,
+                           unsigned int spin_count);
+
+extern ecbor_error_t
+ecbor_ring_reserve (ecbor_ring_t *ring, size_t max_size, uint8_t **slot,
+                    int timeout_ms);
+
+extern ecbor_error_t
+ecbor_ring_commit (ecbor_ring_t *ring, size_t size);
+
+extern ecbor_error_t
+ecbor_ring_flush (ecbor_ring_t *ring);
+
+extern ecbor_error_t
+ecbor_ring_begin_encode (ecbor_ring_t *ring, ecbor_encode_context_t *context,
+                         size_t max_size, int timeout_ms);
+
+extern ecbor_error_t
+ecbor_ring_end_encode (ecbor_ring_t *ring, ecbor_encode_context_t *context);
+
+extern ecbor_error_t
+ecbor_ring_read (ecbor_ring_t *ring, const uint8_t **message, size_t *size,
+                 int timeout_ms);
+
+extern ecbor_error_t
+ecbor_ring_release (ecbor_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
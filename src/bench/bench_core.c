@@ -0,0 +1,767 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Throughput of the core library over generated corpora: encoding, decoding
+ * in normal and streamed mode, tree decoding, and tree decoding followed by a
+ * walk through the accessor API. Corpora are CBOR sequences of records,
+ * encoded from a fixed set of record templates built from a fixed seed, so
+ * they are identical across runs and releases (see their checksums).
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ecbor.h>
+
+/* Distinct records per corpus, repeated up to the corpus size */
+#define TEMPLATES 64
+
+/* Children of array records, pairs of map records, and nesting depth */
+#define ARRAY_LENGTH 256
+#define MAP_PAIRS 16
+#define NESTING_DEPTH 64
+#define BLOB_SIZE (64 << 10)
+
+/* Item buffer for tree decoding, per record */
+#define TREE_ITEMS (1 << 16)
+
+/* Items of a record template (tree), or tokens (streamed) */
+#define TEMPLATE_ITEMS (4 * ARRAY_LENGTH)
+
+static struct option long_options[] = {
+  { "size",      required_argument, 0, 's' },
+  { "runs",      required_argument, 0, 'r' },
+  { "corpus",    required_argument, 0, 'c' },
+  { "operation", required_argument, 0, 'o' },
+  { "json",      required_argument, 0, 'j' },
+  { "help",      no_argument,       0, 'h' },
+  { 0, 0, 0, 0 }
+};
+
+/*
+ * Record template; either an item tree, encoded with ecbor_encode(), or a
+ * list of tokens for streamed encoding
+ */
+typedef struct {
+  ecbor_item_t items[TEMPLATE_ITEMS];
+  size_t n_items;
+  ecbor_item_t *root;
+
+  /* string and blob payloads */
+  uint8_t *text;
+  size_t text_used;
+
+  size_t encoded_size;
+} template_t;
+
+typedef struct {
+  const char *name;
+  void (*build) (template_t *t);
+  int streamed;
+
+  template_t *templates;
+
+  /* encoded corpus and its records */
+  uint8_t *data;
+  size_t size;
+  size_t records;
+  const uint8_t **record_data;
+  size_t *record_size;
+  uint64_t items;
+  uint64_t checksum;
+
+  /* sum of values seen through the accessors, the same on every run */
+  uint64_t walked;
+} corpus_t;
+
+typedef struct {
+  const char *name;
+  uint64_t (*run) (corpus_t *corpus, size_t *peak_items);
+} operation_t;
+
+static uint32_t random_state;
+
+static uint32_t
+next_random (void)
+{
+  random_state = random_state * 1103515245u + 12345u;
+  return random_state >> 8;
+}
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void
+fail (const char *corpus, const char *what, ecbor_error_t rc)
+{
+  fprintf (stderr, "%s: %s failed (%d)\n", corpus, what, rc);
+  exit (1);
+}
+
+/*
+ * Record templates
+ */
+static ecbor_item_t *
+new_item (template_t *t, ecbor_item_t item)
+{
+  if (t->n_items == TEMPLATE_ITEMS) {
+    fail ("template", "building", ECBOR_ERR_END_OF_ITEM_BUFFER);
+  }
+  t->items[t->n_items] = item;
+  return &t->items[t->n_items ++];
+}
+
+static const char *
+new_text (template_t *t, size_t length, int binary)
+{
+  char *text = (char *) t->text + t->text_used;
+  size_t i;
+
+  for (i = 0; i < length; i ++) {
+    text[i] = (char) (binary ? next_random () : 'a' + next_random () % 26);
+  }
+  t->text_used += length;
+  return text;
+}
+
+/* Integers of all widths and both signs */
+static void
+build_ints (template_t *t)
+{
+  static const int bits[5] = { 4, 8, 16, 32, 63 };
+  ecbor_item_t *values = &t->items[1];
+  uint64_t value;
+  size_t i;
+
+  t->n_items = 1;
+  for (i = 0; i < ARRAY_LENGTH; i ++) {
+    value = (((uint64_t) next_random () << 32) | next_random ())
+            >> (64 - bits[next_random () % 5]);
+    new_item (t, (next_random () % 2 ? ecbor_uint (value)
+                                     : ecbor_int (-1 - (int64_t) value)));
+  }
+  ecbor_array (&t->items[0], values, ARRAY_LENGTH);
+  t->root = &t->items[0];
+}
+
+/* Single and double precision floats */
+static void
+build_floats (template_t *t)
+{
+  ecbor_item_t *values = &t->items[1];
+  double value;
+  size_t i;
+
+  t->n_items = 1;
+  for (i = 0; i < ARRAY_LENGTH; i ++) {
+    value = ((double) next_random () - 8388608.0) / 1024.0;
+    new_item (t, (i % 2 ? ecbor_fp32 ((float) value) : ecbor_fp64 (value)));
+  }
+  ecbor_array (&t->items[0], values, ARRAY_LENGTH);
+  t->root = &t->items[0];
+}
+
+/* Maps of text keys to text values */
+static void
+build_strings (template_t *t)
+{
+  ecbor_item_t *keys = &t->items[1], *values = &t->items[1 + MAP_PAIRS];
+  char *key;
+  size_t i, length;
+
+  t->n_items = 1 + 2 * MAP_PAIRS;
+  for (i = 0; i < MAP_PAIRS; i ++) {
+    key = (char *) t->text + t->text_used;
+    t->text_used += (size_t) sprintf (key, "field_%02u", (unsigned int) i);
+    keys[i] = ecbor_str (key, strlen (key));
+    length = 4 + next_random () % 61;
+    values[i] = ecbor_str (new_text (t, length, 0), length);
+  }
+  ecbor_map (&t->items[0], keys, values, MAP_PAIRS);
+  t->root = &t->items[0];
+}
+
+/* Arrays of [int, str, child], NESTING_DEPTH deep */
+static void
+build_nested (template_t *t)
+{
+  ecbor_item_t *level, *child = NULL;
+  size_t depth;
+
+  t->n_items = 0;
+  for (depth = 0; depth < NESTING_DEPTH; depth ++) {
+    level = &t->items[t->n_items];
+    new_item (t, ecbor_uint (next_random () % 1000));
+    new_item (t, ecbor_str (new_text (t, 6, 0), 6));
+    if (child) {
+      new_item (t, *child);
+    }
+    child = new_item (t, ecbor_null ());
+    ecbor_array (child, level, (depth > 0 ? 3 : 2));
+  }
+  t->root = child;
+}
+
+/* A name and a large byte string */
+static void
+build_blobs (template_t *t)
+{
+  ecbor_item_t *keys = &t->items[1], *values = &t->items[3];
+
+  t->n_items = 5;
+  keys[0] = ecbor_str ("name", 4);
+  values[0] = ecbor_str (new_text (t, 12, 0), 12);
+  keys[1] = ecbor_str ("data", 4);
+  values[1] = ecbor_bstr ((const uint8_t *) new_text (t, BLOB_SIZE, 1),
+                          BLOB_SIZE);
+  ecbor_map (&t->items[0], keys, values, 2);
+  t->root = &t->items[0];
+}
+
+/* String header and payload, for streamed encoding */
+static void
+token_string (template_t *t, ecbor_item_t header, const char *text,
+              size_t length)
+{
+  new_item (t, header);
+  new_item (t, ecbor_raw ((const uint8_t *) text, length));
+}
+
+/* Indefinite maps, arrays and chunked strings */
+static void
+build_indefinite (template_t *t)
+{
+  static const uint8_t indefinite_str = 0x7f, indefinite_bstr = 0x5f;
+  const char *chunk;
+  size_t i;
+
+  t->n_items = 0;
+  new_item (t, ecbor_indefinite_map_token ());
+
+  token_string (t, ecbor_str (NULL, 7), "samples", 7);
+  new_item (t, ecbor_indefinite_array_token ());
+  for (i = 0; i < ARRAY_LENGTH / 4; i ++) {
+    new_item (t, ecbor_uint (next_random () % 100000));
+  }
+  new_item (t, ecbor_stop_code ());
+
+  token_string (t, ecbor_str (NULL, 4), "text", 4);
+  new_item (t, ecbor_raw (&indefinite_str, 1));
+  for (i = 0; i < 4; i ++) {
+    chunk = new_text (t, 16, 0);
+    token_string (t, ecbor_str (NULL, 16), chunk, 16);
+  }
+  new_item (t, ecbor_stop_code ());
+
+  token_string (t, ecbor_str (NULL, 3), "raw", 3);
+  new_item (t, ecbor_raw (&indefinite_bstr, 1));
+  for (i = 0; i < 4; i ++) {
+    chunk = new_text (t, 32, 1);
+    token_string (t, ecbor_bstr (NULL, 32), chunk, 32);
+  }
+  new_item (t, ecbor_stop_code ());
+
+  token_string (t, ecbor_str (NULL, 4), "more", 4);
+  new_item (t, ecbor_indefinite_array_token ());
+  for (i = 0; i < 8; i ++) {
+    new_item (t, ecbor_indefinite_map_token ());
+    token_string (t, ecbor_str (NULL, 1), "k", 1);
+    new_item (t, ecbor_uint (i));
+    new_item (t, ecbor_stop_code ());
+  }
+  new_item (t, ecbor_stop_code ());
+
+  new_item (t, ecbor_stop_code ());
+  t->root = NULL;
+}
+
+/*
+ * Encoding
+ */
+static ecbor_error_t
+encode_template (ecbor_encode_context_t *context, corpus_t *corpus,
+                 template_t *t)
+{
+  ecbor_error_t rc = ECBOR_OK;
+  size_t i;
+
+  if (!corpus->streamed) {
+    return ecbor_encode (context, t->root);
+  }
+  for (i = 0; i < t->n_items && rc == ECBOR_OK; i ++) {
+    rc = ecbor_encode (context, &t->items[i]);
+  }
+  return rc;
+}
+
+static ecbor_error_t
+initialize_encode (ecbor_encode_context_t *context, corpus_t *corpus,
+                   uint8_t *buffer, size_t size)
+{
+  return (corpus->streamed
+          ? ecbor_initialize_encode_streamed (context, buffer, size)
+          : ecbor_initialize_encode (context, buffer, size));
+}
+
+static uint64_t
+run_encode (corpus_t *corpus, size_t *peak_items)
+{
+  ecbor_encode_context_t context;
+  ecbor_error_t rc;
+  uint64_t start;
+  size_t i;
+
+  (*peak_items) = 0;
+  start = now_ns ();
+  rc = initialize_encode (&context, corpus, corpus->data, corpus->size);
+  for (i = 0; i < corpus->records && rc == ECBOR_OK; i ++) {
+    rc = encode_template (&context, corpus,
+                          &corpus->templates[i % TEMPLATES]);
+  }
+  if (rc != ECBOR_OK) {
+    fail (corpus->name, "encoding", rc);
+  }
+  return now_ns () - start;
+}
+
+/*
+ * Decoding
+ */
+static uint64_t
+run_decode (corpus_t *corpus, size_t *peak_items)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  ecbor_error_t rc;
+  uint64_t start;
+  size_t records = 0;
+
+  (*peak_items) = 0;
+  start = now_ns ();
+  rc = ecbor_initialize_decode (&context, corpus->data, corpus->size);
+  while (rc == ECBOR_OK) {
+    rc = ecbor_decode (&context, &item);
+    records ++;
+  }
+  if (rc != ECBOR_END_OF_BUFFER || records - 1 != corpus->records) {
+    fail (corpus->name, "decoding", rc);
+  }
+  return now_ns () - start;
+}
+
+static uint64_t
+run_streamed (corpus_t *corpus, size_t *peak_items)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  ecbor_error_t rc;
+  uint64_t start, items = 0;
+
+  (*peak_items) = 0;
+  start = now_ns ();
+  rc = ecbor_initialize_decode_streamed (&context, corpus->data,
+                                         corpus->size);
+  while (rc == ECBOR_OK || rc == ECBOR_END_OF_INDEFINITE) {
+    items += (rc == ECBOR_OK);
+    rc = ecbor_decode (&context, &item);
+  }
+  if (rc != ECBOR_END_OF_BUFFER || items - 1 != corpus->items) {
+    fail (corpus->name, "streamed decoding", rc);
+  }
+  return now_ns () - start;
+}
+
+static ecbor_item_t tree_items[TREE_ITEMS];
+
+static uint64_t
+decode_trees (corpus_t *corpus, size_t *peak_items, uint64_t *checksum,
+              uint64_t (*walk) (ecbor_item_t *))
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t *root;
+  ecbor_error_t rc = ECBOR_OK;
+  uint64_t start, items = 0;
+  size_t i;
+
+  (*peak_items) = 0;
+  start = now_ns ();
+  for (i = 0; i < corpus->records && rc == ECBOR_OK; i ++) {
+    rc = ecbor_initialize_decode_tree (&context, corpus->record_data[i],
+                                       corpus->record_size[i], tree_items,
+                                       TREE_ITEMS);
+    if (rc == ECBOR_OK) {
+      rc = ecbor_decode_tree (&context, &root);
+    }
+    items += context.n_items;
+    if (context.n_items > (*peak_items)) {
+      (*peak_items) = context.n_items;
+    }
+    if (walk && rc == ECBOR_OK) {
+      (*checksum) += walk (root);
+    }
+  }
+  if (rc != ECBOR_OK || items != corpus->items) {
+    fail (corpus->name, "tree decoding", rc);
+  }
+  return now_ns () - start;
+}
+
+static uint64_t
+run_tree (corpus_t *corpus, size_t *peak_items)
+{
+  return decode_trees (corpus, peak_items, NULL, NULL);
+}
+
+/* Visit every value through the accessor API, folding it into a checksum */
+static uint64_t
+walk_accessors (ecbor_item_t *item)
+{
+  ecbor_item_t *child, *key, chunk;
+  const uint8_t *bytes;
+  const char *text;
+  uint64_t sum = 0, u;
+  int64_t s;
+  double d;
+  float f;
+  uint8_t b;
+  size_t length, i;
+
+  switch (ecbor_get_type (item)) {
+    case ECBOR_TYPE_ARRAY:
+      ecbor_get_length (item, &length);
+      for (i = 0; i < length; i ++) {
+        if (ecbor_get_array_item_ptr (item, i, &child) == ECBOR_OK) {
+          sum += walk_accessors (child);
+        }
+      }
+      break;
+
+    case ECBOR_TYPE_MAP:
+      ecbor_get_length (item, &length);
+      for (i = 0; i < length; i ++) {
+        if (ecbor_get_map_item_ptr (item, i, &key, &child) == ECBOR_OK) {
+          sum += walk_accessors (key) + walk_accessors (child);
+        }
+      }
+      break;
+
+    case ECBOR_TYPE_TAG:
+      if (ecbor_get_tag_item_ptr (item, &child) == ECBOR_OK) {
+        sum += walk_accessors (child);
+      }
+      break;
+
+    case ECBOR_TYPE_UINT:
+      ecbor_get_uint64 (item, &u);
+      sum += u;
+      break;
+
+    case ECBOR_TYPE_NINT:
+      ecbor_get_int64 (item, &s);
+      sum += (uint64_t) s;
+      break;
+
+    case ECBOR_TYPE_STR:
+      if (item->is_indefinite) {
+        ecbor_get_str_chunk_count (item, &length);
+        for (i = 0; i < length; i ++) {
+          if (ecbor_get_str_chunk (item, i, &chunk) == ECBOR_OK) {
+            sum += walk_accessors (&chunk);
+          }
+        }
+      } else if (ecbor_get_str (item, &text) == ECBOR_OK) {
+        ecbor_get_length (item, &length);
+        sum += length + (length ? (uint8_t) text[0] : 0);
+      }
+      break;
+
+    case ECBOR_TYPE_BSTR:
+      if (item->is_indefinite) {
+        ecbor_get_bstr_chunk_count (item, &length);
+        for (i = 0; i < length; i ++) {
+          if (ecbor_get_bstr_chunk (item, i, &chunk) == ECBOR_OK) {
+            sum += walk_accessors (&chunk);
+          }
+        }
+      } else if (ecbor_get_bstr (item, &bytes) == ECBOR_OK) {
+        ecbor_get_length (item, &length);
+        sum += length + (length ? bytes[0] : 0);
+      }
+      break;
+
+    case ECBOR_TYPE_FP32:
+      ecbor_get_fp32 (item, &f);
+      sum += (uint64_t) (int64_t) f;
+      break;
+
+    case ECBOR_TYPE_FP64:
+      ecbor_get_fp64 (item, &d);
+      sum += (uint64_t) (int64_t) d;
+      break;
+
+    case ECBOR_TYPE_BOOL:
+      ecbor_get_bool (item, &b);
+      sum += b;
+      break;
+
+    default:
+      break;
+  }
+  return sum;
+}
+
+static uint64_t
+run_access (corpus_t *corpus, size_t *peak_items)
+{
+  uint64_t walked = 0, elapsed;
+
+  elapsed = decode_trees (corpus, peak_items, &walked, walk_accessors);
+  if (corpus->walked && walked != corpus->walked) {
+    fail (corpus->name, "accessor walk", ECBOR_ERR_UNKNOWN);
+  }
+  corpus->walked = walked;
+  return elapsed;
+}
+
+/*
+ * Corpus setup
+ */
+static void
+prepare (corpus_t *corpus, size_t target_size, uint32_t seed)
+{
+  ecbor_encode_context_t context;
+  ecbor_decode_context_t decoder;
+  ecbor_item_t item;
+  ecbor_error_t rc;
+  size_t i, size, total;
+  uint8_t *scratch;
+  const uint8_t *p;
+
+  /* templates, and their encoded sizes */
+  random_state = seed;
+  corpus->templates = (template_t *) calloc (TEMPLATES, sizeof (template_t));
+  scratch = (uint8_t *) malloc (4 * BLOB_SIZE);
+  if (!corpus->templates || !scratch) {
+    fail (corpus->name, "allocation", ECBOR_ERR_SYSTEM);
+  }
+  for (i = 0; i < TEMPLATES; i ++) {
+    corpus->templates[i].text = (uint8_t *) malloc (2 * BLOB_SIZE);
+    if (!corpus->templates[i].text) {
+      fail (corpus->name, "allocation", ECBOR_ERR_SYSTEM);
+    }
+    corpus->build (&corpus->templates[i]);
+
+    rc = initialize_encode (&context, corpus, scratch, 4 * BLOB_SIZE);
+    if (rc == ECBOR_OK) {
+      rc = encode_template (&context, corpus, &corpus->templates[i]);
+    }
+    if (rc != ECBOR_OK) {
+      fail (corpus->name, "template encoding", rc);
+    }
+    ecbor_get_encoded_buffer_size (&context,
+                                   &corpus->templates[i].encoded_size);
+  }
+  free (scratch);
+
+  /* records up to the target size, at least one round of templates */
+  for (total = 0, i = 0; total < target_size || i < TEMPLATES; i ++) {
+    total += corpus->templates[i % TEMPLATES].encoded_size;
+  }
+  corpus->records = i;
+  corpus->size = total;
+  corpus->data = (uint8_t *) malloc (total);
+  corpus->record_data = (const uint8_t **) malloc (i * sizeof (uint8_t *));
+  corpus->record_size = (size_t *) malloc (i * sizeof (size_t));
+  if (!corpus->data || !corpus->record_data || !corpus->record_size) {
+    fail (corpus->name, "allocation", ECBOR_ERR_SYSTEM);
+  }
+  run_encode (corpus, &size);
+
+  /* records, items and checksum (FNV-1a) */
+  for (p = corpus->data, i = 0; i < corpus->records; i ++) {
+    corpus->record_data[i] = p;
+    corpus->record_size[i] = corpus->templates[i % TEMPLATES].encoded_size;
+    p += corpus->record_size[i];
+  }
+  corpus->items = 0;
+  rc = ecbor_initialize_decode_streamed (&decoder, corpus->data, corpus->size);
+  while (rc == ECBOR_OK || rc == ECBOR_END_OF_INDEFINITE) {
+    rc = ecbor_decode (&decoder, &item);
+    corpus->items += (rc == ECBOR_OK);
+  }
+  if (rc != ECBOR_END_OF_BUFFER) {
+    fail (corpus->name, "counting", rc);
+  }
+  corpus->checksum = 0xcbf29ce484222325ull;
+  for (i = 0; i < corpus->size; i ++) {
+    corpus->checksum = (corpus->checksum ^ corpus->data[i])
+                       * 0x100000001b3ull;
+  }
+}
+
+static void
+release (corpus_t *corpus)
+{
+  size_t i;
+
+  for (i = 0; i < TEMPLATES; i ++) {
+    free (corpus->templates[i].text);
+  }
+  free (corpus->templates);
+  free (corpus->data);
+  free (corpus->record_data);
+  free (corpus->record_size);
+}
+
+static void
+print_help (void)
+{
+  printf ("Usage: ecbor-bench-core [options]\n");
+  printf ("  options:\n");
+  printf ("  -s, --size <MB>         Size of each corpus (default 16)\n");
+  printf ("  -r, --runs <n>          Runs per measurement, the best is kept (default 5)\n");
+  printf ("  -c, --corpus <name>     Only this corpus (ints, floats, strings, nested,\n");
+  printf ("                          blobs, indefinite)\n");
+  printf ("  -o, --operation <name>  Only this operation (encode, decode, streamed,\n");
+  printf ("                          tree, access)\n");
+  printf ("  -j, --json <path>       Also write results to <path> as JSON\n");
+  printf ("  -h, --help              Display this help message\n");
+}
+
+int
+main (int argc, char **argv)
+{
+  static corpus_t corpora[] = {
+    { .name = "ints",       .build = build_ints },
+    { .name = "floats",     .build = build_floats },
+    { .name = "strings",    .build = build_strings },
+    { .name = "nested",     .build = build_nested },
+    { .name = "blobs",      .build = build_blobs },
+    { .name = "indefinite", .build = build_indefinite, .streamed = 1 }
+  };
+  static const operation_t operations[] = {
+    { "encode",   run_encode },
+    { "decode",   run_decode },
+    { "streamed", run_streamed },
+    { "tree",     run_tree },
+    { "access",   run_access }
+  };
+  const size_t n_corpora = sizeof (corpora) / sizeof (corpora[0]);
+  const size_t n_operations = sizeof (operations) / sizeof (operations[0]);
+  const char *only_corpus = NULL, *only_operation = NULL, *json_path = NULL;
+  size_t megabytes = 16, runs = 5, c, o, r, peak, first = 1;
+  uint64_t best, elapsed;
+  double seconds;
+  FILE *json = NULL;
+
+  while (1) {
+    int option_index, ch;
+
+    ch = getopt_long (argc, argv, "s:r:c:o:j:h", long_options, &option_index);
+    if (ch == -1) {
+      break;
+    }
+    switch (ch) {
+      case 's': megabytes = (size_t) strtoul (optarg, NULL, 10); break;
+      case 'r': runs = (size_t) strtoul (optarg, NULL, 10); break;
+      case 'c': only_corpus = optarg; break;
+      case 'o': only_operation = optarg; break;
+      case 'j': json_path = optarg; break;
+      default:
+        print_help ();
+        return 0;
+    }
+  }
+  if (runs == 0) {
+    runs = 1;
+  }
+
+#ifndef __OPTIMIZE__
+  fprintf (stderr, "warning: built without optimization, configure with "
+                   "-DCMAKE_BUILD_TYPE=Release for meaningful numbers\n");
+#endif
+
+  if (json_path) {
+    json = fopen (json_path, "w");
+    if (!json) {
+      perror (json_path);
+      return 1;
+    }
+    fprintf (json, "{\n  \"version\": \"%s\",\n", ECBOR_VERSION);
+#ifdef __OPTIMIZE__
+    fprintf (json, "  \"optimized\": true,\n");
+#else
+    fprintf (json, "  \"optimized\": false,\n");
+#endif
+    fprintf (json, "  \"corpus_megabytes\": %zu,\n  \"runs\": %zu,\n"
+                   "  \"results\": [", megabytes, runs);
+  }
+
+  printf ("%-11s %-9s %10s %14s %9s %11s\n", "corpus", "operation", "MB/s",
+          "items/s", "ns/item", "peak items");
+  for (c = 0; c < n_corpora; c ++) {
+    if (only_corpus && strcmp (only_corpus, corpora[c].name)) {
+      continue;
+    }
+    prepare (&corpora[c], megabytes << 20, 0x5eed0000u + (uint32_t) c);
+
+    for (o = 0; o < n_operations; o ++) {
+      if (only_operation && strcmp (only_operation, operations[o].name)) {
+        continue;
+      }
+      best = UINT64_MAX;
+      for (r = 0; r < runs; r ++) {
+        elapsed = operations[o].run (&corpora[c], &peak);
+        if (elapsed < best) {
+          best = elapsed;
+        }
+      }
+      seconds = (double) best / 1e9;
+      if (seconds <= 0) {
+        seconds = 1e-9;
+      }
+
+      printf ("%-11s %-9s %10.1f %14.0f %9.2f %11zu\n", corpora[c].name,
+              operations[o].name,
+              (double) corpora[c].size / (1 << 20) / seconds,
+              (double) corpora[c].items / seconds,
+              (double) best / (double) corpora[c].items, peak);
+      if (json) {
+        fprintf (json, "%s\n    { \"corpus\": \"%s\", \"operation\": \"%s\", "
+                       "\"bytes\": %zu, \"records\": %zu, \"items\": %llu, "
+                       "\"checksum\": \"%016llx\", \"seconds\": %.9f, "
+                       "\"mb_per_s\": %.3f, \"items_per_s\": %.1f, "
+                       "\"ns_per_item\": %.3f, \"peak_items\": %zu, "
+                       "\"peak_item_bytes\": %zu }",
+                 (first ? "" : ","), corpora[c].name, operations[o].name,
+                 corpora[c].size, corpora[c].records,
+                 (unsigned long long int) corpora[c].items,
+                 (unsigned long long int) corpora[c].checksum, seconds,
+                 (double) corpora[c].size / (1 << 20) / seconds,
+                 (double) corpora[c].items / seconds,
+                 (double) best / (double) corpora[c].items, peak,
+                 peak * sizeof (ecbor_item_t));
+        first = 0;
+      }
+    }
+    release (&corpora[c]);
+  }
+
+  if (json) {
+    fprintf (json, "\n  ]\n}\n");
+    fclose (json);
+  }
+  return 0;
+}
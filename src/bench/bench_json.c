@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Throughput of converting newline delimited JSON records to a CBOR sequence,
+ * with ecbor_json_encode() and with a baseline which parses each record into
+ * an item tree built with ecbor_array() and ecbor_map(), then encodes it with
+ * ecbor_encode()
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ecbor.h>
+#include <ecbor_io.h>
+
+#define RUNS 5
+
+/* Baseline limits, per record */
+#define MAX_ITEMS (1 << 16)
+#define MAX_TEXT (1 << 20)
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* Write <size> bytes worth of records to <json>, returning the used size */
+static size_t
+generate (char *json, size_t size)
+{
+  static const char *names[4] = { "alpha", "beta", "gamma \\\"quoted\\\"",
+                                  "delta\\n\\u00e9" };
+  size_t used = 0;
+  uint64_t seq = 0;
+  uint32_t random = 12345;
+
+  while (used + 512 < size) {
+    random = random * 1103515245 + 12345;
+    used += (size_t) snprintf (
+      json + used, size - used,
+      "{\"id\":%llu,\"name\":\"%s\",\"value\":%.3f,\"delta\":%d,"
+      "\"active\":%s,\"tags\":[\"sensor\",\"room-%u\",\"floor-%u\"],"
+      "\"position\":{\"x\":%.6f,\"y\":%.6f,\"z\":null},"
+      "\"samples\":[%u,%u,%u,%u,%u,%u,%u,%u]}\n",
+      (unsigned long long) seq, names[seq % 4], (double) seq * 0.125,
+      (int) (random % 2001) - 1000, (random & 1 ? "true" : "false"),
+      (random >> 8) % 100, (random >> 16) % 10,
+      (double) (random % 100000) / 7.0, (double) seq / 3.0,
+      random % 10, random % 100, random % 1000, random % 10000,
+      random % 100000, random % 1000000, random >> 4, random);
+    seq ++;
+  }
+  return used;
+}
+
+/*
+ * Baseline, a recursive descent parser building item trees
+ */
+typedef struct {
+  const char *p, *end;
+
+  /* tree items, and children being collected */
+  ecbor_item_t items[MAX_ITEMS];
+  size_t n_items;
+  ecbor_item_t stack[MAX_ITEMS];
+  size_t n_stack;
+
+  /* unescaped strings */
+  char text[MAX_TEXT];
+  size_t n_text;
+} dom_t;
+
+static void
+fail (const char *what)
+{
+  fprintf (stderr, "baseline: %s\n", what);
+  exit (1);
+}
+
+static void
+skip_space (dom_t *dom)
+{
+  while (dom->p < dom->end
+         && (*dom->p == ' ' || *dom->p == '\n' || *dom->p == '\r'
+             || *dom->p == '\t')) {
+    dom->p ++;
+  }
+}
+
+static ecbor_item_t
+parse_string (dom_t *dom)
+{
+  dom->p ++;
+  char *out = dom->text + dom->n_text;
+  size_t length = 0;
+  unsigned int code;
+  char hex[5];
+
+  while (*dom->p != '"') {
+    if (*dom->p != '\\') {
+      out[length ++] = *(dom->p ++);
+      continue;
+    }
+    switch (dom->p[1]) {
+      case 'n': out[length ++] = '\n'; break;
+      case 't': out[length ++] = '\t'; break;
+      case 'r': out[length ++] = '\r'; break;
+      case 'b': out[length ++] = '\b'; break;
+      case 'f': out[length ++] = '\f'; break;
+      case 'u':
+        /* no surrogates in the generated corpus */
+        memcpy (hex, dom->p + 2, 4);
+        hex[4] = '\0';
+        code = (unsigned int) strtoul (hex, NULL, 16);
+        if (code >= 0x800) {
+          out[length ++] = (char) (0xe0 | (code >> 12));
+          out[length ++] = (char) (0x80 | ((code >> 6) & 0x3f));
+          out[length ++] = (char) (0x80 | (code & 0x3f));
+        } else if (code >= 0x80) {
+          out[length ++] = (char) (0xc0 | (code >> 6));
+          out[length ++] = (char) (0x80 | (code & 0x3f));
+        } else {
+          out[length ++] = (char) code;
+        }
+        dom->p += 4;
+        break;
+      default: out[length ++] = dom->p[1]; break;
+    }
+    dom->p += 2;
+  }
+  dom->p ++;
+  dom->n_text += length;
+  return ecbor_str (out, length);
+}
+
+static ecbor_item_t
+parse_number (dom_t *dom)
+{
+  const char *start = dom->p;
+  char *end;
+  double value;
+  float narrow;
+
+  if (*dom->p == '-') {
+    dom->p ++;
+  }
+  while (dom->p < dom->end && *dom->p >= '0' && *dom->p <= '9') {
+    dom->p ++;
+  }
+  if (*dom->p != '.' && *dom->p != 'e' && *dom->p != 'E') {
+    return (*start == '-' ? ecbor_int (strtoll (start, NULL, 10))
+                          : ecbor_uint (strtoull (start, NULL, 10)));
+  }
+  value = strtod (start, &end);
+  dom->p = end;
+  narrow = (float) value;
+  return ((double) narrow == value ? ecbor_fp32 (narrow) : ecbor_fp64 (value));
+}
+
+/* Reserve <count> contiguous tree items */
+static ecbor_item_t *
+alloc_items (dom_t *dom, size_t count)
+{
+  ecbor_item_t *items = dom->items + dom->n_items;
+  dom->n_items += count;
+  if (dom->n_items > MAX_ITEMS) {
+    fail ("too many items");
+  }
+  return items;
+}
+
+static ecbor_item_t
+parse_value (dom_t *dom)
+{
+  ecbor_item_t item, *keys, *values;
+  size_t base, count, i;
+  char close;
+
+  skip_space (dom);
+  switch (*dom->p) {
+    case '[':
+    case '{':
+      close = (*dom->p == '[' ? ']' : '}');
+      dom->p ++;
+      base = dom->n_stack;
+      skip_space (dom);
+      while (*dom->p != close) {
+        if (close == '}') {
+          skip_space (dom);
+          dom->stack[dom->n_stack ++] = parse_string (dom);
+          skip_space (dom);
+          dom->p ++; /* : */
+        }
+        dom->stack[dom->n_stack ++] = parse_value (dom);
+        skip_space (dom);
+        if (*dom->p == ',') {
+          dom->p ++;
+        }
+      }
+      dom->p ++;
+
+      /* children are contiguous in the tree */
+      count = dom->n_stack - base;
+      if (close == ']') {
+        values = alloc_items (dom, count);
+        memcpy (values, dom->stack + base, count * sizeof (ecbor_item_t));
+        ecbor_array (&item, values, count);
+      } else {
+        keys = alloc_items (dom, count / 2);
+        values = alloc_items (dom, count / 2);
+        for (i = 0; i < count / 2; i ++) {
+          keys[i] = dom->stack[base + 2 * i];
+          values[i] = dom->stack[base + 2 * i + 1];
+        }
+        ecbor_map (&item, keys, values, count / 2);
+      }
+      dom->n_stack = base;
+      return item;
+
+    case '"':
+      return parse_string (dom);
+
+    case 't':
+      dom->p += 4;
+      return ecbor_bool (1);
+
+    case 'f':
+      dom->p += 5;
+      return ecbor_bool (0);
+
+    case 'n':
+      dom->p += 4;
+      return ecbor_null ();
+
+    default:
+      return parse_number (dom);
+  }
+}
+
+static size_t
+convert_baseline (const char *json, size_t size, uint8_t *out,
+                  size_t out_size)
+{
+  static dom_t dom;
+  ecbor_encode_context_t context;
+  ecbor_item_t record;
+  size_t used;
+
+  dom.p = json;
+  dom.end = json + size;
+  ecbor_initialize_encode (&context, out, out_size);
+
+  while (true) {
+    skip_space (&dom);
+    if (dom.p == dom.end) {
+      break;
+    }
+    dom.n_items = 0;
+    dom.n_stack = 0;
+    dom.n_text = 0;
+    record = parse_value (&dom);
+    if (ecbor_encode (&context, &record) != ECBOR_OK) {
+      fail ("encoding failed");
+    }
+  }
+  ecbor_get_encoded_buffer_size (&context, &used);
+  return used;
+}
+
+static size_t
+convert_direct (const char *json, size_t size, uint8_t *out, size_t out_size)
+{
+  ecbor_encode_context_t context;
+  size_t used, position;
+  ecbor_error_t rc;
+
+  ecbor_initialize_encode (&context, out, out_size);
+  rc = ecbor_json_encode (&context, (const uint8_t *) json, size, &position);
+  if (rc != ECBOR_OK) {
+    fprintf (stderr, "ecbor_json_encode failed (%d) at %zu\n", rc, position);
+    exit (1);
+  }
+  ecbor_get_encoded_buffer_size (&context, &used);
+  return used;
+}
+
+static size_t
+bench (const char *name, size_t (*convert) (const char *, size_t, uint8_t *,
+                                            size_t),
+       const char *json, size_t size, uint8_t *out, size_t out_size)
+{
+  uint64_t best = UINT64_MAX, start, elapsed;
+  size_t used = 0;
+  int run;
+
+  for (run = 0; run < RUNS; run ++) {
+    start = now_ns ();
+    used = convert (json, size, out, out_size);
+    elapsed = now_ns () - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf ("%-10s %6.3f GB/s  (%zu bytes of JSON to %zu bytes of CBOR)\n",
+          name, (double) size / (double) best, size, used);
+  return used;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t megabytes = (argc > 1 ? (size_t) atoi (argv[1]) : 256);
+  size_t size = megabytes << 20, used, direct_used, baseline_used;
+  uint8_t *direct_out, *baseline_out;
+  char *json;
+
+  json = malloc (size);
+  direct_out = malloc (size);
+  baseline_out = malloc (size);
+  if (!json || !direct_out || !baseline_out) {
+    perror ("malloc");
+    return 1;
+  }
+  used = generate (json, size);
+
+  direct_used = bench ("direct", convert_direct, json, used, direct_out, size);
+  baseline_used = bench ("baseline", convert_baseline, json, used,
+                         baseline_out, size);
+  if (direct_used != baseline_used
+      || memcmp (direct_out, baseline_out, direct_used) != 0) {
+    fprintf (stderr, "outputs differ\n");
+    return 1;
+  }
+
+  free (json);
+  free (direct_out);
+  free (baseline_out);
+  return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Throughput of decoding a CBOR sequence file through the prefetching reader
+ * (both backends), a read-only mapping and plain read() refills; the page
+ * cache is dropped for the file before each run, so reads hit the disk
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <ecbor.h>
+#include <ecbor_io.h>
+
+#define BLOCK_SIZE (256 * 1024)
+#define DEPTH 8
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* Write a sequence of <size> bytes worth of records to <path> */
+static void
+generate (const char *path, size_t size)
+{
+  static uint8_t buffer[1 << 20];
+  uint8_t blob[200];
+  ecbor_encode_context_t context;
+  ecbor_item_t fields[4], record;
+  size_t written = 0, used, i;
+  uint64_t seq = 0;
+  FILE *f;
+
+  f = fopen (path, "wb");
+  if (!f) {
+    perror ("fopen");
+    exit (1);
+  }
+  for (i = 0; i < sizeof (blob); i ++) {
+    blob[i] = (uint8_t) i;
+  }
+
+  while (written < size) {
+    ecbor_initialize_encode (&context, buffer, sizeof (buffer));
+    while (ecbor_get_encoded_buffer_size (&context, &used) == ECBOR_OK
+           && used < sizeof (buffer) - 512) {
+      fields[0] = ecbor_uint (seq);
+      fields[1] = ecbor_str ("sensor", 6);
+      fields[2] = ecbor_fp64 ((double) seq * 0.25);
+      fields[3] = ecbor_bstr (blob, seq % sizeof (blob));
+      seq ++;
+      if (ecbor_array (&record, fields, 4) != ECBOR_OK
+          || ecbor_encode (&context, &record) != ECBOR_OK) {
+        fprintf (stderr, "encoding failed\n");
+        exit (1);
+      }
+    }
+    fwrite (buffer, 1, used, f);
+    written += used;
+  }
+  fclose (f);
+}
+
+/* Decode whole records from <data>, returning their number */
+static uint64_t
+decode_window (const uint8_t *data, size_t size)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  uint64_t count = 0;
+
+  ecbor_initialize_decode (&context, data, size);
+  while (ecbor_decode (&context, &item) == ECBOR_OK) {
+    count ++;
+  }
+  return count;
+}
+
+static int
+open_cold (const char *path)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0) {
+    perror ("open");
+    exit (1);
+  }
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+  return fd;
+}
+
+static void
+report (const char *name, uint64_t bytes, uint64_t records, uint64_t elapsed)
+{
+  printf ("%-8s %10.1f MB/s  %12.0f records/s\n", name,
+          (double) bytes * 1e3 / (double) elapsed,
+          (double) records * 1e9 / (double) elapsed);
+}
+
+static void
+bench_reader (const char *path, unsigned int flags)
+{
+  ecbor_reader_t *reader;
+  const uint8_t *window;
+  uint64_t bytes = 0, records = 0, start;
+  unsigned int backend;
+  size_t size;
+  int fd;
+
+  fd = open_cold (path);
+  start = now_ns ();
+  if (ecbor_reader_open (&reader, fd, BLOCK_SIZE, DEPTH, flags) != ECBOR_OK) {
+    fprintf (stderr, "ecbor_reader_open failed\n");
+    exit (1);
+  }
+  while (ecbor_reader_next (reader, &window, &size) == ECBOR_OK) {
+    records += decode_window (window, size);
+    bytes += size;
+  }
+  ecbor_reader_get_backend (reader, &backend);
+  ecbor_reader_close (reader);
+  report (backend == ECBOR_READER_URING ? "uring" : "thread", bytes, records,
+          now_ns () - start);
+  close (fd);
+}
+
+static void
+bench_map (const char *path)
+{
+  ecbor_file_map_t map;
+  uint64_t records, start;
+  int fd;
+
+  /* only used to drop the cache */
+  fd = open_cold (path);
+  start = now_ns ();
+  if (ecbor_map_file (&map, path, ECBOR_MAP_SEQUENTIAL) != ECBOR_OK) {
+    fprintf (stderr, "ecbor_map_file failed\n");
+    exit (1);
+  }
+  records = decode_window (map.data, map.size);
+  report ("mmap", map.size, records, now_ns () - start);
+  ecbor_unmap_file (&map);
+  close (fd);
+}
+
+static void
+bench_read (const char *path)
+{
+  static uint8_t window[BLOCK_SIZE];
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  uint64_t records = 0, start;
+  ecbor_error_t rc;
+  off_t size;
+  int fd;
+
+  fd = open_cold (path);
+  size = lseek (fd, 0, SEEK_END);
+  lseek (fd, 0, SEEK_SET);
+  start = now_ns ();
+  ecbor_initialize_decode (&context, window, 0);
+  ecbor_set_refill_callback (&context, window, sizeof (window),
+                             ecbor_fd_refill, &fd);
+  while ((rc = ecbor_decode (&context, &item)) == ECBOR_OK) {
+    records ++;
+  }
+  if (rc != ECBOR_END_OF_BUFFER) {
+    fprintf (stderr, "decoding failed (%d)\n", rc);
+    exit (1);
+  }
+  report ("read", (uint64_t) size, records, now_ns () - start);
+  close (fd);
+}
+
+int
+main (int argc, char **argv)
+{
+  char path[] = "/tmp/ecbor_bench_XXXXXX";
+  const char *input = path;
+  size_t megabytes = 256;
+  int fd;
+
+  if (argc > 1) {
+    /* existing file */
+    input = argv[1];
+  } else {
+    fd = mkstemp (path);
+    if (fd < 0) {
+      perror ("mkstemp");
+      return 1;
+    }
+    close (fd);
+    generate (path, megabytes << 20);
+    /* flush, so the cache can be dropped */
+    fd = open (path, O_RDONLY);
+    fdatasync (fd);
+    close (fd);
+  }
+
+  bench_reader (input, 0);
+  bench_reader (input, ECBOR_READER_NO_URING);
+  bench_map (input);
+  bench_read (input);
+
+  if (input == path) {
+    unlink (path);
+  }
+  return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Message rate and latency between two processes, over the shared memory
+ * ring and over a pipe (one write() and two read() calls per message); both
+ * buffer 64 KiB, so queueing delays are comparable
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <ecbor.h>
+#include <ecbor_io.h>
+
+#define MAX_MESSAGE_SIZE 64
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* Encode message <seq>, timestamped */
+static void
+encode_message (ecbor_encode_context_t *context, uint64_t seq)
+{
+  ecbor_item_t fields[3], message;
+
+  fields[0] = ecbor_uint (seq);
+  fields[1] = ecbor_uint (now_ns ());
+  fields[2] = ecbor_fp64 ((double) seq * 0.5);
+  if (ecbor_array (&message, fields, 3) != ECBOR_OK
+      || ecbor_encode (context, &message) != ECBOR_OK) {
+    fprintf (stderr, "encoding failed\n");
+    exit (1);
+  }
+}
+
+/* Decode a message in place and return its latency */
+static uint64_t
+decode_latency (const uint8_t *buffer, size_t size)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t items[5], *root, *ts;
+  uint64_t sent;
+
+  if (ecbor_initialize_decode_tree (&context, buffer, size, items, 5)
+        != ECBOR_OK
+      || ecbor_decode_tree (&context, &root) != ECBOR_OK
+      || ecbor_get_array_item_ptr (root, 1, &ts) != ECBOR_OK
+      || ecbor_get_uint64 (ts, &sent) != ECBOR_OK) {
+    fprintf (stderr, "decoding failed\n");
+    exit (1);
+  }
+  return now_ns () - sent;
+}
+
+static int
+compare_u64 (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void
+report (const char *name, uint64_t *latency, size_t count, uint64_t elapsed)
+{
+  qsort (latency, count, sizeof (uint64_t), compare_u64);
+  printf ("%-6s %12.0f msg/s  p50 %8llu ns  p99 %8llu ns  p99.9 %8llu ns"
+          "  max %10llu ns\n",
+          name, (double) count * 1e9 / (double) elapsed,
+          (unsigned long long) latency[count / 2],
+          (unsigned long long) latency[count * 99 / 100],
+          (unsigned long long) latency[count * 999 / 1000],
+          (unsigned long long) latency[count - 1]);
+}
+
+static void
+bench_ring (uint64_t count, uint64_t *latency)
+{
+  ecbor_ring_t ring;
+  ecbor_encode_context_t context;
+  const uint8_t *message;
+  uint64_t i, start;
+  size_t size;
+  pid_t pid;
+
+  if (ecbor_ring_create (&ring, "bench", 1 << 16) != ECBOR_OK) {
+    perror ("ecbor_ring_create");
+    exit (1);
+  }
+
+  pid = fork ();
+  if (pid == 0) {
+    for (i = 0; i < count; i ++) {
+      if (ecbor_ring_begin_encode (&ring, &context, MAX_MESSAGE_SIZE, -1)
+            != ECBOR_OK) {
+        _exit (1);
+      }
+      encode_message (&context, i);
+      if (ecbor_ring_end_encode (&ring, &context) != ECBOR_OK) {
+        _exit (1);
+      }
+    }
+    ecbor_ring_flush (&ring);
+    _exit (0);
+  }
+
+  start = now_ns ();
+  for (i = 0; i < count; i ++) {
+    if (ecbor_ring_read (&ring, &message, &size, -1) != ECBOR_OK) {
+      exit (1);
+    }
+    latency[i] = decode_latency (message, size);
+    ecbor_ring_release (&ring);
+  }
+  report ("ring", latency, count, now_ns () - start);
+
+  waitpid (pid, NULL, 0);
+  ecbor_ring_close (&ring);
+}
+
+static void
+read_exact (int fd, uint8_t *buffer, size_t size)
+{
+  ssize_t n;
+  while (size > 0) {
+    n = read (fd, buffer, size);
+    if (n <= 0) {
+      perror ("read");
+      exit (1);
+    }
+    buffer += n;
+    size -= (size_t) n;
+  }
+}
+
+static void
+bench_pipe (uint64_t count, uint64_t *latency)
+{
+  uint8_t buffer[MAX_MESSAGE_SIZE + 1];
+  ecbor_encode_context_t context;
+  uint64_t i, start;
+  size_t size;
+  int fds[2];
+  pid_t pid;
+
+  if (pipe (fds) < 0) {
+    perror ("pipe");
+    exit (1);
+  }
+
+  pid = fork ();
+  if (pid == 0) {
+    close (fds[0]);
+    for (i = 0; i < count; i ++) {
+      /* one byte length prefix */
+      if (ecbor_initialize_encode (&context, buffer + 1, MAX_MESSAGE_SIZE)
+            != ECBOR_OK) {
+        _exit (1);
+      }
+      encode_message (&context, i);
+      ecbor_get_encoded_buffer_size (&context, &size);
+      buffer[0] = (uint8_t) size;
+      if (write (fds[1], buffer, size + 1) != (ssize_t) (size + 1)) {
+        _exit (1);
+      }
+    }
+    _exit (0);
+  }
+  close (fds[1]);
+
+  start = now_ns ();
+  for (i = 0; i < count; i ++) {
+    read_exact (fds[0], buffer, 1);
+    size = buffer[0];
+    read_exact (fds[0], buffer + 1, size);
+    latency[i] = decode_latency (buffer + 1, size);
+  }
+  report ("pipe", latency, count, now_ns () - start);
+
+  waitpid (pid, NULL, 0);
+  close (fds[0]);
+}
+
+int
+main (int argc, char **argv)
+{
+  uint64_t count = 1000000, *latency;
+
+  if (argc > 1) {
+    count = strtoull (argv[1], NULL, 10);
+  }
+  if (count == 0) {
+    fprintf (stderr, "Usage: ecbor-bench-ring [messages]\n");
+    return 1;
+  }
+
+  latency = malloc (count * sizeof (uint64_t));
+  if (!latency) {
+    perror ("malloc");
+    return 1;
+  }
+
+  bench_ring (count, latency);
+  bench_pipe (count, latency);
+
+  free (latency);
+  return 0;
+}
@@ -5,17 +5,24 @@
  * it under the terms of the MIT license. See LICENSE for details.
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
 #include <ecbor.h>
+#ifdef WITH_ECBOR_IO
+#include <ecbor_io.h>
+#endif
 
 /*
  * Command line arguments
  */
 static struct option long_options[] = {
   { "tree", no_argument,       0, 't' },
+  { "stream", no_argument,     0, 's' },
+  { "diag", no_argument,       0, 'd' },
+  { "read", no_argument,       0, 'r' },
   { "help", no_argument,       0, 'h' },
   { 0, 0, 0, 0 }
 };
@@ -26,12 +33,52 @@ static struct option long_options[] = {
 #define MAX_ITEMS 1024
 static ecbor_item_t items_buffer[MAX_ITEMS];
 
+/*
+ * Output buffer and refill window for streamed mode
+ */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define REFILL_WINDOW_SIZE (1 << 20)
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static uint8_t refill_window[REFILL_WINDOW_SIZE];
+
+/*
+ * Open container in streamed mode
+ */
+typedef struct {
+  /* ECBOR_TYPE_ARRAY, ECBOR_TYPE_MAP or ECBOR_TYPE_TAG */
+  ecbor_type_t type;
+  uint8_t is_indefinite;
+
+  /* children left (keys and values counted apart), for definite containers,
+     and children seen so far */
+  uint64_t remaining;
+  uint64_t index;
+
+  /* indentation level of children */
+  unsigned int level;
+} stream_frame_t;
+
+/*
+ * Streamed mode state
+ */
+typedef struct {
+  int diag;
+  stream_frame_t stack[ECBOR_MAX_NESTING_DEPTH];
+  size_t depth;
+
+  /* set once the separator of the item being decoded has been written (by the
+     payload sink, for strings larger than the window) */
+  int separated;
+} stream_state_t;
+
 void
 print_help (void);
 void
 print_ecbor_error (ecbor_error_t err);
 ecbor_error_t
 print_ecbor_item (ecbor_item_t *item, unsigned int level, char *prefix);
+unsigned char *
+read_file (const char *filename, size_t *length);
 
 /*
  * Print help
@@ -42,6 +89,10 @@ print_help (void)
   printf ("Usage: ecbor-describe [options] <filename>\n");
   printf ("  options:\n");
   printf ("  -t, --tree     Use tree decoding mode\n");
+  printf ("  -s, --stream   Use streamed decoding mode, in linear time and constant\n");
+  printf ("                 memory; <filename> may be - for standard input\n");
+  printf ("  -d, --diag     Print diagnostic notation (RFC 8949), implies --stream\n");
+  printf ("  -r, --read     Read the file into memory instead of mapping it\n");
   printf ("  -h, --help     Display this help message\n");
 }
 
@@ -331,6 +382,472 @@ print_ecbor_item (ecbor_item_t *item, unsigned int level, char *prefix)
   return ECBOR_OK;
 }
 
+/*
+ * Print <value> in the shortest form which reads back as the same float; a
+ * fraction or exponent is always present, so it stays a float
+ */
+static void
+print_diag_float (double value, int single)
+{
+  char text[40], *exponent;
+  int precision;
+
+  if (isnan (value)) {
+    fputs ("NaN", stdout);
+    return;
+  } else if (isinf (value)) {
+    fputs ((value < 0 ? "-Infinity" : "Infinity"), stdout);
+    return;
+  }
+
+  for (precision = (single ? 6 : 15); ; precision ++) {
+    snprintf (text, sizeof (text), "%.*g", precision, value);
+    if (precision == (single ? 9 : 17)
+        || (single ? (double) strtof (text, NULL) == value
+                   : strtod (text, NULL) == value)) {
+      break;
+    }
+  }
+
+  exponent = strchr (text, 'e');
+  if (strchr (text, '.')) {
+    fputs (text, stdout);
+  } else if (exponent) {
+    /* e.g. 1.0e+300 */
+    fwrite (text, 1, (size_t) (exponent - text), stdout);
+    fputs (".0", stdout);
+    fputs (exponent, stdout);
+  } else {
+    fputs (text, stdout);
+    fputs (".0", stdout);
+  }
+}
+
+/*
+ * Print a piece of a string payload in diagnostic notation, without quotes
+ */
+static void
+print_diag_payload (ecbor_type_t type, const uint8_t *data, size_t length)
+{
+  static const char hex[16] = "0123456789abcdef";
+  char digits[512];
+  size_t i, clean, n;
+
+  if (type == ECBOR_TYPE_BSTR) {
+    for (i = 0; i < length; ) {
+      for (n = 0; i < length && n < sizeof (digits); i ++, n += 2) {
+        digits[n] = hex[data[i] >> 4];
+        digits[n + 1] = hex[data[i] & 0xf];
+      }
+      fwrite (digits, 1, n, stdout);
+    }
+    return;
+  }
+
+  for (i = 0; i < length; ) {
+    for (clean = i; clean < length && data[clean] >= 0x20
+         && data[clean] != '"' && data[clean] != '\\'; clean ++)
+      ;
+    fwrite (data + i, 1, clean - i, stdout);
+    if (clean == length) {
+      break;
+    }
+
+    switch (data[clean]) {
+      case '"':  fputs ("\\\"", stdout); break;
+      case '\\': fputs ("\\\\", stdout); break;
+      case '\n': fputs ("\\n", stdout); break;
+      case '\r': fputs ("\\r", stdout); break;
+      case '\t': fputs ("\\t", stdout); break;
+      default:   printf ("\\u%04x", data[clean]); break;
+    }
+    i = clean + 1;
+  }
+}
+
+/*
+ * Print a scalar or string item in diagnostic notation
+ */
+static ecbor_error_t
+print_diag_item (ecbor_item_t *item)
+{
+  uint64_t magnitude;
+
+  switch (item->type) {
+    case ECBOR_TYPE_UINT:
+      printf ("%llu", (unsigned long long int) item->value.uinteger);
+      break;
+
+    case ECBOR_TYPE_NINT:
+      /* value is -1 - n */
+      magnitude = ~item->value.uinteger;
+      if (magnitude == UINT64_MAX) {
+        fputs ("-18446744073709551616", stdout);
+      } else {
+        printf ("-%llu", (unsigned long long int) (magnitude + 1));
+      }
+      break;
+
+    case ECBOR_TYPE_STR:
+    case ECBOR_TYPE_BSTR:
+      if (item->value.string.str || item->length == 0) {
+        fputs ((item->type == ECBOR_TYPE_STR ? "\"" : "h'"), stdout);
+        print_diag_payload (item->type, item->value.string.str, item->length);
+      }
+      /* otherwise the payload sink wrote the rest */
+      putchar (item->type == ECBOR_TYPE_STR ? '"' : '\'');
+      break;
+
+    case ECBOR_TYPE_FP32:
+      print_diag_float (item->value.fp32, 1);
+      break;
+
+    case ECBOR_TYPE_FP64:
+      print_diag_float (item->value.fp64, 0);
+      break;
+
+    case ECBOR_TYPE_BOOL:
+      fputs ((item->value.uinteger ? "true" : "false"), stdout);
+      break;
+
+    case ECBOR_TYPE_NULL:
+      fputs ("null", stdout);
+      break;
+
+    case ECBOR_TYPE_UNDEFINED:
+      fputs ("undefined", stdout);
+      break;
+
+    default:
+      return ECBOR_ERR_INVALID_TYPE;
+  }
+
+  return ECBOR_OK;
+}
+
+/*
+ * Print the chunks of an indefinite string, walking them once
+ */
+static ecbor_error_t
+print_stream_chunks (stream_state_t *state, ecbor_item_t *item,
+                     unsigned int level)
+{
+  ecbor_decode_context_t chunks;
+  ecbor_item_t chunk;
+  ecbor_error_t rc;
+  size_t i;
+
+  if (state->diag) {
+    if (item->value.string.n_chunks == 0) {
+      fputs ((item->type == ECBOR_TYPE_STR ? "\"\"_" : "''_"), stdout);
+      return ECBOR_OK;
+    }
+    fputs ("(_ ", stdout);
+  } else {
+    printf ("[%s] len %u (indefinite)\n",
+            (item->type == ECBOR_TYPE_STR ? "STR" : "BSTR"),
+            (unsigned int) item->length);
+  }
+
+  /* chunks follow the initial byte, up to the stop code */
+  rc = ecbor_initialize_decode (&chunks, item->value.string.str,
+                                item->size - 2);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  for (i = 0; i < item->value.string.n_chunks; i ++) {
+    rc = ecbor_decode (&chunks, &chunk);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    if (state->diag) {
+      if (i > 0) {
+        fputs (", ", stdout);
+      }
+      rc = print_diag_item (&chunk);
+    } else {
+      rc = print_ecbor_item (&chunk, level + 1, "");
+    }
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  if (state->diag) {
+    putchar (')');
+  }
+  return ECBOR_OK;
+}
+
+/*
+ * Write what precedes the next item in streamed mode: a separator in
+ * diagnostic notation, or the indentation and key/value prefix otherwise
+ */
+static void
+print_stream_separator (stream_state_t *state)
+{
+  stream_frame_t *frame;
+  unsigned int i;
+
+  if (state->separated) {
+    return;
+  }
+  state->separated = 1;
+
+  frame = (state->depth > 0 ? &state->stack[state->depth - 1] : NULL);
+  if (state->diag) {
+    if (frame && frame->type == ECBOR_TYPE_MAP && frame->index % 2) {
+      fputs (": ", stdout);
+    } else if (frame && frame->type != ECBOR_TYPE_TAG && frame->index > 0) {
+      fputs (", ", stdout);
+    }
+    return;
+  }
+
+  for (i = 0; frame && i < frame->level * 2; i ++) {
+    putchar (' ');
+  }
+  if (frame && frame->type == ECBOR_TYPE_MAP) {
+    printf ("%s[%u]: ", (frame->index % 2 ? "val" : "key"),
+            (unsigned int) (frame->index / 2));
+  }
+}
+
+/*
+ * Payload sink for strings larger than the refill window
+ */
+static ecbor_error_t
+stream_sink (void *user_data, const ecbor_item_t *item, const uint8_t *data,
+             size_t size)
+{
+  stream_state_t *state = (stream_state_t *) user_data;
+
+  if (!state->diag) {
+    /* too large to be printed anyway */
+    return ECBOR_OK;
+  }
+  if (!state->separated) {
+    print_stream_separator (state);
+    fputs ((item->type == ECBOR_TYPE_STR ? "\"" : "h'"), stdout);
+  }
+  print_diag_payload (item->type, data, size);
+  return ECBOR_OK;
+}
+
+/*
+ * Refill callback reading from a stream
+ */
+static ecbor_error_t
+refill_from_file (void *user_data, uint8_t *buffer, size_t size,
+                  size_t *filled)
+{
+  FILE *fp = (FILE *) user_data;
+
+  (*filled) = fread (buffer, 1, size, fp);
+  if ((*filled) == 0 && ferror (fp)) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  return ECBOR_OK;
+}
+
+/*
+ * Account for a completed item, closing the containers it completes
+ */
+static void
+stream_complete (stream_state_t *state)
+{
+  stream_frame_t *frame;
+
+  while (state->depth > 0) {
+    frame = &state->stack[state->depth - 1];
+    frame->index ++;
+    if (frame->is_indefinite || -- frame->remaining > 0) {
+      return;
+    }
+
+    if (state->diag) {
+      putchar (frame->type == ECBOR_TYPE_ARRAY ? ']'
+               : (frame->type == ECBOR_TYPE_MAP ? '}' : ')'));
+    }
+    state->depth --;
+  }
+
+  /* top level item is done */
+  if (state->diag) {
+    putchar ('\n');
+  }
+}
+
+static ecbor_error_t
+stream_push (stream_state_t *state, ecbor_type_t type, uint8_t is_indefinite,
+             uint64_t remaining, unsigned int level)
+{
+  stream_frame_t *frame;
+
+  if (state->depth == ECBOR_MAX_NESTING_DEPTH) {
+    return ECBOR_ERR_NESTING_TOO_DEEP;
+  }
+
+  frame = &state->stack[state->depth ++];
+  frame->type = type;
+  frame->is_indefinite = is_indefinite;
+  frame->remaining = remaining;
+  frame->index = 0;
+  frame->level = level;
+  return ECBOR_OK;
+}
+
+/*
+ * Describe all items of a streamed decode context, keeping open containers
+ * on an explicit stack
+ */
+static ecbor_error_t
+describe_stream (ecbor_decode_context_t *context, stream_state_t *state)
+{
+  stream_frame_t *frame;
+  ecbor_item_t item;
+  unsigned int level;
+  ecbor_error_t rc;
+
+  while (1) {
+    state->separated = 0;
+    rc = ecbor_decode (context, &item);
+
+    frame = (state->depth > 0 ? &state->stack[state->depth - 1] : NULL);
+    if (rc == ECBOR_END_OF_INDEFINITE) {
+      /* closes the innermost indefinite container */
+      if (!frame || !frame->is_indefinite
+          || (frame->type == ECBOR_TYPE_MAP && frame->index % 2)) {
+        return ECBOR_ERR_INVALID_STOP_CODE;
+      }
+      if (state->diag) {
+        putchar (frame->type == ECBOR_TYPE_ARRAY ? ']' : '}');
+      }
+      state->depth --;
+      stream_complete (state);
+      continue;
+    } else if (rc == ECBOR_END_OF_BUFFER) {
+      return (state->depth > 0 ? ECBOR_ERR_INVALID_END_OF_BUFFER : ECBOR_OK);
+    } else if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    print_stream_separator (state);
+    level = (frame ? frame->level : 0);
+
+    switch (item.type) {
+      case ECBOR_TYPE_ARRAY:
+      case ECBOR_TYPE_MAP:
+        if (state->diag) {
+          putchar (item.type == ECBOR_TYPE_ARRAY ? '[' : '{');
+          if (item.is_indefinite) {
+            fputs ("_ ", stdout);
+          }
+        } else if (item.is_indefinite) {
+          printf ("[%s] (indefinite)\n",
+                  (item.type == ECBOR_TYPE_ARRAY ? "ARRAY" : "MAP"));
+        } else {
+          printf ("[%s] len %u \n",
+                  (item.type == ECBOR_TYPE_ARRAY ? "ARRAY" : "MAP"),
+                  (unsigned int) (item.type == ECBOR_TYPE_ARRAY
+                                  ? item.length : item.length / 2));
+        }
+
+        if (!item.is_indefinite && item.length == 0) {
+          if (state->diag) {
+            putchar (item.type == ECBOR_TYPE_ARRAY ? ']' : '}');
+          }
+          stream_complete (state);
+          rc = ECBOR_OK;
+        } else {
+          rc = stream_push (state, item.type, item.is_indefinite, item.length,
+                            level + (item.type == ECBOR_TYPE_MAP ? 2 : 1));
+        }
+        break;
+
+      case ECBOR_TYPE_TAG:
+        if (state->diag) {
+          printf ("%llu(", (unsigned long long int) item.value.tag.tag_value);
+        } else {
+          printf ("[TAG] value %lld\n",
+                  (long long int) item.value.tag.tag_value);
+        }
+        rc = stream_push (state, ECBOR_TYPE_TAG, 0, 1, level + 1);
+        break;
+
+      default:
+        if ((item.type == ECBOR_TYPE_STR || item.type == ECBOR_TYPE_BSTR)
+            && item.is_indefinite) {
+          rc = print_stream_chunks (state, &item, level);
+        } else if (state->diag) {
+          rc = print_diag_item (&item);
+        } else {
+          rc = print_ecbor_item (&item, 0, "");
+        }
+        if (rc == ECBOR_OK) {
+          stream_complete (state);
+        }
+        break;
+    }
+
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+}
+
+/*
+ * Read whole file in memory
+ */
+unsigned char *
+read_file (const char *filename, size_t *length)
+{
+  unsigned char *buffer;
+  long int file_length;
+  FILE *fp;
+
+  fp = fopen (filename, "rb");
+  if (!fp) {
+    fprintf (stderr, "Error opening file!\n");
+    return NULL;
+  }
+
+  if (fseek (fp, 0L, SEEK_END)) {
+    fprintf (stderr, "Error seeking end of file!\n");
+    fclose (fp);
+    return NULL;
+  }
+  file_length = ftell(fp);
+  if (file_length < 0) {
+    fprintf (stderr, "Error determining input size!\n");
+    fclose (fp);
+    return NULL;
+  }
+  if (fseek (fp, 0L, SEEK_SET)) {
+    fprintf (stderr, "Error seeking beginning of file!\n");
+    fclose (fp);
+    return NULL;
+  }
+
+  buffer = (unsigned char *) malloc (file_length);
+  if (!buffer) {
+    fprintf (stderr, "Error allocating %d bytes!\n", (int) file_length);
+    fclose (fp);
+    return NULL;
+  }
+
+  if (fread (buffer, 1, file_length, fp) != (size_t) file_length) {
+    fprintf (stderr, "Error reading %d bytes!\n", (int) file_length);
+    free (buffer);
+    fclose (fp);
+    return NULL;
+  }
+
+  fclose (fp);
+  (*length) = (size_t) file_length;
+  return buffer;
+}
+
 /*
  * Program entry
  */
@@ -338,15 +855,24 @@ int
 main(int argc, char **argv)
 {
   char *filename = NULL;
-  unsigned char *cbor = NULL;
-  long int cbor_length = 0;
+  const unsigned char *cbor = NULL;
+  unsigned char *cbor_buffer = NULL;
+  size_t cbor_length = 0;
   int tree_mode = 0;
+  int stream_mode = 0;
+  int diag_mode = 0;
+  int read_mode = 0;
+  int mapped = 0;
+  FILE *stream = NULL;
+#ifdef WITH_ECBOR_IO
+  ecbor_file_map_t file_map;
+#endif
 
   /* parse arguments */
   while (1) {
     int option_index, c;
 
-    c = getopt_long (argc, argv, "ht", long_options, &option_index);
+    c = getopt_long (argc, argv, "htsdr", long_options, &option_index);
     if (c == -1) {
       break;
     }
@@ -356,6 +882,19 @@ main(int argc, char **argv)
         tree_mode = 1;
         break;
 
+      case 's':
+        stream_mode = 1;
+        break;
+
+      case 'd':
+        stream_mode = 1;
+        diag_mode = 1;
+        break;
+
+      case 'r':
+        read_mode = 1;
+        break;
+
       default:
         print_help ();
         return 0;
@@ -370,50 +909,49 @@ main(int argc, char **argv)
     filename = strdup (argv[optind]);
   }
   
-  /* load CBOR data from file */
-  {
-    FILE *fp;
-
-    fprintf (stderr, "Reading CBOR from file '%s'\n", filename);
-    fp = fopen (filename, "rb");
-    if (!fp) {
-      fprintf (stderr, "Error opening file!\n");
-      return -1;
-    }
+  if (tree_mode && stream_mode) {
+    fprintf (stderr, "Tree and streamed modes are exclusive!\n");
+    return -1;
+  }
+  if (!stream_mode && !strcmp (filename, "-")) {
+    fprintf (stderr, "Standard input can only be read in streamed mode!\n");
+    return -1;
+  }
 
-    if (fseek (fp, 0L, SEEK_END)) {
-      fprintf (stderr, "Error seeking end of file!\n");
-      fclose (fp);
-      return -1;
-    }
-    cbor_length = ftell(fp);
-    if (cbor_length < 0) {
-      fprintf (stderr, "Error determining input size!\n");
-      fclose (fp);
-      return -1;
-    }
-    if (fseek (fp, 0L, SEEK_SET)) {
-      fprintf (stderr, "Error seeking beginning of file!\n");
-      fclose (fp);
+  /* load CBOR data from file */
+  fprintf (stderr, "Reading CBOR from file '%s'\n", filename);
+#ifdef WITH_ECBOR_IO
+  if (!read_mode && strcmp (filename, "-")) {
+    ecbor_error_t rc = ecbor_map_file (&file_map, filename,
+                                       ECBOR_MAP_SEQUENTIAL);
+    if (rc == ECBOR_OK) {
+      cbor = file_map.data;
+      cbor_length = file_map.size;
+      mapped = 1;
+    } else if (rc != ECBOR_ERR_CURRENTLY_NOT_SUPPORTED) {
+      fprintf (stderr, "Error mapping file!\n");
       return -1;
     }
-    
-    cbor = (unsigned char *) malloc (cbor_length);
-    if (!cbor) {
-      fprintf (stderr, "Error allocating %d bytes!\n", (int) cbor_length);
-      fclose (fp);
+    /* otherwise not a regular file, read it instead */
+  }
+#else
+  (void) read_mode;
+#endif
+  if (!mapped && stream_mode) {
+    /* refilled from a fixed window, so memory use stays constant */
+    stream = (strcmp (filename, "-") ? fopen (filename, "rb") : stdin);
+    if (!stream) {
+      fprintf (stderr, "Error opening file!\n");
       return -1;
     }
-    
-    if (fread (cbor, 1, cbor_length, fp) != (size_t) cbor_length) {
-      fprintf (stderr, "Error reading %d bytes!\n", (int) cbor_length);
-      fclose (fp);
+  } else if (!mapped) {
+    cbor_buffer = read_file (filename, &cbor_length);
+    if (!cbor_buffer) {
       return -1;
     }
-    
-    fclose (fp);
-    free (filename);
+    cbor = cbor_buffer;
   }
+  free (filename);
   
   /* parse CBOR data */
   {
@@ -423,6 +961,15 @@ main(int argc, char **argv)
     if (tree_mode) {
       rc = ecbor_initialize_decode_tree (&context, cbor, cbor_length,
                                          items_buffer, MAX_ITEMS);
+    } else if (stream_mode) {
+      rc = ecbor_initialize_decode_streamed (&context,
+                                             (stream ? refill_window : cbor),
+                                             cbor_length);
+      if (rc == ECBOR_OK && stream) {
+        rc = ecbor_set_refill_callback (&context, refill_window,
+                                        sizeof (refill_window),
+                                        refill_from_file, stream);
+      }
     } else {
       rc = ecbor_initialize_decode (&context, cbor, cbor_length);
     }
@@ -433,7 +980,31 @@ main(int argc, char **argv)
     
     fprintf (stderr, "CBOR objects:\n");
     
-    if (tree_mode) {
+    if (stream_mode) {
+      static stream_state_t state;
+
+      /* fully buffered, also when writing to a terminal */
+      setvbuf (stdout, output_buffer, _IOFBF, sizeof (output_buffer));
+      state.diag = diag_mode;
+      state.depth = 0;
+      if (stream) {
+        rc = ecbor_set_payload_sink (&context, stream_sink, &state);
+        if (rc != ECBOR_OK) {
+          print_ecbor_error (rc);
+          return -1;
+        }
+      }
+
+      rc = describe_stream (&context, &state);
+      if (rc != ECBOR_OK) {
+        if (diag_mode && state.depth > 0) {
+          /* end the partial line */
+          putchar ('\n');
+        }
+        print_ecbor_error (rc);
+        return -1;
+      }
+    } else if (tree_mode) {
       /* decode all */
       ecbor_item_t *item;
 
@@ -475,7 +1046,15 @@ main(int argc, char **argv)
     }
   }
   
-  free (cbor);
+#ifdef WITH_ECBOR_IO
+  if (mapped) {
+    ecbor_unmap_file (&file_map);
+  }
+#endif
+  free (cbor_buffer);
+  if (stream && stream != stdin) {
+    fclose (stream);
+  }
   
   /* all ok */
   return 0;
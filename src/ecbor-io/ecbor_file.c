@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ecbor_io.h"
+
+/* Contents of empty files */
+static const uint8_t ecbor_empty_file[1] = { 0 };
+
+ecbor_error_t
+ecbor_map_file (ecbor_file_map_t *map, const char *path, unsigned int flags)
+{
+  struct stat st;
+  void *data;
+  int fd;
+
+  if (!map) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!path) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  if (fstat (fd, &st) < 0) {
+    close (fd);
+    return ECBOR_ERR_SYSTEM;
+  }
+  if (!S_ISREG (st.st_mode)) {
+    /* pipes, terminals etc. must be read */
+    close (fd);
+    return ECBOR_ERR_CURRENTLY_NOT_SUPPORTED;
+  }
+  if ((uint64_t) st.st_size > (uint64_t) SIZE_MAX) {
+    close (fd);
+    return ECBOR_ERR_BUFFER_TOO_LARGE;
+  }
+
+  map->size = (size_t) st.st_size;
+  map->data = ecbor_empty_file;
+  if (map->size == 0) {
+    /* nothing to map */
+    close (fd);
+    return ECBOR_OK;
+  }
+
+  /* the mapping outlives the descriptor */
+  data = mmap (NULL, map->size, PROT_READ,
+               MAP_PRIVATE | ((flags & ECBOR_MAP_POPULATE) ? MAP_POPULATE : 0),
+               fd, 0);
+  close (fd);
+  if (data == MAP_FAILED) {
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  /* hints only, failures are not reported */
+  if (flags & ECBOR_MAP_SEQUENTIAL) {
+    madvise (data, map->size, MADV_SEQUENTIAL);
+  } else if (flags & ECBOR_MAP_RANDOM) {
+    madvise (data, map->size, MADV_RANDOM);
+  }
+  if (flags & ECBOR_MAP_WILLNEED) {
+    madvise (data, map->size, MADV_WILLNEED);
+  }
+#ifdef MADV_HUGEPAGE
+  if (flags & ECBOR_MAP_HUGEPAGES) {
+    madvise (data, map->size, MADV_HUGEPAGE);
+  }
+#endif
+
+  map->data = (const uint8_t *) data;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_advise_file (ecbor_file_map_t *map, size_t offset, size_t length,
+                   unsigned int flags)
+{
+  long page = sysconf (_SC_PAGESIZE);
+  uintptr_t start, end;
+
+  if (!map) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (offset > map->size) {
+    return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+  }
+  if (length > map->size - offset) {
+    length = map->size - offset;
+  }
+  if (length == 0) {
+    return ECBOR_OK;
+  }
+
+  /* whole pages within the range */
+  start = ((uintptr_t) map->data + offset) & ~((uintptr_t) page - 1);
+  end = (uintptr_t) map->data + offset + length;
+
+  if ((flags & ECBOR_MAP_WILLNEED)
+      && madvise ((void *) start, end - start, MADV_WILLNEED) < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  if ((flags & ECBOR_MAP_DONTNEED)
+      && madvise ((void *) start, end - start, MADV_DONTNEED) < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_unmap_file (ecbor_file_map_t *map)
+{
+  if (!map) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  if (map->data && map->size > 0) {
+    munmap ((void *) map->data, map->size);
+  }
+  map->data = NULL;
+  map->size = 0;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_fd_refill (void *user_data, uint8_t *buffer, size_t size,
+                 size_t *filled)
+{
+  ssize_t n;
+
+  if (!user_data || !filled) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  do {
+    n = read (*(int *) user_data, buffer, size);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  (*filled) = (size_t) n;
+  return ECBOR_OK;
+}
@@ -0,0 +1,886 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ecbor_io.h"
+
+/*
+ * Sidecar layout, all fields little endian:
+ *
+ *   header (64 bytes):
+ *     magic "ECBORIX1", stride, record count, indexed size (bytes of the data
+ *     file covered), entry size, zero padding
+ *   entries, one per block of <stride> records:
+ *     offset of the first record [, key minimum, key maximum]
+ *
+ * Entries are written before the header, so that an interrupted update
+ * leaves the previous index intact.
+ */
+#define ECBOR_INDEX_MAGIC "ECBORIX1"
+#define ECBOR_INDEX_HEADER_SIZE 64
+#define ECBOR_INDEX_ENTRY_SIZE 8
+#define ECBOR_INDEX_KEYED_ENTRY_SIZE 24
+
+/* Smallest range scanned by a builder thread */
+#define ECBOR_INDEX_MIN_CHUNK (1 << 20)
+
+/* Records a chunk start must decode to be accepted, and record starts kept
+   for matching it against the previous chunk */
+#define ECBOR_INDEX_PROBE 8
+#define ECBOR_INDEX_CHECKPOINTS 64
+
+typedef struct {
+  uint64_t offset;
+  int64_t key_min;
+  int64_t key_max;
+} ecbor_index_entry_t;
+
+typedef struct {
+  /* data file */
+  const uint8_t *data;
+  size_t size;
+
+  uint64_t stride;
+  const ecbor_item_t *key_path;
+  size_t key_path_length;
+} ecbor_index_builder_t;
+
+/*
+ * Part of the data file, holding the records which start in [begin, limit);
+ * a thread first guesses where the first record starts and counts records
+ * from there, then, once the true start is known, collects the entries
+ */
+typedef struct {
+  const ecbor_index_builder_t *builder;
+  size_t begin, limit;
+  uint8_t at_record;
+
+  /* guessed start, record count and record starts from there */
+  size_t checkpoints[ECBOR_INDEX_CHECKPOINTS];
+  size_t checkpoint_count;
+  uint64_t guessed_count;
+  size_t guessed_end;
+  uint8_t guess_failed;
+
+  /* true start, first record number and count, end of the last record */
+  size_t start;
+  uint64_t first_record;
+  uint64_t count;
+  size_t end;
+
+  /* entries for blocks starting in this chunk */
+  ecbor_index_entry_t *entries;
+  size_t entry_count, entry_capacity;
+  uint64_t first_block;
+
+  ecbor_error_t rc;
+} ecbor_index_chunk_t;
+
+static uint64_t
+ecbor_index_load (const uint8_t *p)
+{
+  uint64_t v = 0;
+  int i;
+  for (i = 7; i >= 0; i --) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+static void
+ecbor_index_store (uint8_t *p, uint64_t v)
+{
+  int i;
+  for (i = 0; i < 8; i ++) {
+    p[i] = (uint8_t) (v >> (8 * i));
+  }
+}
+
+/*
+ * Count the records starting at <position> and before <limit>, stopping after
+ * <max_count>; <end> receives the end of the last record counted. An
+ * incomplete record at the end of the data ends the scan without error.
+ */
+static ecbor_error_t
+ecbor_index_scan (const ecbor_index_builder_t *builder, size_t position,
+                  size_t limit, uint64_t max_count, size_t *checkpoints,
+                  size_t *checkpoint_count, uint64_t *count, size_t *end)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  ecbor_error_t rc;
+  uint64_t n = 0;
+
+  rc = ecbor_initialize_decode (&context, builder->data + position,
+                                builder->size - position);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  if (checkpoint_count) {
+    (*checkpoint_count) = 0;
+  }
+
+  while (position < limit && n < max_count) {
+    rc = ecbor_decode (&context, &item);
+    if (rc == ECBOR_END_OF_BUFFER || rc == ECBOR_ERR_INVALID_END_OF_BUFFER) {
+      break;
+    } else if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    if (checkpoints && (*checkpoint_count) < ECBOR_INDEX_CHECKPOINTS) {
+      checkpoints[(*checkpoint_count) ++] = position;
+    }
+    position = (size_t) (context.in_position - builder->data);
+    n ++;
+  }
+
+  (*count) = n;
+  (*end) = position;
+  return ECBOR_OK;
+}
+
+/* Whether a few records decode from <position> on */
+static bool
+ecbor_index_probe (const ecbor_index_builder_t *builder, size_t position)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  ecbor_error_t rc;
+  int i;
+
+  if (ecbor_initialize_decode (&context, builder->data + position,
+                               builder->size - position) != ECBOR_OK) {
+    return false;
+  }
+  for (i = 0; i < ECBOR_INDEX_PROBE; i ++) {
+    rc = ecbor_decode (&context, &item);
+    if (rc == ECBOR_END_OF_BUFFER) {
+      return (i > 0);
+    } else if (rc != ECBOR_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* First pass; guess the first record start of a chunk and count from there */
+static void *
+ecbor_index_guess (void *data)
+{
+  ecbor_index_chunk_t *chunk = (ecbor_index_chunk_t *) data;
+  const ecbor_index_builder_t *builder = chunk->builder;
+  size_t position = chunk->begin;
+
+  while (!chunk->at_record && position < chunk->limit
+         && !ecbor_index_probe (builder, position)) {
+    position ++;
+  }
+  if (position == chunk->limit
+      || ecbor_index_scan (builder, position, chunk->limit, UINT64_MAX,
+                           chunk->checkpoints, &chunk->checkpoint_count,
+                           &chunk->guessed_count, &chunk->guessed_end)
+           != ECBOR_OK) {
+    chunk->guess_failed = true;
+  }
+
+  return NULL;
+}
+
+static void
+ecbor_index_update_key (const ecbor_index_builder_t *builder,
+                        const uint8_t *record, size_t size,
+                        ecbor_index_entry_t *entry)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  size_t offset, length;
+  int64_t key;
+
+  if (ecbor_locate (record, size, builder->key_path, builder->key_path_length,
+                    &offset, &length) != ECBOR_OK
+      || ecbor_initialize_decode (&context, record + offset, length)
+           != ECBOR_OK
+      || ecbor_decode (&context, &item) != ECBOR_OK) {
+    /* records without the key do not count */
+    return;
+  }
+
+  if (item.type == ECBOR_TYPE_UINT && item.value.uinteger <= INT64_MAX) {
+    key = (int64_t) item.value.uinteger;
+  } else if (item.type == ECBOR_TYPE_NINT) {
+    key = item.value.integer;
+  } else {
+    return;
+  }
+
+  if (key < entry->key_min) {
+    entry->key_min = key;
+  }
+  if (key > entry->key_max) {
+    entry->key_max = key;
+  }
+}
+
+/*
+ * Second pass; walk the chunk from its true start, opening an entry every
+ * <stride> records, and continue past it to complete the last block
+ */
+static void *
+ecbor_index_collect (void *data)
+{
+  ecbor_index_chunk_t *chunk = (ecbor_index_chunk_t *) data;
+  const ecbor_index_builder_t *builder = chunk->builder;
+  ecbor_decode_context_t context;
+  ecbor_index_entry_t *entry = NULL, *entries;
+  ecbor_item_t item;
+  uint64_t record = chunk->first_record, n = 0;
+  size_t position = chunk->start, capacity;
+  ecbor_error_t rc;
+
+  if (chunk->entry_count > 0) {
+    /* continuing the last block of the existing index */
+    entry = &chunk->entries[chunk->entry_count - 1];
+  }
+
+  rc = ecbor_initialize_decode (&context, builder->data + position,
+                                builder->size - position);
+  while (rc == ECBOR_OK && (n < chunk->count || entry)) {
+    rc = ecbor_decode (&context, &item);
+    if (rc == ECBOR_END_OF_BUFFER || rc == ECBOR_ERR_INVALID_END_OF_BUFFER) {
+      rc = ECBOR_OK;
+      break;
+    } else if (rc != ECBOR_OK) {
+      break;
+    }
+
+    if (record % builder->stride == 0) {
+      if (n >= chunk->count) {
+        /* block of the next chunk */
+        break;
+      }
+      if (chunk->entry_count == chunk->entry_capacity) {
+        capacity = (chunk->entry_capacity ? chunk->entry_capacity * 2 : 64);
+        entries = (ecbor_index_entry_t *)
+          realloc (chunk->entries, capacity * sizeof (ecbor_index_entry_t));
+        if (!entries) {
+          rc = ECBOR_ERR_SYSTEM;
+          break;
+        }
+        chunk->entries = entries;
+        chunk->entry_capacity = capacity;
+      }
+      entry = &chunk->entries[chunk->entry_count ++];
+      entry->offset = position;
+      entry->key_min = INT64_MAX;
+      entry->key_max = INT64_MIN;
+    }
+
+    if (entry && builder->key_path_length > 0) {
+      ecbor_index_update_key (builder, builder->data + position,
+                              (size_t) (context.in_position - builder->data)
+                                - position,
+                              entry);
+    }
+
+    position = (size_t) (context.in_position - builder->data);
+    record ++;
+    if (n < chunk->count) {
+      n ++;
+      chunk->end = position;
+    }
+  }
+
+  chunk->count = n;
+  chunk->rc = rc;
+  return NULL;
+}
+
+/* Run <routine> over all chunks, on a thread each */
+static ecbor_error_t
+ecbor_index_run (ecbor_index_chunk_t *chunks, size_t chunk_count,
+                 void *(*routine) (void *))
+{
+  pthread_t *threads;
+  size_t i, started;
+
+  threads = (pthread_t *) calloc (chunk_count, sizeof (pthread_t));
+  if (!threads) {
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  for (started = 1; started < chunk_count; started ++) {
+    if (pthread_create (&threads[started], NULL, routine,
+                        &chunks[started]) != 0) {
+      break;
+    }
+  }
+  routine (&chunks[0]);
+  for (i = 1; i < started; i ++) {
+    pthread_join (threads[i], NULL);
+  }
+  /* the rest, if threads ran out */
+  for (i = started; i < chunk_count; i ++) {
+    routine (&chunks[i]);
+  }
+
+  free (threads);
+  return ECBOR_OK;
+}
+
+/*
+ * Find the true start and record count of each chunk, from the guesses; the
+ * previous chunk ends at a record start, and walking from there reaches one
+ * of the guessed record starts as soon as the guess resynchronizes, after
+ * which both agree
+ */
+static ecbor_error_t
+ecbor_index_merge (const ecbor_index_builder_t *builder,
+                   ecbor_index_chunk_t *chunks, size_t chunk_count,
+                   uint64_t first_record)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  size_t position = chunks[0].begin, i, j;
+  uint64_t record = first_record, n;
+  bool matched;
+  ecbor_error_t rc;
+
+  for (i = 0; i < chunk_count; i ++) {
+    ecbor_index_chunk_t *chunk = &chunks[i];
+
+    chunk->start = position;
+    chunk->first_record = record;
+    chunk->count = 0;
+    chunk->end = position;
+    if (position >= chunk->limit) {
+      /* covered by a record of a previous chunk */
+      continue;
+    }
+
+    matched = false;
+    if (i > 0 && !chunk->guess_failed && chunk->checkpoint_count > 0) {
+      n = 0;
+      j = 0;
+      rc = ecbor_initialize_decode (&context, builder->data + position,
+                                    builder->size - position);
+      while (rc == ECBOR_OK) {
+        while (j < chunk->checkpoint_count
+               && chunk->checkpoints[j] < position) {
+          j ++;
+        }
+        if (j == chunk->checkpoint_count) {
+          break;
+        }
+        if (chunk->checkpoints[j] == position) {
+          matched = true;
+          break;
+        }
+        rc = ecbor_decode (&context, &item);
+        position = (size_t) (context.in_position - builder->data);
+        n ++;
+      }
+
+      if (matched) {
+        chunk->count = n + chunk->guessed_count - j;
+        chunk->end = chunk->guessed_end;
+      } else {
+        position = chunk->start;
+      }
+    }
+
+    if (i == 0) {
+      /* the first chunk started at a record */
+      chunk->count = chunk->guessed_count;
+      chunk->end = chunk->guessed_end;
+      matched = !chunk->guess_failed;
+    }
+
+    if (!matched) {
+      rc = ecbor_index_scan (builder, chunk->start, chunk->limit, UINT64_MAX,
+                             NULL, NULL, &chunk->count, &chunk->end);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+    }
+
+    position = chunk->end;
+    record += chunk->count;
+  }
+
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_index_write (int fd, const uint8_t *buffer, size_t size, off_t offset)
+{
+  ssize_t n;
+
+  while (size > 0) {
+    n = pwrite (fd, buffer, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return ECBOR_ERR_SYSTEM;
+    }
+    buffer += n;
+    size -= (size_t) n;
+    offset += n;
+  }
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_index_write_entries (int fd, const ecbor_index_chunk_t *chunk,
+                           size_t entry_size)
+{
+  uint8_t buffer[64 * ECBOR_INDEX_KEYED_ENTRY_SIZE];
+  size_t i, used = 0;
+  off_t offset;
+  ecbor_error_t rc;
+
+  offset = (off_t) (ECBOR_INDEX_HEADER_SIZE + chunk->first_block * entry_size);
+  for (i = 0; i < chunk->entry_count; i ++) {
+    ecbor_index_store (buffer + used, chunk->entries[i].offset);
+    if (entry_size == ECBOR_INDEX_KEYED_ENTRY_SIZE) {
+      ecbor_index_store (buffer + used + 8,
+                         (uint64_t) chunk->entries[i].key_min);
+      ecbor_index_store (buffer + used + 16,
+                         (uint64_t) chunk->entries[i].key_max);
+    }
+    used += entry_size;
+
+    if (used == sizeof (buffer) || i + 1 == chunk->entry_count) {
+      rc = ecbor_index_write (fd, buffer, used, offset);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      offset += (off_t) used;
+      used = 0;
+    }
+  }
+
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_index_build_internal (const char *data_path, const char *index_path,
+                            const ecbor_index_options_t *options,
+                            bool resume)
+{
+  ecbor_index_builder_t builder;
+  ecbor_index_chunk_t *chunks = NULL;
+  ecbor_file_map_t map;
+  uint8_t header[ECBOR_INDEX_HEADER_SIZE];
+  uint64_t record_count = 0, block_count = 0;
+  size_t indexed_size = 0, entry_size, chunk_count = 0, i;
+  struct stat st;
+  ecbor_error_t rc;
+  long cpus;
+  int fd;
+
+  if (!data_path || !index_path || !options) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (options->stride == 0) {
+    return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+  }
+  if (options->key_path_length > 0 && !options->key_path) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  entry_size = (options->key_path_length > 0 ? ECBOR_INDEX_KEYED_ENTRY_SIZE
+                                             : ECBOR_INDEX_ENTRY_SIZE);
+
+  rc = ecbor_map_file (&map, data_path, ECBOR_MAP_SEQUENTIAL);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  builder.data = map.data;
+  builder.size = map.size;
+  builder.stride = options->stride;
+  builder.key_path = options->key_path;
+  builder.key_path_length = options->key_path_length;
+
+  fd = open (index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0 || fstat (fd, &st) < 0) {
+    rc = ECBOR_ERR_SYSTEM;
+    goto end;
+  }
+
+  /* resume from an existing index built with the same options */
+  if (resume && st.st_size >= ECBOR_INDEX_HEADER_SIZE
+      && pread (fd, header, sizeof (header), 0) == sizeof (header)
+      && memcmp (header, ECBOR_INDEX_MAGIC, 8) == 0
+      && ecbor_index_load (header + 8) == options->stride
+      && ecbor_index_load (header + 32) == entry_size
+      && ecbor_index_load (header + 24) <= map.size) {
+    record_count = ecbor_index_load (header + 16);
+    indexed_size = (size_t) ecbor_index_load (header + 24);
+    block_count = (record_count + options->stride - 1) / options->stride;
+  }
+
+  /* one thread per CPU, with enough to scan */
+  cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  chunk_count = (options->threads ? options->threads
+                                  : (cpus > 0 ? (size_t) cpus : 1));
+  if (chunk_count > (map.size - indexed_size) / ECBOR_INDEX_MIN_CHUNK) {
+    chunk_count = (map.size - indexed_size) / ECBOR_INDEX_MIN_CHUNK;
+  }
+  if (chunk_count == 0) {
+    chunk_count = 1;
+  }
+
+  chunks = (ecbor_index_chunk_t *) calloc (chunk_count,
+                                           sizeof (ecbor_index_chunk_t));
+  if (!chunks) {
+    rc = ECBOR_ERR_SYSTEM;
+    goto end;
+  }
+  for (i = 0; i < chunk_count; i ++) {
+    chunks[i].builder = &builder;
+    chunks[i].at_record = (i == 0);
+    chunks[i].begin = indexed_size + (map.size - indexed_size) * i
+                                     / chunk_count;
+    chunks[i].limit = indexed_size + (map.size - indexed_size) * (i + 1)
+                                     / chunk_count;
+  }
+
+  if (chunk_count > 1) {
+    /* record counts, in parallel */
+    rc = ecbor_index_run (chunks, chunk_count, ecbor_index_guess);
+    if (rc == ECBOR_OK) {
+      rc = ecbor_index_merge (&builder, chunks, chunk_count, record_count);
+    }
+    if (rc != ECBOR_OK) {
+      goto end;
+    }
+  } else {
+    /* a single pass does */
+    chunks[0].start = indexed_size;
+    chunks[0].first_record = record_count;
+    chunks[0].count = UINT64_MAX;
+    chunks[0].end = indexed_size;
+  }
+
+  for (i = 0; i < chunk_count; i ++) {
+    chunks[i].first_block = (chunks[i].first_record + options->stride - 1)
+                            / options->stride;
+  }
+  if (record_count % options->stride != 0) {
+    /* reload the incomplete last block */
+    chunks[0].entries = (ecbor_index_entry_t *)
+      malloc (64 * sizeof (ecbor_index_entry_t));
+    if (!chunks[0].entries
+        || pread (fd, header, entry_size,
+                  (off_t) (ECBOR_INDEX_HEADER_SIZE
+                           + (block_count - 1) * entry_size))
+             != (ssize_t) entry_size) {
+      rc = ECBOR_ERR_SYSTEM;
+      goto end;
+    }
+    chunks[0].entries[0].offset = ecbor_index_load (header);
+    chunks[0].entries[0].key_min = INT64_MAX;
+    chunks[0].entries[0].key_max = INT64_MIN;
+    if (entry_size == ECBOR_INDEX_KEYED_ENTRY_SIZE) {
+      chunks[0].entries[0].key_min = (int64_t) ecbor_index_load (header + 8);
+      chunks[0].entries[0].key_max = (int64_t) ecbor_index_load (header + 16);
+    }
+    chunks[0].entry_count = 1;
+    chunks[0].entry_capacity = 64;
+    chunks[0].first_block = block_count - 1;
+  }
+
+  /* entries, in parallel */
+  rc = ecbor_index_run (chunks, chunk_count, ecbor_index_collect);
+  if (rc != ECBOR_OK) {
+    goto end;
+  }
+  for (i = 0; i < chunk_count; i ++) {
+    if (chunks[i].rc != ECBOR_OK) {
+      rc = chunks[i].rc;
+      goto end;
+    }
+    rc = ecbor_index_write_entries (fd, &chunks[i], entry_size);
+    if (rc != ECBOR_OK) {
+      goto end;
+    }
+    record_count += chunks[i].count;
+    if (chunks[i].count > 0) {
+      indexed_size = chunks[i].end;
+    }
+  }
+  block_count = (record_count + options->stride - 1) / options->stride;
+
+  /* header last */
+  memset (header, 0, sizeof (header));
+  memcpy (header, ECBOR_INDEX_MAGIC, 8);
+  ecbor_index_store (header + 8, options->stride);
+  ecbor_index_store (header + 16, record_count);
+  ecbor_index_store (header + 24, indexed_size);
+  ecbor_index_store (header + 32, entry_size);
+  if (ftruncate (fd, (off_t) (ECBOR_INDEX_HEADER_SIZE
+                              + block_count * entry_size)) < 0
+      || fdatasync (fd) < 0) {
+    rc = ECBOR_ERR_SYSTEM;
+    goto end;
+  }
+  rc = ecbor_index_write (fd, header, sizeof (header), 0);
+
+end:
+  if (chunks) {
+    for (i = 0; i < chunk_count; i ++) {
+      free (chunks[i].entries);
+    }
+    free (chunks);
+  }
+  if (fd >= 0) {
+    close (fd);
+  }
+  ecbor_unmap_file (&map);
+  return rc;
+}
+
+ecbor_error_t
+ecbor_index_build (const char *data_path, const char *index_path,
+                   const ecbor_index_options_t *options)
+{
+  return ecbor_index_build_internal (data_path, index_path, options, false);
+}
+
+ecbor_error_t
+ecbor_index_update (const char *data_path, const char *index_path,
+                    const ecbor_index_options_t *options)
+{
+  return ecbor_index_build_internal (data_path, index_path, options, true);
+}
+
+ecbor_error_t
+ecbor_index_open (ecbor_index_t *index, const char *data_path,
+                  const char *index_path)
+{
+  const uint8_t *header;
+  ecbor_error_t rc;
+
+  if (!index) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!data_path || !index_path) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  rc = ecbor_map_file (&index->index_map, index_path, ECBOR_MAP_RANDOM);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  rc = ecbor_map_file (&index->data_map, data_path, ECBOR_MAP_RANDOM);
+  if (rc != ECBOR_OK) {
+    ecbor_unmap_file (&index->index_map);
+    return rc;
+  }
+
+  header = index->index_map.data;
+  if (index->index_map.size < ECBOR_INDEX_HEADER_SIZE
+      || memcmp (header, ECBOR_INDEX_MAGIC, 8) != 0) {
+    rc = ECBOR_ERR_INVALID_TYPE;
+    goto fail;
+  }
+  index->stride = ecbor_index_load (header + 8);
+  index->record_count = ecbor_index_load (header + 16);
+  index->indexed_size = (size_t) ecbor_index_load (header + 24);
+  index->entry_size = (size_t) ecbor_index_load (header + 32);
+  index->block_count = (index->stride
+                        ? (index->record_count + index->stride - 1)
+                          / index->stride
+                        : 0);
+  index->entries = header + ECBOR_INDEX_HEADER_SIZE;
+
+  if (index->stride == 0
+      || (index->entry_size != ECBOR_INDEX_ENTRY_SIZE
+          && index->entry_size != ECBOR_INDEX_KEYED_ENTRY_SIZE)
+      || index->index_map.size < ECBOR_INDEX_HEADER_SIZE
+                                 + index->block_count * index->entry_size) {
+    rc = ECBOR_ERR_INVALID_TYPE;
+    goto fail;
+  }
+  if (index->indexed_size > index->data_map.size) {
+    /* data file was truncated */
+    rc = ECBOR_ERR_INVALID_END_OF_BUFFER;
+    goto fail;
+  }
+
+  return ECBOR_OK;
+
+fail:
+  ecbor_unmap_file (&index->data_map);
+  ecbor_unmap_file (&index->index_map);
+  return rc;
+}
+
+ecbor_error_t
+ecbor_index_close (ecbor_index_t *index)
+{
+  if (!index) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  ecbor_unmap_file (&index->data_map);
+  ecbor_unmap_file (&index->index_map);
+  index->entries = NULL;
+  index->record_count = 0;
+  index->block_count = 0;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_index_get_block (const ecbor_index_t *index, uint64_t block,
+                       uint64_t *first_record, size_t *offset,
+                       int64_t *key_min, int64_t *key_max)
+{
+  const uint8_t *entry;
+
+  if (!index) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (block >= index->block_count) {
+    return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+  }
+  if ((key_min || key_max)
+      && index->entry_size != ECBOR_INDEX_KEYED_ENTRY_SIZE) {
+    return ECBOR_ERR_KEY_NOT_FOUND;
+  }
+
+  entry = index->entries + block * index->entry_size;
+  if (first_record) {
+    (*first_record) = block * index->stride;
+  }
+  if (offset) {
+    (*offset) = (size_t) ecbor_index_load (entry);
+  }
+  if (key_min) {
+    (*key_min) = (int64_t) ecbor_index_load (entry + 8);
+  }
+  if (key_max) {
+    (*key_max) = (int64_t) ecbor_index_load (entry + 16);
+  }
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_index_get_record (const ecbor_index_t *index, uint64_t record,
+                        const uint8_t **data, size_t *size)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  const uint8_t *start = NULL;
+  size_t offset;
+  uint64_t i;
+  ecbor_error_t rc;
+
+  if (!index) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!data || !size) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (record >= index->record_count) {
+    return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+  }
+
+  /* closest entry, then skip the rest of the way */
+  offset = (size_t) ecbor_index_load (index->entries + (record / index->stride)
+                                                       * index->entry_size);
+  rc = ecbor_initialize_decode (&context, index->data_map.data + offset,
+                                index->indexed_size - offset);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  for (i = record % index->stride; ; i --) {
+    start = context.in_position;
+    rc = ecbor_decode (&context, &item);
+    if (rc != ECBOR_OK) {
+      return (rc == ECBOR_END_OF_BUFFER ? ECBOR_ERR_INVALID_END_OF_BUFFER : rc);
+    }
+    if (i == 0) {
+      break;
+    }
+  }
+
+  (*data) = start;
+  (*size) = (size_t) (context.in_position - start);
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_index_find_offset (const ecbor_index_t *index, size_t offset,
+                         uint64_t *record)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  uint64_t low, high, middle, current;
+  size_t position;
+  ecbor_error_t rc;
+
+  if (!index) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!record) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (index->block_count == 0 || offset >= index->indexed_size) {
+    return ECBOR_END_OF_BUFFER;
+  }
+
+  /* last block starting at or before <offset> */
+  low = 0;
+  high = index->block_count;
+  while (high - low > 1) {
+    middle = low + (high - low) / 2;
+    if (ecbor_index_load (index->entries + middle * index->entry_size)
+          <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+
+  position = (size_t) ecbor_index_load (index->entries
+                                        + low * index->entry_size);
+  current = low * index->stride;
+  rc = ecbor_initialize_decode (&context, index->data_map.data + position,
+                                index->indexed_size - position);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  /* first record starting at or after <offset> */
+  while (position < offset) {
+    rc = ecbor_decode (&context, &item);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    position = (size_t) (context.in_position - index->data_map.data);
+    current ++;
+  }
+  if (current >= index->record_count) {
+    return ECBOR_END_OF_BUFFER;
+  }
+
+  (*record) = current;
+  return ECBOR_OK;
+}
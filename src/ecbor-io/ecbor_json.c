@@ -0,0 +1,1460 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ecbor_io.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* Longest scalar: a quoted double, or a quoted 20 digit negative integer */
+#define ECBOR_JSON_SCALAR_MAX 40
+
+/* Escape for each byte of a string: 0 when written as is, 'u' for \u00XX,
+   otherwise the character following the backslash */
+static const uint8_t ecbor_json_escape[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+  /* rest are zero */
+};
+
+static const char ecbor_json_hex[16] = "0123456789abcdef";
+
+static const char ecbor_json_base64url[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static const char ecbor_json_digits[200] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "74757677787980818283848586878889909192939495969798" "99";
+
+ecbor_error_t
+ecbor_initialize_json (ecbor_json_context_t *context, uint8_t *buffer,
+                       size_t buffer_size)
+{
+  if (!context) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!buffer) {
+    return ECBOR_ERR_NULL_OUTPUT_BUFFER;
+  }
+
+  context->base = buffer;
+  context->out_position = buffer;
+  context->bytes_left = buffer_size;
+  context->flush = NULL;
+  context->flush_data = NULL;
+  context->tags = ECBOR_JSON_TAGS_DROP;
+  context->keys = ECBOR_JSON_KEYS_STRINGIFY;
+  context->depth = 0;
+  context->muted = 0;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_json_flush_callback (ecbor_json_context_t *context,
+                               ecbor_flush_callback_t flush, void *user_data)
+{
+  if (!context) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if ((size_t) (context->out_position - context->base) + context->bytes_left
+      < ECBOR_JSON_SCALAR_MAX) {
+    /* scalars are written whole */
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  context->flush = flush;
+  context->flush_data = user_data;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_json_policy (ecbor_json_context_t *context,
+                       ecbor_json_tag_policy_t tags,
+                       ecbor_json_key_policy_t keys)
+{
+  if (!context) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  context->tags = tags;
+  context->keys = keys;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_get_json_size (ecbor_json_context_t *context, size_t *size)
+{
+  if (!context) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!size) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  (*size) = (size_t) (context->out_position - context->base);
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_json_flush_internal (ecbor_json_context_t *context)
+{
+  size_t used = (size_t) (context->out_position - context->base);
+  ecbor_error_t rc;
+
+  if (used > 0) {
+    rc = context->flush (context->flush_data, context->base, used);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+  context->out_position = context->base;
+  context->bytes_left += used;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_json_flush (ecbor_json_context_t *context)
+{
+  if (!context) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!context->flush) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  return ecbor_json_flush_internal (context);
+}
+
+/* Make sure <size> contiguous bytes are available in the output buffer */
+static inline ecbor_error_t
+ecbor_json_room (ecbor_json_context_t *context, size_t size)
+{
+  if (__builtin_expect (context->bytes_left >= size, 1)) {
+    return ECBOR_OK;
+  }
+  if (!context->flush) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+  return ecbor_json_flush_internal (context);
+}
+
+static inline ecbor_error_t
+ecbor_json_put_char (ecbor_json_context_t *context, char c)
+{
+  ecbor_error_t rc = ecbor_json_room (context, 1);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  *(context->out_position ++) = (uint8_t) c;
+  context->bytes_left --;
+  return ECBOR_OK;
+}
+
+/* Write <size> bytes, flushing in between if needed */
+static ecbor_error_t
+ecbor_json_put (ecbor_json_context_t *context, const uint8_t *data,
+                size_t size)
+{
+  size_t piece;
+  ecbor_error_t rc;
+
+  while (size > context->bytes_left) {
+    if (!context->flush) {
+      return ECBOR_ERR_INVALID_END_OF_BUFFER;
+    }
+    piece = context->bytes_left;
+    memcpy (context->out_position, data, piece);
+    context->out_position += piece;
+    context->bytes_left = 0;
+    data += piece;
+    size -= piece;
+    rc = ecbor_json_flush_internal (context);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  memcpy (context->out_position, data, size);
+  context->out_position += size;
+  context->bytes_left -= size;
+  return ECBOR_OK;
+}
+
+/*
+ * Length of the leading part of <data> which needs no escaping
+ */
+static inline size_t
+ecbor_json_clean_length (const uint8_t *data, size_t size)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8 ('"');
+  const __m128i backslash = _mm_set1_epi8 ('\\');
+  const __m128i control = _mm_set1_epi8 (0x1f);
+  __m128i v, special;
+  int mask;
+
+  for (; i + 16 <= size; i += 16) {
+    v = _mm_loadu_si128 ((const __m128i *) (data + i));
+    /* unsigned v <= 0x1f is max (v, 0x1f) == 0x1f */
+    special = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, quote),
+                                          _mm_cmpeq_epi8 (v, backslash)),
+                            _mm_cmpeq_epi8 (_mm_max_epu8 (v, control),
+                                            control));
+    mask = _mm_movemask_epi8 (special);
+    if (mask) {
+      return i + (size_t) __builtin_ctz ((unsigned int) mask);
+    }
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t quote = vdupq_n_u8 ('"');
+  const uint8x16_t backslash = vdupq_n_u8 ('\\');
+  const uint8x16_t control = vdupq_n_u8 (0x1f);
+  uint8x16_t v, special;
+
+  for (; i + 16 <= size; i += 16) {
+    v = vld1q_u8 (data + i);
+    special = vorrq_u8 (vorrq_u8 (vceqq_u8 (v, quote),
+                                  vceqq_u8 (v, backslash)),
+                        vcleq_u8 (v, control));
+    if (vmaxvq_u8 (special)) {
+      break;
+    }
+  }
+#endif
+
+  for (; i < size; i ++) {
+    if (ecbor_json_escape[data[i]]) {
+      break;
+    }
+  }
+  return i;
+}
+
+static ecbor_error_t
+ecbor_json_put_escaped (ecbor_json_context_t *context, const uint8_t *data,
+                        size_t size)
+{
+  size_t clean;
+  uint8_t escape;
+  ecbor_error_t rc;
+
+  while (size > 0) {
+    clean = ecbor_json_clean_length (data, size);
+    rc = ecbor_json_put (context, data, clean);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    if (clean == size) {
+      break;
+    }
+
+    rc = ecbor_json_room (context, 6);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    escape = ecbor_json_escape[data[clean]];
+    context->out_position[0] = '\\';
+    if (escape == 'u') {
+      context->out_position[1] = 'u';
+      context->out_position[2] = '0';
+      context->out_position[3] = '0';
+      context->out_position[4] = ecbor_json_hex[data[clean] >> 4];
+      context->out_position[5] = ecbor_json_hex[data[clean] & 0x0f];
+      context->out_position += 6;
+      context->bytes_left -= 6;
+    } else {
+      context->out_position[1] = escape;
+      context->out_position += 2;
+      context->bytes_left -= 2;
+    }
+
+    data += clean + 1;
+    size -= clean + 1;
+  }
+
+  return ECBOR_OK;
+}
+
+/*
+ * Base64url without padding, over consecutive pieces; up to two bytes are
+ * carried between pieces
+ */
+typedef struct {
+  uint8_t carry[2];
+  size_t carried;
+} ecbor_json_base64_t;
+
+static ecbor_error_t
+ecbor_json_put_base64 (ecbor_json_context_t *context,
+                       ecbor_json_base64_t *state, const uint8_t *data,
+                       size_t size)
+{
+  uint8_t group[3];
+  uint8_t *out;
+  size_t groups, i;
+  ecbor_error_t rc;
+
+  /* complete the carried group */
+  while (state->carried > 0 && state->carried < 3 && size > 0) {
+    if (state->carried == 2) {
+      group[0] = state->carry[0];
+      group[1] = state->carry[1];
+      group[2] = *data;
+      data ++;
+      size --;
+      state->carried = 0;
+      rc = ecbor_json_put_base64 (context, state, group, 3);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+    } else {
+      state->carry[state->carried ++] = *data;
+      data ++;
+      size --;
+    }
+  }
+
+  while (size >= 3) {
+    rc = ecbor_json_room (context, 4);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    groups = context->bytes_left / 4;
+    if (groups > size / 3) {
+      groups = size / 3;
+    }
+    out = context->out_position;
+    for (i = 0; i < groups; i ++, data += 3, out += 4) {
+      uint32_t v = ((uint32_t) data[0] << 16) | ((uint32_t) data[1] << 8)
+                   | data[2];
+      out[0] = (uint8_t) ecbor_json_base64url[v >> 18];
+      out[1] = (uint8_t) ecbor_json_base64url[(v >> 12) & 0x3f];
+      out[2] = (uint8_t) ecbor_json_base64url[(v >> 6) & 0x3f];
+      out[3] = (uint8_t) ecbor_json_base64url[v & 0x3f];
+    }
+    context->out_position = out;
+    context->bytes_left -= groups * 4;
+    size -= groups * 3;
+  }
+
+  for (i = 0; i < size; i ++) {
+    state->carry[state->carried ++] = data[i];
+  }
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_json_end_base64 (ecbor_json_context_t *context,
+                       ecbor_json_base64_t *state)
+{
+  uint32_t v;
+  ecbor_error_t rc;
+
+  if (state->carried == 0) {
+    return ECBOR_OK;
+  }
+
+  rc = ecbor_json_room (context, 3);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  v = (uint32_t) state->carry[0] << 16;
+  if (state->carried == 2) {
+    v |= (uint32_t) state->carry[1] << 8;
+  }
+  context->out_position[0] = (uint8_t) ecbor_json_base64url[v >> 18];
+  context->out_position[1] = (uint8_t) ecbor_json_base64url[(v >> 12) & 0x3f];
+  if (state->carried == 2) {
+    context->out_position[2] = (uint8_t) ecbor_json_base64url[(v >> 6) & 0x3f];
+  }
+  context->out_position += state->carried + 1;
+  context->bytes_left -= state->carried + 1;
+  state->carried = 0;
+  return ECBOR_OK;
+}
+
+/*
+ * Write a string item, quoted; text is escaped, bytes are base64url encoded.
+ * Indefinite strings are walked chunk by chunk.
+ */
+static ecbor_error_t
+ecbor_json_put_string (ecbor_json_context_t *context, const ecbor_item_t *item)
+{
+  ecbor_decode_context_t chunks;
+  ecbor_json_base64_t base64 = { { 0, 0 }, 0 };
+  ecbor_item_t chunk;
+  const uint8_t *data = item->value.string.str;
+  size_t size = item->length;
+  ecbor_error_t rc;
+
+  if (!data && size > 0) {
+    /* payload went to a sink */
+    return ECBOR_ERR_NULL_VALUE;
+  }
+
+  rc = ecbor_json_put_char (context, '"');
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  if (item->is_indefinite) {
+    rc = ecbor_initialize_decode_streamed (&chunks, data, item->size - 1);
+    while (rc == ECBOR_OK
+           && (rc = ecbor_decode (&chunks, &chunk)) == ECBOR_OK) {
+      if (item->type == ECBOR_TYPE_STR) {
+        rc = ecbor_json_put_escaped (context, chunk.value.string.str,
+                                     chunk.length);
+      } else {
+        rc = ecbor_json_put_base64 (context, &base64, chunk.value.string.str,
+                                    chunk.length);
+      }
+    }
+    if (rc != ECBOR_END_OF_INDEFINITE) {
+      return rc;
+    }
+    rc = ECBOR_OK;
+  } else if (item->type == ECBOR_TYPE_STR) {
+    rc = ecbor_json_put_escaped (context, data, size);
+  } else {
+    rc = ecbor_json_put_base64 (context, &base64, data, size);
+  }
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  if (item->type == ECBOR_TYPE_BSTR) {
+    rc = ecbor_json_end_base64 (context, &base64);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+  return ecbor_json_put_char (context, '"');
+}
+
+/* Format <value> in decimal at the end of <buffer>; returns the start */
+static inline char *
+ecbor_json_format_uint (char *end, uint64_t value)
+{
+  while (value >= 100) {
+    unsigned int pair = (unsigned int) (value % 100) * 2;
+    value /= 100;
+    end -= 2;
+    end[0] = ecbor_json_digits[pair];
+    end[1] = ecbor_json_digits[pair + 1];
+  }
+  if (value >= 10) {
+    end -= 2;
+    end[0] = ecbor_json_digits[value * 2];
+    end[1] = ecbor_json_digits[value * 2 + 1];
+  } else {
+    *(-- end) = (char) ('0' + value);
+  }
+  return end;
+}
+
+/*
+ * Shortest decimal form which reads back as <value>; integral values get a
+ * ".0" so they stay floats for the reader
+ */
+static size_t
+ecbor_json_format_double (char *buffer, double value, bool single)
+{
+  char *start;
+  int precision, n;
+
+  if (fabs (value) < 1e15 && value == (double) (int64_t) value) {
+    start = ecbor_json_format_uint (buffer + 24, (uint64_t) fabs (value));
+    if (signbit (value)) {
+      *(-- start) = '-';
+    }
+    n = (int) (buffer + 24 - start);
+    memmove (buffer, start, (size_t) n);
+    buffer[n] = '.';
+    buffer[n + 1] = '0';
+    return (size_t) n + 2;
+  }
+
+  /* any value of at most DIG digits round trips, so the first that reads back
+     is the shortest */
+  for (precision = (single ? 6 : 15); ; precision ++) {
+    n = snprintf (buffer, ECBOR_JSON_SCALAR_MAX - 2, "%.*g", precision,
+                  value);
+    if (precision == (single ? 9 : 17)
+        || (single ? (double) strtof (buffer, NULL) == value
+                   : strtod (buffer, NULL) == value)) {
+      break;
+    }
+  }
+  return (size_t) n;
+}
+
+/* Write a scalar item, quoted if it is a map key */
+static ecbor_error_t
+ecbor_json_put_scalar (ecbor_json_context_t *context, const ecbor_item_t *item,
+                       bool quoted)
+{
+  char digits[24], *start;
+  uint8_t *out;
+  const char *text = NULL;
+  size_t length = 0;
+  uint64_t magnitude;
+  double fp;
+  ecbor_error_t rc;
+
+  rc = ecbor_json_room (context, ECBOR_JSON_SCALAR_MAX);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  out = context->out_position;
+  if (quoted) {
+    *(out ++) = '"';
+  }
+
+  switch (item->type) {
+    case ECBOR_TYPE_UINT:
+      start = ecbor_json_format_uint (digits + sizeof (digits),
+                                      item->value.uinteger);
+      length = (size_t) (digits + sizeof (digits) - start);
+      memcpy (out, start, length);
+      out += length;
+      break;
+
+    case ECBOR_TYPE_NINT:
+      /* -1 - n, where n may not fit a signed integer */
+      magnitude = ~ (uint64_t) item->value.integer;
+      *(out ++) = '-';
+      if (magnitude == UINT64_MAX) {
+        text = "18446744073709551616";
+        length = 20;
+      } else {
+        start = ecbor_json_format_uint (digits + sizeof (digits),
+                                        magnitude + 1);
+        text = start;
+        length = (size_t) (digits + sizeof (digits) - start);
+      }
+      memcpy (out, text, length);
+      out += length;
+      break;
+
+    case ECBOR_TYPE_FP32:
+    case ECBOR_TYPE_FP64:
+      fp = (item->type == ECBOR_TYPE_FP32 ? (double) item->value.fp32
+                                          : item->value.fp64);
+      if (!isfinite (fp)) {
+        /* JSON has no NaN or infinity */
+        memcpy (out, "null", 4);
+        out += 4;
+      } else {
+        out += ecbor_json_format_double ((char *) out, fp,
+                                         item->type == ECBOR_TYPE_FP32);
+      }
+      break;
+
+    case ECBOR_TYPE_BOOL:
+      text = (item->value.uinteger ? "true" : "false");
+      length = (item->value.uinteger ? 4 : 5);
+      memcpy (out, text, length);
+      out += length;
+      break;
+
+    default:
+      /* null and undefined */
+      memcpy (out, "null", 4);
+      out += 4;
+      break;
+  }
+
+  if (quoted) {
+    *(out ++) = '"';
+  }
+  context->bytes_left -= (size_t) (out - context->out_position);
+  context->out_position = out;
+  return ECBOR_OK;
+}
+
+/* Account for a finished item in the enclosing containers, closing those it
+   completes */
+static ecbor_error_t
+ecbor_json_complete (ecbor_json_context_t *context)
+{
+  ecbor_json_frame_t *frame;
+  ecbor_error_t rc;
+
+  while (context->depth > 0) {
+    frame = &context->stack[context->depth - 1];
+
+    if (frame->type == ECBOR_TYPE_MAP && !frame->at_value) {
+      frame->at_value = true;
+    } else {
+      frame->at_value = false;
+      if (context->muted == context->depth) {
+        /* skipped pair is done */
+        context->muted = 0;
+      } else {
+        frame->has_output = true;
+      }
+    }
+
+    if (frame->is_indefinite || -- frame->remaining > 0) {
+      return ECBOR_OK;
+    }
+
+    /* container is complete */
+    if (!context->muted) {
+      rc = ecbor_json_put_char (context, (frame->type == ECBOR_TYPE_ARRAY
+                                          ? ']' : '}'));
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+    }
+    context->depth --;
+  }
+
+  /* top level items are separated by new lines */
+  return ecbor_json_put_char (context, '\n');
+}
+
+static ecbor_error_t
+ecbor_json_push (ecbor_json_context_t *context, ecbor_type_t type,
+                 uint64_t remaining, uint8_t is_indefinite)
+{
+  ecbor_json_frame_t *frame;
+
+  if (context->depth == ECBOR_MAX_NESTING_DEPTH) {
+    return ECBOR_ERR_NESTING_TOO_DEEP;
+  }
+
+  frame = &context->stack[context->depth ++];
+  frame->remaining = remaining;
+  frame->type = (uint8_t) type;
+  frame->is_indefinite = is_indefinite;
+  frame->has_output = false;
+  frame->at_value = false;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_json_transcode (ecbor_json_context_t *context,
+                      ecbor_decode_context_t *input)
+{
+  ecbor_json_frame_t *frame;
+  ecbor_item_t item;
+  bool is_key;
+  char prefix[48], digits[24], *start;
+  size_t length;
+  ecbor_error_t rc;
+
+  if (!context) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!input) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (input->mode != ECBOR_MODE_DECODE_STREAMED) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  while (true) {
+    rc = ecbor_decode (input, &item);
+
+    if (rc == ECBOR_END_OF_INDEFINITE) {
+      /* closes the innermost indefinite container */
+      frame = (context->depth > 0 ? &context->stack[context->depth - 1]
+                                  : NULL);
+      if (!frame || !frame->is_indefinite || frame->at_value) {
+        return ECBOR_ERR_INVALID_STOP_CODE;
+      }
+      if (!context->muted) {
+        rc = ecbor_json_put_char (context, (frame->type == ECBOR_TYPE_ARRAY
+                                            ? ']' : '}'));
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+      }
+      context->depth --;
+      rc = ecbor_json_complete (context);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      continue;
+    } else if (rc == ECBOR_END_OF_BUFFER) {
+      return (context->depth > 0 ? ECBOR_ERR_INVALID_END_OF_BUFFER
+                                 : ECBOR_OK);
+    } else if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    if (item.type == ECBOR_TYPE_TAG) {
+      if (context->tags == ECBOR_JSON_TAGS_DROP) {
+        /* the tagged item stands in its place */
+        continue;
+      } else if (context->tags == ECBOR_JSON_TAGS_REJECT) {
+        return ECBOR_ERR_CURRENTLY_NOT_SUPPORTED;
+      }
+    }
+
+    /* separators, and the key policy */
+    is_key = false;
+    frame = (context->depth > 0 ? &context->stack[context->depth - 1] : NULL);
+    if (frame && frame->type == ECBOR_TYPE_MAP && !frame->at_value) {
+      is_key = (item.type != ECBOR_TYPE_STR);
+      if (is_key && !context->muted) {
+        if (context->keys == ECBOR_JSON_KEYS_REJECT) {
+          return ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+        } else if (context->keys == ECBOR_JSON_KEYS_SKIP) {
+          context->muted = context->depth;
+        } else if (item.type == ECBOR_TYPE_ARRAY
+                   || item.type == ECBOR_TYPE_MAP
+                   || item.type == ECBOR_TYPE_TAG) {
+          /* no string form */
+          return ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+        }
+      }
+      if (!context->muted && frame->has_output) {
+        rc = ecbor_json_put_char (context, ',');
+      }
+    } else if (frame && frame->type == ECBOR_TYPE_MAP) {
+      rc = (context->muted ? ECBOR_OK : ecbor_json_put_char (context, ':'));
+    } else if (frame && frame->type == ECBOR_TYPE_ARRAY && frame->has_output
+               && !context->muted) {
+      rc = ecbor_json_put_char (context, ',');
+    }
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    switch (item.type) {
+      case ECBOR_TYPE_STR:
+      case ECBOR_TYPE_BSTR:
+        rc = (context->muted ? ECBOR_OK
+                             : ecbor_json_put_string (context, &item));
+        if (rc == ECBOR_OK) {
+          rc = ecbor_json_complete (context);
+        }
+        break;
+
+      case ECBOR_TYPE_ARRAY:
+      case ECBOR_TYPE_MAP:
+        if (!context->muted) {
+          rc = ecbor_json_room (context, 2);
+          if (rc != ECBOR_OK) {
+            return rc;
+          }
+          *(context->out_position ++) = (item.type == ECBOR_TYPE_ARRAY
+                                         ? '[' : '{');
+          context->bytes_left --;
+        }
+        if (!item.is_indefinite && item.length == 0) {
+          if (!context->muted) {
+            *(context->out_position ++) = (item.type == ECBOR_TYPE_ARRAY
+                                           ? ']' : '}');
+            context->bytes_left --;
+          }
+          rc = ecbor_json_complete (context);
+        } else {
+          rc = ecbor_json_push (context, item.type, item.length,
+                                item.is_indefinite);
+        }
+        break;
+
+      case ECBOR_TYPE_TAG:
+        /* wrapped as {"tag":<number>,"value":<item>}, a map of one value */
+        if (!context->muted) {
+          start = ecbor_json_format_uint (digits + sizeof (digits),
+                                          item.value.tag.tag_value);
+          length = (size_t) (digits + sizeof (digits) - start);
+          memcpy (prefix, "{\"tag\":", 7);
+          memcpy (prefix + 7, start, length);
+          memcpy (prefix + 7 + length, ",\"value\":", 9);
+          rc = ecbor_json_put (context, (const uint8_t *) prefix,
+                               length + 16);
+          if (rc != ECBOR_OK) {
+            return rc;
+          }
+        }
+        rc = ecbor_json_push (context, ECBOR_TYPE_TAG, 1, false);
+        break;
+
+      default:
+        rc = (context->muted ? ECBOR_OK
+                             : ecbor_json_put_scalar (context, &item, is_key));
+        if (rc == ECBOR_OK) {
+          rc = ecbor_json_complete (context);
+        }
+        break;
+    }
+
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+}
+
+/*
+ * JSON to CBOR encoding
+ */
+
+/* Containers kept on the parser stack; deeper ones are allocated */
+#define ECBOR_JSON_INLINE_DEPTH 32
+
+/* Longest number parsed from a stack copy */
+#define ECBOR_JSON_NUMBER_MAX 64
+
+typedef struct {
+  /* input text */
+  const uint8_t *base;
+  const uint8_t *position;
+  const uint8_t *end;
+
+  /* output context, and its innermost container when parsing started */
+  ecbor_encode_context_t *output;
+  ecbor_container_t *outer;
+
+  /* open containers */
+  ecbor_container_t inline_frames[ECBOR_JSON_INLINE_DEPTH];
+  ecbor_container_t *frames;
+  size_t depth;
+
+  /* unescaped strings and long numbers */
+  uint8_t *scratch;
+  size_t scratch_size;
+} ecbor_json_parser_t;
+
+/* Powers of ten exactly representable as doubles */
+static const double ecbor_json_pow10[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool
+ecbor_json_is_space (uint8_t c)
+{
+  return (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+}
+
+static inline bool
+ecbor_json_is_digit (uint8_t c)
+{
+  return (c >= '0' && c <= '9');
+}
+
+/*
+ * Length of the leading whitespace of <data>
+ */
+static inline size_t
+ecbor_json_space_length (const uint8_t *data, size_t size)
+{
+  size_t i = 0;
+
+  /* compact text has little whitespace, and never more than a byte */
+  if (size == 0 || !ecbor_json_is_space (data[0])) {
+    return 0;
+  }
+
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8 (' ');
+  const __m128i newline = _mm_set1_epi8 ('\n');
+  const __m128i carriage = _mm_set1_epi8 ('\r');
+  const __m128i tab = _mm_set1_epi8 ('\t');
+  __m128i v, blank;
+  int mask;
+
+  for (; i + 16 <= size; i += 16) {
+    v = _mm_loadu_si128 ((const __m128i *) (data + i));
+    blank = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, space),
+                                        _mm_cmpeq_epi8 (v, newline)),
+                          _mm_or_si128 (_mm_cmpeq_epi8 (v, carriage),
+                                        _mm_cmpeq_epi8 (v, tab)));
+    mask = _mm_movemask_epi8 (blank) ^ 0xffff;
+    if (mask) {
+      return i + (size_t) __builtin_ctz ((unsigned int) mask);
+    }
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t space = vdupq_n_u8 (' ');
+  const uint8x16_t newline = vdupq_n_u8 ('\n');
+  const uint8x16_t carriage = vdupq_n_u8 ('\r');
+  const uint8x16_t tab = vdupq_n_u8 ('\t');
+  uint8x16_t v, blank;
+
+  for (; i + 16 <= size; i += 16) {
+    v = vld1q_u8 (data + i);
+    blank = vorrq_u8 (vorrq_u8 (vceqq_u8 (v, space), vceqq_u8 (v, newline)),
+                      vorrq_u8 (vceqq_u8 (v, carriage), vceqq_u8 (v, tab)));
+    if (vminvq_u8 (blank) == 0) {
+      break;
+    }
+  }
+#endif
+
+  for (; i < size; i ++) {
+    if (!ecbor_json_is_space (data[i])) {
+      break;
+    }
+  }
+  return i;
+}
+
+static inline void
+ecbor_json_skip_space (ecbor_json_parser_t *parser)
+{
+  parser->position += ecbor_json_space_length (parser->position,
+                                               (size_t) (parser->end
+                                                         - parser->position));
+}
+
+/* Make sure the scratch buffer holds at least <size> bytes */
+static ecbor_error_t
+ecbor_json_reserve_scratch (ecbor_json_parser_t *parser, size_t size)
+{
+  size_t new_size;
+  uint8_t *scratch;
+
+  if (size <= parser->scratch_size) {
+    return ECBOR_OK;
+  }
+  new_size = (parser->scratch_size ? parser->scratch_size * 2 : 256);
+  while (new_size < size) {
+    new_size *= 2;
+  }
+  scratch = (uint8_t *) realloc (parser->scratch, new_size);
+  if (!scratch) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  parser->scratch = scratch;
+  parser->scratch_size = new_size;
+  return ECBOR_OK;
+}
+
+/* Value of the four hex digits at <p>, or -1 */
+static int32_t
+ecbor_json_parse_hex4 (const uint8_t *p)
+{
+  int32_t value = 0, digit;
+  int i;
+
+  for (i = 0; i < 4; i ++) {
+    if (p[i] >= '0' && p[i] <= '9') {
+      digit = p[i] - '0';
+    } else if ((p[i] | 0x20) >= 'a' && (p[i] | 0x20) <= 'f') {
+      digit = (p[i] | 0x20) - 'a' + 10;
+    } else {
+      return -1;
+    }
+    value = (value << 4) | digit;
+  }
+  return value;
+}
+
+/*
+ * Unescape the escape sequence at the parser position (a backslash) into
+ * <out>, returning the number of bytes written, or 0 if invalid
+ */
+static size_t
+ecbor_json_unescape (ecbor_json_parser_t *parser, uint8_t *out)
+{
+  const uint8_t *p = parser->position;
+  size_t left = (size_t) (parser->end - p);
+  int32_t code, low;
+
+  if (left < 2) {
+    return 0;
+  }
+
+  switch (p[1]) {
+    case '"':  out[0] = '"'; break;
+    case '\\': out[0] = '\\'; break;
+    case '/':  out[0] = '/'; break;
+    case 'b':  out[0] = '\b'; break;
+    case 'f':  out[0] = '\f'; break;
+    case 'n':  out[0] = '\n'; break;
+    case 'r':  out[0] = '\r'; break;
+    case 't':  out[0] = '\t'; break;
+
+    case 'u':
+      if (left < 6 || (code = ecbor_json_parse_hex4 (p + 2)) < 0) {
+        return 0;
+      }
+      parser->position += 6;
+
+      if (code >= 0xdc00 && code <= 0xdfff) {
+        /* lone low surrogate */
+        return 0;
+      } else if (code >= 0xd800 && code <= 0xdbff) {
+        /* must be followed by a low surrogate */
+        if (left < 12 || p[6] != '\\' || p[7] != 'u'
+            || (low = ecbor_json_parse_hex4 (p + 8)) < 0xdc00
+            || low > 0xdfff) {
+          return 0;
+        }
+        parser->position += 6;
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        out[0] = (uint8_t) (0xf0 | (code >> 18));
+        out[1] = (uint8_t) (0x80 | ((code >> 12) & 0x3f));
+        out[2] = (uint8_t) (0x80 | ((code >> 6) & 0x3f));
+        out[3] = (uint8_t) (0x80 | (code & 0x3f));
+        return 4;
+      } else if (code >= 0x800) {
+        out[0] = (uint8_t) (0xe0 | (code >> 12));
+        out[1] = (uint8_t) (0x80 | ((code >> 6) & 0x3f));
+        out[2] = (uint8_t) (0x80 | (code & 0x3f));
+        return 3;
+      } else if (code >= 0x80) {
+        out[0] = (uint8_t) (0xc0 | (code >> 6));
+        out[1] = (uint8_t) (0x80 | (code & 0x3f));
+        return 2;
+      }
+      out[0] = (uint8_t) code;
+      return 1;
+
+    default:
+      return 0;
+  }
+
+  parser->position += 2;
+  return 1;
+}
+
+/*
+ * Parse the string at the parser position (an opening quote) into a text
+ * string item; strings without escapes reference the input in place
+ */
+static ecbor_error_t
+ecbor_json_parse_string (ecbor_json_parser_t *parser, ecbor_item_t *item)
+{
+  const uint8_t *start = ++ parser->position;
+  size_t clean, used = 0, written;
+  ecbor_error_t rc;
+
+  clean = ecbor_json_clean_length (start, (size_t) (parser->end - start));
+  parser->position += clean;
+  if (parser->position < parser->end && *parser->position == '"') {
+    parser->position ++;
+    (*item) = ecbor_str ((const char *) start, clean);
+    return ECBOR_OK;
+  }
+
+  /* escaped, unescape into scratch memory */
+  while (true) {
+    if (parser->position == parser->end || *parser->position < 0x20) {
+      /* unterminated, or unescaped control character */
+      return ECBOR_ERR_INVALID_SYNTAX;
+    }
+
+    rc = ecbor_json_reserve_scratch (parser, used + clean + 4);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    memcpy (parser->scratch + used, parser->position - clean, clean);
+    used += clean;
+
+    if (*parser->position == '"') {
+      parser->position ++;
+      break;
+    }
+
+    written = ecbor_json_unescape (parser, parser->scratch + used);
+    if (written == 0) {
+      return ECBOR_ERR_INVALID_SYNTAX;
+    }
+    used += written;
+
+    clean = ecbor_json_clean_length (parser->position,
+                                     (size_t) (parser->end
+                                               - parser->position));
+    parser->position += clean;
+  }
+
+  (*item) = ecbor_str ((const char *) parser->scratch, used);
+  return ECBOR_OK;
+}
+
+/*
+ * Parse the number at the parser position into an integer item if it has no
+ * fraction or exponent and fits, otherwise into the narrowest float holding
+ * its value
+ */
+static ecbor_error_t
+ecbor_json_parse_number (ecbor_json_parser_t *parser, ecbor_item_t *item)
+{
+  const uint8_t *start = parser->position, *p = start, *end = parser->end;
+  char copy[ECBOR_JSON_NUMBER_MAX], *text;
+  bool negative = false, integral = true, truncated = false;
+  uint64_t mantissa = 0, digit;
+  int64_t exponent = 0, exp10 = 0;
+  bool exp_negative = false;
+  size_t length;
+  double value;
+  float narrow;
+  ecbor_error_t rc;
+
+  if (*p == '-') {
+    negative = true;
+    p ++;
+  }
+
+  /* integer part, without leading zeros */
+  if (p == end || !ecbor_json_is_digit (*p)) {
+    parser->position = p;
+    return ECBOR_ERR_INVALID_SYNTAX;
+  }
+  if (*p == '0') {
+    p ++;
+  } else {
+    for (; p < end && ecbor_json_is_digit (*p); p ++) {
+      digit = (uint64_t) (*p - '0');
+      if (!truncated && mantissa <= (UINT64_MAX - digit) / 10) {
+        mantissa = mantissa * 10 + digit;
+      } else {
+        truncated = true;
+        exponent ++;
+      }
+    }
+  }
+
+  /* fraction */
+  if (p < end && *p == '.') {
+    integral = false;
+    p ++;
+    if (p == end || !ecbor_json_is_digit (*p)) {
+      parser->position = p;
+    return ECBOR_ERR_INVALID_SYNTAX;
+    }
+    for (; p < end && ecbor_json_is_digit (*p); p ++) {
+      digit = (uint64_t) (*p - '0');
+      if (!truncated && mantissa <= (UINT64_MAX - digit) / 10) {
+        mantissa = mantissa * 10 + digit;
+        exponent --;
+      } else {
+        truncated = true;
+      }
+    }
+  }
+
+  /* exponent */
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    integral = false;
+    p ++;
+    if (p < end && (*p == '+' || *p == '-')) {
+      exp_negative = (*p == '-');
+      p ++;
+    }
+    if (p == end || !ecbor_json_is_digit (*p)) {
+      parser->position = p;
+    return ECBOR_ERR_INVALID_SYNTAX;
+    }
+    for (; p < end && ecbor_json_is_digit (*p); p ++) {
+      if (exp10 < 100000) {
+        exp10 = exp10 * 10 + (*p - '0');
+      }
+    }
+    exponent += (exp_negative ? -exp10 : exp10);
+  }
+
+  parser->position = p;
+
+  if (integral && !truncated) {
+    if (!negative) {
+      (*item) = ecbor_uint (mantissa);
+      return ECBOR_OK;
+    } else if (mantissa > 0 && mantissa <= (uint64_t) INT64_MAX + 1) {
+      /* two's complement negation, also for -2^63 */
+      (*item) = ecbor_int ((int64_t) (0 - mantissa));
+      return ECBOR_OK;
+    }
+    /* -0 and integers below -2^63 fall through */
+  }
+
+  if (!truncated && mantissa <= (1ull << 53)
+      && exponent >= -22 && exponent <= 22) {
+    /* exact operands, correctly rounded result */
+    value = (double) mantissa;
+    value = (exponent < 0 ? value / ecbor_json_pow10[-exponent]
+                          : value * ecbor_json_pow10[exponent]);
+  } else {
+    /* strtod() needs a terminated string */
+    length = (size_t) (p - start);
+    if (length < sizeof (copy)) {
+      text = copy;
+    } else {
+      rc = ecbor_json_reserve_scratch (parser, length + 1);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      text = (char *) parser->scratch;
+    }
+    memcpy (text, start, length);
+    text[length] = '\0';
+    value = strtod (text, NULL);
+  }
+  if (negative) {
+    value = -value;
+  }
+
+  /* out of range conversions to float are undefined */
+  if (fabs (value) <= FLT_MAX || isinf (value)) {
+    narrow = (float) value;
+    if ((double) narrow == value) {
+      (*item) = ecbor_fp32 (narrow);
+      return ECBOR_OK;
+    }
+  }
+  (*item) = ecbor_fp64 (value);
+  return ECBOR_OK;
+}
+
+/* Parse one of true, false or null */
+static ecbor_error_t
+ecbor_json_parse_literal (ecbor_json_parser_t *parser, ecbor_item_t *item)
+{
+  size_t left = (size_t) (parser->end - parser->position);
+
+  if (left >= 4 && memcmp (parser->position, "true", 4) == 0) {
+    (*item) = ecbor_bool (1);
+    parser->position += 4;
+  } else if (left >= 5 && memcmp (parser->position, "false", 5) == 0) {
+    (*item) = ecbor_bool (0);
+    parser->position += 5;
+  } else if (left >= 4 && memcmp (parser->position, "null", 4) == 0) {
+    (*item) = ecbor_null ();
+    parser->position += 4;
+  } else {
+    return ECBOR_ERR_INVALID_SYNTAX;
+  }
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_json_open (ecbor_json_parser_t *parser, ecbor_type_t type)
+{
+  ecbor_container_t *frame;
+
+  if (parser->depth == ECBOR_MAX_NESTING_DEPTH) {
+    return ECBOR_ERR_NESTING_TOO_DEEP;
+  }
+
+  if (parser->depth < ECBOR_JSON_INLINE_DEPTH) {
+    frame = &parser->inline_frames[parser->depth];
+  } else {
+    if (!parser->frames) {
+      /* frames are linked, so they are never moved */
+      parser->frames = (ecbor_container_t *)
+        malloc (sizeof (ecbor_container_t)
+                * (ECBOR_MAX_NESTING_DEPTH - ECBOR_JSON_INLINE_DEPTH));
+      if (!parser->frames) {
+        return ECBOR_ERR_SYSTEM;
+      }
+    }
+    frame = &parser->frames[parser->depth - ECBOR_JSON_INLINE_DEPTH];
+  }
+
+  parser->position ++;
+  parser->depth ++;
+  return (type == ECBOR_TYPE_ARRAY
+          ? ecbor_encode_begin_array (parser->output, frame)
+          : ecbor_encode_begin_map (parser->output, frame));
+}
+
+static ecbor_error_t
+ecbor_json_close (ecbor_json_parser_t *parser)
+{
+  parser->position ++;
+  parser->depth --;
+  return ecbor_encode_end_container (parser->output, 1);
+}
+
+/*
+ * Parse one JSON value at the parser position, with any nested values
+ */
+static ecbor_error_t
+ecbor_json_parse_value (ecbor_json_parser_t *parser)
+{
+  enum { AT_VALUE, AT_KEY, AT_NEXT } state = AT_VALUE;
+  ecbor_item_t item;
+  uint8_t c, close;
+  ecbor_error_t rc;
+
+  while (true) {
+    ecbor_json_skip_space (parser);
+    if (parser->position == parser->end) {
+      return ECBOR_ERR_INVALID_SYNTAX;
+    }
+    c = *parser->position;
+
+    if (state == AT_KEY) {
+      /* "key" : */
+      if (c != '"') {
+        return ECBOR_ERR_INVALID_SYNTAX;
+      }
+      rc = ecbor_json_parse_string (parser, &item);
+      if (rc == ECBOR_OK) {
+        rc = ecbor_encode (parser->output, &item);
+      }
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      ecbor_json_skip_space (parser);
+      if (parser->position == parser->end || *parser->position != ':') {
+        return ECBOR_ERR_INVALID_SYNTAX;
+      }
+      parser->position ++;
+      state = AT_VALUE;
+      continue;
+    }
+
+    if (state == AT_NEXT) {
+      /* separator, or end of the innermost container */
+      close = (parser->output->container->type == ECBOR_TYPE_MAP ? '}' : ']');
+      if (c == ',') {
+        parser->position ++;
+        state = (close == '}' ? AT_KEY : AT_VALUE);
+      } else if (c == close) {
+        rc = ecbor_json_close (parser);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+        if (parser->depth == 0) {
+          return ECBOR_OK;
+        }
+      } else {
+        return ECBOR_ERR_INVALID_SYNTAX;
+      }
+      continue;
+    }
+
+    switch (c) {
+      case '[':
+      case '{':
+        rc = ecbor_json_open (parser, (c == '[' ? ECBOR_TYPE_ARRAY
+                                                : ECBOR_TYPE_MAP));
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+        ecbor_json_skip_space (parser);
+        if (parser->position < parser->end
+            && *parser->position == (c == '[' ? ']' : '}')) {
+          /* empty */
+          rc = ecbor_json_close (parser);
+          if (rc != ECBOR_OK) {
+            return rc;
+          }
+          if (parser->depth == 0) {
+            return ECBOR_OK;
+          }
+          state = AT_NEXT;
+        } else {
+          state = (c == '[' ? AT_VALUE : AT_KEY);
+        }
+        continue;
+
+      case '"':
+        rc = ecbor_json_parse_string (parser, &item);
+        break;
+
+      case 't':
+      case 'f':
+      case 'n':
+        rc = ecbor_json_parse_literal (parser, &item);
+        break;
+
+      default:
+        rc = ecbor_json_parse_number (parser, &item);
+        break;
+    }
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    if (c != '"' && parser->position < parser->end) {
+      /* numbers and literals end at a delimiter */
+      c = *parser->position;
+      if (!ecbor_json_is_space (c) && c != ',' && c != ']' && c != '}') {
+        return ECBOR_ERR_INVALID_SYNTAX;
+      }
+    }
+
+    rc = ecbor_encode (parser->output, &item);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    if (parser->depth == 0) {
+      return ECBOR_OK;
+    }
+    state = AT_NEXT;
+  }
+}
+
+ecbor_error_t
+ecbor_json_encode (ecbor_encode_context_t *context, const uint8_t *json,
+                   size_t json_size, size_t *json_position)
+{
+  ecbor_json_parser_t parser;
+  ecbor_error_t rc = ECBOR_OK;
+
+  if (!context) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!json && json_size > 0) {
+    return ECBOR_ERR_NULL_INPUT_BUFFER;
+  }
+  if (context->mode != ECBOR_MODE_ENCODE) {
+    /* strings are written whole */
+    return ECBOR_ERR_WRONG_MODE;
+  }
+  if (context->segments) {
+    /* unescaped strings do not outlive the call */
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  parser.base = json;
+  parser.position = json;
+  parser.end = json + json_size;
+  parser.output = context;
+  parser.outer = context->container;
+  parser.frames = NULL;
+  parser.depth = 0;
+  parser.scratch = NULL;
+  parser.scratch_size = 0;
+
+  /* a sequence of whitespace separated values */
+  while (true) {
+    ecbor_json_skip_space (&parser);
+    if (parser.position == parser.end) {
+      break;
+    }
+    rc = ecbor_json_parse_value (&parser);
+    if (rc != ECBOR_OK) {
+      /* drop our open containers, they live on this stack */
+      context->container = parser.outer;
+      break;
+    }
+  }
+
+  if (json_position) {
+    (*json_position) = (size_t) (parser.position - parser.base);
+  }
+  free (parser.frames);
+  free (parser.scratch);
+  return rc;
+}
@@ -0,0 +1,718 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "ecbor_io.h"
+
+/*
+ * The file is read in blocks, into a ring of <depth> slots which are kept
+ * reading ahead of the consumer. Each slot has a block sized headroom in
+ * front, where the incomplete trailing item of the previous window is moved,
+ * so that windows are contiguous without copying whole blocks. Items larger
+ * than that are gathered in a separate, growing spill buffer.
+ */
+
+typedef enum {
+  ECBOR_SLOT_IDLE = 0,
+  ECBOR_SLOT_READING,
+  ECBOR_SLOT_DONE
+} ecbor_slot_state_t;
+
+typedef struct {
+  /* headroom followed by block */
+  uint8_t *buffer;
+
+  /* file offset and bytes read so far */
+  uint64_t offset;
+  size_t filled;
+
+  ecbor_slot_state_t state;
+  int error;
+} ecbor_reader_slot_t;
+
+struct ecbor_reader {
+  int fd;
+  uint8_t seekable;
+  size_t block_size;
+  unsigned int depth;
+  unsigned int backend;
+
+  ecbor_reader_slot_t *slots;
+  uint8_t *memory;
+
+  /* file offset of the next read, and whether the end of file was hit */
+  uint64_t next_offset;
+  uint8_t end_of_file;
+
+  /* next slot to deliver, and slot of the last delivered window (or -1) */
+  unsigned int head;
+  int delivered;
+
+  /* incomplete trailing item of the last window */
+  const uint8_t *carry;
+  size_t carry_length;
+
+  /* spill buffer, holding the carry when it is larger than the headroom */
+  uint8_t *spill;
+  size_t spill_length;
+  size_t spill_capacity;
+
+  /* io_uring backend */
+  int ring_fd;
+  void *sq_map, *cq_map;
+  size_t sq_map_size, cq_map_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* thread backend */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  unsigned int worker_next;
+  uint8_t stop;
+};
+
+#define ECBOR_SLOT_DATA(r, s) ((s)->buffer + (r)->block_size)
+
+/*
+ * io_uring backend, through raw system calls
+ */
+static int
+ecbor_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete,
+                   unsigned int flags)
+{
+  return (int) syscall (__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+/* Whether the ring supports IORING_OP_READ; kernels before 5.6 set up rings
+   but fail every such read, and cannot be probed either */
+static bool
+ecbor_uring_supports_read (int ring_fd)
+{
+  struct io_uring_probe *probe;
+  size_t n_ops = IORING_OP_READ + 1;
+  bool supported;
+
+  probe = (struct io_uring_probe *) calloc (1, sizeof (struct io_uring_probe)
+                                  + n_ops * sizeof (struct io_uring_probe_op));
+  if (!probe) {
+    return false;
+  }
+
+  supported =
+    (syscall (__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe,
+              (unsigned int) n_ops) == 0
+     && probe->last_op >= IORING_OP_READ
+     && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED));
+
+  free (probe);
+  return supported;
+}
+
+static ecbor_error_t
+ecbor_uring_setup (ecbor_reader_t *reader)
+{
+  struct io_uring_params params;
+  uint8_t *sq, *cq;
+
+  memset (&params, 0, sizeof (params));
+  reader->ring_fd = (int) syscall (__NR_io_uring_setup, reader->depth,
+                                   &params);
+  if (reader->ring_fd < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  if (!ecbor_uring_supports_read (reader->ring_fd)) {
+    return ECBOR_ERR_CURRENTLY_NOT_SUPPORTED;
+  }
+
+  reader->sq_map_size = params.sq_off.array
+                        + params.sq_entries * sizeof (unsigned int);
+  reader->cq_map_size = params.cq_off.cqes
+                        + params.cq_entries * sizeof (struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (reader->cq_map_size > reader->sq_map_size) {
+      reader->sq_map_size = reader->cq_map_size;
+    }
+    reader->cq_map_size = 0;
+  }
+
+  reader->sq_map = mmap (NULL, reader->sq_map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, reader->ring_fd,
+                         IORING_OFF_SQ_RING);
+  if (reader->sq_map == MAP_FAILED) {
+    reader->sq_map = NULL;
+    return ECBOR_ERR_SYSTEM;
+  }
+  if (reader->cq_map_size > 0) {
+    reader->cq_map = mmap (NULL, reader->cq_map_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, reader->ring_fd,
+                           IORING_OFF_CQ_RING);
+    if (reader->cq_map == MAP_FAILED) {
+      reader->cq_map = NULL;
+      return ECBOR_ERR_SYSTEM;
+    }
+  } else {
+    reader->cq_map = reader->sq_map;
+  }
+
+  reader->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+  reader->sqes = mmap (NULL, reader->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, reader->ring_fd,
+                       IORING_OFF_SQES);
+  if (reader->sqes == MAP_FAILED) {
+    reader->sqes = NULL;
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  sq = (uint8_t *) reader->sq_map;
+  cq = (uint8_t *) reader->cq_map;
+  reader->sq_head = (unsigned int *) (sq + params.sq_off.head);
+  reader->sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+  reader->sq_mask = (unsigned int *) (sq + params.sq_off.ring_mask);
+  reader->sq_array = (unsigned int *) (sq + params.sq_off.array);
+  reader->cq_head = (unsigned int *) (cq + params.cq_off.head);
+  reader->cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+  reader->cq_mask = (unsigned int *) (cq + params.cq_off.ring_mask);
+  reader->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return ECBOR_OK;
+}
+
+static void
+ecbor_uring_teardown (ecbor_reader_t *reader)
+{
+  if (reader->sqes) {
+    munmap (reader->sqes, reader->sqes_size);
+  }
+  if (reader->cq_map && reader->cq_map != reader->sq_map) {
+    munmap (reader->cq_map, reader->cq_map_size);
+  }
+  if (reader->sq_map) {
+    munmap (reader->sq_map, reader->sq_map_size);
+  }
+  if (reader->ring_fd >= 0) {
+    close (reader->ring_fd);
+  }
+  reader->sqes = NULL;
+  reader->sq_map = reader->cq_map = NULL;
+  reader->ring_fd = -1;
+}
+
+/* Queue a read of the unfilled part of <slot> */
+static ecbor_error_t
+ecbor_uring_submit (ecbor_reader_t *reader, unsigned int index)
+{
+  ecbor_reader_slot_t *slot = &reader->slots[index];
+  struct io_uring_sqe *sqe;
+  unsigned int tail, entry;
+
+  tail = *reader->sq_tail;
+  entry = tail & *reader->sq_mask;
+  sqe = &reader->sqes[entry];
+
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = reader->fd;
+  sqe->off = slot->offset + slot->filled;
+  sqe->addr = (uint64_t) (uintptr_t) (ECBOR_SLOT_DATA (reader, slot)
+                                      + slot->filled);
+  sqe->len = (uint32_t) (reader->block_size - slot->filled);
+  sqe->user_data = index;
+
+  reader->sq_array[entry] = entry;
+  __atomic_store_n (reader->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (ecbor_uring_enter (reader->ring_fd, 1, 0, 0) < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  return ECBOR_OK;
+}
+
+/* Reap completions until <slot> is done; short reads are resubmitted */
+static ecbor_error_t
+ecbor_uring_wait (ecbor_reader_t *reader, ecbor_reader_slot_t *slot)
+{
+  struct io_uring_cqe *cqe;
+  ecbor_reader_slot_t *done;
+  unsigned int head;
+  ecbor_error_t rc;
+
+  while (slot->state == ECBOR_SLOT_READING) {
+    head = *reader->cq_head;
+    if (head == __atomic_load_n (reader->cq_tail, __ATOMIC_ACQUIRE)) {
+      if (ecbor_uring_enter (reader->ring_fd, 0, 1,
+                             IORING_ENTER_GETEVENTS) < 0
+          && errno != EINTR) {
+        return ECBOR_ERR_SYSTEM;
+      }
+      continue;
+    }
+
+    cqe = &reader->cqes[head & *reader->cq_mask];
+    done = &reader->slots[cqe->user_data];
+    if (cqe->res < 0) {
+      done->error = -cqe->res;
+      done->state = ECBOR_SLOT_DONE;
+    } else if (cqe->res == 0) {
+      reader->end_of_file = true;
+      done->state = ECBOR_SLOT_DONE;
+    } else {
+      done->filled += (size_t) cqe->res;
+      if (done->filled == reader->block_size) {
+        done->state = ECBOR_SLOT_DONE;
+      }
+    }
+    __atomic_store_n (reader->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    if (done->state != ECBOR_SLOT_DONE) {
+      /* short read */
+      rc = ecbor_uring_submit (reader, (unsigned int) cqe->user_data);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+    }
+  }
+
+  return ECBOR_OK;
+}
+
+/*
+ * Thread backend; the worker fills slots in submission order
+ */
+static void *
+ecbor_reader_worker (void *data)
+{
+  ecbor_reader_t *reader = (ecbor_reader_t *) data;
+  ecbor_reader_slot_t *slot;
+  uint8_t *target;
+  size_t wanted;
+  ssize_t n;
+
+  pthread_mutex_lock (&reader->lock);
+  while (true) {
+    slot = &reader->slots[reader->worker_next];
+    while (!reader->stop && slot->state != ECBOR_SLOT_READING) {
+      pthread_cond_wait (&reader->cond, &reader->lock);
+    }
+    if (reader->stop) {
+      break;
+    }
+    pthread_mutex_unlock (&reader->lock);
+
+    /* fill the whole block, unless the file ends */
+    n = 1;
+    while (slot->filled < reader->block_size && n > 0) {
+      target = ECBOR_SLOT_DATA (reader, slot) + slot->filled;
+      wanted = reader->block_size - slot->filled;
+      if (reader->seekable) {
+        n = pread (reader->fd, target, wanted,
+                   (off_t) (slot->offset + slot->filled));
+      } else {
+        n = read (reader->fd, target, wanted);
+      }
+      if (n < 0 && errno == EINTR) {
+        n = 1;
+      } else if (n > 0) {
+        slot->filled += (size_t) n;
+      }
+    }
+
+    pthread_mutex_lock (&reader->lock);
+    if (n < 0) {
+      slot->error = errno;
+    } else if (n == 0) {
+      reader->end_of_file = true;
+    }
+    slot->state = ECBOR_SLOT_DONE;
+    reader->worker_next = (reader->worker_next + 1) % reader->depth;
+    pthread_cond_broadcast (&reader->cond);
+  }
+  pthread_mutex_unlock (&reader->lock);
+
+  return NULL;
+}
+
+/*
+ * Backend independent slot handling
+ */
+static ecbor_error_t
+ecbor_reader_submit (ecbor_reader_t *reader, unsigned int index)
+{
+  ecbor_reader_slot_t *slot = &reader->slots[index];
+  uint8_t end_of_file;
+
+  if (reader->backend == ECBOR_READER_THREAD) {
+    pthread_mutex_lock (&reader->lock);
+  }
+  end_of_file = reader->end_of_file;
+  if (end_of_file) {
+    /* nothing more to read */
+    slot->state = ECBOR_SLOT_IDLE;
+  } else {
+    slot->offset = reader->next_offset;
+    slot->filled = 0;
+    slot->error = 0;
+    slot->state = ECBOR_SLOT_READING;
+    reader->next_offset += reader->block_size;
+  }
+  if (reader->backend == ECBOR_READER_THREAD) {
+    pthread_cond_broadcast (&reader->cond);
+    pthread_mutex_unlock (&reader->lock);
+    return ECBOR_OK;
+  }
+
+  return (end_of_file ? ECBOR_OK : ecbor_uring_submit (reader, index));
+}
+
+static ecbor_error_t
+ecbor_reader_wait (ecbor_reader_t *reader, ecbor_reader_slot_t *slot)
+{
+  if (reader->backend == ECBOR_READER_URING) {
+    return ecbor_uring_wait (reader, slot);
+  }
+
+  pthread_mutex_lock (&reader->lock);
+  while (slot->state == ECBOR_SLOT_READING) {
+    pthread_cond_wait (&reader->cond, &reader->lock);
+  }
+  pthread_mutex_unlock (&reader->lock);
+  return ECBOR_OK;
+}
+
+/* Length of the leading complete items of <data> */
+static size_t
+ecbor_reader_align (const uint8_t *data, size_t size)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  const uint8_t *end = data;
+  ecbor_error_t rc;
+
+  if (size == 0 || ecbor_initialize_decode (&context, data, size) != ECBOR_OK) {
+    return 0;
+  }
+
+  while ((rc = ecbor_decode (&context, &item)) == ECBOR_OK) {
+    end = context.in_position;
+  }
+  if (rc == ECBOR_END_OF_BUFFER || rc == ECBOR_ERR_INVALID_END_OF_BUFFER) {
+    return (size_t) (end - data);
+  }
+
+  /* malformed input; hand it all over, the decode loop reports it */
+  return size;
+}
+
+/* Make room for <size> bytes in the spill buffer */
+static ecbor_error_t
+ecbor_reader_grow_spill (ecbor_reader_t *reader, size_t size)
+{
+  size_t capacity;
+  uint8_t *spill;
+
+  if (size <= reader->spill_capacity) {
+    return ECBOR_OK;
+  }
+
+  capacity = (reader->spill_capacity ? reader->spill_capacity * 2
+                                     : reader->block_size * 2);
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  spill = (uint8_t *) realloc (reader->spill, capacity);
+  if (!spill) {
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  reader->spill = spill;
+  reader->spill_capacity = capacity;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_reader_open (ecbor_reader_t **reader, int fd, size_t block_size,
+                   unsigned int depth, unsigned int flags)
+{
+  ecbor_reader_t *r;
+  struct stat st;
+  unsigned int i;
+  ecbor_error_t rc;
+
+  if (!reader) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (block_size < ECBOR_READER_MIN_BLOCK) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+  if (block_size > UINT32_MAX) {
+    return ECBOR_ERR_BUFFER_TOO_LARGE;
+  }
+  if (depth == 0) {
+    return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+  }
+  if (fstat (fd, &st) < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  r = (ecbor_reader_t *) calloc (1, sizeof (ecbor_reader_t));
+  if (!r) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  r->fd = fd;
+  r->seekable = (S_ISREG (st.st_mode) || S_ISBLK (st.st_mode));
+  r->block_size = block_size;
+  r->depth = depth;
+  r->delivered = -1;
+  r->ring_fd = -1;
+
+  r->slots = (ecbor_reader_slot_t *) calloc (depth,
+                                             sizeof (ecbor_reader_slot_t));
+  if (!r->slots
+      || posix_memalign ((void **) &r->memory, 4096,
+                         (size_t) depth * 2 * block_size) != 0) {
+    r->memory = NULL;
+    ecbor_reader_close (r);
+    return ECBOR_ERR_SYSTEM;
+  }
+  for (i = 0; i < depth; i ++) {
+    r->slots[i].buffer = r->memory + (size_t) i * 2 * block_size;
+  }
+
+  /* io_uring reads need offsets, so streams go through the thread */
+  rc = ECBOR_ERR_CURRENTLY_NOT_SUPPORTED;
+  if (r->seekable && !(flags & ECBOR_READER_NO_URING)) {
+    rc = ecbor_uring_setup (r);
+    if (rc != ECBOR_OK) {
+      ecbor_uring_teardown (r);
+    }
+  }
+  if (rc == ECBOR_OK) {
+    r->backend = ECBOR_READER_URING;
+  } else {
+    r->backend = ECBOR_READER_THREAD;
+    pthread_mutex_init (&r->lock, NULL);
+    pthread_cond_init (&r->cond, NULL);
+    if (pthread_create (&r->thread, NULL, ecbor_reader_worker, r) != 0) {
+      r->backend = 0;
+      ecbor_reader_close (r);
+      return ECBOR_ERR_SYSTEM;
+    }
+  }
+
+  /* start reading ahead */
+  for (i = 0; i < depth; i ++) {
+    rc = ecbor_reader_submit (r, i);
+    if (rc != ECBOR_OK) {
+      ecbor_reader_close (r);
+      return rc;
+    }
+  }
+
+  (*reader) = r;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_reader_next (ecbor_reader_t *reader, const uint8_t **window,
+                   size_t *size)
+{
+  ecbor_reader_slot_t *slot;
+  const uint8_t *data;
+  size_t length, aligned;
+  ecbor_error_t rc;
+
+  if (!reader) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!window || !size) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  if (reader->delivered >= 0) {
+    /* move the carry out of the delivered slot, then reuse it */
+    if (reader->carry_length > 0 && reader->spill_length == 0) {
+      slot = &reader->slots[reader->head];
+      if (reader->carry_length <= reader->block_size) {
+        memmove (ECBOR_SLOT_DATA (reader, slot) - reader->carry_length,
+                 reader->carry, reader->carry_length);
+        reader->carry = ECBOR_SLOT_DATA (reader, slot) - reader->carry_length;
+      } else {
+        rc = ecbor_reader_grow_spill (reader, reader->carry_length);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+        memcpy (reader->spill, reader->carry, reader->carry_length);
+        reader->spill_length = reader->carry_length;
+        reader->carry = reader->spill;
+      }
+    }
+
+    rc = ecbor_reader_submit (reader, (unsigned int) reader->delivered);
+    reader->delivered = -1;
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  if (reader->spill_length > 0 && reader->carry != reader->spill) {
+    /* carry left in the spill buffer by the last window; back to the
+       headroom if it fits */
+    slot = &reader->slots[reader->head];
+    if (reader->carry_length <= reader->block_size) {
+      memcpy (ECBOR_SLOT_DATA (reader, slot) - reader->carry_length,
+              reader->carry, reader->carry_length);
+      reader->carry = ECBOR_SLOT_DATA (reader, slot) - reader->carry_length;
+      reader->spill_length = 0;
+    } else {
+      memmove (reader->spill, reader->carry, reader->carry_length);
+      reader->spill_length = reader->carry_length;
+      reader->carry = reader->spill;
+    }
+  }
+
+  while (true) {
+    slot = &reader->slots[reader->head];
+    rc = ecbor_reader_wait (reader, slot);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    if (slot->state == ECBOR_SLOT_IDLE) {
+      /* end of file; whatever is left is an incomplete item */
+      if (reader->carry_length == 0) {
+        return ECBOR_END_OF_BUFFER;
+      }
+      (*window) = reader->carry;
+      (*size) = reader->carry_length;
+      reader->carry_length = 0;
+      reader->spill_length = 0;
+      return ECBOR_OK;
+    }
+    if (slot->error) {
+      errno = slot->error;
+      return ECBOR_ERR_SYSTEM;
+    }
+
+    if (reader->spill_length > 0) {
+      /* gathering a large item */
+      rc = ecbor_reader_grow_spill (reader,
+                                    reader->spill_length + slot->filled);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      memcpy (reader->spill + reader->spill_length,
+              ECBOR_SLOT_DATA (reader, slot), slot->filled);
+      reader->spill_length += slot->filled;
+      data = reader->spill;
+      length = reader->spill_length;
+    } else {
+      /* carry sits in the headroom, right before the block */
+      data = ECBOR_SLOT_DATA (reader, slot) - reader->carry_length;
+      length = reader->carry_length + slot->filled;
+    }
+
+    aligned = ecbor_reader_align (data, length);
+    if (aligned == 0 || data == reader->spill) {
+      /* slot contents are copied or about to be; reuse it; an empty slot
+         with nothing carried has nothing to copy, and no spill yet */
+      if (aligned == 0 && data != reader->spill && length > 0) {
+        rc = ecbor_reader_grow_spill (reader, length);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+        memcpy (reader->spill, data, length);
+        reader->spill_length = length;
+        data = reader->spill;
+      }
+      rc = ecbor_reader_submit (reader, reader->head);
+      reader->head = (reader->head + 1) % reader->depth;
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      if (aligned == 0) {
+        reader->carry = reader->spill;
+        reader->carry_length = length;
+        continue;
+      }
+    } else {
+      reader->delivered = (int) reader->head;
+      reader->head = (reader->head + 1) % reader->depth;
+    }
+
+    (*window) = data;
+    (*size) = aligned;
+    reader->carry = data + aligned;
+    reader->carry_length = length - aligned;
+    if (data == reader->spill && reader->carry_length == 0) {
+      reader->spill_length = 0;
+    }
+    return ECBOR_OK;
+  }
+}
+
+ecbor_error_t
+ecbor_reader_get_backend (const ecbor_reader_t *reader, unsigned int *backend)
+{
+  if (!reader) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!backend) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  (*backend) = reader->backend;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_reader_close (ecbor_reader_t *reader)
+{
+  unsigned int i;
+
+  if (!reader) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  if (reader->backend == ECBOR_READER_THREAD) {
+    pthread_mutex_lock (&reader->lock);
+    reader->stop = true;
+    pthread_cond_broadcast (&reader->cond);
+    pthread_mutex_unlock (&reader->lock);
+    pthread_join (reader->thread, NULL);
+    pthread_mutex_destroy (&reader->lock);
+    pthread_cond_destroy (&reader->cond);
+  } else if (reader->backend == ECBOR_READER_URING) {
+    /* buffers must outlive reads still in flight */
+    for (i = 0; i < reader->depth; i ++) {
+      if (reader->slots[i].state == ECBOR_SLOT_READING) {
+        ecbor_uring_wait (reader, &reader->slots[i]);
+      }
+    }
+    ecbor_uring_teardown (reader);
+  }
+
+  free (reader->spill);
+  free (reader->memory);
+  free (reader->slots);
+  free (reader);
+
+  return ECBOR_OK;
+}
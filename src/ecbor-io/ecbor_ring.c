@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ecbor_io.h"
+
+/*
+ * The ring is a header followed by the message area. Records are a 32-bit
+ * length followed by the message, padded to 8 bytes, and never wrap; a record
+ * that does not fit before the end of the area is preceded by a wrap marker.
+ * Positions grow monotonically and are reduced modulo the capacity.
+ *
+ * Each side writes only to its own cache line. A side that finds the ring
+ * full (producer) or empty (consumer) polls for a while, then raises its
+ * waiting flag and sleeps on the other side's futex word; the other side
+ * only makes a system call when it sees the flag raised, so a busy ring is
+ * driven without any.
+ */
+#define ECBOR_RING_MAGIC 0x52424345 /* "ECBR" */
+#define ECBOR_RING_VERSION 1
+#define ECBOR_RING_WRAP 0xFFFFFFFF
+#define ECBOR_RING_MIN_CAPACITY 64
+#define ECBOR_RING_MAX_CAPACITY (((size_t) 1) << 31)
+#define ECBOR_RING_DEFAULT_SPINS 1024
+#define ECBOR_RING_RECORD_SIZE(s) ((sizeof (uint32_t) + (s) + 7) & ~((size_t) 7))
+
+struct ecbor_ring_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+
+  /* written by the producer */
+  uint64_t head __attribute__ ((aligned (64)));
+  uint32_t head_futex;
+  uint32_t producer_waiting;
+  uint64_t producer_need;
+
+  /* written by the consumer */
+  uint64_t tail __attribute__ ((aligned (64)));
+  uint32_t tail_futex;
+  uint32_t consumer_waiting;
+} __attribute__ ((aligned (64)));
+
+#define ECBOR_RING_HEADER_SIZE \
+  ((sizeof (ecbor_ring_header_t) + 4095) & ~((size_t) 4095))
+
+static void
+ecbor_ring_init_view (ecbor_ring_t *ring, int fd, void *map, size_t map_size,
+                      size_t capacity)
+{
+  ring->fd = fd;
+  ring->header = (ecbor_ring_header_t *) map;
+  ring->map_size = map_size;
+  ring->data = (uint8_t *) map + ECBOR_RING_HEADER_SIZE;
+  ring->capacity = capacity;
+  ring->reserved_position = 0;
+  ring->reserved_size = 0;
+  ring->read_next = 0;
+  ring->pending_wakes = 0;
+  ring->wake_batch = 1;
+  ring->spin_count = ECBOR_RING_DEFAULT_SPINS;
+}
+
+ecbor_error_t
+ecbor_ring_create (ecbor_ring_t *ring, const char *name, size_t capacity)
+{
+  size_t map_size;
+  void *map;
+  int fd;
+
+  if (!ring) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (capacity > ECBOR_RING_MAX_CAPACITY) {
+    return ECBOR_ERR_BUFFER_TOO_LARGE;
+  }
+
+  /* round up to a power of two */
+  if (capacity < ECBOR_RING_MIN_CAPACITY) {
+    capacity = ECBOR_RING_MIN_CAPACITY;
+  }
+  capacity = ((size_t) 1) << (64 - __builtin_clzll (capacity - 1));
+  map_size = ECBOR_RING_HEADER_SIZE + capacity;
+
+  fd = memfd_create (name ? name : "ecbor-ring", 0);
+  if (fd < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  if (ftruncate (fd, (off_t) map_size) < 0) {
+    close (fd);
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close (fd);
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  /* fresh pages are zeroed */
+  ecbor_ring_init_view (ring, fd, map, map_size, capacity);
+  ring->header->capacity = capacity;
+  ring->header->version = ECBOR_RING_VERSION;
+  __atomic_store_n (&ring->header->magic, ECBOR_RING_MAGIC, __ATOMIC_RELEASE);
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_ring_attach (ecbor_ring_t *ring, int fd)
+{
+  ecbor_ring_header_t *header;
+  struct stat st;
+  void *map;
+
+  if (!ring) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (fstat (fd, &st) < 0) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  if ((size_t) st.st_size < ECBOR_RING_HEADER_SIZE + ECBOR_RING_MIN_CAPACITY) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  map = mmap (NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+              fd, 0);
+  if (map == MAP_FAILED) {
+    return ECBOR_ERR_SYSTEM;
+  }
+
+  header = (ecbor_ring_header_t *) map;
+  if (__atomic_load_n (&header->magic, __ATOMIC_ACQUIRE) != ECBOR_RING_MAGIC
+      || header->version != ECBOR_RING_VERSION) {
+    munmap (map, (size_t) st.st_size);
+    return ECBOR_ERR_CURRENTLY_NOT_SUPPORTED;
+  }
+  if (ECBOR_RING_HEADER_SIZE + header->capacity != (uint64_t) st.st_size) {
+    munmap (map, (size_t) st.st_size);
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  ecbor_ring_init_view (ring, fd, map, (size_t) st.st_size,
+                        (size_t) header->capacity);
+  ring->reserved_position = __atomic_load_n (&header->head, __ATOMIC_ACQUIRE);
+  ring->read_next = __atomic_load_n (&header->tail, __ATOMIC_ACQUIRE);
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_ring_close (ecbor_ring_t *ring)
+{
+  if (!ring) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  if (ring->header) {
+    munmap (ring->header, ring->map_size);
+    ring->header = NULL;
+  }
+  if (ring->fd >= 0) {
+    close (ring->fd);
+    ring->fd = -1;
+  }
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_ring_set_wake_batch (ecbor_ring_t *ring, size_t messages,
+                           unsigned int spin_count)
+{
+  if (!ring) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  ring->wake_batch = (messages > 0 ? messages : 1);
+  ring->spin_count = spin_count;
+
+  return ECBOR_OK;
+}
+
+static inline void
+ecbor_ring_pause (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause ();
+#endif
+}
+
+static void
+ecbor_ring_futex_wake (uint32_t *word)
+{
+  __atomic_fetch_add (word, 1, __ATOMIC_RELEASE);
+  /* shared between processes, so not FUTEX_PRIVATE_FLAG */
+  syscall (SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Milliseconds left until <deadline>, or -1 for no deadline */
+static int
+ecbor_ring_remaining (const struct timespec *deadline)
+{
+  struct timespec now;
+  long long ms;
+
+  if (!deadline) {
+    return -1;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  ms = (long long) (deadline->tv_sec - now.tv_sec) * 1000
+       + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+  return (ms > 0 ? (int) ms : 0);
+}
+
+/*
+ * Wait until <ready> holds for <ring>; <word> is the futex the other side
+ * bumps when <flag> is raised. Returns ECBOR_END_OF_BUFFER on timeout.
+ */
+typedef uint8_t (*ecbor_ring_ready_t) (ecbor_ring_t *ring);
+
+static ecbor_error_t
+ecbor_ring_wait (ecbor_ring_t *ring, ecbor_ring_ready_t ready, uint32_t *word,
+                 uint32_t *flag, int timeout_ms)
+{
+  struct timespec deadline, *dl = NULL, ts;
+  unsigned int spin;
+  uint32_t seq;
+  int left;
+
+  if (timeout_ms == 0) {
+    return (ready (ring) ? ECBOR_OK : ECBOR_END_OF_BUFFER);
+  }
+  for (spin = 0; spin < ring->spin_count; spin ++) {
+    if (ready (ring)) {
+      return ECBOR_OK;
+    }
+    ecbor_ring_pause ();
+  }
+
+  if (timeout_ms > 0) {
+    clock_gettime (CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec ++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    dl = &deadline;
+  }
+
+  while (true) {
+    seq = __atomic_load_n (word, __ATOMIC_ACQUIRE);
+    __atomic_store_n (flag, 1, __ATOMIC_SEQ_CST);
+    /* re-check after raising the flag; pairs with the fence in the waker */
+    if (ready (ring)) {
+      break;
+    }
+
+    left = ecbor_ring_remaining (dl);
+    if (left == 0) {
+      __atomic_store_n (flag, 0, __ATOMIC_RELAXED);
+      return ECBOR_END_OF_BUFFER;
+    }
+    if (left > 0) {
+      ts.tv_sec = left / 1000;
+      ts.tv_nsec = (long) (left % 1000) * 1000000;
+    }
+    syscall (SYS_futex, word, FUTEX_WAIT, seq, (left > 0 ? &ts : NULL),
+             NULL, 0);
+  }
+
+  __atomic_store_n (flag, 0, __ATOMIC_RELAXED);
+  return ECBOR_OK;
+}
+
+/* Producer side readiness: room for the reserved record */
+static uint8_t
+ecbor_ring_has_room (ecbor_ring_t *ring)
+{
+  uint64_t tail = __atomic_load_n (&ring->header->tail, __ATOMIC_ACQUIRE);
+  return (ring->reserved_position + ring->reserved_size - tail
+          <= ring->capacity);
+}
+
+/* Consumer side readiness: a record past the read position */
+static uint8_t
+ecbor_ring_has_data (ecbor_ring_t *ring)
+{
+  return (__atomic_load_n (&ring->header->head, __ATOMIC_ACQUIRE)
+          != ring->read_next);
+}
+
+ecbor_error_t
+ecbor_ring_flush (ecbor_ring_t *ring)
+{
+  if (!ring || !ring->header) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  /* pairs with the consumer raising its flag before re-checking */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (ring->pending_wakes > 0
+      && __atomic_load_n (&ring->header->consumer_waiting, __ATOMIC_RELAXED)) {
+    ecbor_ring_futex_wake (&ring->header->head_futex);
+    ring->pending_wakes = 0;
+  }
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_ring_reserve (ecbor_ring_t *ring, size_t max_size, uint8_t **slot,
+                    int timeout_ms)
+{
+  ecbor_ring_header_t *header;
+  uint64_t head;
+  size_t offset, record, contiguous;
+  ecbor_error_t rc;
+
+  if (!ring || !ring->header) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!slot) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (max_size >= ECBOR_RING_WRAP
+      || ECBOR_RING_RECORD_SIZE (max_size) > ring->capacity) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  header = ring->header;
+  head = __atomic_load_n (&header->head, __ATOMIC_RELAXED);
+  offset = head & (ring->capacity - 1);
+  record = ECBOR_RING_RECORD_SIZE (max_size);
+  contiguous = ring->capacity - offset;
+
+  /* the reservation covers the wrap padding, if any, plus the record; the
+     ready check uses these fields */
+  ring->reserved_position = head;
+  ring->reserved_size = (contiguous < record ? contiguous + record : record);
+
+  if (!ecbor_ring_has_room (ring)) {
+    /* the consumer must not be left asleep on a partial batch */
+    ecbor_ring_flush (ring);
+    __atomic_store_n (&header->producer_need,
+                      head + ring->reserved_size - ring->capacity,
+                      __ATOMIC_RELAXED);
+    rc = ecbor_ring_wait (ring, ecbor_ring_has_room, &header->tail_futex,
+                          &header->producer_waiting, timeout_ms);
+    if (rc != ECBOR_OK) {
+      ring->reserved_size = 0;
+      return rc;
+    }
+  }
+
+  if (contiguous < record) {
+    /* consumer skips to the start of the area */
+    *(uint32_t *) (ring->data + offset) = ECBOR_RING_WRAP;
+    ring->reserved_position = head + contiguous;
+    offset = 0;
+  }
+  ring->reserved_size = record;
+
+  (*slot) = ring->data + offset + sizeof (uint32_t);
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_ring_commit (ecbor_ring_t *ring, size_t size)
+{
+  uint64_t head;
+
+  if (!ring || !ring->header) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (ring->reserved_size == 0) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+  if (ECBOR_RING_RECORD_SIZE (size) > ring->reserved_size) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  *(uint32_t *) (ring->data + (ring->reserved_position
+                               & (ring->capacity - 1))) = (uint32_t) size;
+  head = ring->reserved_position + ECBOR_RING_RECORD_SIZE (size);
+  ring->reserved_size = 0;
+  __atomic_store_n (&ring->header->head, head, __ATOMIC_RELEASE);
+
+  /* a sleeping consumer is woken once per batch */
+  ring->pending_wakes ++;
+  if (ring->pending_wakes >= ring->wake_batch) {
+    return ecbor_ring_flush (ring);
+  }
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_ring_begin_encode (ecbor_ring_t *ring, ecbor_encode_context_t *context,
+                         size_t max_size, int timeout_ms)
+{
+  uint8_t *slot;
+  ecbor_error_t rc;
+
+  rc = ecbor_ring_reserve (ring, max_size, &slot, timeout_ms);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  return ecbor_initialize_encode (context, slot, max_size);
+}
+
+ecbor_error_t
+ecbor_ring_end_encode (ecbor_ring_t *ring, ecbor_encode_context_t *context)
+{
+  size_t size;
+  ecbor_error_t rc;
+
+  rc = ecbor_get_encoded_buffer_size (context, &size);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  return ecbor_ring_commit (ring, size);
+}
+
+ecbor_error_t
+ecbor_ring_read (ecbor_ring_t *ring, const uint8_t **message, size_t *size,
+                 int timeout_ms)
+{
+  ecbor_ring_header_t *header;
+  uint64_t tail;
+  uint32_t length;
+  size_t offset;
+  ecbor_error_t rc;
+
+  if (!ring || !ring->header) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+  if (!message || !size) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  header = ring->header;
+  tail = __atomic_load_n (&header->tail, __ATOMIC_RELAXED);
+  ring->read_next = tail;
+
+  while (true) {
+    if (!ecbor_ring_has_data (ring)) {
+      rc = ecbor_ring_wait (ring, ecbor_ring_has_data, &header->head_futex,
+                            &header->consumer_waiting, timeout_ms);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+    }
+
+    offset = ring->read_next & (ring->capacity - 1);
+    length = *(const uint32_t *) (ring->data + offset);
+    if (length != ECBOR_RING_WRAP) {
+      break;
+    }
+    ring->read_next += ring->capacity - offset;
+  }
+
+  (*message) = ring->data + offset + sizeof (uint32_t);
+  (*size) = length;
+  ring->read_next += ECBOR_RING_RECORD_SIZE (length);
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_ring_release (ecbor_ring_t *ring)
+{
+  ecbor_ring_header_t *header;
+
+  if (!ring || !ring->header) {
+    return ECBOR_ERR_NULL_CONTEXT;
+  }
+
+  header = ring->header;
+  __atomic_store_n (&header->tail, ring->read_next, __ATOMIC_RELEASE);
+
+  /* pairs with the producer raising its flag before re-checking; it is only
+     woken once enough room is free */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&header->producer_waiting, __ATOMIC_ACQUIRE)
+      && ring->read_next
+         >= __atomic_load_n (&header->producer_need, __ATOMIC_RELAXED)) {
+    ecbor_ring_futex_wake (&header->tail_futex);
+  }
+
+  return ECBOR_OK;
+}
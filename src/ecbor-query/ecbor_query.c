@@ -0,0 +1,1362 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ecbor.h>
+#include <ecbor_io.h>
+
+/*
+ * Command line arguments
+ */
+static struct option long_options[] = {
+  { "json",    no_argument,       0, 'J' },
+  { "count",   no_argument,       0, 'c' },
+  { "threads", required_argument, 0, 'j' },
+  { "index",   required_argument, 0, 'i' },
+  { "help",    no_argument,       0, 'h' },
+  { 0, 0, 0, 0 }
+};
+
+/* Expression limits */
+#define MAX_STEPS 64
+#define MAX_FILTER_STEPS 16
+
+/* Records per sidecar index entry, when splitting files across threads */
+#define SPLIT_STRIDE 256
+
+/* Reader blocks, for input that cannot be mapped */
+#define READER_BLOCK_SIZE (1 << 20)
+#define READER_DEPTH 4
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define JSON_BUFFER_SIZE (1 << 16)
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+
+/*
+ * Path expression
+ */
+typedef enum {
+  STEP_KEY,         /* .name, ."name", ["name"] or [n]; [n] also indexes
+                       arrays */
+  STEP_WILDCARD,    /* .* or [*], every array element or map value */
+  STEP_DESCEND,     /* .., the item and all items below it */
+  STEP_FILTER       /* [?@... op literal], keeps items satisfying it */
+} step_type_t;
+
+typedef enum {
+  OP_EXISTS,
+  OP_EQ,
+  OP_NE,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE
+} filter_op_t;
+
+typedef struct {
+  step_type_t type;
+
+  /* key, for STEP_KEY */
+  ecbor_item_t key;
+
+  /* relative path, operator and literal, for STEP_FILTER */
+  ecbor_item_t path[MAX_FILTER_STEPS];
+  size_t path_length;
+  filter_op_t op;
+  ecbor_item_t literal;
+} step_t;
+
+typedef struct {
+  step_t steps[MAX_STEPS];
+  size_t n_steps;
+
+  /* unescaped strings of the expression */
+  char *text;
+  size_t text_used;
+} query_t;
+
+/*
+ * Destination of matches
+ */
+typedef struct {
+  FILE *fp;
+  int json;
+  int count_only;
+  uint64_t matches;
+
+  /* JSON output is transcoded into <json_buffer> and flushed to <fp> */
+  ecbor_json_context_t json_context;
+  uint8_t json_buffer[JSON_BUFFER_SIZE];
+} output_t;
+
+/*
+ * Range of a mapped file queried by a thread
+ */
+typedef struct {
+  const query_t *query;
+  const uint8_t *data;
+  size_t begin, end;
+  output_t *output;
+  ecbor_error_t rc;
+  size_t error_offset;
+} query_job_t;
+
+void
+print_help (void);
+
+/*
+ * Print help
+ */
+void
+print_help (void)
+{
+  printf ("Usage: ecbor-query [options] <expression> [filename]...\n");
+  printf ("  options:\n");
+  printf ("  -J, --json         Print matches as JSON instead of diagnostic notation\n");
+  printf ("  -c, --count        Print only the number of matches\n");
+  printf ("  -j, --threads <n>  Query each file with <n> threads (0 for one per CPU)\n");
+  printf ("  -i, --index <path> Keep the sidecar index used to split the file across\n");
+  printf ("                     threads at <path>, updating it incrementally\n");
+  printf ("  -h, --help         Display this help message\n");
+  printf ("  <expression> is applied to every top-level item, e.g.\n");
+  printf ("    .name  .\"some key\"  [0]  [-1]  .*  [*]  ..name\n");
+  printf ("    [?@.level == \"error\"]  [?@[0] >= 10]  [?@.id]\n");
+  printf ("  a [?...] filter keeps or drops the current item; elements are filtered\n");
+  printf ("  with e.g. .tags[*][?@ == \"a\"]\n");
+  printf ("  <filename> may be - for standard input (the default), which is read\n");
+  printf ("  by one thread\n");
+}
+
+/*
+ * Expression parsing
+ */
+static void
+skip_space (const char **p)
+{
+  while (**p == ' ' || **p == '\t' || **p == '\n') {
+    (*p) ++;
+  }
+}
+
+static int
+is_name_char (char c)
+{
+  return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+          || (c >= '0' && c <= '9') || c == '_' || c == '-');
+}
+
+/* Parse a quoted string at <p>, unescaping \" and \\ */
+static int
+parse_quoted (query_t *query, const char **p, ecbor_item_t *item)
+{
+  char *out = query->text + query->text_used;
+  size_t length = 0;
+
+  (*p) ++;
+  while (**p != '"') {
+    if (**p == '\0') {
+      return -1;
+    }
+    if (**p == '\\' && ((*p)[1] == '"' || (*p)[1] == '\\')) {
+      (*p) ++;
+    }
+    out[length ++] = *((*p) ++);
+  }
+  (*p) ++;
+
+  query->text_used += length;
+  (*item) = ecbor_str (out, length);
+  return 0;
+}
+
+static int
+parse_name (query_t *query, const char **p, ecbor_item_t *item)
+{
+  const char *start = *p;
+  char *out = query->text + query->text_used;
+
+  while (is_name_char (**p)) {
+    (*p) ++;
+  }
+  if (*p == start) {
+    return -1;
+  }
+  memcpy (out, start, (size_t) (*p - start));
+  query->text_used += (size_t) (*p - start);
+  (*item) = ecbor_str (out, (size_t) (*p - start));
+  return 0;
+}
+
+static int
+parse_integer (const char **p, ecbor_item_t *item)
+{
+  char *end;
+
+  if (**p == '-') {
+    long long int value = strtoll (*p, &end, 10);
+    (*item) = ecbor_int (value);
+  } else {
+    unsigned long long int value = strtoull (*p, &end, 10);
+    (*item) = ecbor_uint (value);
+  }
+  if (end == *p) {
+    return -1;
+  }
+  (*p) = end;
+  return 0;
+}
+
+static int
+parse_literal (query_t *query, const char **p, ecbor_item_t *item)
+{
+  const char *end;
+  char *float_end;
+
+  if (**p == '"') {
+    return parse_quoted (query, p, item);
+  } else if (!strncmp (*p, "true", 4)) {
+    (*p) += 4;
+    (*item) = ecbor_bool (1);
+    return 0;
+  } else if (!strncmp (*p, "false", 5)) {
+    (*p) += 5;
+    (*item) = ecbor_bool (0);
+    return 0;
+  } else if (!strncmp (*p, "null", 4)) {
+    (*p) += 4;
+    (*item) = ecbor_null ();
+    return 0;
+  }
+
+  /* integers stay exact, anything with a fraction or exponent is a float */
+  for (end = *p + (**p == '-'); *end >= '0' && *end <= '9'; end ++)
+    ;
+  if (*end == '.' || *end == 'e' || *end == 'E') {
+    (*item) = ecbor_fp64 (strtod (*p, &float_end));
+    if (float_end == *p) {
+      return -1;
+    }
+    (*p) = float_end;
+    return 0;
+  }
+  return parse_integer (p, item);
+}
+
+/* Parse a key within brackets: a quoted string or an integer */
+static int
+parse_bracket_key (query_t *query, const char **p, ecbor_item_t *key)
+{
+  int rc;
+
+  skip_space (p);
+  rc = (**p == '"' ? parse_quoted (query, p, key) : parse_integer (p, key));
+  if (rc != 0) {
+    return rc;
+  }
+  skip_space (p);
+  if (**p != ']') {
+    return -1;
+  }
+  (*p) ++;
+  return 0;
+}
+
+static int
+parse_filter (query_t *query, const char **p, step_t *step)
+{
+  static const struct {
+    const char *text;
+    filter_op_t op;
+  } ops[] = {
+    { "==", OP_EQ }, { "!=", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE },
+    { "<", OP_LT }, { ">", OP_GT }
+  };
+  size_t i;
+
+  step->type = STEP_FILTER;
+  step->path_length = 0;
+  step->op = OP_EXISTS;
+
+  skip_space (p);
+  if (**p != '@') {
+    return -1;
+  }
+  (*p) ++;
+
+  /* relative path, without wildcards */
+  while (**p == '.' || **p == '[') {
+    if (step->path_length == MAX_FILTER_STEPS) {
+      return -1;
+    }
+    if (**p == '[') {
+      (*p) ++;
+      if (parse_bracket_key (query, p, &step->path[step->path_length]) != 0) {
+        return -1;
+      }
+    } else {
+      (*p) ++;
+      if ((**p == '"' ? parse_quoted (query, p, &step->path[step->path_length])
+                      : parse_name (query, p, &step->path[step->path_length]))
+          != 0) {
+        return -1;
+      }
+    }
+    step->path_length ++;
+  }
+
+  skip_space (p);
+  for (i = 0; i < sizeof (ops) / sizeof (ops[0]); i ++) {
+    if (!strncmp (*p, ops[i].text, strlen (ops[i].text))) {
+      step->op = ops[i].op;
+      (*p) += strlen (ops[i].text);
+      skip_space (p);
+      if (parse_literal (query, p, &step->literal) != 0) {
+        return -1;
+      }
+      skip_space (p);
+      break;
+    }
+  }
+
+  if (**p != ']') {
+    return -1;
+  }
+  (*p) ++;
+  return 0;
+}
+
+/*
+ * Parse <expression> into <query>; returns the offset of a syntax error, or
+ * -1 on success
+ */
+static long
+parse_query (query_t *query, const char *expression)
+{
+  const char *p = expression;
+  step_t *step;
+
+  query->n_steps = 0;
+  query->text_used = 0;
+  query->text = (char *) malloc (strlen (expression) + 1);
+  if (!query->text) {
+    return 0;
+  }
+
+  skip_space (&p);
+  if (*p == '$') {
+    p ++;
+  }
+
+  while (1) {
+    skip_space (&p);
+    if (*p == '\0') {
+      return -1;
+    }
+    if (query->n_steps == MAX_STEPS) {
+      return (long) (p - expression);
+    }
+    step = &query->steps[query->n_steps];
+
+    if (*p == '.') {
+      p ++;
+      if (*p == '.') {
+        /* recursive descent, optionally followed by a name or wildcard */
+        p ++;
+        step->type = STEP_DESCEND;
+        query->n_steps ++;
+        if (*p != '"' && *p != '*' && !is_name_char (*p)) {
+          continue;
+        }
+        if (query->n_steps == MAX_STEPS) {
+          return (long) (p - expression);
+        }
+        step = &query->steps[query->n_steps];
+      }
+
+      if (*p == '*') {
+        p ++;
+        step->type = STEP_WILDCARD;
+      } else if (*p == '"') {
+        step->type = STEP_KEY;
+        if (parse_quoted (query, &p, &step->key) != 0) {
+          return (long) (p - expression);
+        }
+      } else if (is_name_char (*p)) {
+        step->type = STEP_KEY;
+        parse_name (query, &p, &step->key);
+      } else if (query->n_steps == 0 && (*p == '\0' || *p == ' ')) {
+        /* a lone . is the item itself */
+        continue;
+      } else {
+        return (long) (p - expression);
+      }
+    } else if (*p == '[') {
+      p ++;
+      skip_space (&p);
+      if (*p == '*') {
+        p ++;
+        skip_space (&p);
+        if (*p != ']') {
+          return (long) (p - expression);
+        }
+        p ++;
+        step->type = STEP_WILDCARD;
+      } else if (*p == '?') {
+        p ++;
+        if (parse_filter (query, &p, step) != 0) {
+          return (long) (p - expression);
+        }
+      } else {
+        step->type = STEP_KEY;
+        if (parse_bracket_key (query, &p, &step->key) != 0) {
+          return (long) (p - expression);
+        }
+      }
+    } else {
+      return (long) (p - expression);
+    }
+    query->n_steps ++;
+  }
+}
+
+/*
+ * Evaluation
+ */
+
+/* Decode the item at <data>, looking through tags */
+static ecbor_error_t
+decode_untagged (const uint8_t *data, size_t size, ecbor_item_t *item)
+{
+  ecbor_decode_context_t context;
+  ecbor_error_t rc;
+
+  while (1) {
+    rc = ecbor_initialize_decode (&context, data, size);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    rc = ecbor_decode (&context, item);
+    if (rc != ECBOR_OK || item->type != ECBOR_TYPE_TAG) {
+      return rc;
+    }
+    size -= (size_t) (item->value.tag.child - data);
+    data = item->value.tag.child;
+  }
+}
+
+static int
+key_equal (const ecbor_item_t *key, const ecbor_item_t *path_key)
+{
+  if (key->type != path_key->type) {
+    return 0;
+  }
+  if (key->type == ECBOR_TYPE_STR || key->type == ECBOR_TYPE_BSTR) {
+    return (!key->is_indefinite && key->length == path_key->length
+            && !memcmp (key->value.string.str, path_key->value.string.str,
+                        key->length));
+  }
+  return ((key->type == ECBOR_TYPE_UINT || key->type == ECBOR_TYPE_NINT)
+          && key->value.uinteger == path_key->value.uinteger);
+}
+
+/* Compare a text string, possibly in chunks, with a literal */
+static int
+compare_text (const ecbor_item_t *item, const ecbor_item_t *literal)
+{
+  ecbor_decode_context_t chunks;
+  ecbor_item_t chunk;
+  const uint8_t *expected = literal->value.string.str;
+  size_t left = literal->length, n;
+  int rc;
+
+  if (!item->is_indefinite) {
+    n = (item->length < left ? item->length : left);
+    rc = memcmp (item->value.string.str, expected, n);
+    if (rc != 0) {
+      return (rc < 0 ? -1 : 1);
+    }
+    return (item->length > left) - (item->length < left);
+  }
+
+  /* chunks follow the initial byte, up to the stop code */
+  ecbor_initialize_decode (&chunks, item->value.string.str, item->size - 2);
+  while (ecbor_decode (&chunks, &chunk) == ECBOR_OK) {
+    n = (chunk.length < left ? chunk.length : left);
+    rc = memcmp (chunk.value.string.str, expected, n);
+    if (rc != 0) {
+      return (rc < 0 ? -1 : 1);
+    }
+    if (chunk.length > left) {
+      return 1;
+    }
+    expected += n;
+    left -= n;
+  }
+  return (left > 0 ? -1 : 0);
+}
+
+static int
+is_number (const ecbor_item_t *item)
+{
+  return (item->type == ECBOR_TYPE_UINT || item->type == ECBOR_TYPE_NINT
+          || item->type == ECBOR_TYPE_FP32 || item->type == ECBOR_TYPE_FP64);
+}
+
+static double
+number_value (const ecbor_item_t *item)
+{
+  switch (item->type) {
+    case ECBOR_TYPE_UINT:
+      return (double) item->value.uinteger;
+    case ECBOR_TYPE_NINT:
+      /* value is -1 - n */
+      return -1.0 - (double) ~item->value.uinteger;
+    case ECBOR_TYPE_FP32:
+      return item->value.fp32;
+    default:
+      return item->value.fp64;
+  }
+}
+
+/*
+ * Order <item> against <literal>: -1, 0 or 1, or 2 if they cannot be compared
+ */
+static int
+compare_item (const ecbor_item_t *item, const ecbor_item_t *literal)
+{
+  double a, b;
+
+  if (is_number (item) && is_number (literal)) {
+    if (item->type == ECBOR_TYPE_UINT && literal->type == ECBOR_TYPE_UINT) {
+      return (item->value.uinteger > literal->value.uinteger)
+             - (item->value.uinteger < literal->value.uinteger);
+    } else if (item->type == ECBOR_TYPE_NINT
+               && literal->type == ECBOR_TYPE_NINT) {
+      /* larger n is more negative */
+      return (~item->value.uinteger < ~literal->value.uinteger)
+             - (~item->value.uinteger > ~literal->value.uinteger);
+    } else if (item->type == ECBOR_TYPE_UINT
+               && literal->type == ECBOR_TYPE_NINT) {
+      return 1;
+    } else if (item->type == ECBOR_TYPE_NINT
+               && literal->type == ECBOR_TYPE_UINT) {
+      return -1;
+    }
+
+    a = number_value (item);
+    b = number_value (literal);
+    if (isnan (a) || isnan (b)) {
+      return 2;
+    }
+    return (a > b) - (a < b);
+  }
+
+  if (item->type != literal->type) {
+    return 2;
+  }
+  switch (item->type) {
+    case ECBOR_TYPE_STR:
+      return compare_text (item, literal);
+    case ECBOR_TYPE_BOOL:
+      return (item->value.uinteger != literal->value.uinteger ? 2 : 0);
+    case ECBOR_TYPE_NULL:
+      return 0;
+    default:
+      return 2;
+  }
+}
+
+static ecbor_error_t
+filter (const step_t *step, const uint8_t *data, size_t size, int *pass)
+{
+  ecbor_item_t item;
+  size_t offset, length;
+  ecbor_error_t rc;
+  int order;
+
+  rc = ecbor_locate (data, size, step->path, step->path_length, &offset,
+                     &length);
+  if (rc == ECBOR_ERR_KEY_NOT_FOUND || rc == ECBOR_ERR_INDEX_OUT_OF_BOUNDS
+      || rc == ECBOR_ERR_INVALID_TYPE) {
+    /* no such item */
+    (*pass) = 0;
+    return ECBOR_OK;
+  } else if (rc != ECBOR_OK) {
+    return rc;
+  }
+  if (step->op == OP_EXISTS) {
+    (*pass) = 1;
+    return ECBOR_OK;
+  }
+
+  rc = decode_untagged (data + offset, length, &item);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  order = compare_item (&item, &step->literal);
+
+  switch (step->op) {
+    case OP_EQ: (*pass) = (order == 0); break;
+    case OP_NE: (*pass) = (order != 0); break;
+    case OP_LT: (*pass) = (order == -1); break;
+    case OP_LE: (*pass) = (order == -1 || order == 0); break;
+    case OP_GT: (*pass) = (order == 1); break;
+    case OP_GE: (*pass) = (order == 1 || order == 0); break;
+    default: (*pass) = 0; break;
+  }
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+emit (output_t *output, const uint8_t *data, size_t size);
+
+/*
+ * Apply steps <step> onwards to the item of <size> bytes at <data>; subtrees
+ * off the path are skipped without being looked into
+ */
+static ecbor_error_t
+match (const query_t *query, output_t *output, const uint8_t *data,
+       size_t size, size_t step)
+{
+  const step_t *current = &query->steps[step];
+  ecbor_decode_context_t context, children;
+  ecbor_item_t container, child;
+  const uint8_t *child_data;
+  ecbor_error_t rc;
+  uint64_t i, n;
+  int pass;
+
+  if (step == query->n_steps) {
+    return emit (output, data, size);
+  }
+
+  if (current->type == STEP_FILTER) {
+    rc = filter (current, data, size, &pass);
+    if (rc != ECBOR_OK || !pass) {
+      return rc;
+    }
+    return match (query, output, data, size, step + 1);
+  } else if (current->type == STEP_DESCEND) {
+    /* the item itself, then its descendants */
+    rc = match (query, output, data, size, step + 1);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  /* container header, through tags */
+  rc = ecbor_initialize_decode_streamed (&context, data, size);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  do {
+    rc = ecbor_decode (&context, &container);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  } while (container.type == ECBOR_TYPE_TAG);
+  if (container.type != ECBOR_TYPE_ARRAY && container.type != ECBOR_TYPE_MAP) {
+    return ECBOR_OK;
+  }
+  if (current->type == STEP_KEY && container.type == ECBOR_TYPE_ARRAY
+      && current->key.type != ECBOR_TYPE_UINT) {
+    return ECBOR_OK;
+  }
+
+  /* children, measured by skipping them */
+  rc = ecbor_initialize_decode (&children, context.in_position,
+                                context.bytes_left);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  n = (container.is_indefinite ? UINT64_MAX : container.length);
+  for (i = 0; i < n; i ++) {
+    child_data = children.in_position;
+    rc = ecbor_decode (&children, &child);
+    if (rc == ECBOR_END_OF_INDEFINITE) {
+      break;
+    } else if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    if (container.type == ECBOR_TYPE_MAP) {
+      /* <child> is a key; look at the value, or skip it */
+      if (current->type == STEP_KEY && !key_equal (&child, &current->key)) {
+        rc = ecbor_decode (&children, &child);
+        i ++;
+        if (rc != ECBOR_OK) {
+          return (rc == ECBOR_END_OF_INDEFINITE
+                  ? ECBOR_ERR_INVALID_KEY_VALUE_PAIR : rc);
+        }
+        continue;
+      }
+      child_data = children.in_position;
+      rc = ecbor_decode (&children, &child);
+      i ++;
+      if (rc != ECBOR_OK) {
+        return (rc == ECBOR_END_OF_INDEFINITE
+                ? ECBOR_ERR_INVALID_KEY_VALUE_PAIR : rc);
+      }
+    } else if (current->type == STEP_KEY
+               && i != current->key.value.uinteger) {
+      continue;
+    }
+
+    rc = match (query, output, child_data, child.size,
+                (current->type == STEP_DESCEND ? step : step + 1));
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    if (current->type == STEP_KEY) {
+      /* the rest of the container is of no interest */
+      break;
+    }
+  }
+
+  return ECBOR_OK;
+}
+
+/*
+ * Output
+ */
+static void
+print_diag_float (FILE *fp, double value, int single)
+{
+  char text[40], *exponent;
+  int precision;
+
+  if (isnan (value)) {
+    fputs ("NaN", fp);
+    return;
+  } else if (isinf (value)) {
+    fputs ((value < 0 ? "-Infinity" : "Infinity"), fp);
+    return;
+  }
+
+  for (precision = (single ? 6 : 15); ; precision ++) {
+    snprintf (text, sizeof (text), "%.*g", precision, value);
+    if (precision == (single ? 9 : 17)
+        || (single ? (double) strtof (text, NULL) == value
+                   : strtod (text, NULL) == value)) {
+      break;
+    }
+  }
+
+  exponent = strchr (text, 'e');
+  if (strchr (text, '.')) {
+    fputs (text, fp);
+  } else if (exponent) {
+    /* e.g. 1.0e+300 */
+    fwrite (text, 1, (size_t) (exponent - text), fp);
+    fputs (".0", fp);
+    fputs (exponent, fp);
+  } else {
+    fputs (text, fp);
+    fputs (".0", fp);
+  }
+}
+
+static void
+print_diag_string (FILE *fp, const ecbor_item_t *item)
+{
+  static const char hex[16] = "0123456789abcdef";
+  const uint8_t *data = item->value.string.str;
+  size_t i, clean;
+
+  if (item->type == ECBOR_TYPE_BSTR) {
+    fputs ("h'", fp);
+    for (i = 0; i < item->length; i ++) {
+      putc (hex[data[i] >> 4], fp);
+      putc (hex[data[i] & 0xf], fp);
+    }
+    putc ('\'', fp);
+    return;
+  }
+
+  putc ('"', fp);
+  for (i = 0; i < item->length; ) {
+    for (clean = i; clean < item->length && data[clean] >= 0x20
+         && data[clean] != '"' && data[clean] != '\\'; clean ++)
+      ;
+    fwrite (data + i, 1, clean - i, fp);
+    if (clean == item->length) {
+      break;
+    }
+
+    switch (data[clean]) {
+      case '"':  fputs ("\\\"", fp); break;
+      case '\\': fputs ("\\\\", fp); break;
+      case '\n': fputs ("\\n", fp); break;
+      case '\r': fputs ("\\r", fp); break;
+      case '\t': fputs ("\\t", fp); break;
+      default:   fprintf (fp, "\\u%04x", data[clean]); break;
+    }
+    i = clean + 1;
+  }
+  putc ('"', fp);
+}
+
+/*
+ * Print the next item of a streamed context in diagnostic notation
+ */
+static ecbor_error_t
+print_diag (FILE *fp, ecbor_decode_context_t *context)
+{
+  ecbor_decode_context_t chunks;
+  ecbor_item_t item, chunk;
+  ecbor_error_t rc;
+  uint64_t magnitude, i;
+
+  rc = ecbor_decode (context, &item);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  switch (item.type) {
+    case ECBOR_TYPE_ARRAY:
+    case ECBOR_TYPE_MAP:
+      fputs ((item.type == ECBOR_TYPE_ARRAY ? "[" : "{"), fp);
+      if (item.is_indefinite) {
+        fputs ("_ ", fp);
+      }
+      for (i = 0; item.is_indefinite || i < item.length; i ++) {
+        if (item.is_indefinite && (context->bytes_left == 0
+                                   || *context->in_position == 0xff)) {
+          /* consume the stop code */
+          rc = ecbor_decode (context, &chunk);
+          if (rc != ECBOR_END_OF_INDEFINITE) {
+            return (rc == ECBOR_OK ? ECBOR_ERR_INVALID_STOP_CODE : rc);
+          }
+          break;
+        }
+        if (i > 0) {
+          fputs ((item.type == ECBOR_TYPE_MAP && i % 2 ? ": " : ", "), fp);
+        }
+        rc = print_diag (fp, context);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+      }
+      putc ((item.type == ECBOR_TYPE_ARRAY ? ']' : '}'), fp);
+      break;
+
+    case ECBOR_TYPE_TAG:
+      fprintf (fp, "%llu(", (unsigned long long int) item.value.tag.tag_value);
+      rc = print_diag (fp, context);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      putc (')', fp);
+      break;
+
+    case ECBOR_TYPE_STR:
+    case ECBOR_TYPE_BSTR:
+      if (!item.is_indefinite) {
+        print_diag_string (fp, &item);
+        break;
+      }
+      if (item.value.string.n_chunks == 0) {
+        fputs ((item.type == ECBOR_TYPE_STR ? "\"\"_" : "''_"), fp);
+        break;
+      }
+      fputs ("(_ ", fp);
+      rc = ecbor_initialize_decode (&chunks, item.value.string.str,
+                                    item.size - 2);
+      for (i = 0; rc == ECBOR_OK && i < item.value.string.n_chunks; i ++) {
+        rc = ecbor_decode (&chunks, &chunk);
+        if (rc == ECBOR_OK) {
+          fputs ((i > 0 ? ", " : ""), fp);
+          print_diag_string (fp, &chunk);
+        }
+      }
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      putc (')', fp);
+      break;
+
+    case ECBOR_TYPE_UINT:
+      fprintf (fp, "%llu", (unsigned long long int) item.value.uinteger);
+      break;
+
+    case ECBOR_TYPE_NINT:
+      /* value is -1 - n */
+      magnitude = ~item.value.uinteger;
+      if (magnitude == UINT64_MAX) {
+        fputs ("-18446744073709551616", fp);
+      } else {
+        fprintf (fp, "-%llu", (unsigned long long int) (magnitude + 1));
+      }
+      break;
+
+    case ECBOR_TYPE_FP32:
+      print_diag_float (fp, item.value.fp32, 1);
+      break;
+
+    case ECBOR_TYPE_FP64:
+      print_diag_float (fp, item.value.fp64, 0);
+      break;
+
+    case ECBOR_TYPE_BOOL:
+      fputs ((item.value.uinteger ? "true" : "false"), fp);
+      break;
+
+    case ECBOR_TYPE_NULL:
+      fputs ("null", fp);
+      break;
+
+    case ECBOR_TYPE_UNDEFINED:
+      fputs ("undefined", fp);
+      break;
+
+    default:
+      return ECBOR_ERR_INVALID_TYPE;
+  }
+
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+flush_to_file (void *user_data, const uint8_t *data, size_t size)
+{
+  FILE *fp = (FILE *) user_data;
+
+  if (fwrite (data, 1, size, fp) != size) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+emit (output_t *output, const uint8_t *data, size_t size)
+{
+  ecbor_decode_context_t context;
+  ecbor_error_t rc;
+
+  output->matches ++;
+  if (output->count_only) {
+    return ECBOR_OK;
+  }
+
+  rc = ecbor_initialize_decode_streamed (&context, data, size);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  if (output->json) {
+    return ecbor_json_transcode (&output->json_context, &context);
+  }
+  rc = print_diag (output->fp, &context);
+  putc ('\n', output->fp);
+  return rc;
+}
+
+static output_t *
+open_output (FILE *fp, int json, int count_only)
+{
+  output_t *output = (output_t *) malloc (sizeof (output_t));
+
+  if (!output) {
+    return NULL;
+  }
+  output->fp = fp;
+  output->json = json;
+  output->count_only = count_only;
+  output->matches = 0;
+  if (json
+      && (ecbor_initialize_json (&output->json_context, output->json_buffer,
+                                 sizeof (output->json_buffer)) != ECBOR_OK
+          || ecbor_set_json_flush_callback (&output->json_context,
+                                            flush_to_file, fp) != ECBOR_OK)) {
+    free (output);
+    return NULL;
+  }
+  return output;
+}
+
+/* Write out pending JSON and count the matches in <total> */
+static void
+close_output (output_t *output, uint64_t *total)
+{
+  size_t pending;
+
+  if (output->json && ecbor_get_json_size (&output->json_context,
+                                           &pending) == ECBOR_OK
+      && pending > 0) {
+    ecbor_json_flush (&output->json_context);
+  }
+  (*total) += output->matches;
+  free (output);
+}
+
+/*
+ * Query all records of a range
+ */
+static void *
+query_job (void *data)
+{
+  query_job_t *job = (query_job_t *) data;
+  ecbor_decode_context_t context;
+  ecbor_item_t record;
+  const uint8_t *start;
+
+  job->rc = ecbor_initialize_decode (&context, job->data + job->begin,
+                                     job->end - job->begin);
+  while (job->rc == ECBOR_OK) {
+    start = context.in_position;
+    job->rc = ecbor_decode (&context, &record);
+    if (job->rc == ECBOR_END_OF_BUFFER) {
+      job->rc = ECBOR_OK;
+      break;
+    } else if (job->rc == ECBOR_END_OF_INDEFINITE) {
+      job->rc = ECBOR_ERR_INVALID_STOP_CODE;
+    }
+    if (job->rc == ECBOR_OK) {
+      job->rc = match (job->query, job->output, start, record.size, 0);
+    }
+    job->error_offset = (size_t) (start - job->data);
+  }
+  return NULL;
+}
+
+static void
+print_error (const char *filename, ecbor_error_t rc, size_t offset)
+{
+  fflush (stdout);
+  fprintf (stderr, "%s: ECBOR error %d in record at offset %zu\n", filename,
+           rc, offset);
+}
+
+static int
+copy_to_stdout (FILE *fp)
+{
+  char buffer[1 << 16];
+  size_t n;
+
+  fflush (fp);
+  rewind (fp);
+  while ((n = fread (buffer, 1, sizeof (buffer), fp)) > 0) {
+    fwrite (buffer, 1, n, stdout);
+  }
+  return (ferror (fp) ? -1 : 0);
+}
+
+/*
+ * Query a mapped file with <threads> threads, split at record boundaries
+ * found through a sidecar index; matches are printed in file order
+ */
+static int
+query_parallel (const query_t *query, const char *filename,
+                const char *index_path, unsigned int threads, int json,
+                int count_only, uint64_t *total)
+{
+  char temp_path[] = "/tmp/ecbor_query_XXXXXX";
+  ecbor_index_options_t options = { SPLIT_STRIDE, NULL, 0, threads };
+  ecbor_index_t index;
+  query_job_t *jobs;
+  pthread_t *workers;
+  uint64_t block;
+  size_t i, started;
+  ecbor_error_t rc;
+  FILE *fp;
+  int fd, status = 0;
+
+  if (!index_path) {
+    fd = mkstemp (temp_path);
+    if (fd < 0) {
+      perror ("mkstemp");
+      return -1;
+    }
+    close (fd);
+    index_path = temp_path;
+    rc = ecbor_index_build (filename, index_path, &options);
+  } else {
+    rc = ecbor_index_update (filename, index_path, &options);
+  }
+  if (rc == ECBOR_OK) {
+    rc = ecbor_index_open (&index, filename, index_path);
+  }
+  if (index_path == temp_path) {
+    unlink (temp_path);
+  }
+  if (rc != ECBOR_OK) {
+    /* e.g. malformed data; a single pass reports where */
+    return 1;
+  }
+
+  jobs = (query_job_t *) calloc (threads + 1, sizeof (query_job_t));
+  workers = (pthread_t *) calloc (threads, sizeof (pthread_t));
+  if (!jobs || !workers) {
+    free (jobs);
+    free (workers);
+    ecbor_index_close (&index);
+    return -1;
+  }
+
+  /* even shares of index blocks; the last job takes what was not indexed,
+     and writes straight to the output, after all others */
+  for (i = 0; i <= threads; i ++) {
+    jobs[i].query = query;
+    jobs[i].data = index.data_map.data;
+    block = index.block_count * i / threads;
+    if (i < threads && block < index.block_count) {
+      ecbor_index_get_block (&index, block, NULL, &jobs[i].begin, NULL, NULL);
+    } else {
+      jobs[i].begin = index.indexed_size;
+    }
+    jobs[i].output = open_output ((i < threads ? tmpfile () : stdout), json,
+                                  count_only);
+    if (!jobs[i].output || !jobs[i].output->fp) {
+      status = -1;
+    }
+  }
+  jobs[threads].end = index.data_map.size;
+  for (i = 0; i < threads; i ++) {
+    jobs[i].end = jobs[i + 1].begin;
+  }
+
+  if (status == 0) {
+    for (started = 0; started < threads; started ++) {
+      if (pthread_create (&workers[started], NULL, query_job,
+                          &jobs[started]) != 0) {
+        break;
+      }
+    }
+    for (i = 0; i < started; i ++) {
+      pthread_join (workers[i], NULL);
+    }
+    /* the rest, if threads ran out */
+    for (i = started; i < threads; i ++) {
+      query_job (&jobs[i]);
+    }
+
+    /* matches up to the first failing range, as a single pass would print */
+    for (i = 0; i < threads && status == 0; i ++) {
+      fp = jobs[i].output->fp;
+      close_output (jobs[i].output, total);
+      jobs[i].output = NULL;
+      if (copy_to_stdout (fp) != 0) {
+        perror ("tmpfile");
+        status = -1;
+      } else if (jobs[i].rc != ECBOR_OK) {
+        print_error (filename, jobs[i].rc, jobs[i].error_offset);
+        status = -1;
+      }
+      fclose (fp);
+    }
+    if (status == 0) {
+      query_job (&jobs[threads]);
+      close_output (jobs[threads].output, total);
+      jobs[threads].output = NULL;
+      if (jobs[threads].rc != ECBOR_OK) {
+        print_error (filename, jobs[threads].rc, jobs[threads].error_offset);
+        status = -1;
+      }
+    }
+  }
+
+  for (i = 0; i <= threads; i ++) {
+    if (jobs[i].output) {
+      if (jobs[i].output->fp && jobs[i].output->fp != stdout) {
+        fclose (jobs[i].output->fp);
+      }
+      free (jobs[i].output);
+    }
+  }
+  free (jobs);
+  free (workers);
+  ecbor_index_close (&index);
+  return status;
+}
+
+/*
+ * Query a file in one pass, mapped if possible and read in item-aligned
+ * windows otherwise
+ */
+static int
+query_single (const query_t *query, const char *filename, int json,
+              int count_only, uint64_t *total)
+{
+  ecbor_file_map_t map;
+  ecbor_reader_t *reader;
+  query_job_t job;
+  const uint8_t *window;
+  size_t size, offset = 0;
+  ecbor_error_t rc;
+  int fd, status = 0;
+
+  memset (&job, 0, sizeof (job));
+  job.query = query;
+  job.output = open_output (stdout, json, count_only);
+  if (!job.output) {
+    return -1;
+  }
+
+  if (strcmp (filename, "-")) {
+    rc = ecbor_map_file (&map, filename, ECBOR_MAP_SEQUENTIAL);
+    if (rc == ECBOR_OK) {
+      job.data = map.data;
+      job.end = map.size;
+      query_job (&job);
+      close_output (job.output, total);
+      if (job.rc != ECBOR_OK) {
+        print_error (filename, job.rc, job.error_offset);
+        status = -1;
+      }
+      ecbor_unmap_file (&map);
+      return status;
+    } else if (rc != ECBOR_ERR_CURRENTLY_NOT_SUPPORTED) {
+      fprintf (stderr, "%s: error mapping file\n", filename);
+      close_output (job.output, total);
+      return -1;
+    }
+    /* otherwise not a regular file, read it instead */
+  }
+
+  fd = (strcmp (filename, "-") ? open (filename, O_RDONLY) : STDIN_FILENO);
+  if (fd < 0) {
+    fprintf (stderr, "%s: error opening file\n", filename);
+    close_output (job.output, total);
+    return -1;
+  }
+  rc = ecbor_reader_open (&reader, fd, READER_BLOCK_SIZE, READER_DEPTH, 0);
+  if (rc != ECBOR_OK) {
+    fprintf (stderr, "%s: ECBOR error %d reading input\n", filename, rc);
+    reader = NULL;
+    status = -1;
+  }
+  while (reader && status == 0) {
+    rc = ecbor_reader_next (reader, &window, &size);
+    if (rc == ECBOR_END_OF_BUFFER) {
+      break;
+    } else if (rc != ECBOR_OK) {
+      fprintf (stderr, "%s: ECBOR error %d reading input\n", filename, rc);
+      status = -1;
+      break;
+    }
+
+    job.data = window;
+    job.begin = 0;
+    job.end = size;
+    query_job (&job);
+    if (job.rc != ECBOR_OK) {
+      print_error (filename, job.rc, offset + job.error_offset);
+      status = -1;
+    }
+    offset += size;
+  }
+  if (reader) {
+    ecbor_reader_close (reader);
+  }
+  if (fd != STDIN_FILENO) {
+    close (fd);
+  }
+  close_output (job.output, total);
+  return status;
+}
+
+/*
+ * Program entry
+ */
+int
+main (int argc, char **argv)
+{
+  static query_t query;
+  const char *index_path = NULL;
+  unsigned int threads = 1;
+  uint64_t total = 0;
+  int json = 0, count_only = 0, i, rc, status = 0;
+  long cpus, error;
+
+  /* parse arguments */
+  while (1) {
+    int option_index, c;
+
+    c = getopt_long (argc, argv, "Jcj:i:h", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'J':
+        json = 1;
+        break;
+
+      case 'c':
+        count_only = 1;
+        break;
+
+      case 'j':
+        threads = (unsigned int) strtoul (optarg, NULL, 10);
+        if (threads == 0) {
+          cpus = sysconf (_SC_NPROCESSORS_ONLN);
+          threads = (unsigned int) (cpus > 0 ? cpus : 1);
+        }
+        break;
+
+      case 'i':
+        index_path = optarg;
+        break;
+
+      default:
+        print_help ();
+        return 0;
+    }
+  }
+
+  if (optind == argc) {
+    fprintf (stderr, "Expecting an expression!\n");
+    print_help ();
+    return -1;
+  }
+  error = parse_query (&query, argv[optind]);
+  if (error >= 0) {
+    fprintf (stderr, "Invalid expression at offset %ld: %s\n", error,
+             argv[optind]);
+    return -1;
+  }
+  optind ++;
+  if (index_path && argc - optind != 1) {
+    fprintf (stderr, "An index can only be kept for a single file!\n");
+    return -1;
+  }
+
+  setvbuf (stdout, output_buffer, _IOFBF, sizeof (output_buffer));
+
+  for (i = optind; i < argc || i == optind; i ++) {
+    const char *filename = (i < argc ? argv[i] : "-");
+
+    rc = 1;
+    if (threads > 1 && strcmp (filename, "-")) {
+      rc = query_parallel (&query, filename, index_path, threads, json,
+                           count_only, &total);
+    }
+    if (rc > 0) {
+      /* one thread, or the file could not be split */
+      rc = query_single (&query, filename, json, count_only, &total);
+    }
+    if (rc != 0) {
+      status = -1;
+      break;
+    }
+  }
+
+  if (count_only) {
+    printf ("%llu\n", (unsigned long long int) total);
+  }
+  fflush (stdout);
+  free (query.text);
+  return status;
+}
@@ -0,0 +1,803 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ecbor.h>
+#include <ecbor_io.h>
+
+/*
+ * Command line arguments
+ */
+static struct option long_options[] = {
+  { "threads", required_argument, 0, 'j' },
+  { "index",   required_argument, 0, 'i' },
+  { "tags",    required_argument, 0, 'n' },
+  { "help",    no_argument,       0, 'h' },
+  { 0, 0, 0, 0 }
+};
+
+/* Head widths: immediate, 1, 2, 4 and 8 byte arguments, indefinite */
+#define WIDTH_CLASSES 6
+
+/* String lengths below LENGTH_EXACT are counted exactly, longer ones in
+   LENGTH_STEPS buckets per power of two */
+#define LENGTH_EXACT 64
+#define LENGTH_STEPS 8
+#define LENGTH_BUCKETS (LENGTH_EXACT + (64 - 6) * LENGTH_STEPS)
+
+/* Records per sidecar index entry, when splitting files across threads */
+#define SPLIT_STRIDE 256
+
+/* Refill window for input that cannot be mapped */
+#define REFILL_WINDOW_SIZE (1 << 20)
+static uint8_t refill_window[REFILL_WINDOW_SIZE];
+
+static const char *type_names[ECBOR_TYPE_LAST + 1] = {
+  "uint", "nint", "bstr", "str", "array", "map", "tag", NULL,
+  "stop code", "fp16", "fp32", "fp64", "bool", "null", "undefined", NULL
+};
+
+static const char *major_names[8] = {
+  "uint", "nint", "bstr", "str", "array", "map", "tag", "simple/float"
+};
+
+typedef struct {
+  uint64_t tag;
+  uint64_t count;
+} tag_count_t;
+
+/*
+ * Statistics of a part of the input; merged at the end
+ */
+typedef struct {
+  /* items and encoded bytes per type (containers and tags count their head
+     only) */
+  uint64_t items[ECBOR_TYPE_LAST + 1];
+  uint64_t bytes[ECBOR_TYPE_LAST + 1];
+
+  /* head widths per major type */
+  uint64_t widths[8][WIDTH_CLASSES];
+
+  /* string lengths, for bstr [0] and str [1] */
+  uint64_t lengths[2][LENGTH_BUCKETS];
+  uint64_t length_total[2];
+  uint64_t length_max[2];
+
+  /* indefinite items per type, and chunks of indefinite strings */
+  uint64_t indefinite[ECBOR_TYPE_MAP + 1];
+  uint64_t chunks;
+
+  /* top level items, sum of item depths and of record depths */
+  uint64_t records;
+  uint64_t depth_total;
+  uint64_t record_depth_total;
+  size_t max_depth;
+
+  /* tag frequencies, open addressing on the tag value */
+  tag_count_t *tags;
+  size_t tag_capacity;
+  size_t tag_count;
+} stats_t;
+
+/*
+ * Open container while scanning
+ */
+typedef struct {
+  ecbor_type_t type;
+  uint8_t is_indefinite;
+
+  /* children left, for definite containers, and children seen */
+  uint64_t remaining;
+  uint64_t count;
+} scan_frame_t;
+
+/*
+ * Range of a mapped file scanned by a thread
+ */
+typedef struct {
+  const uint8_t *data;
+  size_t begin, end;
+  stats_t stats;
+  ecbor_error_t rc;
+  size_t error_offset;
+} scan_job_t;
+
+void
+print_help (void);
+
+/*
+ * Print help
+ */
+void
+print_help (void)
+{
+  printf ("Usage: ecbor-stat [options] <filename>...\n");
+  printf ("  options:\n");
+  printf ("  -j, --threads <n>  Scan each file with <n> threads (0 for one per CPU)\n");
+  printf ("  -i, --index <path> Keep the sidecar index used to split the file across\n");
+  printf ("                     threads at <path>, updating it incrementally\n");
+  printf ("  -n, --tags <n>     Number of most frequent tags listed (default 20)\n");
+  printf ("  -h, --help         Display this help message\n");
+  printf ("  <filename> may be - for standard input, which is scanned by one thread\n");
+}
+
+static size_t
+tag_slot (const stats_t *stats, uint64_t tag)
+{
+  size_t i = (size_t) ((tag * 0x9e3779b97f4a7c15ull) >> 32)
+             & (stats->tag_capacity - 1);
+
+  while (stats->tags[i].count && stats->tags[i].tag != tag) {
+    i = (i + 1) & (stats->tag_capacity - 1);
+  }
+  return i;
+}
+
+/* Add <count> occurrences of <tag> */
+static int
+count_tag (stats_t *stats, uint64_t tag, uint64_t count)
+{
+  tag_count_t *old = stats->tags;
+  size_t old_capacity = stats->tag_capacity, i;
+
+  if ((stats->tag_count + 1) * 2 > stats->tag_capacity) {
+    /* grow, keeping the load below one half */
+    stats->tag_capacity = (old_capacity ? old_capacity * 2 : 64);
+    stats->tags = (tag_count_t *) calloc (stats->tag_capacity,
+                                          sizeof (tag_count_t));
+    if (!stats->tags) {
+      return -1;
+    }
+    for (i = 0; i < old_capacity; i ++) {
+      if (old[i].count) {
+        stats->tags[tag_slot (stats, old[i].tag)] = old[i];
+      }
+    }
+    free (old);
+  }
+
+  i = tag_slot (stats, tag);
+  if (!stats->tags[i].count) {
+    stats->tags[i].tag = tag;
+    stats->tag_count ++;
+  }
+  stats->tags[i].count += count;
+  return 0;
+}
+
+static size_t
+length_bucket (uint64_t length)
+{
+  int e;
+
+  if (length < LENGTH_EXACT) {
+    return (size_t) length;
+  }
+  e = 63 - __builtin_clzll (length);
+  return LENGTH_EXACT + (size_t) (e - 6) * LENGTH_STEPS
+         + (size_t) ((length >> (e - 3)) & (LENGTH_STEPS - 1));
+}
+
+/* Largest length falling in <bucket> */
+static uint64_t
+length_bucket_bound (size_t bucket)
+{
+  size_t e, step;
+
+  if (bucket < LENGTH_EXACT) {
+    return bucket;
+  }
+  e = (bucket - LENGTH_EXACT) / LENGTH_STEPS + 6;
+  step = (bucket - LENGTH_EXACT) % LENGTH_STEPS;
+  return ((uint64_t) (LENGTH_STEPS + step + 1) << (e - 3)) - 1;
+}
+
+/* Width class of an argument of <length>, in preferred serialization */
+static int
+width_class_of (uint64_t value)
+{
+  return (value < 24 ? 0 : value <= 0xff ? 1 : value <= 0xffff ? 2
+          : value <= 0xffffffffull ? 3 : 4);
+}
+
+/* Width class of the head starting with <initial> */
+static int
+width_class (uint8_t initial)
+{
+  uint8_t additional = initial & 0x1f;
+  return (additional < 24 ? 0 : additional == 31 ? 5 : additional - 23);
+}
+
+/*
+ * Count all items of a streamed decode context, up to its end
+ */
+static ecbor_error_t
+scan (ecbor_decode_context_t *context, stats_t *stats)
+{
+  static __thread scan_frame_t stack[ECBOR_MAX_NESTING_DEPTH];
+  scan_frame_t *frame;
+  size_t depth = 0, record_depth = 0;
+  ecbor_item_t item;
+  ecbor_error_t rc;
+  uint8_t initial;
+  int is_text;
+
+  while (1) {
+    rc = ecbor_decode (context, &item);
+
+    frame = (depth > 0 ? &stack[depth - 1] : NULL);
+    if (rc == ECBOR_END_OF_INDEFINITE) {
+      if (!frame || !frame->is_indefinite
+          || (frame->type == ECBOR_TYPE_MAP && frame->count % 2)) {
+        return ECBOR_ERR_INVALID_STOP_CODE;
+      }
+      stats->items[ECBOR_TYPE_STOP_CODE] ++;
+      stats->bytes[ECBOR_TYPE_STOP_CODE] ++;
+      depth --;
+    } else if (rc == ECBOR_END_OF_BUFFER) {
+      return (depth > 0 ? ECBOR_ERR_INVALID_END_OF_BUFFER : ECBOR_OK);
+    } else if (rc != ECBOR_OK) {
+      return rc;
+    } else {
+      stats->items[item.type] ++;
+      stats->bytes[item.type] += item.size;
+      stats->depth_total += depth + 1;
+      if (depth + 1 > record_depth) {
+        record_depth = depth + 1;
+      }
+
+      if ((item.type == ECBOR_TYPE_STR || item.type == ECBOR_TYPE_BSTR)
+          && !item.value.string.str && item.length > 0) {
+        /* payload went to a sink, and the head is gone with the window */
+        stats->widths[item.type][width_class_of (item.length)] ++;
+      } else {
+        initial = *(context->in_position - item.size);
+        stats->widths[initial >> 5][width_class (initial)] ++;
+      }
+
+      switch (item.type) {
+        case ECBOR_TYPE_STR:
+        case ECBOR_TYPE_BSTR:
+          is_text = (item.type == ECBOR_TYPE_STR);
+          stats->lengths[is_text][length_bucket (item.length)] ++;
+          stats->length_total[is_text] += item.length;
+          if (item.length > stats->length_max[is_text]) {
+            stats->length_max[is_text] = item.length;
+          }
+          if (item.is_indefinite) {
+            stats->indefinite[item.type] ++;
+            stats->chunks += item.value.string.n_chunks;
+          }
+          break;
+
+        case ECBOR_TYPE_ARRAY:
+        case ECBOR_TYPE_MAP:
+        case ECBOR_TYPE_TAG:
+          if (item.type == ECBOR_TYPE_TAG) {
+            if (count_tag (stats, item.value.tag.tag_value, 1) != 0) {
+              return ECBOR_ERR_SYSTEM;
+            }
+          } else if (item.is_indefinite) {
+            stats->indefinite[item.type] ++;
+          } else if (item.length == 0) {
+            break;
+          }
+
+          if (depth == ECBOR_MAX_NESTING_DEPTH) {
+            return ECBOR_ERR_NESTING_TOO_DEEP;
+          }
+          frame = &stack[depth ++];
+          frame->type = item.type;
+          frame->is_indefinite = item.is_indefinite;
+          frame->remaining = (item.type == ECBOR_TYPE_TAG ? 1 : item.length);
+          frame->count = 0;
+          continue;
+
+        default:
+          break;
+      }
+    }
+
+    /* item complete; close the containers it completes */
+    while (depth > 0) {
+      frame = &stack[depth - 1];
+      frame->count ++;
+      if (frame->is_indefinite || -- frame->remaining > 0) {
+        break;
+      }
+      depth --;
+    }
+    if (depth == 0) {
+      stats->records ++;
+      stats->record_depth_total += record_depth;
+      if (record_depth > stats->max_depth) {
+        stats->max_depth = record_depth;
+      }
+      record_depth = 0;
+    }
+  }
+}
+
+static int
+merge_stats (stats_t *total, const stats_t *part)
+{
+  size_t i, j;
+
+  for (i = 0; i <= ECBOR_TYPE_LAST; i ++) {
+    total->items[i] += part->items[i];
+    total->bytes[i] += part->bytes[i];
+  }
+  for (i = 0; i < 8; i ++) {
+    for (j = 0; j < WIDTH_CLASSES; j ++) {
+      total->widths[i][j] += part->widths[i][j];
+    }
+  }
+  for (i = 0; i < 2; i ++) {
+    for (j = 0; j < LENGTH_BUCKETS; j ++) {
+      total->lengths[i][j] += part->lengths[i][j];
+    }
+    total->length_total[i] += part->length_total[i];
+    if (part->length_max[i] > total->length_max[i]) {
+      total->length_max[i] = part->length_max[i];
+    }
+  }
+  for (i = 0; i <= ECBOR_TYPE_MAP; i ++) {
+    total->indefinite[i] += part->indefinite[i];
+  }
+  total->chunks += part->chunks;
+  total->records += part->records;
+  total->depth_total += part->depth_total;
+  total->record_depth_total += part->record_depth_total;
+  if (part->max_depth > total->max_depth) {
+    total->max_depth = part->max_depth;
+  }
+
+  for (i = 0; i < part->tag_capacity; i ++) {
+    if (part->tags[i].count
+        && count_tag (total, part->tags[i].tag, part->tags[i].count) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void *
+scan_job (void *data)
+{
+  scan_job_t *job = (scan_job_t *) data;
+  ecbor_decode_context_t context;
+
+  job->rc = ecbor_initialize_decode_streamed (&context, job->data + job->begin,
+                                              job->end - job->begin);
+  if (job->rc == ECBOR_OK) {
+    job->rc = scan (&context, &job->stats);
+  }
+  job->error_offset = job->begin
+                      + (size_t) (context.in_position
+                                  - (job->data + job->begin));
+  return NULL;
+}
+
+static void
+print_error (const char *filename, ecbor_error_t rc, size_t offset)
+{
+  fprintf (stderr, "%s: ECBOR error %d near offset %zu\n", filename, rc,
+           offset);
+}
+
+/*
+ * Scan a mapped file with <threads> threads, split at record boundaries
+ * found through a sidecar index
+ */
+static int
+scan_parallel (const char *filename, const char *index_path,
+               unsigned int threads, stats_t *total)
+{
+  char temp_path[] = "/tmp/ecbor_stat_XXXXXX";
+  ecbor_index_options_t options = { SPLIT_STRIDE, NULL, 0, threads };
+  ecbor_index_t index;
+  scan_job_t *jobs;
+  pthread_t *workers;
+  uint64_t block;
+  size_t i, started;
+  ecbor_error_t rc;
+  int fd, status = 0;
+
+  if (!index_path) {
+    fd = mkstemp (temp_path);
+    if (fd < 0) {
+      perror ("mkstemp");
+      return -1;
+    }
+    close (fd);
+    index_path = temp_path;
+    rc = ecbor_index_build (filename, index_path, &options);
+  } else {
+    rc = ecbor_index_update (filename, index_path, &options);
+  }
+  if (rc == ECBOR_OK) {
+    rc = ecbor_index_open (&index, filename, index_path);
+  }
+  if (index_path == temp_path) {
+    unlink (temp_path);
+  }
+  if (rc != ECBOR_OK) {
+    /* e.g. malformed data; a single pass reports where */
+    return 1;
+  }
+
+  jobs = (scan_job_t *) calloc (threads + 1, sizeof (scan_job_t));
+  workers = (pthread_t *) calloc (threads, sizeof (pthread_t));
+  if (!jobs || !workers) {
+    free (jobs);
+    free (workers);
+    ecbor_index_close (&index);
+    return -1;
+  }
+
+  /* even shares of index blocks; the last job takes what was not indexed */
+  for (i = 0; i < threads; i ++) {
+    block = index.block_count * i / threads;
+    jobs[i].data = index.data_map.data;
+    if (block < index.block_count) {
+      ecbor_index_get_block (&index, block, NULL, &jobs[i].begin, NULL, NULL);
+    } else {
+      jobs[i].begin = index.indexed_size;
+    }
+  }
+  jobs[threads].data = index.data_map.data;
+  jobs[threads].begin = index.indexed_size;
+  jobs[threads].end = index.data_map.size;
+  for (i = 0; i < threads; i ++) {
+    jobs[i].end = jobs[i + 1].begin;
+  }
+
+  for (started = 0; started < threads; started ++) {
+    if (pthread_create (&workers[started], NULL, scan_job,
+                        &jobs[started]) != 0) {
+      break;
+    }
+  }
+  for (i = 0; i < started; i ++) {
+    pthread_join (workers[i], NULL);
+  }
+  /* the rest, if threads ran out */
+  for (i = started; i <= threads; i ++) {
+    scan_job (&jobs[i]);
+  }
+
+  for (i = 0; i <= threads; i ++) {
+    if (jobs[i].rc != ECBOR_OK && status == 0) {
+      print_error (filename, jobs[i].rc, jobs[i].error_offset);
+      status = -1;
+    }
+    if (merge_stats (total, &jobs[i].stats) != 0) {
+      status = -1;
+    }
+    free (jobs[i].stats.tags);
+  }
+
+  free (jobs);
+  free (workers);
+  ecbor_index_close (&index);
+  return status;
+}
+
+/*
+ * Refill callback reading from a stream
+ */
+static ecbor_error_t
+refill_from_file (void *user_data, uint8_t *buffer, size_t size,
+                  size_t *filled)
+{
+  FILE *fp = (FILE *) user_data;
+
+  (*filled) = fread (buffer, 1, size, fp);
+  if ((*filled) == 0 && ferror (fp)) {
+    return ECBOR_ERR_SYSTEM;
+  }
+  return ECBOR_OK;
+}
+
+/* Payloads larger than the window are only counted */
+static ecbor_error_t
+discard_payload (void *user_data, const ecbor_item_t *item,
+                 const uint8_t *data, size_t size)
+{
+  (void) user_data;
+  (void) item;
+  (void) data;
+  (void) size;
+  return ECBOR_OK;
+}
+
+/*
+ * Scan a file in one pass, mapped if possible and refilled otherwise
+ */
+static int
+scan_single (const char *filename, stats_t *total)
+{
+  ecbor_decode_context_t context;
+  ecbor_file_map_t map;
+  scan_job_t job;
+  FILE *fp;
+  ecbor_error_t rc;
+  int status = 0;
+
+  if (strcmp (filename, "-")) {
+    rc = ecbor_map_file (&map, filename, ECBOR_MAP_SEQUENTIAL);
+    if (rc == ECBOR_OK) {
+      memset (&job, 0, sizeof (job));
+      job.data = map.data;
+      job.end = map.size;
+      scan_job (&job);
+      if (job.rc != ECBOR_OK) {
+        print_error (filename, job.rc, job.error_offset);
+        status = -1;
+      }
+      if (merge_stats (total, &job.stats) != 0) {
+        status = -1;
+      }
+      free (job.stats.tags);
+      ecbor_unmap_file (&map);
+      return status;
+    } else if (rc != ECBOR_ERR_CURRENTLY_NOT_SUPPORTED) {
+      fprintf (stderr, "%s: error mapping file\n", filename);
+      return -1;
+    }
+    /* otherwise not a regular file, read it instead */
+  }
+
+  fp = (strcmp (filename, "-") ? fopen (filename, "rb") : stdin);
+  if (!fp) {
+    fprintf (stderr, "%s: error opening file\n", filename);
+    return -1;
+  }
+  rc = ecbor_initialize_decode_streamed (&context, refill_window, 0);
+  if (rc == ECBOR_OK) {
+    rc = ecbor_set_refill_callback (&context, refill_window,
+                                    sizeof (refill_window), refill_from_file,
+                                    fp);
+  }
+  if (rc == ECBOR_OK) {
+    rc = ecbor_set_payload_sink (&context, discard_payload, NULL);
+  }
+  if (rc == ECBOR_OK) {
+    rc = scan (&context, total);
+  }
+  if (rc != ECBOR_OK) {
+    /* offsets are not known past the window */
+    fprintf (stderr, "%s: ECBOR error %d\n", filename, rc);
+    status = -1;
+  }
+  if (fp != stdin) {
+    fclose (fp);
+  }
+  return status;
+}
+
+static int
+compare_tags (const void *a, const void *b)
+{
+  const tag_count_t *ta = (const tag_count_t *) a;
+  const tag_count_t *tb = (const tag_count_t *) b;
+
+  if (ta->count != tb->count) {
+    return (ta->count < tb->count ? 1 : -1);
+  }
+  return (ta->tag > tb->tag) - (ta->tag < tb->tag);
+}
+
+/* Smallest bucket bound below which at least <fraction> of lengths fall */
+static uint64_t
+length_percentile (const stats_t *stats, int is_text, uint64_t count,
+                   double fraction)
+{
+  uint64_t seen = 0, target = (uint64_t) ((double) count * fraction);
+  size_t i;
+
+  if (target == 0) {
+    target = 1;
+  }
+  for (i = 0; i < LENGTH_BUCKETS; i ++) {
+    seen += stats->lengths[is_text][i];
+    if (seen >= target) {
+      break;
+    }
+  }
+  return (i == LENGTH_BUCKETS || length_bucket_bound (i)
+                                   > stats->length_max[is_text]
+          ? stats->length_max[is_text] : length_bucket_bound (i));
+}
+
+static void
+print_stats (const stats_t *stats, size_t top_tags)
+{
+  static const char *width_names[WIDTH_CLASSES] = {
+    "immediate", "1 byte", "2 bytes", "4 bytes", "8 bytes", "indefinite"
+  };
+  uint64_t items = 0, bytes = 0, count;
+  tag_count_t *tags;
+  size_t i, j;
+  int t;
+
+  for (i = 0; i <= ECBOR_TYPE_LAST; i ++) {
+    items += stats->items[i];
+    bytes += stats->bytes[i];
+  }
+
+  printf ("records     %llu\n", (unsigned long long int) stats->records);
+  printf ("items       %llu\n", (unsigned long long int) items);
+  printf ("bytes       %llu\n", (unsigned long long int) bytes);
+  printf ("depth       max %zu, mean per item %.2f, mean per record %.2f\n",
+          stats->max_depth,
+          (items ? (double) stats->depth_total / (double) items : 0.0),
+          (stats->records ? (double) stats->record_depth_total
+                            / (double) stats->records : 0.0));
+
+  printf ("\n%-12s %14s %8s %16s %8s\n", "type", "items", "%", "bytes", "%");
+  for (i = 0; i <= ECBOR_TYPE_LAST; i ++) {
+    if (!type_names[i] || !stats->items[i]) {
+      continue;
+    }
+    printf ("%-12s %14llu %7.2f%% %16llu %7.2f%%\n", type_names[i],
+            (unsigned long long int) stats->items[i],
+            100.0 * (double) stats->items[i] / (double) items,
+            (unsigned long long int) stats->bytes[i],
+            100.0 * (double) stats->bytes[i] / (double) bytes);
+  }
+
+  printf ("\n%-12s", "head width");
+  for (j = 0; j < WIDTH_CLASSES; j ++) {
+    printf (" %12s", width_names[j]);
+  }
+  putchar ('\n');
+  for (i = 0; i < 8; i ++) {
+    for (j = 0, count = 0; j < WIDTH_CLASSES; j ++) {
+      count += stats->widths[i][j];
+    }
+    if (!count) {
+      continue;
+    }
+    printf ("%-12s", major_names[i]);
+    for (j = 0; j < WIDTH_CLASSES; j ++) {
+      printf (" %12llu", (unsigned long long int) stats->widths[i][j]);
+    }
+    putchar ('\n');
+  }
+
+  printf ("\n%-12s %14s %10s %10s %10s %10s %10s %12s\n", "length",
+          "strings", "mean", "p50", "p90", "p99", "p99.9", "max");
+  for (t = 1; t >= 0; t --) {
+    count = stats->items[t ? ECBOR_TYPE_STR : ECBOR_TYPE_BSTR];
+    if (!count) {
+      continue;
+    }
+    printf ("%-12s %14llu %10.1f %10llu %10llu %10llu %10llu %12llu\n",
+            (t ? "str" : "bstr"), (unsigned long long int) count,
+            (double) stats->length_total[t] / (double) count,
+            (unsigned long long int) length_percentile (stats, t, count, 0.5),
+            (unsigned long long int) length_percentile (stats, t, count, 0.9),
+            (unsigned long long int) length_percentile (stats, t, count, 0.99),
+            (unsigned long long int) length_percentile (stats, t, count,
+                                                        0.999),
+            (unsigned long long int) stats->length_max[t]);
+  }
+
+  printf ("\nindefinite  bstr %llu, str %llu (%llu chunks), array %llu, "
+          "map %llu\n",
+          (unsigned long long int) stats->indefinite[ECBOR_TYPE_BSTR],
+          (unsigned long long int) stats->indefinite[ECBOR_TYPE_STR],
+          (unsigned long long int) stats->chunks,
+          (unsigned long long int) stats->indefinite[ECBOR_TYPE_ARRAY],
+          (unsigned long long int) stats->indefinite[ECBOR_TYPE_MAP]);
+
+  if (stats->tag_count == 0 || top_tags == 0) {
+    return;
+  }
+  tags = (tag_count_t *) malloc (stats->tag_count * sizeof (tag_count_t));
+  if (!tags) {
+    return;
+  }
+  for (i = 0, j = 0; i < stats->tag_capacity; i ++) {
+    if (stats->tags[i].count) {
+      tags[j ++] = stats->tags[i];
+    }
+  }
+  qsort (tags, j, sizeof (tag_count_t), compare_tags);
+  printf ("\n%-12s %14s %8s\n", "tag", "items", "%");
+  for (i = 0; i < j && i < top_tags; i ++) {
+    printf ("%-12llu %14llu %7.2f%%\n", (unsigned long long int) tags[i].tag,
+            (unsigned long long int) tags[i].count,
+            100.0 * (double) tags[i].count
+            / (double) stats->items[ECBOR_TYPE_TAG]);
+  }
+  if (j > top_tags) {
+    printf ("(%zu more)\n", j - top_tags);
+  }
+  free (tags);
+}
+
+/*
+ * Program entry
+ */
+int
+main (int argc, char **argv)
+{
+  static stats_t total;
+  const char *index_path = NULL;
+  unsigned int threads = 1;
+  size_t top_tags = 20;
+  long cpus;
+  int i, rc, status = 0;
+
+  /* parse arguments */
+  while (1) {
+    int option_index, c;
+
+    c = getopt_long (argc, argv, "j:i:n:h", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'j':
+        threads = (unsigned int) strtoul (optarg, NULL, 10);
+        if (threads == 0) {
+          cpus = sysconf (_SC_NPROCESSORS_ONLN);
+          threads = (unsigned int) (cpus > 0 ? cpus : 1);
+        }
+        break;
+
+      case 'i':
+        index_path = optarg;
+        break;
+
+      case 'n':
+        top_tags = (size_t) strtoul (optarg, NULL, 10);
+        break;
+
+      default:
+        print_help ();
+        return 0;
+    }
+  }
+
+  if (optind == argc) {
+    fprintf (stderr, "Expecting at least one file name!\n");
+    print_help ();
+    return -1;
+  }
+  if (index_path && argc - optind > 1) {
+    fprintf (stderr, "An index can only be kept for a single file!\n");
+    return -1;
+  }
+
+  for (i = optind; i < argc; i ++) {
+    rc = 1;
+    if (threads > 1 && strcmp (argv[i], "-")) {
+      rc = scan_parallel (argv[i], index_path, threads, &total);
+    }
+    if (rc > 0) {
+      /* one thread, or the file could not be split */
+      rc = scan_single (argv[i], &total);
+    }
+    if (rc != 0) {
+      status = -1;
+    }
+  }
+
+  print_stats (&total, top_tags);
+  return status;
+}
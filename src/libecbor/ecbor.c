@@ -8,118 +8,6 @@
 #include "ecbor.h"
 #include "ecbor_internal.h"
 
-uint16_t
-ecbor_uint16_from_big_endian (uint16_t value)
-{
-#if __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
-  return value;
-#elif __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
-  /* TODO: ARM optimization */
-  return ((value << 8) & 0xff00)
-       | ((value >> 8) & 0x00ff);
-#else
-  #error "Endianness not supported!"
-#endif
-}
-
-uint32_t
-ecbor_uint32_from_big_endian (uint32_t value)
-{
-#if __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
-  return value;
-#elif __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
-  /* TODO: ARM optimization */
-  return ((value <<  8) & 0x00ff0000)
-       | ((value >>  8) & 0x0000ff00)
-       | ((value << 24) & 0xff000000)
-       | ((value >> 24) & 0x000000ff);
-#else
-  #error "Endianness not supported!"
-#endif
-}
-
-uint64_t
-ecbor_uint64_from_big_endian (uint64_t value)
-{
-#if __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
-  return value;
-#elif __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
-  /* TODO: ARM optimization */
-  return ((value <<  8) & 0x000000ff00000000)
-       | ((value >>  8) & 0x00000000ff000000)
-       | ((value << 24) & 0x0000ff0000000000)
-       | ((value >> 24) & 0x0000000000ff0000)
-       | ((value << 40) & 0x00ff000000000000)
-       | ((value >> 40) & 0x000000000000ff00)
-       | ((value << 56) & 0xff00000000000000)
-       | ((value >> 56) & 0x00000000000000ff);
-#else
-  #error "Endianness not supported!"
-#endif
-}
-
-float
-ecbor_fp32_from_big_endian (float value)
-{
-#if __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
-  return value;
-#elif __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
-  /* while it looks like a lot of casts, we're doing this just so we follow
-     aliasing rules; the compiler will optimize */
-  uint8_t *base = (uint8_t *) &value;
-  uint32_t r = ecbor_uint32_from_big_endian(*((uint32_t *) base));
-  base = (uint8_t *) &r;
-  return *((float *) base);
-#else
-  #error "Endianness not supported!"
-#endif
-}
-
-double
-ecbor_fp64_from_big_endian (double value)
-{
-#if __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
-  return value;
-#elif __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
-  uint8_t *base = (uint8_t *) &value;
-  uint64_t r = ecbor_uint64_from_big_endian(*((uint64_t *) base));
-  base = (uint8_t *) &r;
-  return *((double *) base);
-#else
-  #error "Endianness not supported!"
-#endif
-}
-
-uint16_t
-ecbor_uint16_to_big_endian (uint16_t value)
-{
-  return ecbor_uint16_from_big_endian (value);
-}
-
-uint32_t
-ecbor_uint32_to_big_endian (uint32_t value)
-{
-  return ecbor_uint32_from_big_endian (value);
-}
-
-uint64_t
-ecbor_uint64_to_big_endian (uint64_t value)
-{
-  return ecbor_uint64_from_big_endian (value);
-}
-
-float
-ecbor_fp32_to_big_endian (float value)
-{
-  return ecbor_fp32_from_big_endian (value);
-}
-
-double
-ecbor_fp64_to_big_endian (double value)
-{
-  return ecbor_fp64_from_big_endian (value);
-}
-
 ecbor_type_t
 ecbor_get_type (ecbor_item_t *item)
 {
@@ -588,18 +476,40 @@ ecbor_get_bool (ecbor_item_t *item, uint8_t *value)
 void
 ecbor_memcpy (void *dest, void *src, size_t num)
 {
-  /* TODO: Replace with memcpy when platform supports */
-  /* TODO: Optimize */
-  while (num > 4) {
-    *((uint32_t *) dest) = *((uint32_t *) src);
-    num -= 4;
-    dest = ((uint32_t *)dest) + 1;
-    src = ((uint32_t *)src) + 1;
+  uint8_t *d = (uint8_t *) dest;
+  const uint8_t *s = (const uint8_t *) src;
+  uint64_t word;
+
+  /* fixed size builtin copies compile to single unaligned moves, without
+     pulling in the platform memcpy */
+  while (num >= sizeof (word)) {
+    __builtin_memcpy (&word, s, sizeof (word));
+    __builtin_memcpy (d, &word, sizeof (word));
+    num -= sizeof (word);
+    d += sizeof (word);
+    s += sizeof (word);
   }
   while (num) {
-    *((uint8_t *) dest) = *((uint8_t *) src);
+    *d ++ = *s ++;
     num --;
-    dest = ((uint8_t *)dest) + 1;
-    src = ((uint8_t *)src) + 1;
+  }
+}
+
+void
+ecbor_memmove (void *dest, const void *src, size_t num)
+{
+  uint8_t *d = (uint8_t *) dest;
+  const uint8_t *s = (const uint8_t *) src;
+
+  if (d < s) {
+    while (num) {
+      *(d ++) = *(s ++);
+      num --;
+    }
+  } else if (d > s) {
+    while (num) {
+      num --;
+      d[num] = s[num];
+    }
   }
 }
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "ecbor.h"
+#include "ecbor_internal.h"
+
+ecbor_error_t
+ecbor_initialize_arena (ecbor_arena_t *arena, uint8_t *buffer,
+                        size_t buffer_size)
+{
+  ECBOR_INTERNAL_CHECK_ARENA_PTR (arena);
+  if (!buffer && buffer_size > 0) {
+    return ECBOR_ERR_NULL_OUTPUT_BUFFER;
+  }
+
+  arena->base = buffer;
+  arena->base_size = buffer_size;
+  arena->current = NULL;
+  arena->blocks = NULL;
+  arena->position = buffer;
+  arena->bytes_left = buffer_size;
+  arena->alloc = NULL;
+  arena->release = NULL;
+  arena->alloc_data = NULL;
+  arena->block_size = 0;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_arena_allocator (ecbor_arena_t *arena, ecbor_block_alloc_t alloc,
+                           ecbor_block_release_t release, void *user_data,
+                           size_t block_size)
+{
+  ECBOR_INTERNAL_CHECK_ARENA_PTR (arena);
+  if (!alloc || !release) {
+    /* chained blocks are only ever given back through <release> */
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  arena->alloc = alloc;
+  arena->release = release;
+  arena->alloc_data = user_data;
+  arena->block_size = block_size;
+
+  return ECBOR_OK;
+}
+
+/* Bytes to skip from <position> to reach <alignment> (a power of two) */
+static inline size_t
+ecbor_arena_padding (const uint8_t *position, size_t alignment)
+{
+  return (alignment - ((uintptr_t) position & (alignment - 1)))
+         & (alignment - 1);
+}
+
+/* Switch to the next block in chain that can hold <size> bytes, obtaining a
+   new one from the block allocator if none is left; <size> plus alignment
+   slack and block header is known not to overflow */
+static ecbor_error_t
+ecbor_arena_next_block (ecbor_arena_t *arena, size_t size, size_t alignment)
+{
+  ecbor_arena_block_t *block, **link;
+  size_t block_size;
+
+  /* reuse blocks kept from before the last reset */
+  link = (arena->current ? &arena->current->next : &arena->blocks);
+  for (block = (*link); block; link = &block->next, block = block->next) {
+    if (block->capacity >= size + alignment - 1) {
+      break;
+    }
+  }
+
+  if (!block) {
+    if (!arena->alloc) {
+      return ECBOR_ERR_END_OF_ARENA;
+    }
+
+    block_size = size + alignment - 1;
+    if (block_size < arena->block_size) {
+      block_size = arena->block_size;
+    }
+    if (block_size > SIZE_MAX - sizeof (ecbor_arena_block_t)) {
+      return ECBOR_ERR_END_OF_ARENA;
+    }
+    block = (ecbor_arena_block_t *)
+      arena->alloc (arena->alloc_data,
+                    sizeof (ecbor_arena_block_t) + block_size);
+    if (!block) {
+      return ECBOR_ERR_END_OF_ARENA;
+    }
+
+    /* insert right after the current block */
+    link = (arena->current ? &arena->current->next : &arena->blocks);
+    block->next = (*link);
+    block->capacity = block_size;
+    (*link) = block;
+  }
+
+  arena->current = block;
+  arena->position = (uint8_t *) (block + 1);
+  arena->bytes_left = block->capacity;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_arena_alloc (ecbor_arena_t *arena, size_t size, size_t alignment,
+                   void **memory)
+{
+  size_t padding;
+  ecbor_error_t rc;
+
+  ECBOR_INTERNAL_CHECK_ARENA_PTR (arena);
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (memory);
+  if (alignment == 0) {
+    alignment = 1;
+  }
+  if (alignment & (alignment - 1)) {
+    /* not a power of two */
+    return ECBOR_ERR_INVALID_ADDITIONAL;
+  }
+  if (size > SIZE_MAX - (alignment - 1) - sizeof (ecbor_arena_block_t)) {
+    /* no block could hold it, and the arithmetic below would wrap */
+    return ECBOR_ERR_END_OF_ARENA;
+  }
+
+  padding = ecbor_arena_padding (arena->position, alignment);
+  if (arena->bytes_left < size + padding) {
+    rc = ecbor_arena_next_block (arena, size, alignment);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    padding = ecbor_arena_padding (arena->position, alignment);
+  }
+
+  (*memory) = arena->position + padding;
+  arena->position += size + padding;
+  arena->bytes_left -= size + padding;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_arena_reset (ecbor_arena_t *arena)
+{
+  ECBOR_INTERNAL_CHECK_ARENA_PTR (arena);
+
+  /* blocks are kept for reuse */
+  arena->current = NULL;
+  arena->position = arena->base;
+  arena->bytes_left = arena->base_size;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_arena_release (ecbor_arena_t *arena)
+{
+  ecbor_arena_block_t *block, *next;
+
+  ECBOR_INTERNAL_CHECK_ARENA_PTR (arena);
+
+  for (block = arena->blocks; block; block = next) {
+    next = block->next;
+    arena->release (arena->alloc_data, block);
+  }
+  arena->blocks = NULL;
+
+  return ecbor_arena_reset (arena);
+}
+
+ecbor_error_t
+ecbor_initialize_item_pool (ecbor_item_pool_t *pool, ecbor_arena_t *arena,
+                            size_t block_items)
+{
+  ECBOR_INTERNAL_CHECK_POOL_PTR (pool);
+  ECBOR_INTERNAL_CHECK_ARENA_PTR (arena);
+  if (block_items == 0) {
+    return ECBOR_ERR_EMPTY_ITEM_BUFFER;
+  }
+
+  pool->arena = arena;
+  pool->block_items = block_items;
+  pool->free_blocks = NULL;
+  pool->n_blocks = 0;
+  pool->n_items = 0;
+  pool->high_water = 0;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_item_pool_acquire (ecbor_item_pool_t *pool, ecbor_item_block_t **block)
+{
+  ecbor_error_t rc;
+  void *memory;
+
+  ECBOR_INTERNAL_CHECK_POOL_PTR (pool);
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (block);
+
+  if (pool->free_blocks) {
+    /* recycled blocks are not cleared, the decoder sets every field */
+    (*block) = pool->free_blocks;
+    pool->free_blocks = (*block)->next;
+    return ECBOR_OK;
+  }
+
+  rc = ecbor_arena_alloc (pool->arena,
+                          sizeof (ecbor_item_block_t)
+                            + pool->block_items * sizeof (ecbor_item_t),
+                          __alignof__ (ecbor_item_t), &memory);
+  if (rc != ECBOR_OK) {
+    return (rc == ECBOR_ERR_END_OF_ARENA ? ECBOR_ERR_END_OF_ITEM_BUFFER : rc);
+  }
+
+  (*block) = (ecbor_item_block_t *) memory;
+  (*block)->capacity = pool->block_items;
+  pool->n_blocks ++;
+
+  return ECBOR_OK;
+}
+
+void
+ecbor_item_pool_release (ecbor_item_pool_t *pool, ecbor_item_block_t *blocks)
+{
+  ecbor_item_block_t *last;
+
+  if (!pool || !blocks) {
+    return;
+  }
+
+  for (last = blocks; last->next; last = last->next) {
+  }
+  last->next = pool->free_blocks;
+  pool->free_blocks = blocks;
+}
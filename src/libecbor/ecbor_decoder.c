@@ -20,6 +20,16 @@ ecbor_initialize_decode_internal (ecbor_decode_context_t *context,
 
   context->in_position = buffer;
   context->bytes_left = buffer_size;
+  context->arena = NULL;
+  context->pool = NULL;
+  context->blocks = NULL;
+  context->refill = NULL;
+  context->refill_data = NULL;
+  context->window = NULL;
+  context->window_size = 0;
+  context->end_of_input = false;
+  context->sink = NULL;
+  context->sink_data = NULL;
   
   return ECBOR_OK;
 }
@@ -90,6 +100,100 @@ ecbor_initialize_decode_tree (ecbor_decode_context_t *context,
   return ECBOR_OK;
 }
 
+ecbor_error_t
+ecbor_initialize_decode_tree_pool (ecbor_decode_context_t *context,
+                                   const uint8_t *buffer,
+                                   size_t buffer_size,
+                                   ecbor_item_pool_t *pool)
+{
+  ecbor_error_t rc =
+    ecbor_initialize_decode_internal (context, buffer, buffer_size);
+
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  ECBOR_INTERNAL_CHECK_POOL_PTR (pool);
+
+  context->mode = ECBOR_MODE_DECODE_TREE;
+  context->items = NULL;
+  context->item_capacity = 0;
+  context->n_items = 0;
+  context->pool = pool;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_release_tree (ecbor_decode_context_t *context)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (context->mode != ECBOR_MODE_DECODE_TREE) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  if (context->pool) {
+    context->pool->n_items -= context->n_items;
+    ecbor_item_pool_release (context->pool, context->blocks);
+    context->blocks = NULL;
+  }
+  context->n_items = 0;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_decode_arena (ecbor_decode_context_t *context, ecbor_arena_t *arena)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+
+  context->arena = arena;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_refill_callback (ecbor_decode_context_t *context, uint8_t *window,
+                           size_t window_size, ecbor_refill_callback_t refill,
+                           void *user_data)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (context->mode == ECBOR_MODE_DECODE_TREE) {
+    /* tree items would point into a moving window */
+    return ECBOR_ERR_WRONG_MODE;
+  }
+  if (!window) {
+    return ECBOR_ERR_NULL_INPUT_BUFFER;
+  }
+  if (!refill) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (window_size < ECBOR_REFILL_MIN_WINDOW) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  /* decoding starts with an empty window */
+  context->refill = refill;
+  context->refill_data = user_data;
+  context->window = window;
+  context->window_size = window_size;
+  context->end_of_input = false;
+  context->in_position = window;
+  context->bytes_left = 0;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_payload_sink (ecbor_decode_context_t *context,
+                        ecbor_sink_callback_t sink, void *user_data)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+
+  context->sink = sink;
+  context->sink_data = user_data;
+  return ECBOR_OK;
+}
+
 static inline ecbor_error_t
 ecbor_decode_uint (ecbor_decode_context_t *context,
                    uint64_t *value,
@@ -107,31 +211,23 @@ ecbor_decode_uint (ecbor_decode_context_t *context,
       return ECBOR_ERR_INVALID_END_OF_BUFFER;
     }
 
-    /* read actual value */
-    switch (additional) {
-      case ECBOR_ADDITIONAL_1BYTE:
-        (*value) = *((uint8_t *) context->in_position);
-        break;
-
-      case ECBOR_ADDITIONAL_2BYTE:
-        (*value) =
-          ecbor_uint16_from_big_endian (*((uint16_t *) context->in_position));
-        break;
-
-      case ECBOR_ADDITIONAL_4BYTE:
-        (*value) =
-          ecbor_uint32_from_big_endian (*((uint32_t *) context->in_position));
-        break;
-
-      case ECBOR_ADDITIONAL_8BYTE:
-        (*value) =
-          ecbor_uint64_from_big_endian (*((uint64_t *) context->in_position));
-        break;
+    if (additional > ECBOR_ADDITIONAL_8BYTE) {
+      return ECBOR_ERR_INVALID_ADDITIONAL;
+    }
 
-      default:
-        return ECBOR_ERR_INVALID_ADDITIONAL;
+    /* read actual value; with enough slack left in the buffer this is a
+       single wide load, shifted down to the storage size */
+    if (context->bytes_left >= sizeof (uint64_t)) {
+      (*value) = ecbor_load_uint64 (context->in_position)
+                   >> (64 - 8 * (*size));
+    } else {
+      size_t i;
+      (*value) = 0;
+      for (i = 0; i < (*size); i ++) {
+        (*value) = ((*value) << 8) | context->in_position[i];
+      }
     }
-    
+
     /* advance buffer */
     context->in_position += (*size);
     context->bytes_left -= (*size);
@@ -155,8 +251,7 @@ ecbor_decode_fp32 (ecbor_decode_context_t *context,
   }
 
   /* read actual value */
-  (*value) =
-    ecbor_fp32_from_big_endian (*((float *) context->in_position));
+  (*value) = ecbor_load_fp32 (context->in_position);
   
   /* advance buffer */
   context->in_position += (*size);
@@ -180,8 +275,7 @@ ecbor_decode_fp64 (ecbor_decode_context_t *context,
   }
 
   /* read actual value */
-  (*value) =
-    ecbor_fp64_from_big_endian (*((double *) context->in_position));
+  (*value) = ecbor_load_fp64 (context->in_position);
 
   /* advance buffer */
   context->in_position += (*size);
@@ -219,6 +313,20 @@ ecbor_decode_simple_value (ecbor_item_t *item)
   return ECBOR_OK;
 }
 
+/* Clear the tree links and cache of an item handed to the user outside tree
+   mode; ecbor_decode_next_internal() sets all other fields, per type, and
+   leaves these alone, since children walked for their size never reach the
+   user */
+static inline void
+ecbor_decode_clear_links (ecbor_item_t *item)
+{
+  item->encoded_size = 0;
+  item->parent = NULL;
+  item->child = NULL;
+  item->next = NULL;
+  item->index = 0;
+}
+
 static __attribute__((noinline)) ecbor_error_t
 ecbor_decode_next_internal (ecbor_decode_context_t *context,
                             ecbor_item_t *item,
@@ -237,9 +345,6 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
     return ECBOR_ERR_WRONG_MODE;
   }
   
-  /* clear item, just so we do not leave garbage on partial read */
-  (*item) = null_item;
-  
   /* extract major type (most significant three bits) and additional info */
   item->type = (*context->in_position >> 5) & 0x07;
   additional = (*context->in_position & 0x1f);
@@ -253,6 +358,8 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
         && additional == ECBOR_ADDITIONAL_INDEFINITE) {
       /* this is a valid stop code, pass it directly; note that this branch is
          only taken when inside an indefinite string */
+      item->size = 1;
+      item->type = ECBOR_TYPE_STOP_CODE;
       return ECBOR_END_OF_INDEFINITE;
     } else {
       /* this is not a stop code, and the item has the wrong major type */
@@ -267,11 +374,16 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
      * Integer types
      */
     case ECBOR_TYPE_UINT:
+      item->length = 0;
+      item->is_indefinite = false;
       return ecbor_decode_uint (context, &item->value.uinteger, &item->size,
                                 additional);
     
     case ECBOR_TYPE_NINT:
       {
+        item->length = 0;
+        item->is_indefinite = false;
+
         /* read negative value as unsigned */
         ecbor_error_t rc = ecbor_decode_uint (context, &item->value.uinteger,
                                               &item->size, additional);
@@ -302,6 +414,7 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
         /* mark accordingly */
         item->is_indefinite = true;
         item->size = 1; /* already processed first byte */
+        item->length = 0;
         
         /* do not allow nested indefinite length strings */
         if (is_chunk) {
@@ -336,8 +449,10 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
       } else {
         /* read size of buffer */
         uint64_t len;
-        ecbor_error_t rc = ecbor_decode_uint (context, &len, &item->size,
-                                              additional);
+        ecbor_error_t rc;
+
+        item->is_indefinite = false;
+        rc = ecbor_decode_uint (context, &len, &item->size, additional);
         if (rc != ECBOR_OK) {
           return rc;
         }
@@ -370,6 +485,7 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
         /* mark accordingly */
         item->is_indefinite = true;
         item->size = 1; /* already processed first byte */
+        item->length = 0;
         
         /* keep buffer pointer from current pointer */
         item->value.items = context->in_position;
@@ -412,10 +528,11 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
         }
       } else {
         uint64_t len;
+        ecbor_error_t rc;
 
         /* read size of map or array */
-        ecbor_error_t rc = ecbor_decode_uint (context, &len,
-                                              &item->size, additional);
+        item->is_indefinite = false;
+        rc = ecbor_decode_uint (context, &len, &item->size, additional);
         if (rc != ECBOR_OK) {
           return rc;
         }
@@ -469,6 +586,7 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
         ecbor_error_t rc;
 
         /* decode tag */
+        item->is_indefinite = false;
         rc = ecbor_decode_uint (context, &item->value.tag.tag_value,
                                 &item->size, additional);
         if (rc != ECBOR_OK) {
@@ -499,6 +617,8 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
 #pragma GCC diagnostic ignored "-Wswitch"
     case ECBOR_TYPE_SPECIAL:
 #pragma GCC diagnostic pop
+      item->length = 0;
+      item->is_indefinite = false;
       if (additional == ECBOR_ADDITIONAL_INDEFINITE) {
         /* stop code */
         item->size = 1;
@@ -542,6 +662,127 @@ ecbor_decode_next_internal (ecbor_decode_context_t *context,
   return ECBOR_OK;
 }
 
+/* Move unread input to the start of the window and append more from the
+   refill callback */
+static ecbor_error_t
+ecbor_decode_refill_window (ecbor_decode_context_t *context)
+{
+  size_t filled = 0;
+  ecbor_error_t rc;
+
+  if (context->in_position != context->window && context->bytes_left > 0) {
+    ecbor_memmove (context->window, context->in_position,
+                   context->bytes_left);
+  }
+  context->in_position = context->window;
+
+  rc = context->refill (context->refill_data,
+                        context->window + context->bytes_left,
+                        context->window_size - context->bytes_left, &filled);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  if (filled == 0) {
+    context->end_of_input = true;
+  }
+  context->bytes_left += filled;
+
+  return ECBOR_OK;
+}
+
+/* Decode a definite string that does not fit the window, passing its payload
+   to the sink as it is refilled */
+static ecbor_error_t
+ecbor_decode_spill_string (ecbor_decode_context_t *context,
+                           ecbor_item_t *item)
+{
+  uint8_t additional;
+  uint64_t length, remaining;
+  size_t piece;
+  ecbor_error_t rc;
+
+  item->type = (*context->in_position >> 5) & 0x07;
+  additional = (*context->in_position & 0x1f);
+
+  if ((item->type != ECBOR_TYPE_STR && item->type != ECBOR_TYPE_BSTR)
+      || additional == ECBOR_ADDITIONAL_INDEFINITE || !context->sink) {
+    /* only definite strings can be delivered in pieces */
+    return ECBOR_ERR_BUFFER_TOO_LARGE;
+  }
+  context->in_position ++; context->bytes_left --;
+
+  /* the window holds at least the whole head */
+  rc = ecbor_decode_uint (context, &length, &item->size, additional);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  item->length = length;
+  item->size += length;
+  item->is_indefinite = false;
+  item->value.string.str = NULL;
+  item->value.string.n_chunks = 0;
+
+  for (remaining = length; remaining > 0; remaining -= piece) {
+    if (context->bytes_left == 0) {
+      rc = ecbor_decode_refill_window (context);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      if (context->end_of_input) {
+        return ECBOR_ERR_INVALID_END_OF_BUFFER;
+      }
+    }
+
+    piece = (context->bytes_left < remaining ? context->bytes_left
+                                             : (size_t) remaining);
+    rc = context->sink (context->sink_data, item, context->in_position,
+                        piece);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    context->in_position += piece;
+    context->bytes_left -= piece;
+  }
+
+  return ECBOR_OK;
+}
+
+/* Decode next item from a refilled window; an item crossing the end of the
+   window is decoded again once more input is in */
+static ecbor_error_t
+ecbor_decode_refilled (ecbor_decode_context_t *context, ecbor_item_t *item)
+{
+  const uint8_t *start;
+  size_t left;
+  ecbor_error_t rc;
+
+  while (true) {
+    start = context->in_position;
+    left = context->bytes_left;
+
+    rc = ecbor_decode_next_internal (context, item, false, ECBOR_TYPE_NONE);
+    if (context->end_of_input
+        || (rc != ECBOR_END_OF_BUFFER
+            && rc != ECBOR_ERR_INVALID_END_OF_BUFFER)) {
+      return rc;
+    }
+
+    /* rewind */
+    context->in_position = start;
+    context->bytes_left = left;
+
+    if (left == context->window_size) {
+      /* item is larger than the window */
+      return ecbor_decode_spill_string (context, item);
+    }
+
+    rc = ecbor_decode_refill_window (context);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+}
+
 ecbor_error_t
 ecbor_decode (ecbor_decode_context_t *context, ecbor_item_t *item)
 {  
@@ -554,6 +795,12 @@ ecbor_decode (ecbor_decode_context_t *context, ecbor_item_t *item)
     return ECBOR_ERR_WRONG_MODE;
   }
   
+  ecbor_decode_clear_links (item);
+
+  if (context->refill) {
+    return ecbor_decode_refilled (context, item);
+  }
+
   /* we just get the next item */
   return ecbor_decode_next_internal (context, item, false, ECBOR_TYPE_NONE);
 }
@@ -572,7 +819,10 @@ ecbor_decode_tree (ecbor_decode_context_t *context, ecbor_item_t **root)
   } state = CONSUME_NODE;
   uint8_t last_was_stop_code = 0;
   ecbor_error_t rc = ECBOR_OK;
-  ecbor_item_t *curr_node = NULL, *new_node = NULL;
+  ecbor_item_t *curr_node = NULL, *new_node = NULL, *first_node = NULL;
+  ecbor_item_t *block;
+  size_t block_left;
+  void *memory;
   
   ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
   ECBOR_INTERNAL_CHECK_ITEM_PTR (root);
@@ -581,8 +831,13 @@ ecbor_decode_tree (ecbor_decode_context_t *context, ecbor_item_t **root)
     return ECBOR_ERR_WRONG_MODE;
   }
   
-  /* initialization */
-  context->n_items = 0;
+  /* initialization; a previous tree is given back to the pool */
+  rc = ecbor_release_tree (context);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  block = context->items;
+  block_left = context->item_capacity;
   (*root) = NULL;
   
   /* step into streamed mode; some of the semantic checks will be done here */
@@ -595,23 +850,60 @@ ecbor_decode_tree (ecbor_decode_context_t *context, ecbor_item_t **root)
     switch (state) {
       case CONSUME_NODE:
         /* allocate new node */
-        if (context->n_items >= context->item_capacity) {
-          rc = ECBOR_ERR_END_OF_ITEM_BUFFER;
-          goto end;
+        if (block_left == 0 && context->pool) {
+          /* item buffer is full, continue in a block from the pool */
+          ecbor_item_block_t *pool_block;
+
+          rc = ecbor_item_pool_acquire (context->pool, &pool_block);
+          if (rc != ECBOR_OK) {
+            goto end;
+          }
+          pool_block->next = context->blocks;
+          context->blocks = pool_block;
+          block = ECBOR_ITEM_BLOCK_ITEMS (pool_block);
+          block_left = pool_block->capacity;
+        } else if (block_left == 0) {
+          /* item buffer is full, continue in a block taken from the arena */
+          if (!context->arena) {
+            rc = ECBOR_ERR_END_OF_ITEM_BUFFER;
+            goto end;
+          }
+          rc = ecbor_arena_alloc (context->arena,
+                                  ECBOR_ARENA_ITEM_BLOCK * sizeof (ecbor_item_t),
+                                  sizeof (void *), &memory);
+          if (rc != ECBOR_OK) {
+            if (rc == ECBOR_ERR_END_OF_ARENA) {
+              rc = ECBOR_ERR_END_OF_ITEM_BUFFER;
+            }
+            goto end;
+          }
+          block = (ecbor_item_t *) memory;
+          block_left = ECBOR_ARENA_ITEM_BLOCK;
         }
 
-        new_node = &context->items[context->n_items];
+        new_node = block;
+        block ++;
+        block_left --;
         context->n_items ++;
 
+        /* parent and index are set when linking */
+        new_node->encoded_size = 0;
+        new_node->child = NULL;
+        new_node->next = NULL;
+
         /* consume next item */
         rc = ecbor_decode_next_internal (context, new_node, false,
                                          ECBOR_TYPE_NONE);
         if (rc == ECBOR_END_OF_INDEFINITE) {
           state = ANALYZE_STOP_CODE;
+          block --;
+          block_left ++;
           context->n_items --;
           rc = ECBOR_OK;
         } else if (rc == ECBOR_END_OF_BUFFER) {
           state = CHECK_END;
+          block --;
+          block_left ++;
           context->n_items --;
           rc = ECBOR_OK;
         } else if (rc == ECBOR_OK) {
@@ -645,7 +937,8 @@ ecbor_decode_tree (ecbor_decode_context_t *context, ecbor_item_t **root)
             && ECBOR_IS_INDEFINITE (curr_node)) {
           /* check map case, we need complete key-value pair */
           if (ECBOR_IS_MAP (curr_node) && curr_node->length % 2 != 0) {
-            return ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+            rc = ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+            goto end;
           }
           /* correct stop code */
           state = CHECK_END_OF_DEFINITE;
@@ -659,7 +952,9 @@ ecbor_decode_tree (ecbor_decode_context_t *context, ecbor_item_t **root)
 
       case LINK_FIRST_NODE:
         /* first node, skip checks */
+        first_node = new_node;
         curr_node = new_node;
+        new_node->parent = NULL;
         new_node->index = 0;
         state = CONSUME_NODE;
         break;
@@ -779,11 +1074,17 @@ end:
   if (rc != ECBOR_OK) {
     /* make sure we don't expose garbage to user */
     context->n_items = 0;
+    (void) ecbor_release_tree (context);
+  } else if (context->pool) {
+    context->pool->n_items += context->n_items;
+    if (context->pool->n_items > context->pool->high_water) {
+      context->pool->high_water = context->pool->n_items;
+    }
   }
   
   /* return root node */
   if (context->n_items > 0) {
-    (*root) = &context->items[0];
+    (*root) = first_node;
   } else {
     (*root) = NULL;
   }
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "ecbor.h"
+#include "ecbor_internal.h"
+
+/* Decode the next item; in streamed mode only the header of arrays, maps and
+   tags is consumed, otherwise the whole item is skipped */
+static inline ecbor_error_t
+ecbor_edit_next (ecbor_decode_context_t *context, ecbor_item_t *item,
+                 ecbor_mode_t mode)
+{
+  ecbor_error_t rc;
+
+  context->mode = mode;
+  rc = ecbor_decode (context, item);
+  if (rc == ECBOR_END_OF_BUFFER) {
+    /* ran out of bytes inside a container */
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+  return rc;
+}
+
+/* Compare a decoded map key with a path key */
+static uint8_t
+ecbor_edit_key_equal (const ecbor_item_t *key, const ecbor_item_t *path_key)
+{
+  size_t i;
+
+  if (key->type != path_key->type) {
+    return false;
+  }
+
+  switch (key->type) {
+    case ECBOR_TYPE_UINT:
+    case ECBOR_TYPE_NINT:
+      return (key->value.uinteger == path_key->value.uinteger);
+
+    case ECBOR_TYPE_STR:
+    case ECBOR_TYPE_BSTR:
+      if (key->is_indefinite || key->length != path_key->length) {
+        return false;
+      }
+      for (i = 0; i < key->length; i ++) {
+        if (key->value.string.str[i] != path_key->value.string.str[i]) {
+          return false;
+        }
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/* Position <context> on the child of <container> selected by <path_key> */
+static ecbor_error_t
+ecbor_edit_select (ecbor_decode_context_t *context,
+                   const ecbor_item_t *container,
+                   const ecbor_item_t *path_key)
+{
+  ecbor_item_t child;
+  ecbor_error_t rc;
+  size_t i;
+
+  switch (container->type) {
+    case ECBOR_TYPE_ARRAY:
+      if (path_key->type != ECBOR_TYPE_UINT) {
+        return ECBOR_ERR_INVALID_TYPE;
+      }
+      if (!container->is_indefinite
+          && path_key->value.uinteger >= container->length) {
+        return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+      }
+
+      /* skip preceding elements */
+      for (i = 0; i < path_key->value.uinteger; i ++) {
+        rc = ecbor_edit_next (context, &child, ECBOR_MODE_DECODE);
+        if (rc == ECBOR_END_OF_INDEFINITE) {
+          return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+        } else if (rc != ECBOR_OK) {
+          return rc;
+        }
+      }
+
+      if (container->is_indefinite && context->bytes_left > 0
+          && (*context->in_position) == 0xff) {
+        /* selected element is the stop code */
+        return ECBOR_ERR_INDEX_OUT_OF_BOUNDS;
+      }
+      return ECBOR_OK;
+
+    case ECBOR_TYPE_MAP:
+      for (i = 0; container->is_indefinite || i < container->length; i += 2) {
+        rc = ecbor_edit_next (context, &child, ECBOR_MODE_DECODE);
+        if (rc == ECBOR_END_OF_INDEFINITE) {
+          break;
+        } else if (rc != ECBOR_OK) {
+          return rc;
+        }
+
+        if (ecbor_edit_key_equal (&child, path_key)) {
+          /* positioned on value */
+          return ECBOR_OK;
+        }
+
+        /* skip value */
+        rc = ecbor_edit_next (context, &child, ECBOR_MODE_DECODE);
+        if (rc == ECBOR_END_OF_INDEFINITE) {
+          return ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+        } else if (rc != ECBOR_OK) {
+          return rc;
+        }
+      }
+      return ECBOR_ERR_KEY_NOT_FOUND;
+
+    default:
+      /* cannot descend */
+      return ECBOR_ERR_INVALID_TYPE;
+  }
+}
+
+ecbor_error_t
+ecbor_locate (const uint8_t *buffer, size_t size, const ecbor_item_t *path,
+              size_t path_length, size_t *offset, size_t *length)
+{
+  ecbor_decode_context_t context;
+  ecbor_item_t item;
+  const uint8_t *start;
+  ecbor_error_t rc;
+  size_t i;
+
+  if (!path && path_length > 0) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (!offset || !length) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  rc = ecbor_initialize_decode (&context, buffer, size);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  /* walk down through headers only */
+  for (i = 0; i < path_length; i ++) {
+    do {
+      rc = ecbor_edit_next (&context, &item, ECBOR_MODE_DECODE_STREAMED);
+      if (rc == ECBOR_END_OF_INDEFINITE) {
+        return ECBOR_ERR_INVALID_STOP_CODE;
+      } else if (rc != ECBOR_OK) {
+        return rc;
+      }
+      /* tags are stepped through, they do not take a path element */
+    } while (item.type == ECBOR_TYPE_TAG);
+
+    rc = ecbor_edit_select (&context, &item, &path[i]);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  /* measure selected item */
+  start = context.in_position;
+  rc = ecbor_edit_next (&context, &item, ECBOR_MODE_DECODE);
+  if (rc == ECBOR_END_OF_INDEFINITE) {
+    return ECBOR_ERR_INVALID_STOP_CODE;
+  } else if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  (*offset) = start - buffer;
+  (*length) = item.size;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_edit (uint8_t *buffer, size_t *size, size_t capacity,
+            const ecbor_item_t *path, size_t path_length, ecbor_item_t *value)
+{
+  ecbor_encode_context_t context;
+  size_t offset, old_length, new_length, tail;
+  ecbor_error_t rc;
+
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (size);
+  ECBOR_INTERNAL_CHECK_ITEM_PTR (value);
+
+  rc = ecbor_locate (buffer, (*size), path, path_length, &offset,
+                     &old_length);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  /* the size pass fails wherever encoding would, so the buffer is left
+     untouched on error; a cached size is not trusted for this */
+  rc = ecbor_encoded_size (value, &new_length);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  if ((*size) - old_length + new_length > capacity) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  /* make room; definite headers count items, not bytes, so they stay valid */
+  tail = (*size) - offset - old_length;
+  if (new_length != old_length && tail > 0) {
+    ecbor_memmove (buffer + offset + new_length,
+                   buffer + offset + old_length, tail);
+  }
+
+  rc = ecbor_initialize_encode (&context, buffer + offset, new_length);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+  rc = ecbor_encode (&context, value);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  (*size) = offset + new_length + tail;
+  return ECBOR_OK;
+}
@@ -8,10 +8,19 @@
 #include "ecbor.h"
 #include "ecbor_internal.h"
 
-ecbor_error_t
-ecbor_initialize_encode (ecbor_encode_context_t *context,
-                         uint8_t *buffer,
-                         size_t buffer_size)
+#include <float.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__) \
+      && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#endif
+
+static ecbor_error_t
+ecbor_initialize_encode_internal (ecbor_encode_context_t *context,
+                                  uint8_t *buffer,
+                                  size_t buffer_size)
 {
   ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
   if (!buffer) {
@@ -21,6 +30,31 @@ ecbor_initialize_encode (ecbor_encode_context_t *context,
   context->base = buffer;
   context->out_position = buffer;
   context->bytes_left = buffer_size;
+  context->flush = NULL;
+  context->flush_data = NULL;
+  context->segments = NULL;
+  context->segment_capacity = 0;
+  context->n_segments = 0;
+  context->gather_threshold = 0;
+  context->segment_start = buffer;
+  context->container = NULL;
+  context->arena = NULL;
+  
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_initialize_encode (ecbor_encode_context_t *context,
+                         uint8_t *buffer,
+                         size_t buffer_size)
+{
+  ecbor_error_t rc =
+    ecbor_initialize_encode_internal (context, buffer, buffer_size);
+
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
   context->mode = ECBOR_MODE_ENCODE;
   
   return ECBOR_OK;
@@ -31,19 +65,217 @@ ecbor_initialize_encode_streamed (ecbor_encode_context_t *context,
                                   uint8_t *buffer,
                                   size_t buffer_size)
 {
-  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
-  if (!buffer) {
-    return ECBOR_ERR_NULL_OUTPUT_BUFFER;
+  ecbor_error_t rc =
+    ecbor_initialize_encode_internal (context, buffer, buffer_size);
+
+  if (rc != ECBOR_OK) {
+    return rc;
   }
-  
-  context->base = buffer;
-  context->out_position = buffer;
-  context->bytes_left = buffer_size;
+
   context->mode = ECBOR_MODE_ENCODE_STREAMED;
   
   return ECBOR_OK;
 }
 
+ecbor_error_t
+ecbor_set_encode_arena (ecbor_encode_context_t *context, ecbor_arena_t *arena)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+
+  context->arena = arena;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_flush_callback (ecbor_encode_context_t *context,
+                          ecbor_flush_callback_t flush, void *user_data)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (context->segments) {
+    /* flushing would overwrite buffer regions referenced by segments */
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  context->flush = flush;
+  context->flush_data = user_data;
+
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_flush_internal (ecbor_encode_context_t *context)
+{
+  uint8_t *limit = context->out_position;
+  ecbor_container_t *container;
+  size_t used, kept;
+  ecbor_error_t rc;
+
+  /* headers of open containers must stay in the buffer until patched, so we
+     only flush what precedes the outermost one */
+  for (container = context->container; container;
+       container = container->parent) {
+    limit = container->header;
+  }
+
+  used = limit - context->base;
+  if (used == 0) {
+    return ECBOR_OK;
+  }
+
+  /* hand filled part of the buffer to the sink and rewind */
+  rc = context->flush (context->flush_data, context->base, used);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  kept = context->out_position - limit;
+  if (kept > 0) {
+    ecbor_memmove (context->base, limit, kept);
+    for (container = context->container; container;
+         container = container->parent) {
+      container->header -= used;
+    }
+  }
+
+  context->out_position = context->base + kept;
+  context->bytes_left += used;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_flush (ecbor_encode_context_t *context)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (!context->flush) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  return ecbor_flush_internal (context);
+}
+
+ecbor_error_t
+ecbor_set_gather_segments (ecbor_encode_context_t *context,
+                           ecbor_segment_t *segments,
+                           size_t segment_capacity,
+                           size_t threshold)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (!segments) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (context->flush) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  context->segments = segments;
+  context->segment_capacity = segment_capacity;
+  context->n_segments = 0;
+  context->gather_threshold = threshold;
+  context->segment_start = context->out_position;
+
+  return ECBOR_OK;
+}
+
+static inline void
+ecbor_gather_close_segment (ecbor_encode_context_t *context)
+{
+  if (context->out_position > context->segment_start) {
+    ecbor_segment_t *segment = &context->segments[context->n_segments];
+    segment->base = context->segment_start;
+    segment->length = context->out_position - context->segment_start;
+    context->n_segments ++;
+    context->segment_start = context->out_position;
+  }
+}
+
+ecbor_error_t
+ecbor_get_gather_segment_count (ecbor_encode_context_t *context,
+                                size_t *count)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (count);
+  if (!context->segments) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  /* cover trailing output; encoding may continue afterwards */
+  if (context->n_segments >= context->segment_capacity
+      && context->out_position > context->segment_start) {
+    return ECBOR_ERR_END_OF_ITEM_BUFFER;
+  }
+  ecbor_gather_close_segment (context);
+
+  (*count) = context->n_segments;
+  return ECBOR_OK;
+}
+
+static inline ecbor_error_t
+ecbor_encode_reserve (ecbor_encode_context_t *context, size_t size)
+{
+  ecbor_error_t rc;
+
+  if (context->bytes_left >= size) {
+    return ECBOR_OK;
+  }
+  if (!context->flush) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  /* make room by flushing what we have so far */
+  rc = ecbor_flush_internal (context);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  /* buffer is smaller than the requested contiguous space */
+  return (context->bytes_left >= size ? ECBOR_OK
+                                      : ECBOR_ERR_INVALID_END_OF_BUFFER);
+}
+
+static ecbor_error_t
+ecbor_encode_payload (ecbor_encode_context_t *context, const uint8_t *data,
+                      size_t size)
+{
+  if (context->segments && size >= context->gather_threshold
+      && context->n_segments + 3 <= context->segment_capacity) {
+    /* reference payload in place; we keep room for the segment before it and
+       for the trailing one, otherwise we fall back to copying */
+    ecbor_segment_t *segment;
+
+    ecbor_gather_close_segment (context);
+    segment = &context->segments[context->n_segments];
+    segment->base = data;
+    segment->length = size;
+    context->n_segments ++;
+
+    return ECBOR_OK;
+  }
+
+  if (context->bytes_left < size) {
+    ecbor_error_t rc;
+
+    if (!context->flush) {
+      return ECBOR_ERR_INVALID_END_OF_BUFFER;
+    }
+
+    rc = ecbor_flush_internal (context);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    if (context->bytes_left < size) {
+      /* larger than the whole buffer; pass straight through to the sink */
+      return context->flush (context->flush_data, data, size);
+    }
+  }
+
+  ecbor_memcpy ((void *) context->out_position, (void *) data, size);
+  context->out_position += size;
+  context->bytes_left -= size;
+
+  return ECBOR_OK;
+}
 
 ecbor_error_t
 ecbor_get_encoded_buffer_size(const ecbor_encode_context_t *context, size_t *out_size)
@@ -64,73 +296,55 @@ ecbor_get_encoded_buffer_size(const ecbor_encode_context_t *context, size_t *out
   return ECBOR_OK;
 }
 
+ecbor_error_t
+ecbor_encode_raw (ecbor_encode_context_t *context, const uint8_t *bytes,
+                  size_t length)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (!bytes && length > 0) {
+    return ECBOR_ERR_NULL_VALUE;
+  }
+  if (context->mode != ECBOR_MODE_ENCODE
+      && context->mode != ECBOR_MODE_ENCODE_STREAMED) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  return ecbor_encode_payload (context, bytes, length);
+}
+
+static inline size_t
+ecbor_uint_encoded_size (uint64_t value)
+{
+  return 1 + ECBOR_ADDITIONAL_WIDTH (ecbor_uint_additional (value));
+}
+
 static ecbor_error_t
 ecbor_encode_uint (ecbor_encode_context_t *context, uint8_t major_type,
                    uint64_t value)
 {
-  uint8_t size = 0;
-
-  /* compute storage size */
-  if (value <= ECBOR_ADDITIONAL_LAST_INTEGER) {
-    size = 1;
-  } else if (value <= 0xFF) {
-    size = 2;
-  } else if (value <= 0xFFFF) {
-    size = 3;
-  } else if (value <= 0xFFFFFFFF) {
-    size = 5;
-  } else {
-    size = 9;
-  }
-
-  /* check buffer */
-  if (context->bytes_left < size) {
-    return ECBOR_ERR_INVALID_END_OF_BUFFER;
-  }
+  ecbor_error_t rc;
+  size_t size;
 
-  /* write value */
-  if (value <= ECBOR_ADDITIONAL_LAST_INTEGER) {
-    /* value coded in header */
-    (*context->out_position) = ((major_type & 0x7) << 5) | (value & 0x1f);
-    context->out_position ++;
-    context->bytes_left --;
-  } else if (value <= 0xFF) {
-    /* 1 extra byte */
-    (*context->out_position) =
-      ((major_type & 0x7) << 5) | ECBOR_ADDITIONAL_1BYTE;
-    context->out_position ++;
-    (*context->out_position) = (uint8_t) value;
-    context->out_position ++;
-    context->bytes_left -= 2;
-  } else if (value <= 0xFFFF) {
-    /* 2 extra bytes */
-    (*context->out_position) =
-      ((major_type & 0x7) << 5) | ECBOR_ADDITIONAL_2BYTE;
-    context->out_position ++;
-    (*((uint16_t *)context->out_position)) =
-      ecbor_uint16_to_big_endian ((uint16_t) value);
-    context->out_position += 2;
-    context->bytes_left -= 3;
-  } else if (value <= 0xFFFFFFFF) {
-    /* 4 extra bytes */
-    (*context->out_position) =
-      ((major_type & 0x7) << 5) | ECBOR_ADDITIONAL_4BYTE;
-    context->out_position ++;
-    (*((uint32_t *)context->out_position)) =
-      ecbor_uint32_to_big_endian ((uint32_t) value);
-    context->out_position += 4;
-    context->bytes_left -= 5;
+  if (context->bytes_left >= 9) {
+    /* fast path, enough slack for a full width store */
+    size = ecbor_put_uint_wide (context->out_position, major_type, value);
   } else {
-    /* 8 extra bytes */
-    (*context->out_position) =
-      ((major_type & 0x7) << 5) | ECBOR_ADDITIONAL_8BYTE;
-    context->out_position ++;
-    (*((uint64_t *)context->out_position)) =
-      ecbor_uint64_to_big_endian ((uint64_t) value);
-    context->out_position += 8;
-    context->bytes_left -= 9;
+    /* check buffer */
+    rc = ecbor_encode_reserve (context, ecbor_uint_encoded_size (value));
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    /* write value */
+    if (context->bytes_left >= 9) {
+      size = ecbor_put_uint_wide (context->out_position, major_type, value);
+    } else {
+      size = ecbor_put_uint (context->out_position, major_type, value);
+    }
   }
 
+  context->out_position += size;
+  context->bytes_left -= size;
   return ECBOR_OK;
 }
 
@@ -138,8 +352,9 @@ static ecbor_error_t
 ecbor_encode_header (ecbor_encode_context_t *context, uint8_t major_type,
                      uint8_t additional)
 {
-  if (context->bytes_left < 1) {
-    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  ecbor_error_t rc = ecbor_encode_reserve (context, 1);
+  if (rc != ECBOR_OK) {
+    return rc;
   }
 
   (*context->out_position) =
@@ -150,24 +365,13 @@ ecbor_encode_header (ecbor_encode_context_t *context, uint8_t major_type,
   return ECBOR_OK;
 }
 
-ecbor_error_t
-ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
+/* Write a single item; children of arrays, maps and tags are written by the
+   caller */
+static ecbor_error_t
+ecbor_encode_item (ecbor_encode_context_t *context, ecbor_item_t *item)
 {
   ecbor_error_t rc;
 
-  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
-  ECBOR_INTERNAL_CHECK_ITEM_PTR (item);
-
-  if (context->bytes_left == 0) {
-    return ECBOR_ERR_INVALID_END_OF_BUFFER;
-  }
-  if (context->mode != ECBOR_MODE_ENCODE
-      && context->mode != ECBOR_MODE_ENCODE_STREAMED) {
-    /* only allow known modes of operation; junk in <mode> will generate
-       undefined behaviour */
-    return ECBOR_ERR_WRONG_MODE;
-  }
-
   switch (item->type) {
     case ECBOR_TYPE_UINT:
       rc = ecbor_encode_uint (context, ECBOR_TYPE_UINT, item->value.uinteger);
@@ -212,15 +416,12 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
           if (!item->value.string.str) {
             return ECBOR_ERR_NULL_VALUE;
           }
-          if (context->bytes_left < item->length) {
-            return ECBOR_ERR_INVALID_END_OF_BUFFER;
-          }
 
-          ecbor_memcpy ((void *) context->out_position,
-                        (void *) item->value.string.str,
-                        item->length);
-          context->out_position += item->length;
-          context->bytes_left -= item->length;
+          rc = ecbor_encode_payload (context, item->value.string.str,
+                                     item->length);
+          if (rc != ECBOR_OK) {
+            return rc;
+          }
         }
       }
       break;
@@ -256,25 +457,6 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
         if (rc != ECBOR_OK) {
           return rc;
         }
-
-        if (context->mode == ECBOR_MODE_ENCODE && item->length > 0) {
-          size_t remaining = item->length;
-          ecbor_item_t *current = item->child;
-          
-          while (remaining--) {
-            /* write item */
-            if (!current) {
-              return ECBOR_ERR_NULL_ITEM;
-            }
-
-            rc = ecbor_encode (context, current);
-            if (rc != ECBOR_OK) {
-              return rc;
-            }
-
-            current = current->next;
-          }
-        }
       }
       break;
 
@@ -284,16 +466,6 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
       if (rc != ECBOR_OK) {
         return rc;
       }
-
-      if (context->mode == ECBOR_MODE_ENCODE) {
-        /* write tagged item */
-        ECBOR_INTERNAL_CHECK_ITEM_PTR (item->child);
-
-        rc = ecbor_encode (context, item->child);
-        if (rc != ECBOR_OK) {
-          return rc;
-        }
-      }
       break;
 
     case ECBOR_TYPE_STOP_CODE:
@@ -306,8 +478,11 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
 
     case ECBOR_TYPE_FP32:
       {
-        float value_bigend =
-          ecbor_fp32_to_big_endian (item->value.fp32);
+        /* check buffer for header and value */
+        rc = ecbor_encode_reserve (context, 1 + sizeof (float));
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
 
         /* write header */
         rc = ecbor_encode_header (context, ECBOR_TYPE_SPECIAL,
@@ -317,10 +492,7 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
         }
 
         /* write value */
-        if (context->bytes_left < sizeof (float)) {
-          return ECBOR_ERR_INVALID_END_OF_BUFFER;
-        }
-        (*((float *)context->out_position)) = value_bigend;
+        ecbor_store_fp32 (context->out_position, item->value.fp32);
         context->out_position += sizeof (float);
         context->bytes_left -= sizeof (float);
       }
@@ -328,8 +500,11 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
 
     case ECBOR_TYPE_FP64:
       {
-        double value_bigend =
-          ecbor_fp64_to_big_endian (item->value.fp64);
+        /* check buffer for header and value */
+        rc = ecbor_encode_reserve (context, 1 + sizeof (double));
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
 
         /* write header */
         rc = ecbor_encode_header (context, ECBOR_TYPE_SPECIAL,
@@ -339,10 +514,7 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
         }
 
         /* write value */
-        if (context->bytes_left < sizeof (double)) {
-          return ECBOR_ERR_INVALID_END_OF_BUFFER;
-        }
-        (*((double *)context->out_position)) = value_bigend;
+        ecbor_store_fp64 (context->out_position, item->value.fp64);
         context->out_position += sizeof (double);
         context->bytes_left -= sizeof (double);
       }
@@ -372,6 +544,18 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
         return rc;
       }
       break;
+
+    case ECBOR_TYPE_RAW:
+      /* pre-encoded item, copy verbatim regardless of mode */
+      if (!item->value.items && item->length > 0) {
+        return ECBOR_ERR_NULL_VALUE;
+      }
+
+      rc = ecbor_encode_payload (context, item->value.items, item->length);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      break;
     
     default:
       return ECBOR_ERR_INVALID_TYPE;
@@ -380,69 +564,1257 @@ ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
   return ECBOR_OK;
 }
 
-ecbor_item_t
-ecbor_int (int64_t value)
+/* Number of children of an item in a builder tree */
+static inline size_t
+ecbor_item_child_count (const ecbor_item_t *item)
 {
-  ecbor_item_t r = null_item;
-  if (value >= 0) {
-    r.type = ECBOR_TYPE_UINT;
-    r.value.uinteger = (uint64_t) value;
-  } else {
-    r.type = ECBOR_TYPE_NINT;
-    r.value.integer = value;
+  switch (item->type) {
+    case ECBOR_TYPE_ARRAY:
+    case ECBOR_TYPE_MAP:
+      return item->length;
+
+    case ECBOR_TYPE_TAG:
+      return 1;
+
+    default:
+      return 0;
   }
-  return r;
 }
 
-ecbor_item_t
-ecbor_uint (uint64_t value)
+/* Tree walking; we do not recurse, but use the parent and next links to move
+   around the tree, (re)writing parent and index links on the way down since
+   builders do not keep them consistent */
+static inline ecbor_error_t
+ecbor_walk_descend (ecbor_item_t **node, size_t *depth)
 {
-  ecbor_item_t r = null_item;
-  r.type = ECBOR_TYPE_UINT;
-  r.value.uinteger = value;
-  return r;
-}
+  ecbor_item_t *child = (*node)->child;
 
-ecbor_item_t
-ecbor_bstr (const uint8_t *bstr, size_t length)
-{
-  ecbor_item_t r = null_item;
-  r.is_indefinite = false;
-  r.type = ECBOR_TYPE_BSTR;
-  r.value.string.str = bstr;
-  r.length = length;
-  return r;
-}
+  ECBOR_INTERNAL_CHECK_ITEM_PTR (child);
+  if ((*depth) >= ECBOR_MAX_NESTING_DEPTH) {
+    return ECBOR_ERR_NESTING_TOO_DEEP;
+  }
 
-ecbor_item_t
-ecbor_str (const char *str, size_t length)
-{
-  ecbor_item_t r = null_item;
-  r.is_indefinite = false;
-  r.type = ECBOR_TYPE_STR;
-  r.value.string.str = (uint8_t *)str;
-  r.length = length;
-  return r;
-}
+  child->parent = (*node);
+  child->index = 0;
+  (*node) = child;
+  (*depth) ++;
 
-ecbor_item_t
-ecbor_tag (ecbor_item_t *child, uint64_t tag_value)
-{
-  ecbor_item_t r = null_item;
-  r.type = ECBOR_TYPE_TAG;
-  r.child = child;
-  r.value.tag.tag_value = tag_value;
-  return r;
+  return ECBOR_OK;
 }
 
-ecbor_item_t
-ecbor_fp32 (float value)
+/* Move from a node whose subtree is done to the next node in encoding order;
+   sets <node> to NULL when the subtree of <root> is done. If <cache> is set,
+   cached subtree sizes are accumulated in the parents. */
+static inline ecbor_error_t
+ecbor_walk_ascend (ecbor_item_t *root, ecbor_item_t **node, size_t *depth,
+                   uint8_t cache)
 {
-  ecbor_item_t r = null_item;
-  r.type = ECBOR_TYPE_FP32;
-  r.value.fp32 = value;
-  return r;
-}
+  ecbor_item_t *current = (*node);
+
+  while (current != root) {
+    ecbor_item_t *parent = current->parent;
+
+    if (cache) {
+      parent->encoded_size += current->encoded_size;
+    }
+
+    if (current->index + 1 < ecbor_item_child_count (parent)) {
+      /* next sibling */
+      ECBOR_INTERNAL_CHECK_ITEM_PTR (current->next);
+      current->next->parent = parent;
+      current->next->index = current->index + 1;
+      (*node) = current->next;
+      return ECBOR_OK;
+    }
+
+    /* up one level */
+    current = parent;
+    (*depth) --;
+  }
+
+  (*node) = NULL;
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_encode_internal (ecbor_encode_context_t *context, ecbor_item_t *item)
+{
+  ecbor_item_t *node = item;
+  size_t depth = 0;
+  ecbor_error_t rc;
+
+  if (context->mode != ECBOR_MODE_ENCODE) {
+    /* streamed mode, children are encoded by the user */
+    return ecbor_encode_item (context, item);
+  }
+
+  while (node) {
+    rc = ecbor_encode_item (context, node);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    if (ecbor_item_child_count (node) > 0) {
+      rc = ecbor_walk_descend (&node, &depth);
+    } else {
+      rc = ecbor_walk_ascend (item, &node, &depth, false);
+    }
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  return ECBOR_OK;
+}
+
+/* Keep track of direct children of the innermost open container */
+static void
+ecbor_container_account (ecbor_encode_context_t *context,
+                         const ecbor_item_t *item)
+{
+  ecbor_container_t *container = context->container;
+  uint8_t is_indefinite_item =
+    item->is_indefinite
+    && (item->type == ECBOR_TYPE_BSTR || item->type == ECBOR_TYPE_STR
+        || item->type == ECBOR_TYPE_ARRAY || item->type == ECBOR_TYPE_MAP);
+
+  if (!container) {
+    return;
+  }
+
+  if (container->indefinite > 0) {
+    /* within an indefinite item of the last child; only track nesting */
+    if (is_indefinite_item) {
+      container->indefinite ++;
+    } else if (item->type == ECBOR_TYPE_STOP_CODE) {
+      container->indefinite --;
+    }
+    return;
+  }
+
+  /* either a new child, or part of the last one */
+  if (container->pending > 0) {
+    container->pending --;
+  } else {
+    container->count ++;
+  }
+
+  if (context->mode != ECBOR_MODE_ENCODE_STREAMED) {
+    /* item was written with all its children */
+    return;
+  }
+
+  if (is_indefinite_item) {
+    container->indefinite ++;
+  } else if (item->type == ECBOR_TYPE_ARRAY
+             || item->type == ECBOR_TYPE_MAP) {
+    container->pending += item->length;
+  } else if (item->type == ECBOR_TYPE_TAG) {
+    container->pending ++;
+  }
+}
+
+ecbor_error_t
+ecbor_encode (ecbor_encode_context_t *context, ecbor_item_t *item)
+{
+  ecbor_error_t rc;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  ECBOR_INTERNAL_CHECK_ITEM_PTR (item);
+
+  if (context->bytes_left == 0 && !context->flush) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+  if (context->mode != ECBOR_MODE_ENCODE
+      && context->mode != ECBOR_MODE_ENCODE_STREAMED) {
+    /* only allow known modes of operation; junk in <mode> will generate
+       undefined behaviour */
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  if (context->mode == ECBOR_MODE_ENCODE && item->encoded_size > 0
+      && !context->segments) {
+    /* size is known; fail before writing anything, or flush once so that
+       the item is written contiguously. Items larger than the whole buffer
+       are still flushed as they are written. */
+    rc = ecbor_encode_reserve (context, item->encoded_size);
+    if (rc != ECBOR_OK
+        && (rc != ECBOR_ERR_INVALID_END_OF_BUFFER || !context->flush)) {
+      return rc;
+    }
+  }
+
+  rc = ecbor_encode_internal (context, item);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  ecbor_container_account (context, item);
+  return ECBOR_OK;
+}
+
+static ecbor_error_t
+ecbor_encode_begin_container (ecbor_encode_context_t *context,
+                              ecbor_container_t *container,
+                              ecbor_type_t type)
+{
+  ecbor_item_t token = null_item;
+  ecbor_error_t rc;
+  void *memory;
+  uint8_t i;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (context->mode != ECBOR_MODE_ENCODE
+      && context->mode != ECBOR_MODE_ENCODE_STREAMED) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+  if (!container) {
+    /* take the frame from the arena, if any */
+    if (!context->arena) {
+      return ECBOR_ERR_NULL_VALUE;
+    }
+    rc = ecbor_arena_alloc (context->arena, sizeof (ecbor_container_t),
+                            sizeof (void *), &memory);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    container = (ecbor_container_t *) memory;
+  }
+
+  /* reserve a maximal width header */
+  rc = ecbor_encode_reserve (context, 9);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  container->type = type;
+  container->header = context->out_position;
+  container->count = 0;
+  container->pending = 0;
+  container->indefinite = 0;
+  container->has_slots = false;
+
+  context->out_position[0] = ((type & 0x7) << 5) | ECBOR_ADDITIONAL_8BYTE;
+  for (i = 1; i < 9; i ++) {
+    context->out_position[i] = 0;
+  }
+  context->out_position += 9;
+  context->bytes_left -= 9;
+
+  /* the container is a complete child of its parent, as far as the parent is
+     concerned */
+  token.type = type;
+  ecbor_container_account (context, &token);
+
+  container->parent = context->container;
+  context->container = container;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_encode_begin_array (ecbor_encode_context_t *context,
+                          ecbor_container_t *container)
+{
+  return ecbor_encode_begin_container (context, container, ECBOR_TYPE_ARRAY);
+}
+
+ecbor_error_t
+ecbor_encode_begin_map (ecbor_encode_context_t *context,
+                        ecbor_container_t *container)
+{
+  return ecbor_encode_begin_container (context, container, ECBOR_TYPE_MAP);
+}
+
+ecbor_error_t
+ecbor_encode_end_container (ecbor_encode_context_t *context, uint8_t compact)
+{
+  ecbor_container_t *container;
+  uint8_t *payload;
+  uint64_t length;
+  size_t header_size;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  container = context->container;
+  if (!container) {
+    return ECBOR_ERR_NO_OPEN_CONTAINER;
+  }
+  if (container->pending > 0 || container->indefinite > 0) {
+    /* last child is not finished */
+    return ECBOR_ERR_INCOMPLETE_ITEM;
+  }
+  if (compact && container->has_slots) {
+    /* shifting children would invalidate slot offsets */
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  length = container->count;
+  if (container->type == ECBOR_TYPE_MAP) {
+    if (length % 2) {
+      return ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+    }
+    length /= 2;
+  }
+
+  /* patch reserved header */
+  ecbor_store_uint64 (container->header + 1, length);
+
+  /* shift children down if a shorter header fits; not possible if gather
+     segments already reference bytes after the header */
+  length = (container->type == ECBOR_TYPE_MAP ? container->count / 2
+                                              : container->count);
+  header_size = ecbor_uint_encoded_size (length);
+  if (compact && header_size < 9
+      && (!context->segments || context->segment_start <= container->header)) {
+    /* rewrite header in place */
+    (void) ecbor_put_uint_wide (container->header, container->type, length);
+
+    payload = container->header + 9;
+    ecbor_memmove (container->header + header_size, payload,
+                   context->out_position - payload);
+    context->out_position -= (9 - header_size);
+    context->bytes_left += (9 - header_size);
+  }
+
+  if (container->has_slots && container->parent) {
+    container->parent->has_slots = true;
+  }
+  context->container = container->parent;
+  return ECBOR_OK;
+}
+
+/* Write the header of a bulk encoded array */
+static ecbor_error_t
+ecbor_encode_bulk_header (ecbor_encode_context_t *context, const void *values,
+                          size_t count)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  if (!values && count > 0) {
+    return ECBOR_ERR_NULL_VALUE;
+  }
+  if (context->mode != ECBOR_MODE_ENCODE
+      && context->mode != ECBOR_MODE_ENCODE_STREAMED) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  return ecbor_encode_uint (context, ECBOR_TYPE_ARRAY, count);
+}
+
+/* Number of elements of at most <element_size> bytes that can be written in
+   one go, flushing if needed */
+static ecbor_error_t
+ecbor_encode_bulk_chunk (ecbor_encode_context_t *context, size_t count,
+                         size_t element_size, size_t *chunk)
+{
+  ecbor_error_t rc;
+
+  if (context->bytes_left < element_size) {
+    rc = ecbor_encode_reserve (context, element_size);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  (*chunk) = context->bytes_left / element_size;
+  if ((*chunk) > count) {
+    (*chunk) = count;
+  }
+  return ECBOR_OK;
+}
+
+/*
+ * Bulk fp32 elements, vectorized: each block of four little endian floats is
+ * byte swapped and interleaved with the element heads by two shuffles, and
+ * written as 20 bytes with two overlapping 16 byte stores. Returns the number
+ * of elements written, the rest are left to the scalar loop of the caller.
+ * 64-bit elements take a single byte swap and store each, which is as fast.
+ */
+#if defined(__SSSE3__) \
+    || (defined(__ARM_NEON) && defined(__aarch64__) \
+        && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+/* shuffles for the store at the block output and for the one ending at the
+   block output end; 0x80 yields zero, where heads go */
+static const uint8_t ecbor_bulk_perm32[2][16] = {
+  { 0x80, 3, 2, 1, 0, 0x80, 7, 6, 5, 4, 0x80, 11, 10, 9, 8, 0x80 },
+  { 0, 0x80, 7, 6, 5, 4, 0x80, 11, 10, 9, 8, 0x80, 15, 14, 13, 12 }
+};
+
+/* head positions of the two stores */
+static const uint8_t ecbor_bulk_heads32[2][16] = {
+  { 0xff, 0, 0, 0, 0, 0xff, 0, 0, 0, 0, 0xff, 0, 0, 0, 0, 0xff },
+  { 0, 0xff, 0, 0, 0, 0, 0xff, 0, 0, 0, 0, 0xff, 0, 0, 0, 0 }
+};
+
+#if defined(__SSSE3__)
+typedef __m128i ecbor_bulk_vec_t;
+#define ECBOR_BULK_LOAD(p) _mm_loadu_si128 ((const __m128i *) (p))
+#define ECBOR_BULK_STORE(p, v) _mm_storeu_si128 ((__m128i *) (p), (v))
+#define ECBOR_BULK_SPLAT(b) _mm_set1_epi8 ((char) (b))
+#define ECBOR_BULK_SHUFFLE(v, idx) _mm_shuffle_epi8 ((v), (idx))
+#define ECBOR_BULK_AND(a, b) _mm_and_si128 ((a), (b))
+#define ECBOR_BULK_OR(a, b) _mm_or_si128 ((a), (b))
+#else
+typedef uint8x16_t ecbor_bulk_vec_t;
+#define ECBOR_BULK_LOAD(p) vld1q_u8 ((const uint8_t *) (p))
+#define ECBOR_BULK_STORE(p, v) vst1q_u8 ((p), (v))
+#define ECBOR_BULK_SPLAT(b) vdupq_n_u8 ((b))
+#define ECBOR_BULK_SHUFFLE(v, idx) vqtbl1q_u8 ((v), (idx))
+#define ECBOR_BULK_AND(a, b) vandq_u8 ((a), (b))
+#define ECBOR_BULK_OR(a, b) vorrq_u8 ((a), (b))
+#endif
+
+static inline size_t
+ecbor_encode_bulk_fp32 (uint8_t *out, const float *values, size_t count)
+{
+  const uint8_t *in = (const uint8_t *) values;
+  ecbor_bulk_vec_t head = ECBOR_BULK_SPLAT ((ECBOR_TYPE_SPECIAL << 5)
+                                            | ECBOR_ADDITIONAL_4BYTE);
+  ecbor_bulk_vec_t perm0 = ECBOR_BULK_LOAD (ecbor_bulk_perm32[0]);
+  ecbor_bulk_vec_t perm1 = ECBOR_BULK_LOAD (ecbor_bulk_perm32[1]);
+  ecbor_bulk_vec_t head0 =
+    ECBOR_BULK_AND (ECBOR_BULK_LOAD (ecbor_bulk_heads32[0]), head);
+  ecbor_bulk_vec_t head1 =
+    ECBOR_BULK_AND (ECBOR_BULK_LOAD (ecbor_bulk_heads32[1]), head);
+  ecbor_bulk_vec_t v;
+  size_t done = 0;
+
+  for (; done + 4 <= count; done += 4) {
+    v = ECBOR_BULK_LOAD (in);
+    ECBOR_BULK_STORE (out, ECBOR_BULK_OR (ECBOR_BULK_SHUFFLE (v, perm0),
+                                          head0));
+    ECBOR_BULK_STORE (out + 4, ECBOR_BULK_OR (ECBOR_BULK_SHUFFLE (v, perm1),
+                                              head1));
+    in += 16;
+    out += 4 * (1 + sizeof (float));
+  }
+
+  return done;
+}
+
+#else
+
+static inline size_t
+ecbor_encode_bulk_fp32 (uint8_t *out, const float *values, size_t count)
+{
+  (void) out;
+  (void) values;
+  (void) count;
+  return 0;
+}
+
+#endif
+
+/* Account a finished bulk array in the open container, if any */
+static void
+ecbor_encode_bulk_account (ecbor_encode_context_t *context)
+{
+  ecbor_item_t token = null_item;
+  token.type = ECBOR_TYPE_ARRAY;
+  ecbor_container_account (context, &token);
+}
+
+ecbor_error_t
+ecbor_encode_array_u64 (ecbor_encode_context_t *context,
+                        const uint64_t *values, size_t count, uint8_t compact)
+{
+  ecbor_error_t rc;
+  uint8_t *out;
+  size_t chunk, i;
+
+  rc = ecbor_encode_bulk_header (context, values, count);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  while (count > 0) {
+    if (compact && context->bytes_left < 9) {
+      /* not enough slack for wide stores; write exactly one element */
+      rc = ecbor_encode_uint (context, ECBOR_TYPE_UINT, values[0]);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      values ++;
+      count --;
+      continue;
+    }
+
+    rc = ecbor_encode_bulk_chunk (context, count, 9, &chunk);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    out = context->out_position;
+    if (compact) {
+      for (i = 0; i < chunk; i ++) {
+        out += ecbor_put_uint_wide (out, ECBOR_TYPE_UINT, values[i]);
+      }
+    } else {
+      for (i = 0; i < chunk; i ++) {
+        out[0] = (ECBOR_TYPE_UINT << 5) | ECBOR_ADDITIONAL_8BYTE;
+        ecbor_store_uint64 (out + 1, values[i]);
+        out += 9;
+      }
+    }
+
+    context->bytes_left -= (out - context->out_position);
+    context->out_position = out;
+    values += chunk;
+    count -= chunk;
+  }
+
+  ecbor_encode_bulk_account (context);
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_encode_array_i64 (ecbor_encode_context_t *context,
+                        const int64_t *values, size_t count, uint8_t compact)
+{
+  ecbor_error_t rc;
+  uint8_t *out;
+  size_t chunk, i;
+
+  rc = ecbor_encode_bulk_header (context, values, count);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  while (count > 0) {
+    if (compact && context->bytes_left < 9) {
+      /* not enough slack for wide stores; write exactly one element */
+      uint64_t sign = (uint64_t) (values[0] >> 63);
+      rc = ecbor_encode_uint (context, (uint8_t) (sign & 0x1),
+                              ((uint64_t) values[0]) ^ sign);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      values ++;
+      count --;
+      continue;
+    }
+
+    rc = ecbor_encode_bulk_chunk (context, count, 9, &chunk);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    /* negative values are stored as (-1 - value), which is the bitwise
+       complement; <sign> is all ones for negative values */
+    out = context->out_position;
+    if (compact) {
+      for (i = 0; i < chunk; i ++) {
+        uint64_t sign = (uint64_t) (values[i] >> 63);
+        out += ecbor_put_uint_wide (out, (uint8_t) (sign & 0x1),
+                                    ((uint64_t) values[i]) ^ sign);
+      }
+    } else {
+      for (i = 0; i < chunk; i ++) {
+        uint64_t sign = (uint64_t) (values[i] >> 63);
+        out[0] = (uint8_t) (((sign & 0x1) << 5) | ECBOR_ADDITIONAL_8BYTE);
+        ecbor_store_uint64 (out + 1, ((uint64_t) values[i]) ^ sign);
+        out += 9;
+      }
+    }
+
+    context->bytes_left -= (out - context->out_position);
+    context->out_position = out;
+    values += chunk;
+    count -= chunk;
+  }
+
+  ecbor_encode_bulk_account (context);
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_encode_array_f32 (ecbor_encode_context_t *context,
+                        const float *values, size_t count)
+{
+  ecbor_error_t rc;
+  uint8_t *out;
+  size_t chunk, i;
+
+  rc = ecbor_encode_bulk_header (context, values, count);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  while (count > 0) {
+    rc = ecbor_encode_bulk_chunk (context, count, 1 + sizeof (float), &chunk);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    out = context->out_position;
+    i = ecbor_encode_bulk_fp32 (out, values, chunk);
+    out += i * (1 + sizeof (float));
+    for (; i < chunk; i ++) {
+      out[0] = (ECBOR_TYPE_SPECIAL << 5) | ECBOR_ADDITIONAL_4BYTE;
+      ecbor_store_fp32 (out + 1, values[i]);
+      out += 1 + sizeof (float);
+    }
+
+    context->bytes_left -= (out - context->out_position);
+    context->out_position = out;
+    values += chunk;
+    count -= chunk;
+  }
+
+  ecbor_encode_bulk_account (context);
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_encode_array_f64 (ecbor_encode_context_t *context,
+                        const double *values, size_t count)
+{
+  ecbor_error_t rc;
+  uint8_t *out;
+  size_t chunk, i;
+
+  rc = ecbor_encode_bulk_header (context, values, count);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  while (count > 0) {
+    rc = ecbor_encode_bulk_chunk (context, count, 1 + sizeof (double), &chunk);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    out = context->out_position;
+    for (i = 0; i < chunk; i ++) {
+      out[0] = (ECBOR_TYPE_SPECIAL << 5) | ECBOR_ADDITIONAL_8BYTE;
+      ecbor_store_fp64 (out + 1, values[i]);
+      out += 1 + sizeof (double);
+    }
+
+    context->bytes_left -= (out - context->out_position);
+    context->out_position = out;
+    values += chunk;
+    count -= chunk;
+  }
+
+  ecbor_encode_bulk_account (context);
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_encode_slot (ecbor_encode_context_t *context, ecbor_slot_t *slot,
+                   ecbor_type_t type, uint8_t width)
+{
+  ecbor_item_t token = null_item;
+  ecbor_error_t rc;
+  uint8_t major_type, additional, i;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (slot);
+  if (context->mode != ECBOR_MODE_ENCODE
+      && context->mode != ECBOR_MODE_ENCODE_STREAMED) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+  if (context->flush || context->segments) {
+    /* offsets are only meaningful in a contiguous output buffer */
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  /* resolve width policy */
+  switch (type) {
+    case ECBOR_TYPE_UINT:
+      major_type = ECBOR_TYPE_UINT;
+      if (width == 0) {
+        width = sizeof (uint64_t);
+      }
+      break;
+
+    case ECBOR_TYPE_FP32:
+    case ECBOR_TYPE_FP64:
+      major_type = ECBOR_TYPE_SPECIAL;
+      if (width == 0) {
+        width = (type == ECBOR_TYPE_FP32 ? sizeof (float) : sizeof (double));
+      } else if (width != (type == ECBOR_TYPE_FP32 ? sizeof (float)
+                                                   : sizeof (double))) {
+        return ECBOR_ERR_INVALID_ADDITIONAL;
+      }
+      break;
+
+    default:
+      return ECBOR_ERR_INVALID_TYPE;
+  }
+
+  switch (width) {
+    case 1: additional = ECBOR_ADDITIONAL_1BYTE; break;
+    case 2: additional = ECBOR_ADDITIONAL_2BYTE; break;
+    case 4: additional = ECBOR_ADDITIONAL_4BYTE; break;
+    case 8: additional = ECBOR_ADDITIONAL_8BYTE; break;
+    default:
+      return ECBOR_ERR_INVALID_ADDITIONAL;
+  }
+
+  rc = ecbor_encode_reserve (context, 1 + width);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  /* write a zero valued placeholder */
+  slot->offset = context->out_position - context->base;
+  slot->type = type;
+  slot->width = width;
+
+  context->out_position[0] = ((major_type & 0x7) << 5) | additional;
+  for (i = 1; i <= width; i ++) {
+    context->out_position[i] = 0;
+  }
+  context->out_position += 1 + width;
+  context->bytes_left -= 1 + width;
+
+  if (context->container) {
+    context->container->has_slots = true;
+  }
+
+  token.type = type;
+  ecbor_container_account (context, &token);
+  return ECBOR_OK;
+}
+
+/* Write the argument of an integer slot; <major_type> only changes the high
+   bits of the head byte */
+static ecbor_error_t
+ecbor_patch_integer (uint8_t *buffer, const ecbor_slot_t *slot,
+                     uint8_t major_type, uint64_t value)
+{
+  uint8_t *out;
+
+  if (!buffer) {
+    return ECBOR_ERR_NULL_OUTPUT_BUFFER;
+  }
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (slot);
+  if (slot->type != ECBOR_TYPE_UINT) {
+    return ECBOR_ERR_INVALID_TYPE;
+  }
+  if (slot->width < sizeof (uint64_t)
+      && (value >> (8 * slot->width)) != 0) {
+    return ECBOR_ERR_VALUE_OVERFLOW;
+  }
+
+  out = buffer + slot->offset;
+  out[0] = (out[0] & 0x1f) | ((major_type & 0x7) << 5);
+  switch (slot->width) {
+    case 1:
+      out[1] = (uint8_t) value;
+      break;
+
+    case 2:
+      ecbor_store_uint16 (out + 1, (uint16_t) value);
+      break;
+
+    case 4:
+      ecbor_store_uint32 (out + 1, (uint32_t) value);
+      break;
+
+    case 8:
+      ecbor_store_uint64 (out + 1, value);
+      break;
+
+    default:
+      return ECBOR_ERR_INVALID_ADDITIONAL;
+  }
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_patch_uint (uint8_t *buffer, const ecbor_slot_t *slot, uint64_t value)
+{
+  return ecbor_patch_integer (buffer, slot, ECBOR_TYPE_UINT, value);
+}
+
+ecbor_error_t
+ecbor_patch_int (uint8_t *buffer, const ecbor_slot_t *slot, int64_t value)
+{
+  if (value < 0) {
+    return ecbor_patch_integer (buffer, slot, ECBOR_TYPE_NINT,
+                                (uint64_t) ((-1) - value));
+  }
+  return ecbor_patch_integer (buffer, slot, ECBOR_TYPE_UINT,
+                              (uint64_t) value);
+}
+
+ecbor_error_t
+ecbor_patch_fp32 (uint8_t *buffer, const ecbor_slot_t *slot, float value)
+{
+  if (!buffer) {
+    return ECBOR_ERR_NULL_OUTPUT_BUFFER;
+  }
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (slot);
+  if (slot->type == ECBOR_TYPE_FP64) {
+    /* widening is always exact */
+    ecbor_store_fp64 (buffer + slot->offset + 1, (double) value);
+    return ECBOR_OK;
+  }
+  if (slot->type != ECBOR_TYPE_FP32) {
+    return ECBOR_ERR_INVALID_TYPE;
+  }
+
+  ecbor_store_fp32 (buffer + slot->offset + 1, value);
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_patch_fp64 (uint8_t *buffer, const ecbor_slot_t *slot, double value)
+{
+  if (!buffer) {
+    return ECBOR_ERR_NULL_OUTPUT_BUFFER;
+  }
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (slot);
+  if (slot->type == ECBOR_TYPE_FP32) {
+    /* narrow only values single precision holds exactly, NaNs and
+       infinities included; converting a finite value out of its range is
+       undefined, so that is checked first */
+    float narrow;
+    if ((value > FLT_MAX || value < -FLT_MAX) && value - value == 0.0) {
+      return ECBOR_ERR_VALUE_OVERFLOW;
+    }
+    narrow = (float) value;
+    if (value == value && (double) narrow != value) {
+      return ECBOR_ERR_VALUE_OVERFLOW;
+    }
+    ecbor_store_fp32 (buffer + slot->offset + 1, narrow);
+    return ECBOR_OK;
+  }
+  if (slot->type != ECBOR_TYPE_FP64) {
+    return ECBOR_ERR_INVALID_TYPE;
+  }
+
+  ecbor_store_fp64 (buffer + slot->offset + 1, value);
+  return ECBOR_OK;
+}
+
+static inline uint8_t
+ecbor_reencode_is_container (const ecbor_item_t *item)
+{
+  return (item->type == ECBOR_TYPE_ARRAY || item->type == ECBOR_TYPE_MAP
+          || item->type == ECBOR_TYPE_TAG);
+}
+
+void
+ecbor_mark_modified (ecbor_item_t *item)
+{
+  /* a zero size marks the item, and every container holding it, as not
+     matching its source bytes anymore; leaves keep theirs, since indefinite
+     strings still need it to find their chunks. Cached encoded sizes are
+     dropped along the way. */
+  for (; item; item = item->parent) {
+    if (ecbor_reencode_is_container (item)) {
+      item->size = 0;
+    }
+    item->encoded_size = 0;
+  }
+}
+
+/* Source bytes of a decoded definite array, map or tag header, or NULL; items
+   made by the builders have a zero size, so they are always re-encoded */
+static inline const uint8_t *
+ecbor_reencode_source (const ecbor_item_t *item)
+{
+  if (item->size == 0 || item->is_indefinite) {
+    return NULL;
+  }
+
+  switch (item->type) {
+    case ECBOR_TYPE_ARRAY:
+    case ECBOR_TYPE_MAP:
+      return (item->value.items ? item->value.items - item->size : NULL);
+
+    case ECBOR_TYPE_TAG:
+      return (item->value.tag.child ? item->value.tag.child - item->size
+                                    : NULL);
+
+    default:
+      return NULL;
+  }
+}
+
+/* Length of the source bytes of an unmodified subtree, or zero if it has to
+   be re-encoded; the offending item is marked, so that the walk is not
+   repeated for the containers on its path */
+static ecbor_error_t
+ecbor_reencode_extent (ecbor_item_t *item, size_t *extent)
+{
+  ecbor_item_t *node = item;
+  size_t depth = 0, total = 0;
+  ecbor_error_t rc;
+
+  while (node) {
+    if (node->size == 0 || node->is_indefinite) {
+      ecbor_mark_modified (node);
+      (*extent) = 0;
+      return ECBOR_OK;
+    }
+    total += node->size;
+
+    if (ecbor_item_child_count (node) > 0) {
+      rc = ecbor_walk_descend (&node, &depth);
+    } else {
+      rc = ecbor_walk_ascend (item, &node, &depth, false);
+    }
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  (*extent) = total;
+  return ECBOR_OK;
+}
+
+/* Write a single node in definite form */
+static ecbor_error_t
+ecbor_reencode_item (ecbor_encode_context_t *context, ecbor_item_t *item)
+{
+  ecbor_decode_context_t chunks;
+  ecbor_item_t chunk;
+  ecbor_error_t rc;
+  size_t i;
+
+  if (!item->is_indefinite) {
+    return ecbor_encode_item (context, item);
+  }
+
+  switch (item->type) {
+    case ECBOR_TYPE_ARRAY:
+      return ecbor_encode_uint (context, ECBOR_TYPE_ARRAY, item->length);
+
+    case ECBOR_TYPE_MAP:
+      if (item->length % 2) {
+        return ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+      }
+      return ecbor_encode_uint (context, ECBOR_TYPE_MAP, item->length / 2);
+
+    case ECBOR_TYPE_BSTR:
+    case ECBOR_TYPE_STR:
+      /* concatenate chunks; they lie between the first byte and the stop
+         code of the source */
+      if (!item->value.string.str || item->size < 2) {
+        return ECBOR_ERR_NULL_VALUE;
+      }
+
+      rc = ecbor_encode_uint (context, item->type, item->length);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+
+      rc = ecbor_initialize_decode (&chunks, item->value.string.str,
+                                    item->size - 2);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      for (i = 0; i < item->value.string.n_chunks; i ++) {
+        rc = ecbor_decode (&chunks, &chunk);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+        if (chunk.type != item->type) {
+          return ECBOR_ERR_INVALID_CHUNK_MAJOR_TYPE;
+        }
+        rc = ecbor_encode_payload (context, chunk.value.string.str,
+                                   chunk.length);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+      }
+      return ECBOR_OK;
+
+    default:
+      return ecbor_encode_item (context, item);
+  }
+}
+
+ecbor_error_t
+ecbor_reencode (ecbor_encode_context_t *context, ecbor_item_t *item)
+{
+  ecbor_item_t *node;
+  const uint8_t *source;
+  size_t depth = 0, extent;
+  ecbor_error_t rc;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (context);
+  ECBOR_INTERNAL_CHECK_ITEM_PTR (item);
+  if (context->mode != ECBOR_MODE_ENCODE) {
+    return ECBOR_ERR_WRONG_MODE;
+  }
+
+  node = item;
+  while (node) {
+    /* copy unmodified subtrees verbatim */
+    source = ecbor_reencode_source (node);
+    if (source) {
+      rc = ecbor_reencode_extent (node, &extent);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+      if (extent > 0) {
+        rc = ecbor_encode_payload (context, source, extent);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+        rc = ecbor_walk_ascend (item, &node, &depth, false);
+        if (rc != ECBOR_OK) {
+          return rc;
+        }
+        continue;
+      }
+    }
+
+    rc = ecbor_reencode_item (context, node);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    if (ecbor_item_child_count (node) > 0) {
+      rc = ecbor_walk_descend (&node, &depth);
+    } else {
+      rc = ecbor_walk_ascend (item, &node, &depth, false);
+    }
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  ecbor_container_account (context, item);
+  return ECBOR_OK;
+}
+
+/* Size of the item itself, without children, as written by ecbor_encode() in
+   normal mode; fails wherever ecbor_encode() would, short of running out of
+   buffer */
+static ecbor_error_t
+ecbor_item_encoded_size (const ecbor_item_t *item, size_t *size)
+{
+  switch (item->type) {
+    case ECBOR_TYPE_UINT:
+      (*size) = ecbor_uint_encoded_size (item->value.uinteger);
+      break;
+
+    case ECBOR_TYPE_NINT:
+      (*size) = ecbor_uint_encoded_size ((-1) - item->value.integer);
+      break;
+
+    case ECBOR_TYPE_BSTR:
+    case ECBOR_TYPE_STR:
+      if (item->is_indefinite) {
+        return ECBOR_ERR_WONT_ENCODE_INDEFINITE;
+      }
+      if (!item->value.string.str && item->length > 0) {
+        return ECBOR_ERR_NULL_VALUE;
+      }
+      (*size) = ecbor_uint_encoded_size (item->length) + item->length;
+      break;
+
+    case ECBOR_TYPE_ARRAY:
+    case ECBOR_TYPE_MAP:
+      if (item->is_indefinite) {
+        return ECBOR_ERR_WONT_ENCODE_INDEFINITE;
+      }
+      if (item->type == ECBOR_TYPE_MAP) {
+        if (item->length % 2) {
+          return ECBOR_ERR_INVALID_KEY_VALUE_PAIR;
+        }
+        (*size) = ecbor_uint_encoded_size (item->length / 2);
+      } else {
+        (*size) = ecbor_uint_encoded_size (item->length);
+      }
+      break;
+
+    case ECBOR_TYPE_TAG:
+      (*size) = ecbor_uint_encoded_size (item->value.tag.tag_value);
+      break;
+
+    case ECBOR_TYPE_FP32:
+      (*size) = 1 + sizeof (float);
+      break;
+
+    case ECBOR_TYPE_FP64:
+      (*size) = 1 + sizeof (double);
+      break;
+
+    case ECBOR_TYPE_STOP_CODE:
+    case ECBOR_TYPE_BOOL:
+    case ECBOR_TYPE_NULL:
+    case ECBOR_TYPE_UNDEFINED:
+      (*size) = 1;
+      break;
+
+    case ECBOR_TYPE_RAW:
+      if (!item->value.items && item->length > 0) {
+        return ECBOR_ERR_NULL_VALUE;
+      }
+      (*size) = item->length;
+      break;
+
+    default:
+      return ECBOR_ERR_INVALID_TYPE;
+  }
+
+  return ECBOR_OK;
+}
+
+/* Level of the read-only size walk: the child being visited and how many of
+   its siblings are left after it */
+typedef struct {
+  const ecbor_item_t *node;
+  size_t left;
+} ecbor_size_level_t;
+
+ecbor_error_t
+ecbor_encoded_size (const ecbor_item_t *item, size_t *size)
+{
+  /* the tree is only read, so the path is kept here instead of in the parent
+     and index links the encoder walk refreshes */
+  ecbor_size_level_t path[ECBOR_MAX_NESTING_DEPTH];
+  const ecbor_item_t *node = item;
+  size_t total = 0, depth = 0, node_size;
+  ecbor_error_t rc;
+
+  ECBOR_INTERNAL_CHECK_ITEM_PTR (item);
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (size);
+
+  while (node) {
+    rc = ecbor_item_encoded_size (node, &node_size);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+    total += node_size;
+
+    if (ecbor_item_child_count (node) > 0) {
+      /* first child */
+      ECBOR_INTERNAL_CHECK_ITEM_PTR (node->child);
+      if (depth >= ECBOR_MAX_NESTING_DEPTH) {
+        return ECBOR_ERR_NESTING_TOO_DEEP;
+      }
+      path[depth].node = node->child;
+      path[depth].left = ecbor_item_child_count (node) - 1;
+      node = node->child;
+      depth ++;
+      continue;
+    }
+
+    /* next sibling, up as many levels as needed */
+    while (depth > 0 && path[depth - 1].left == 0) {
+      depth --;
+    }
+    if (depth == 0) {
+      break;
+    }
+    ECBOR_INTERNAL_CHECK_ITEM_PTR (path[depth - 1].node->next);
+    path[depth - 1].node = path[depth - 1].node->next;
+    path[depth - 1].left --;
+    node = path[depth - 1].node;
+  }
+
+  (*size) = total;
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_cache_encoded_size (ecbor_item_t *item, size_t *size)
+{
+  ecbor_item_t *node = item;
+  size_t total = 0, depth = 0;
+  ecbor_error_t rc;
+
+  ECBOR_INTERNAL_CHECK_ITEM_PTR (item);
+  ECBOR_INTERNAL_CHECK_VALUE_PTR (size);
+
+  while (node) {
+    size_t node_size;
+
+    rc = ecbor_item_encoded_size (node, &node_size);
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+
+    total += node_size;
+    node->encoded_size = node_size;
+
+    if (ecbor_item_child_count (node) > 0) {
+      rc = ecbor_walk_descend (&node, &depth);
+    } else {
+      rc = ecbor_walk_ascend (item, &node, &depth, true);
+    }
+    if (rc != ECBOR_OK) {
+      return rc;
+    }
+  }
+
+  (*size) = total;
+  return ECBOR_OK;
+}
+
+ecbor_item_t
+ecbor_int (int64_t value)
+{
+  ecbor_item_t r = null_item;
+  if (value >= 0) {
+    r.type = ECBOR_TYPE_UINT;
+    r.value.uinteger = (uint64_t) value;
+  } else {
+    r.type = ECBOR_TYPE_NINT;
+    r.value.integer = value;
+  }
+  return r;
+}
+
+ecbor_item_t
+ecbor_uint (uint64_t value)
+{
+  ecbor_item_t r = null_item;
+  r.type = ECBOR_TYPE_UINT;
+  r.value.uinteger = value;
+  return r;
+}
+
+ecbor_item_t
+ecbor_bstr (const uint8_t *bstr, size_t length)
+{
+  ecbor_item_t r = null_item;
+  r.is_indefinite = false;
+  r.type = ECBOR_TYPE_BSTR;
+  r.value.string.str = bstr;
+  r.length = length;
+  return r;
+}
+
+ecbor_item_t
+ecbor_str (const char *str, size_t length)
+{
+  ecbor_item_t r = null_item;
+  r.is_indefinite = false;
+  r.type = ECBOR_TYPE_STR;
+  r.value.string.str = (uint8_t *)str;
+  r.length = length;
+  return r;
+}
+
+ecbor_item_t
+ecbor_tag (ecbor_item_t *child, uint64_t tag_value)
+{
+  ecbor_item_t r = null_item;
+  r.type = ECBOR_TYPE_TAG;
+  r.child = child;
+  r.value.tag.tag_value = tag_value;
+  return r;
+}
+
+ecbor_item_t
+ecbor_fp32 (float value)
+{
+  ecbor_item_t r = null_item;
+  r.type = ECBOR_TYPE_FP32;
+  r.value.fp32 = value;
+  return r;
+}
 
 ecbor_item_t
 ecbor_fp64 (double value)
@@ -478,6 +1850,16 @@ ecbor_undefined (void)
   return r;
 }
 
+ecbor_item_t
+ecbor_raw (const uint8_t *cbor, size_t length)
+{
+  ecbor_item_t r = null_item;
+  r.type = ECBOR_TYPE_RAW;
+  r.value.items = cbor;
+  r.length = length;
+  return r;
+}
+
 ecbor_item_t
 ecbor_array_token (size_t length)
 {
@@ -501,7 +1883,7 @@ ecbor_map_token (size_t length)
 {
   ecbor_item_t r = null_item;
   r.type = ECBOR_TYPE_MAP;
-  r.length = length;
+  r.length = length * 2;
   return r;
 }
 
@@ -536,16 +1918,20 @@ ecbor_array (ecbor_item_t *array, ecbor_item_t *items, size_t length)
   array->type = ECBOR_TYPE_ARRAY;
   array->is_indefinite = false;
   array->length = length;
+  array->size = 0;
+  array->encoded_size = 0;
+  array->parent = NULL;
   array->child = items;
   
   if (length > 0) {
     ECBOR_INTERNAL_CHECK_ITEM_PTR (items);
-    items->parent = array;
 
-    for (i = 1; i < length; i ++) {
+    for (i = 0; i < length; i ++, items ++) {
+      items->parent = array;
+      items->index = i;
       items->next = (items + 1);
-      items ++;
     }
+    (items - 1)->next = NULL;
   }
   
   return ECBOR_OK;
@@ -564,6 +1950,10 @@ ecbor_map (ecbor_item_t *map, ecbor_item_t *keys, ecbor_item_t *values,
   map->is_indefinite = false;
   map->type = ECBOR_TYPE_MAP;
   map->length = length * 2;
+  map->size = 0;
+  map->encoded_size = 0;
+  map->parent = NULL;
+  map->child = NULL;
 
   if (length > 0) {
     ECBOR_INTERNAL_CHECK_ITEM_PTR (keys);
@@ -573,10 +1963,12 @@ ecbor_map (ecbor_item_t *map, ecbor_item_t *keys, ecbor_item_t *values,
     for (i = 0; i < length; i ++, keys ++, values ++) {
       keys->parent = map;
       values->parent = map;
+      keys->index = i * 2;
+      values->index = i * 2 + 1;
       keys->next = values;
       values->next = keys + 1;
     }
-    values->next = NULL;
+    (values - 1)->next = NULL;
   }
 
   return ECBOR_OK;
@@ -50,6 +50,7 @@ static const ecbor_item_t null_item = {
     }
   },
   .size = 0,
+  .encoded_size = 0,
   .length = 0,
   .is_indefinite = 0,
   .parent = NULL,
@@ -66,6 +67,18 @@ static const ecbor_item_t null_item = {
       return ECBOR_ERR_NULL_CONTEXT;        \
     }                                       \
   }
+#define ECBOR_INTERNAL_CHECK_ARENA_PTR(a) \
+  {                                       \
+    if (!(a)) {                           \
+      return ECBOR_ERR_NULL_PARAMETER;    \
+    }                                     \
+  }
+#define ECBOR_INTERNAL_CHECK_POOL_PTR(p)  \
+  {                                       \
+    if (!(p)) {                           \
+      return ECBOR_ERR_NULL_ITEM_BUFFER;  \
+    }                                     \
+  }
 #define ECBOR_INTERNAL_CHECK_ITEM_PTR(i)  \
   {                                       \
     if (!(i)) {                           \
@@ -94,40 +107,242 @@ static const ecbor_item_t null_item = {
     }                                             \
   }
 
+/*
+ * Number of items taken from the arena at once, when a tree outgrows the item
+ * buffer
+ */
+#define ECBOR_ARENA_ITEM_BLOCK 64
+
+/*
+ * Smallest refill window; must hold the largest item head
+ */
+#define ECBOR_REFILL_MIN_WINDOW 9
+
+/* Items of a pool block */
+#define ECBOR_ITEM_BLOCK_ITEMS(b) \
+  ((ecbor_item_t *) ((ecbor_item_block_t *) (b) + 1))
+
+/* Item pool internals */
+extern ecbor_error_t
+ecbor_item_pool_acquire (ecbor_item_pool_t *pool, ecbor_item_block_t **block);
+
+extern void
+ecbor_item_pool_release (ecbor_item_pool_t *pool, ecbor_item_block_t *blocks);
+
+/* Encoded size of an item tree, taken from the cache when there is one */
+static inline ecbor_error_t
+ecbor_encoded_size_cached (const ecbor_item_t *item, size_t *size)
+{
+  if (item->encoded_size > 0) {
+    (*size) = item->encoded_size;
+    return ECBOR_OK;
+  }
+  return ecbor_encoded_size (item, size);
+}
+
 /*
  * Endianness
  */
-extern uint16_t
-ecbor_uint16_from_big_endian (uint16_t value);
+#if !defined(__BYTE_ORDER__) \
+    || ((__BYTE_ORDER__ != __ORDER_BIG_ENDIAN__) \
+        && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__))
+  #error "Endianness not supported!"
+#endif
 
-extern uint32_t
-ecbor_uint32_from_big_endian (uint32_t value);
+static inline uint16_t
+ecbor_uint16_from_big_endian (uint16_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return value;
+#else
+  return __builtin_bswap16 (value);
+#endif
+}
 
-extern uint64_t
-ecbor_uint64_from_big_endian (uint64_t value);
+static inline uint32_t
+ecbor_uint32_from_big_endian (uint32_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return value;
+#else
+  return __builtin_bswap32 (value);
+#endif
+}
 
-extern float
-ecbor_fp32_from_big_endian (float value);
+static inline uint64_t
+ecbor_uint64_from_big_endian (uint64_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return value;
+#else
+  return __builtin_bswap64 (value);
+#endif
+}
 
-extern double
-ecbor_fp64_from_big_endian (double value);
+#define ecbor_uint16_to_big_endian ecbor_uint16_from_big_endian
+#define ecbor_uint32_to_big_endian ecbor_uint32_from_big_endian
+#define ecbor_uint64_to_big_endian ecbor_uint64_from_big_endian
 
+/*
+ * Unaligned big endian loads and stores; fixed size builtin copies compile to
+ * single (unaligned) memory accesses and never call into a C library
+ */
+static inline uint16_t
+ecbor_load_uint16 (const uint8_t *buffer)
+{
+  uint16_t value;
+  __builtin_memcpy (&value, buffer, sizeof (value));
+  return ecbor_uint16_from_big_endian (value);
+}
+
+static inline uint32_t
+ecbor_load_uint32 (const uint8_t *buffer)
+{
+  uint32_t value;
+  __builtin_memcpy (&value, buffer, sizeof (value));
+  return ecbor_uint32_from_big_endian (value);
+}
 
-extern uint16_t
-ecbor_uint16_to_big_endian (uint16_t value);
+static inline uint64_t
+ecbor_load_uint64 (const uint8_t *buffer)
+{
+  uint64_t value;
+  __builtin_memcpy (&value, buffer, sizeof (value));
+  return ecbor_uint64_from_big_endian (value);
+}
 
-extern uint32_t
-ecbor_uint32_to_big_endian (uint32_t value);
+static inline float
+ecbor_load_fp32 (const uint8_t *buffer)
+{
+  uint32_t bits = ecbor_load_uint32 (buffer);
+  float value;
+  __builtin_memcpy (&value, &bits, sizeof (value));
+  return value;
+}
 
-extern uint64_t
-ecbor_uint64_to_big_endian (uint64_t value);
+static inline double
+ecbor_load_fp64 (const uint8_t *buffer)
+{
+  uint64_t bits = ecbor_load_uint64 (buffer);
+  double value;
+  __builtin_memcpy (&value, &bits, sizeof (value));
+  return value;
+}
 
-extern float
-ecbor_fp32_to_big_endian (float value);
+static inline void
+ecbor_store_uint16 (uint8_t *buffer, uint16_t value)
+{
+  value = ecbor_uint16_to_big_endian (value);
+  __builtin_memcpy (buffer, &value, sizeof (value));
+}
 
-extern double
-ecbor_fp64_to_big_endian (double value);
+static inline void
+ecbor_store_uint32 (uint8_t *buffer, uint32_t value)
+{
+  value = ecbor_uint32_to_big_endian (value);
+  __builtin_memcpy (buffer, &value, sizeof (value));
+}
 
+static inline void
+ecbor_store_uint64 (uint8_t *buffer, uint64_t value)
+{
+  value = ecbor_uint64_to_big_endian (value);
+  __builtin_memcpy (buffer, &value, sizeof (value));
+}
+
+static inline void
+ecbor_store_fp32 (uint8_t *buffer, float value)
+{
+  uint32_t bits;
+  __builtin_memcpy (&bits, &value, sizeof (bits));
+  ecbor_store_uint32 (buffer, bits);
+}
+
+static inline void
+ecbor_store_fp64 (uint8_t *buffer, double value)
+{
+  uint64_t bits;
+  __builtin_memcpy (&bits, &value, sizeof (bits));
+  ecbor_store_uint64 (buffer, bits);
+}
+
+/*
+ * Integer heads
+ */
+
+/* additional information for values above ECBOR_ADDITIONAL_LAST_INTEGER,
+   indexed by the number of leading zero bits of the value */
+static const uint8_t ecbor_additional_by_clz[64] = {
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_8BYTE, ECBOR_ADDITIONAL_8BYTE,
+  ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE,
+  ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE,
+  ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE,
+  ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE,
+  ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE, ECBOR_ADDITIONAL_4BYTE,
+  ECBOR_ADDITIONAL_4BYTE,
+  ECBOR_ADDITIONAL_2BYTE, ECBOR_ADDITIONAL_2BYTE, ECBOR_ADDITIONAL_2BYTE,
+  ECBOR_ADDITIONAL_2BYTE, ECBOR_ADDITIONAL_2BYTE, ECBOR_ADDITIONAL_2BYTE,
+  ECBOR_ADDITIONAL_2BYTE, ECBOR_ADDITIONAL_2BYTE,
+  ECBOR_ADDITIONAL_1BYTE, ECBOR_ADDITIONAL_1BYTE, ECBOR_ADDITIONAL_1BYTE,
+  ECBOR_ADDITIONAL_1BYTE, ECBOR_ADDITIONAL_1BYTE, ECBOR_ADDITIONAL_1BYTE,
+  ECBOR_ADDITIONAL_1BYTE, ECBOR_ADDITIONAL_1BYTE
+};
+
+/* additional information needed to store <value> */
+static inline uint8_t
+ecbor_uint_additional (uint64_t value)
+{
+  if (value <= ECBOR_ADDITIONAL_LAST_INTEGER) {
+    return (uint8_t) value;
+  }
+  return ecbor_additional_by_clz[__builtin_clzll (value)];
+}
+
+/* number of bytes following the first one, for a given additional info */
+#define ECBOR_ADDITIONAL_WIDTH(a) \
+  ((a) < ECBOR_ADDITIONAL_1BYTE ? 0 : (1 << ((a) - ECBOR_ADDITIONAL_1BYTE)))
+
+/* Write an integer head to <buffer>; requires 9 writable bytes, of which only
+   the returned number is meaningful */
+static inline size_t
+ecbor_put_uint_wide (uint8_t *buffer, uint8_t major_type, uint64_t value)
+{
+  uint8_t additional = ecbor_uint_additional (value);
+  size_t width = ECBOR_ADDITIONAL_WIDTH (additional);
+
+  buffer[0] = ((major_type & 0x7) << 5) | additional;
+  if (width > 0) {
+    /* one wide store, value aligned to the first byte */
+    ecbor_store_uint64 (buffer + 1, value << (64 - 8 * width));
+  }
+  return 1 + width;
+}
+
+/* Write an integer head to <buffer>, without touching bytes past it */
+static inline size_t
+ecbor_put_uint (uint8_t *buffer, uint8_t major_type, uint64_t value)
+{
+  uint8_t additional = ecbor_uint_additional (value);
+  size_t width = ECBOR_ADDITIONAL_WIDTH (additional);
+  size_t i;
+
+  buffer[0] = ((major_type & 0x7) << 5) | additional;
+  for (i = width; i > 0; i --) {
+    buffer[i] = (uint8_t) value;
+    value >>= 8;
+  }
+  return 1 + width;
+}
 
 /*
  * Memory
@@ -135,4 +350,7 @@ ecbor_fp64_to_big_endian (double value);
 extern void
 ecbor_memcpy (void *dest, void *src, size_t num);
 
+extern void
+ecbor_memmove (void *dest, const void *src, size_t num);
+
 #endif
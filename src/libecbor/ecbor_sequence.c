@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2018 Vasile Vilvoiu <vasi.vilvoiu@gmail.com>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "ecbor.h"
+#include "ecbor_internal.h"
+
+/*
+ * Writers reserve space with a single atomic add on <reserved>, write their
+ * record, then add its size to <written>; records are committed in any order
+ * and no writer waits on another. Whenever <written> catches up with
+ * <reserved>, every record before that offset is complete and the writer
+ * publishes it in <committed>, for readers.
+ *
+ * The writer whose reservation crosses the end of the buffer closes it: it
+ * records the end of the last record in <closed> and adds the remainder up to
+ * ECBOR_SEQUENCE_CLOSED to <written>. The writer that brings <written> to
+ * exactly that value, which is the last one to finish, rotates the buffer.
+ * Writers that reserved past the end wait for the next generation and retry;
+ * this is the only wait, and only happens on a full buffer.
+ */
+
+#define ECBOR_SEQUENCE_GENERATION(s) ((uint32_t) ((s) >> 32))
+#define ECBOR_SEQUENCE_OFFSET(s) ((size_t) ((s) & 0xFFFFFFFF))
+#define ECBOR_SEQUENCE_STATE(g, o) \
+  ((((uint64_t) (g)) << 32) | (uint64_t) (o))
+
+/* Written bytes of a closed buffer, once all its records are complete; above
+   any capacity */
+#define ECBOR_SEQUENCE_CLOSED 0x80000000
+
+static inline void
+ecbor_sequence_wait (ecbor_sequence_t *sequence)
+{
+  if (sequence->yield) {
+    sequence->yield (sequence->yield_data);
+  } else {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause ();
+#endif
+  }
+}
+
+/* Wait until the buffer of <generation> has been rotated */
+static inline void
+ecbor_sequence_wait_rotated (ecbor_sequence_t *sequence, uint32_t generation)
+{
+  while (ECBOR_SEQUENCE_GENERATION (
+           __atomic_load_n (&sequence->reserved, __ATOMIC_ACQUIRE))
+         == generation) {
+    ecbor_sequence_wait (sequence);
+  }
+}
+
+ecbor_error_t
+ecbor_initialize_sequence (ecbor_sequence_t *sequence, uint8_t *buffer,
+                           size_t capacity, ecbor_rotate_callback_t rotate,
+                           void *user_data)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (sequence);
+  if (!buffer) {
+    return ECBOR_ERR_NULL_OUTPUT_BUFFER;
+  }
+  if (!rotate) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+  if (capacity > ECBOR_SEQUENCE_MAX_CAPACITY) {
+    return ECBOR_ERR_BUFFER_TOO_LARGE;
+  }
+
+  sequence->buffer = buffer;
+  sequence->capacity = capacity;
+  sequence->reserved = 0;
+  sequence->written = 0;
+  sequence->committed = 0;
+  sequence->closed = 0;
+  sequence->rotate = rotate;
+  sequence->rotate_data = user_data;
+  sequence->yield = NULL;
+  sequence->yield_data = NULL;
+
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_set_sequence_yield (ecbor_sequence_t *sequence,
+                          ecbor_yield_callback_t yield, void *user_data)
+{
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (sequence);
+
+  sequence->yield = yield;
+  sequence->yield_data = user_data;
+
+  return ECBOR_OK;
+}
+
+/* Hand the buffer of <generation> to the rotation callback and start the
+   next generation; the buffer is reused, and its contents lost, if the
+   callback fails */
+static ecbor_error_t
+ecbor_sequence_rotate (ecbor_sequence_t *sequence, uint32_t generation)
+{
+  uint8_t *buffer, *next;
+  size_t size;
+  ecbor_error_t rc = ECBOR_OK;
+
+  buffer = __atomic_load_n (&sequence->buffer, __ATOMIC_RELAXED);
+  size = __atomic_load_n (&sequence->closed, __ATOMIC_RELAXED);
+  next = buffer;
+  if (size > 0) {
+    rc = sequence->rotate (sequence->rotate_data, buffer, size, &next);
+    if (rc != ECBOR_OK || !next) {
+      next = buffer;
+    }
+  }
+
+  /* readers must see the new generation before the new buffer; writers find
+     both through <reserved>, which is reset last */
+  __atomic_store_n (&sequence->committed,
+                    ECBOR_SEQUENCE_STATE (generation + 1, 0),
+                    __ATOMIC_RELEASE);
+  __atomic_store_n (&sequence->buffer, next, __ATOMIC_RELEASE);
+  __atomic_store_n (&sequence->written,
+                    ECBOR_SEQUENCE_STATE (generation + 1, 0),
+                    __ATOMIC_RELAXED);
+  __atomic_store_n (&sequence->reserved,
+                    ECBOR_SEQUENCE_STATE (generation + 1, 0),
+                    __ATOMIC_RELEASE);
+
+  return rc;
+}
+
+/* Close the buffer at the end of the reservation <state>, the first one past
+   the end; rotates it if no record is still being written */
+static ecbor_error_t
+ecbor_sequence_close (ecbor_sequence_t *sequence, uint64_t state)
+{
+  size_t end = ECBOR_SEQUENCE_OFFSET (state);
+  uint64_t written;
+
+  __atomic_store_n (&sequence->closed, end, __ATOMIC_RELAXED);
+  written = __atomic_add_fetch (&sequence->written,
+                                (uint64_t) (ECBOR_SEQUENCE_CLOSED - end),
+                                __ATOMIC_ACQ_REL);
+  if (ECBOR_SEQUENCE_OFFSET (written) == ECBOR_SEQUENCE_CLOSED) {
+    return ecbor_sequence_rotate (sequence,
+                                  ECBOR_SEQUENCE_GENERATION (state));
+  }
+  return ECBOR_OK;
+}
+
+/* Reserve <size> bytes; closes the buffer, or waits for another writer to
+   close it, when full. Returns the slot (generation and offset) reserved. */
+static ecbor_error_t
+ecbor_sequence_reserve (ecbor_sequence_t *sequence, size_t size,
+                        uint64_t *slot)
+{
+  uint64_t state;
+  size_t start;
+  ecbor_error_t rc;
+
+  if (size > sequence->capacity) {
+    return ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+
+  while (true) {
+    state = __atomic_load_n (&sequence->reserved, __ATOMIC_ACQUIRE);
+    if (ECBOR_SEQUENCE_OFFSET (state) > sequence->capacity) {
+      /* already closed; no need to push the offset further */
+      ecbor_sequence_wait_rotated (sequence,
+                                   ECBOR_SEQUENCE_GENERATION (state));
+      continue;
+    }
+
+    state = __atomic_fetch_add (&sequence->reserved, (uint64_t) size,
+                                __ATOMIC_ACQ_REL);
+    start = ECBOR_SEQUENCE_OFFSET (state);
+
+    if (start + size <= sequence->capacity) {
+      (*slot) = state;
+      return ECBOR_OK;
+    }
+
+    if (start <= sequence->capacity) {
+      /* first reservation past the end; this writer closes the buffer */
+      rc = ecbor_sequence_close (sequence, state);
+      if (rc != ECBOR_OK) {
+        return rc;
+      }
+    }
+    ecbor_sequence_wait_rotated (sequence,
+                                 ECBOR_SEQUENCE_GENERATION (state));
+  }
+}
+
+/* Mark the record at <slot> as complete, publishing it (and all records
+   before it) if no earlier record is still being written */
+static ecbor_error_t
+ecbor_sequence_commit (ecbor_sequence_t *sequence, uint64_t slot, size_t size)
+{
+  uint64_t written, reserved, committed;
+
+  written = __atomic_add_fetch (&sequence->written, (uint64_t) size,
+                                __ATOMIC_ACQ_REL);
+  if (ECBOR_SEQUENCE_OFFSET (written) == ECBOR_SEQUENCE_CLOSED) {
+    /* last record of a closed buffer */
+    return ecbor_sequence_rotate (sequence,
+                                  ECBOR_SEQUENCE_GENERATION (slot));
+  }
+
+  /* all reserved records are written; a later reservation, or a rotation,
+     only means someone else publishes */
+  reserved = __atomic_load_n (&sequence->reserved, __ATOMIC_ACQUIRE);
+  if (reserved != written) {
+    return ECBOR_OK;
+  }
+
+  committed = __atomic_load_n (&sequence->committed, __ATOMIC_RELAXED);
+  while (ECBOR_SEQUENCE_GENERATION (committed)
+           == ECBOR_SEQUENCE_GENERATION (written)
+         && ECBOR_SEQUENCE_OFFSET (committed)
+           < ECBOR_SEQUENCE_OFFSET (written)) {
+    if (__atomic_compare_exchange_n (&sequence->committed, &committed,
+                                     written, true, __ATOMIC_RELEASE,
+                                     __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  return ECBOR_OK;
+}
+
+ecbor_error_t
+ecbor_sequence_append (ecbor_sequence_t *sequence, ecbor_item_t *item)
+{
+  ecbor_encode_context_t context;
+  ecbor_error_t rc, commit_rc;
+  uint64_t slot;
+  uint8_t *record;
+  size_t size, i;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (sequence);
+  ECBOR_INTERNAL_CHECK_ITEM_PTR (item);
+
+  rc = ecbor_encoded_size_cached (item, &size);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  rc = ecbor_sequence_reserve (sequence, size, &slot);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  /* encode in place; the record size is exact, so no staging is needed */
+  record = __atomic_load_n (&sequence->buffer, __ATOMIC_RELAXED)
+           + ECBOR_SEQUENCE_OFFSET (slot);
+  rc = ecbor_initialize_encode (&context, record, size);
+  if (rc == ECBOR_OK) {
+    rc = ecbor_encode (&context, item);
+  }
+  if (rc == ECBOR_OK && ECBOR_GET_ENCODED_BUFFER_SIZE (&context) != size) {
+    /* stale cached size */
+    rc = ECBOR_ERR_INVALID_END_OF_BUFFER;
+  }
+  if (rc != ECBOR_OK) {
+    /* the slot must be committed regardless; fill it with well-formed
+       'undefined' items rather than garbage */
+    for (i = 0; i < size; i ++) {
+      record[i] = ((ECBOR_TYPE_SPECIAL << 5) | ECBOR_SIMPLE_UNDEFINED);
+    }
+  }
+
+  commit_rc = ecbor_sequence_commit (sequence, slot, size);
+  return (rc != ECBOR_OK ? rc : commit_rc);
+}
+
+ecbor_error_t
+ecbor_sequence_append_raw (ecbor_sequence_t *sequence, const uint8_t *bytes,
+                           size_t size)
+{
+  ecbor_error_t rc;
+  uint64_t slot;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (sequence);
+  if (!bytes) {
+    return ECBOR_ERR_NULL_VALUE;
+  }
+  if (size == 0) {
+    return ECBOR_OK;
+  }
+
+  rc = ecbor_sequence_reserve (sequence, size, &slot);
+  if (rc != ECBOR_OK) {
+    return rc;
+  }
+
+  ecbor_memcpy (__atomic_load_n (&sequence->buffer, __ATOMIC_RELAXED)
+                  + ECBOR_SEQUENCE_OFFSET (slot),
+                (void *) bytes, size);
+
+  return ecbor_sequence_commit (sequence, slot, size);
+}
+
+ecbor_error_t
+ecbor_sequence_flush (ecbor_sequence_t *sequence)
+{
+  ecbor_error_t rc = ECBOR_OK;
+  uint64_t state;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (sequence);
+
+  /* mark the buffer full, which makes this the closing writer; unless it
+     already is full, and another writer closed it */
+  state = __atomic_load_n (&sequence->reserved, __ATOMIC_ACQUIRE);
+  while (ECBOR_SEQUENCE_OFFSET (state) <= sequence->capacity) {
+    if (__atomic_compare_exchange_n (&sequence->reserved, &state,
+                                     ECBOR_SEQUENCE_STATE (
+                                       ECBOR_SEQUENCE_GENERATION (state),
+                                       sequence->capacity + 1),
+                                     false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+      rc = ecbor_sequence_close (sequence, state);
+      break;
+    }
+  }
+
+  /* records still being written are rotated out by their writers */
+  ecbor_sequence_wait_rotated (sequence, ECBOR_SEQUENCE_GENERATION (state));
+  return rc;
+}
+
+ecbor_error_t
+ecbor_sequence_get_committed (ecbor_sequence_t *sequence,
+                              const uint8_t **buffer, size_t *size,
+                              uint32_t *generation)
+{
+  uint64_t state, check;
+
+  ECBOR_INTERNAL_CHECK_CONTEXT_PTR (sequence);
+  if (!buffer || !size) {
+    return ECBOR_ERR_NULL_PARAMETER;
+  }
+
+  /* a buffer loaded between two reads of the same generation belongs to
+     it; rotation publishes the new generation before the new buffer */
+  do {
+    state = __atomic_load_n (&sequence->committed, __ATOMIC_ACQUIRE);
+    (*buffer) = __atomic_load_n (&sequence->buffer, __ATOMIC_ACQUIRE);
+    check = __atomic_load_n (&sequence->committed, __ATOMIC_ACQUIRE);
+  } while (ECBOR_SEQUENCE_GENERATION (state)
+           != ECBOR_SEQUENCE_GENERATION (check));
+
+  (*size) = ECBOR_SEQUENCE_OFFSET (state);
+  if (generation) {
+    (*generation) = ECBOR_SEQUENCE_GENERATION (state);
+  }
+
+  return ECBOR_OK;
+}
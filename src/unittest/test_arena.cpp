@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor.h"
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+struct block_stats {
+    size_t allocated = 0;
+    size_t released = 0;
+};
+
+static void *counting_alloc(void *user_data, size_t size)
+{
+    static_cast<block_stats*>(user_data)->allocated++;
+    return std::malloc(size);
+}
+
+static void counting_release(void *user_data, void *block)
+{
+    static_cast<block_stats*>(user_data)->released++;
+    std::free(block);
+}
+
+TEST(arena, bump_allocation)
+{
+    alignas(16) uint8_t buf[64];
+    ecbor_arena_t arena;
+    void *a, *b, *c;
+    ASSERT_EQ(ecbor_initialize_arena(&arena, buf, sizeof(buf)), ECBOR_OK);
+
+    EXPECT_EQ(ecbor_arena_alloc(&arena, 3, 1, &a), ECBOR_OK);
+    EXPECT_EQ(ecbor_arena_alloc(&arena, 8, 8, &b), ECBOR_OK);
+    EXPECT_EQ(a, (void*)buf);
+    EXPECT_EQ(b, (void*)(buf + 8));
+    EXPECT_EQ(ecbor_arena_alloc(&arena, 64, 1, &c), ECBOR_ERR_END_OF_ARENA);
+    EXPECT_EQ(ecbor_arena_alloc(&arena, 8, 3, &c), ECBOR_ERR_INVALID_ADDITIONAL);
+
+    // reset rewinds to the start
+    EXPECT_EQ(ecbor_arena_reset(&arena), ECBOR_OK);
+    EXPECT_EQ(ecbor_arena_alloc(&arena, 1, 1, &c), ECBOR_OK);
+    EXPECT_EQ(c, (void*)buf);
+}
+
+TEST(arena, chained_blocks)
+{
+    block_stats stats;
+    ecbor_arena_t arena;
+    void *p;
+    ASSERT_EQ(ecbor_initialize_arena(&arena, NULL, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_arena_allocator(&arena, counting_alloc, counting_release, &stats, 128), ECBOR_OK);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 10; i++) {
+            ASSERT_EQ(ecbor_arena_alloc(&arena, 32, 8, &p), ECBOR_OK);
+            EXPECT_EQ((uintptr_t)p % 8, 0u);
+        }
+        ASSERT_EQ(ecbor_arena_alloc(&arena, 1000, 8, &p), ECBOR_OK);
+        EXPECT_EQ(ecbor_arena_reset(&arena), ECBOR_OK);
+    }
+    // blocks are reused after a reset
+    EXPECT_EQ(stats.allocated, 4u);
+
+    EXPECT_EQ(ecbor_arena_release(&arena), ECBOR_OK);
+    EXPECT_EQ(stats.released, stats.allocated);
+}
+
+TEST(arena, invalid_requests)
+{
+    block_stats stats;
+    alignas(16) uint8_t buf[64];
+    ecbor_arena_t arena;
+    void *p;
+    ASSERT_EQ(ecbor_initialize_arena(&arena, buf, sizeof(buf)), ECBOR_OK);
+
+    // blocks could never be given back
+    EXPECT_EQ(ecbor_set_arena_allocator(&arena, counting_alloc, NULL, &stats, 128), ECBOR_ERR_NULL_PARAMETER);
+    EXPECT_EQ(ecbor_set_arena_allocator(&arena, NULL, counting_release, &stats, 128), ECBOR_ERR_NULL_PARAMETER);
+
+    // sizes that would wrap around fail without reaching the allocator
+    EXPECT_EQ(ecbor_arena_alloc(&arena, SIZE_MAX, 1, &p), ECBOR_ERR_END_OF_ARENA);
+    ASSERT_EQ(ecbor_set_arena_allocator(&arena, counting_alloc, counting_release, &stats, 128), ECBOR_OK);
+    EXPECT_EQ(ecbor_arena_alloc(&arena, SIZE_MAX, 1, &p), ECBOR_ERR_END_OF_ARENA);
+    EXPECT_EQ(ecbor_arena_alloc(&arena, SIZE_MAX - 8, 16, &p), ECBOR_ERR_END_OF_ARENA);
+    EXPECT_EQ(ecbor_arena_alloc(&arena, SIZE_MAX / 2, 1 + SIZE_MAX / 2, &p), ECBOR_ERR_END_OF_ARENA);
+    EXPECT_EQ(stats.allocated, 0u);
+
+    ASSERT_EQ(ecbor_set_arena_allocator(&arena, counting_alloc, counting_release, &stats, SIZE_MAX), ECBOR_OK);
+    EXPECT_EQ(ecbor_arena_alloc(&arena, 128, 1, &p), ECBOR_ERR_END_OF_ARENA);
+    EXPECT_EQ(stats.allocated, 0u);
+    EXPECT_EQ(ecbor_arena_release(&arena), ECBOR_OK);
+}
+
+TEST(arena, tree_growth)
+{
+    // array of 100 small integers, more than the item buffer holds
+    std::vector<uint8_t> doc = { 0x98, 100 };
+    for (int i = 0; i < 100; i++) {
+        doc.push_back(i % 24);
+    }
+
+    ecbor_item_t items[8];
+    ecbor_decode_context_t context;
+    ecbor_item_t *root;
+    ASSERT_EQ(ecbor_initialize_decode_tree(&context, doc.data(), doc.size(), items, 8), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode_tree(&context, &root), ECBOR_ERR_END_OF_ITEM_BUFFER);
+
+    block_stats stats;
+    ecbor_arena_t arena;
+    ASSERT_EQ(ecbor_initialize_arena(&arena, NULL, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_arena_allocator(&arena, counting_alloc, counting_release, &stats, 4096), ECBOR_OK);
+    ASSERT_EQ(ecbor_initialize_decode_tree(&context, doc.data(), doc.size(), items, 8), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_decode_arena(&context, &arena), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&context, &root), ECBOR_OK);
+    EXPECT_EQ(context.n_items, 101u);
+    EXPECT_EQ(root, &items[0]);
+
+    ecbor_item_t *element;
+    uint64_t value;
+    ASSERT_EQ(ecbor_get_array_item_ptr(root, 99, &element), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_uint64(element, &value), ECBOR_OK);
+    EXPECT_EQ(value, 99u % 24);
+
+    // container frames taken from the arena
+    uint8_t out[16];
+    ecbor_encode_context_t ectx;
+    ASSERT_EQ(ecbor_initialize_encode(&ectx, out, sizeof(out)), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_begin_array(&ectx, NULL), ECBOR_ERR_NULL_VALUE);
+    ASSERT_EQ(ecbor_set_encode_arena(&ectx, &arena), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_begin_array(&ectx, NULL), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_end_container(&ectx, 1), ECBOR_OK);
+    EXPECT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ectx), 1u);
+    EXPECT_EQ(out[0], 0x80);
+
+    EXPECT_EQ(ecbor_arena_release(&arena), ECBOR_OK);
+    EXPECT_EQ(stats.released, stats.allocated);
+}
+
+TEST(arena, item_pool)
+{
+    std::vector<uint8_t> small = { 0x83, 0x01, 0x02, 0x03 };
+    std::vector<uint8_t> large = { 0x98, 20 };
+    for (int i = 0; i < 20; i++) {
+        large.push_back(i);
+    }
+
+    block_stats stats;
+    ecbor_arena_t arena;
+    ecbor_item_pool_t pool;
+    ASSERT_EQ(ecbor_initialize_arena(&arena, NULL, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_arena_allocator(&arena, counting_alloc, counting_release, &stats, 4096), ECBOR_OK);
+    EXPECT_EQ(ecbor_initialize_item_pool(NULL, &arena, 8), ECBOR_ERR_NULL_ITEM_BUFFER);
+    EXPECT_EQ(ecbor_initialize_item_pool(&pool, NULL, 8), ECBOR_ERR_NULL_PARAMETER);
+    ASSERT_EQ(ecbor_initialize_item_pool(&pool, &arena, 8), ECBOR_OK);
+
+    ecbor_decode_context_t a, b;
+    ecbor_item_t *root_a, *root_b, *element;
+    uint64_t value;
+    for (int round = 0; round < 100; round++) {
+        ASSERT_EQ(ecbor_initialize_decode_tree_pool(&a, small.data(), small.size(), &pool), ECBOR_OK);
+        ASSERT_EQ(ecbor_initialize_decode_tree_pool(&b, large.data(), large.size(), &pool), ECBOR_OK);
+        ASSERT_EQ(ecbor_decode_tree(&a, &root_a), ECBOR_OK);
+        ASSERT_EQ(ecbor_decode_tree(&b, &root_b), ECBOR_OK);
+
+        ASSERT_EQ(ecbor_get_array_item_ptr(root_a, 2, &element), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_uint64(element, &value), ECBOR_OK);
+        EXPECT_EQ(value, 3u);
+        ASSERT_EQ(ecbor_get_array_item_ptr(root_b, 19, &element), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_uint64(element, &value), ECBOR_OK);
+        EXPECT_EQ(value, 19u);
+        EXPECT_EQ(pool.n_items, 4u + 21u);
+
+        EXPECT_EQ(ecbor_release_tree(&b), ECBOR_OK);
+        EXPECT_EQ(ecbor_release_tree(&a), ECBOR_OK);
+    }
+
+    // blocks are recycled: one for the small tree, three for the large one
+    EXPECT_EQ(pool.n_blocks, 4u);
+    EXPECT_EQ(pool.n_items, 0u);
+    EXPECT_EQ(pool.high_water, 25u);
+
+    // malformed input gives its blocks back
+    std::vector<uint8_t> bad = { 0xbf, 0x01, 0xff };
+    ASSERT_EQ(ecbor_initialize_decode_tree_pool(&a, bad.data(), bad.size(), &pool), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode_tree(&a, &root_a), ECBOR_ERR_INVALID_KEY_VALUE_PAIR);
+    EXPECT_EQ(pool.n_blocks, 4u);
+
+    EXPECT_EQ(ecbor_arena_release(&arena), ECBOR_OK);
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+struct chunked_input {
+    const std::vector<uint8_t> *data;
+    size_t position = 0;
+    size_t step = 1;
+};
+
+// hands out at most a few bytes per call, to cross the window end everywhere
+static ecbor_error_t chunked_refill(void *user_data, uint8_t *buffer, size_t size, size_t *filled)
+{
+    auto *in = static_cast<chunked_input*>(user_data);
+    size_t n = std::min({ size, in->step, in->data->size() - in->position });
+    std::copy(in->data->begin() + in->position, in->data->begin() + in->position + n, buffer);
+    in->position += n;
+    in->step = in->step % 7 + 1;
+    *filled = n;
+    return ECBOR_OK;
+}
+
+static ecbor_error_t collect_sink(void *user_data, const ecbor_item_t *item, const uint8_t *data, size_t size)
+{
+    auto *out = static_cast<std::vector<uint8_t>*>(user_data);
+    EXPECT_EQ(item->type, ECBOR_TYPE_BSTR);
+    out->insert(out->end(), data, data + size);
+    return ECBOR_OK;
+}
+
+static std::vector<uint8_t> encode_sequence(std::vector<ecbor_item_t> items)
+{
+    std::vector<uint8_t> out(1 << 16);
+    ecbor_encode_context_t context;
+    size_t size;
+    EXPECT_EQ(ecbor_initialize_encode(&context, out.data(), out.size()), ECBOR_OK);
+    for (auto &item : items) {
+        EXPECT_EQ(ecbor_encode(&context, &item), ECBOR_OK);
+    }
+    EXPECT_EQ(ecbor_get_encoded_buffer_size(&context, &size), ECBOR_OK);
+    out.resize(size);
+    return out;
+}
+
+TEST(decoder, refill_window)
+{
+    ecbor_item_t fields[3] = { ecbor_uint(1ull << 40), ecbor_str("hello", 5), ecbor_fp64(2.5) };
+    ecbor_item_t array;
+    ASSERT_EQ(ecbor_array(&array, fields, 3), ECBOR_OK);
+
+    std::vector<ecbor_item_t> items;
+    for (int i = 0; i < 50; i++) {
+        items.push_back(array);
+        items.push_back(ecbor_int(-i * 1000));
+    }
+    std::vector<uint8_t> data = encode_sequence(items);
+
+    for (ecbor_mode_t mode : { ECBOR_MODE_DECODE, ECBOR_MODE_DECODE_STREAMED }) {
+        // reference decode of the whole buffer
+        ecbor_decode_context_t reference;
+        ASSERT_EQ(mode == ECBOR_MODE_DECODE
+                    ? ecbor_initialize_decode(&reference, data.data(), data.size())
+                    : ecbor_initialize_decode_streamed(&reference, data.data(), data.size()),
+                  ECBOR_OK);
+
+        uint8_t window[32];
+        chunked_input in { &data };
+        ecbor_decode_context_t context;
+        ASSERT_EQ(mode == ECBOR_MODE_DECODE
+                    ? ecbor_initialize_decode(&context, window, 0)
+                    : ecbor_initialize_decode_streamed(&context, window, 0),
+                  ECBOR_OK);
+        ASSERT_EQ(ecbor_set_refill_callback(&context, window, sizeof(window), chunked_refill, &in), ECBOR_OK);
+
+        size_t count = 0;
+        while (true) {
+            ecbor_item_t expected, item;
+            ecbor_error_t rc = ecbor_decode(&reference, &expected);
+            ASSERT_EQ(ecbor_decode(&context, &item), rc);
+            if (rc == ECBOR_END_OF_BUFFER) {
+                break;
+            }
+            ASSERT_EQ(rc, ECBOR_OK);
+            EXPECT_EQ(item.type, expected.type);
+            EXPECT_EQ(item.size, expected.size);
+            EXPECT_EQ(item.length, expected.length);
+            if (item.type == ECBOR_TYPE_STR) {
+                EXPECT_EQ(memcmp(item.value.string.str, expected.value.string.str, item.length), 0);
+            } else if (item.type != ECBOR_TYPE_ARRAY) {
+                EXPECT_EQ(item.value.uinteger, expected.value.uinteger);
+            }
+            count++;
+        }
+        EXPECT_EQ(count, mode == ECBOR_MODE_DECODE ? 100u : 250u);
+    }
+}
+
+TEST(decoder, refill_large_payload)
+{
+    std::vector<uint8_t> blob(1000);
+    for (size_t i = 0; i < blob.size(); i++) {
+        blob[i] = (uint8_t)(i * 7);
+    }
+    std::vector<uint8_t> data = encode_sequence({ ecbor_uint(1), ecbor_bstr(blob.data(), blob.size()), ecbor_uint(2) });
+
+    uint8_t window[64];
+    chunked_input in { &data };
+    ecbor_decode_context_t context;
+    ecbor_item_t item;
+    ASSERT_EQ(ecbor_initialize_decode_streamed(&context, window, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_refill_callback(&context, window, sizeof(window), chunked_refill, &in), ECBOR_OK);
+
+    // without a sink the payload does not fit
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_ERR_BUFFER_TOO_LARGE);
+
+    std::vector<uint8_t> spilled;
+    ASSERT_EQ(ecbor_set_payload_sink(&context, collect_sink, &spilled), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(item.type, ECBOR_TYPE_BSTR);
+    EXPECT_EQ(item.length, blob.size());
+    EXPECT_EQ(item.value.string.str, nullptr);
+    EXPECT_EQ(spilled, blob);
+
+    uint64_t v;
+    ASSERT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_uint64(&item, &v), ECBOR_OK);
+    EXPECT_EQ(v, 2u);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_END_OF_BUFFER);
+
+    // truncated input
+    data.resize(data.size() - 2);
+    chunked_input truncated { &data };
+    ASSERT_EQ(ecbor_set_refill_callback(&context, window, sizeof(window), chunked_refill, &truncated), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_ERR_INVALID_END_OF_BUFFER);
+
+    // tree mode cannot be refilled
+    ecbor_item_t items[4];
+    ASSERT_EQ(ecbor_initialize_decode_tree(&context, window, 0, items, 4), ECBOR_OK);
+    EXPECT_EQ(ecbor_set_refill_callback(&context, window, sizeof(window), chunked_refill, &in), ECBOR_ERR_WRONG_MODE);
+}
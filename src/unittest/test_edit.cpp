@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor.h"
+#include <vector>
+
+// {"name": "x", "hits": [1, 2, 3], 7: 1(_ [10, 20])}
+static const std::vector<uint8_t> document = {
+    0xa3,
+    0x64, 'n', 'a', 'm', 'e', 0x61, 'x',
+    0x64, 'h', 'i', 't', 's', 0x83, 0x01, 0x02, 0x03,
+    0x07, 0xc1, 0x9f, 0x0a, 0x14, 0xff
+};
+
+TEST(edit, locate)
+{
+    ecbor_item_t path[2] = { ecbor_str("hits", 4), ecbor_uint(2) };
+    size_t offset, length;
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 2, &offset, &length), ECBOR_OK);
+    EXPECT_EQ(offset, 16u);
+    EXPECT_EQ(length, 1u);
+
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 0, &offset, &length), ECBOR_OK);
+    EXPECT_EQ(offset, 0u);
+    EXPECT_EQ(length, document.size());
+
+    // tags are stepped through
+    path[0] = ecbor_uint(7);
+    path[1] = ecbor_uint(1);
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 2, &offset, &length), ECBOR_OK);
+    EXPECT_EQ(offset, 21u);
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 1, &offset, &length), ECBOR_OK);
+    EXPECT_EQ(offset, 18u);
+    EXPECT_EQ(length, 5u);
+
+    path[1] = ecbor_uint(2);
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 2, &offset, &length), ECBOR_ERR_INDEX_OUT_OF_BOUNDS);
+    path[0] = ecbor_str("hits", 4);
+    path[1] = ecbor_uint(3);
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 2, &offset, &length), ECBOR_ERR_INDEX_OUT_OF_BOUNDS);
+    path[0] = ecbor_str("miss", 4);
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 1, &offset, &length), ECBOR_ERR_KEY_NOT_FOUND);
+    path[0] = ecbor_str("name", 4);
+    EXPECT_EQ(ecbor_locate(document.data(), document.size(), path, 2, &offset, &length), ECBOR_ERR_INVALID_TYPE);
+}
+
+TEST(edit, replace)
+{
+    std::vector<uint8_t> buf(document);
+    buf.resize(64);
+    size_t size = document.size();
+
+    // same width, in place
+    ecbor_item_t path[2] = { ecbor_str("hits", 4), ecbor_uint(1) };
+    ecbor_item_t value = ecbor_uint(9);
+    EXPECT_EQ(ecbor_edit(buf.data(), &size, buf.size(), path, 2, &value), ECBOR_OK);
+    EXPECT_EQ(size, document.size());
+    EXPECT_EQ(buf[15], 0x09);
+
+    // wider, tail moves
+    value = ecbor_uint(1000);
+    EXPECT_EQ(ecbor_edit(buf.data(), &size, buf.size(), path, 2, &value), ECBOR_OK);
+    EXPECT_EQ(size, document.size() + 2);
+    std::vector<uint8_t> expected(document);
+    expected[15] = 0x19;
+    expected.insert(expected.begin() + 16, { 0x03, 0xe8 });
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), buf.begin()));
+
+    // narrower, whole string replaced
+    path[0] = ecbor_str("name", 4);
+    value = ecbor_str("", 0);
+    EXPECT_EQ(ecbor_edit(buf.data(), &size, buf.size(), path, 1, &value), ECBOR_OK);
+    expected[6] = 0x60;
+    expected.erase(expected.begin() + 7);
+    EXPECT_EQ(size, expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), buf.begin()));
+
+    // result still decodes
+    ecbor_decode_context_t dctx;
+    ecbor_item_t items[16];
+    ecbor_item_t *root;
+    ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, buf.data(), size, items, 16), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+
+    // does not fit
+    value = ecbor_uint(1000);
+    EXPECT_EQ(ecbor_edit(buf.data(), &size, size, path, 1, &value), ECBOR_ERR_INVALID_END_OF_BUFFER);
+
+    // values that fail to encode leave the buffer alone
+    std::vector<uint8_t> before(buf.begin(), buf.begin() + size);
+    size_t size_before = size;
+    value = ecbor_str(NULL, 3);
+    EXPECT_EQ(ecbor_edit(buf.data(), &size, buf.size(), path, 1, &value), ECBOR_ERR_NULL_VALUE);
+    value = ecbor_raw(NULL, 2);
+    EXPECT_EQ(ecbor_edit(buf.data(), &size, buf.size(), path, 1, &value), ECBOR_ERR_NULL_VALUE);
+    EXPECT_EQ(size, size_before);
+    EXPECT_TRUE(std::equal(before.begin(), before.end(), buf.begin()));
+}
@@ -673,3 +673,743 @@ TEST(encoder, appendix_a)
         idx ++;
     }
 }
+
+static ecbor_error_t collect_flush(void *user_data, const uint8_t *data, size_t size)
+{
+    auto *out = static_cast<std::vector<uint8_t>*>(user_data);
+    out->insert(out->end(), data, data + size);
+    return ECBOR_OK;
+}
+
+TEST(encoder, flush_callback)
+{
+    std::string small_ = "abc";
+    std::vector<uint8_t> large_(100, 0x5a);
+    std::vector<ecbor_item_t> arr_ = {
+        ecbor_uint(1000000),
+        ecbor_str(small_.c_str(), small_.size()),
+        ecbor_bstr(large_.data(), large_.size()),
+        ecbor_fp64(1.5),
+        ecbor_int(-500),
+    };
+    ecbor_item_t arr;
+    EXPECT_EQ(ecbor_array(&arr, arr_.data(), arr_.size()), ECBOR_OK);
+
+    // reference encoding in a large buffer
+    uint8_t ref[4096];
+    ecbor_encode_context_t ref_ctx;
+    EXPECT_EQ(ecbor_initialize_encode(&ref_ctx, ref, sizeof(ref)), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ref_ctx, &arr), ECBOR_OK);
+    std::vector<uint8_t> expected(ref, ref + ECBOR_GET_ENCODED_BUFFER_SIZE(&ref_ctx));
+
+    // same item through a 16 byte buffer
+    uint8_t buf[16];
+    std::vector<uint8_t> out;
+    ecbor_encode_context_t ctx;
+    EXPECT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    EXPECT_EQ(ecbor_flush(&ctx), ECBOR_ERR_NULL_PARAMETER);
+    EXPECT_EQ(ecbor_set_flush_callback(&ctx, collect_flush, &out), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &arr), ECBOR_OK);
+    EXPECT_EQ(ecbor_flush(&ctx), ECBOR_OK);
+    EXPECT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), 0u);
+    EXPECT_EQ(out, expected);
+
+    // without a callback the small buffer is not enough
+    EXPECT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &arr), ECBOR_ERR_INVALID_END_OF_BUFFER);
+}
+
+TEST(encoder, gather_segments)
+{
+    std::vector<uint8_t> blob1_(300, 0x11);
+    std::vector<uint8_t> blob2_(20, 0x22);
+    std::vector<uint8_t> blob3_(500, 0x33);
+    std::vector<ecbor_item_t> arr_ = {
+        ecbor_bstr(blob1_.data(), blob1_.size()),
+        ecbor_bstr(blob2_.data(), blob2_.size()),
+        ecbor_uint(7),
+        ecbor_bstr(blob3_.data(), blob3_.size()),
+    };
+    ecbor_item_t arr;
+    EXPECT_EQ(ecbor_array(&arr, arr_.data(), arr_.size()), ECBOR_OK);
+
+    uint8_t ref[4096];
+    ecbor_encode_context_t ref_ctx;
+    EXPECT_EQ(ecbor_initialize_encode(&ref_ctx, ref, sizeof(ref)), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ref_ctx, &arr), ECBOR_OK);
+    std::vector<uint8_t> expected(ref, ref + ECBOR_GET_ENCODED_BUFFER_SIZE(&ref_ctx));
+
+    uint8_t scratch[64];
+    ecbor_segment_t segments[8];
+    size_t count = 0;
+    ecbor_encode_context_t ctx;
+    EXPECT_EQ(ecbor_initialize_encode(&ctx, scratch, sizeof(scratch)), ECBOR_OK);
+    EXPECT_EQ(ecbor_set_gather_segments(&ctx, segments, 8, 256), ECBOR_OK);
+    EXPECT_EQ(ecbor_set_flush_callback(&ctx, collect_flush, nullptr), ECBOR_ERR_WRONG_MODE);
+    EXPECT_EQ(ecbor_encode(&ctx, &arr), ECBOR_OK);
+    EXPECT_EQ(ecbor_get_gather_segment_count(&ctx, &count), ECBOR_OK);
+
+    // header, blob1, header+blob2+uint+header, blob3
+    EXPECT_EQ(count, 4u);
+    EXPECT_EQ(segments[1].base, blob1_.data());
+    EXPECT_EQ(segments[3].base, blob3_.data());
+
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < count; i++) {
+        auto *p = static_cast<const uint8_t*>(segments[i].base);
+        out.insert(out.end(), p, p + segments[i].length);
+    }
+    EXPECT_EQ(out, expected);
+}
+
+TEST(encoder, encoded_size)
+{
+    std::string k1_ = "a";
+    std::string k2_ = "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb";
+    std::vector<uint8_t> blob_(1000, 0x01);
+
+    std::vector<ecbor_item_t> arr_ = {
+        ecbor_uint(24),
+        ecbor_int(-70000),
+        ecbor_fp32(1.0f),
+        ecbor_bstr(blob_.data(), blob_.size()),
+    };
+    ecbor_item_t arr = ecbor_null();
+    EXPECT_EQ(ecbor_array(&arr, arr_.data(), arr_.size()), ECBOR_OK);
+    ecbor_item_t tagged = ecbor_fp64(2.5);
+    ecbor_item_t tag = ecbor_tag(&tagged, 1);
+
+    std::vector<ecbor_item_t> keys = {
+        ecbor_str(k1_.c_str(), k1_.size()),
+        ecbor_str(k2_.c_str(), k2_.size()),
+    };
+    std::vector<ecbor_item_t> vals = { arr, tag };
+    ecbor_item_t map = ecbor_null();
+    EXPECT_EQ(ecbor_map(&map, keys.data(), vals.data(), keys.size()), ECBOR_OK);
+
+    uint8_t buf[4096];
+    ecbor_encode_context_t ctx;
+    EXPECT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &map), ECBOR_OK);
+
+    size_t size = 0;
+    EXPECT_EQ(ecbor_encoded_size(&map, &size), ECBOR_OK);
+    EXPECT_EQ(size, ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx));
+
+    size_t cached = 0;
+    EXPECT_EQ(ecbor_cache_encoded_size(&map, &cached), ECBOR_OK);
+    EXPECT_EQ(cached, size);
+    EXPECT_EQ(map.encoded_size, size);
+    EXPECT_EQ(vals[1].encoded_size, 1u + 9u);
+    EXPECT_EQ(vals[0].encoded_size, 1u + 2u + 5u + 5u + 3u + 1000u);
+
+    // cached size is checked before anything is written
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, size - 1), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &map), ECBOR_ERR_INVALID_END_OF_BUFFER);
+    EXPECT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), 0u);
+
+    // and dropped for modified items and their parents
+    ecbor_mark_modified(&tagged);
+    EXPECT_EQ(tagged.encoded_size, 0u);
+    EXPECT_EQ(map.encoded_size, 0u);
+    EXPECT_EQ(vals[0].encoded_size, 1u + 2u + 5u + 5u + 3u + 1000u);
+
+    // the plain size walk only reads the tree; copied containers leave their
+    // children with stale parent links, which it does not need
+    ecbor_item_t inner[2] = { ecbor_uint(1), ecbor_uint(1000) };
+    ecbor_item_t outer[3] = { ecbor_null(), ecbor_null(), ecbor_str(k1_.c_str(), k1_.size()) };
+    ASSERT_EQ(ecbor_array(&outer[0], inner, 2), ECBOR_OK);
+    outer[1] = ecbor_tag(&outer[0], 1);
+    ecbor_item_t copy = ecbor_null();
+    ASSERT_EQ(ecbor_array(&copy, outer, 3), ECBOR_OK);
+    outer[0].parent = nullptr;
+    const ecbor_item_t *croot = &copy;
+    EXPECT_EQ(ecbor_encoded_size(croot, &size), ECBOR_OK);
+    EXPECT_EQ(size, 1u + (1 + 1 + 3) + (1 + 1 + 1 + 3) + (1 + k1_.size()));
+    EXPECT_EQ(outer[0].parent, nullptr);
+    EXPECT_EQ(copy.encoded_size, 0u);
+
+    ecbor_item_t indef = ecbor_indefinite_array_token();
+    EXPECT_EQ(ecbor_encoded_size(&indef, &size), ECBOR_ERR_WONT_ENCODE_INDEFINITE);
+    EXPECT_EQ(ecbor_encoded_size(nullptr, &size), ECBOR_ERR_NULL_ITEM);
+    EXPECT_EQ(ecbor_encoded_size(&map, nullptr), ECBOR_ERR_NULL_VALUE);
+}
+
+TEST(encoder, raw_fragments)
+{
+    // cached sub-document: {"a": 1}
+    std::vector<uint8_t> fragment = { 0xa1, 0x61, 0x61, 0x01 };
+    std::string s_ = "xyz";
+
+    // normal mode, fragment embedded in an array
+    run_encoder_test_normal([&](ecbor_encode_context_t* ctx) -> void {
+                std::vector<ecbor_item_t> arr_ = {
+                    ecbor_uint(1),
+                    ecbor_raw(fragment.data(), fragment.size()),
+                };
+                ecbor_item_t arr;
+                EXPECT_EQ(ecbor_array(&arr, arr_.data(), arr_.size()), ECBOR_OK);
+
+                size_t size = 0;
+                EXPECT_EQ(ecbor_encoded_size(&arr, &size), ECBOR_OK);
+                EXPECT_EQ(size, 6u);
+
+                EXPECT_EQ(ecbor_encode(ctx, &arr), ECBOR_OK);
+            },
+            { 0x82, 0x01, 0xa1, 0x61, 0x61, 0x01 });
+
+    // streamed mode, string header followed by raw payload, then fragment
+    constexpr size_t BUFFER_SIZE = 64;
+    uint8_t buf[BUFFER_SIZE];
+    ecbor_encode_context_t ctx;
+    EXPECT_EQ(ecbor_initialize_encode_streamed(&ctx, buf, BUFFER_SIZE), ECBOR_OK);
+
+    ecbor_item_t arr = ecbor_array_token(2);
+    ecbor_item_t str = ecbor_str(s_.c_str(), s_.size());
+    ecbor_item_t raw = ecbor_raw(fragment.data(), fragment.size());
+    EXPECT_EQ(ecbor_encode(&ctx, &arr), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &str), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_raw(&ctx, (const uint8_t *) s_.c_str(), s_.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &raw), ECBOR_OK);
+
+    std::vector<uint8_t> expected = { 0x82, 0x63, 'x', 'y', 'z', 0xa1, 0x61, 0x61, 0x01 };
+    EXPECT_EQ(std::vector<uint8_t>(buf, buf + ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx)), expected);
+
+    EXPECT_EQ(ecbor_encode_raw(nullptr, fragment.data(), 1), ECBOR_ERR_NULL_CONTEXT);
+    EXPECT_EQ(ecbor_encode_raw(&ctx, nullptr, 1), ECBOR_ERR_NULL_VALUE);
+    EXPECT_EQ(ecbor_encode_raw(&ctx, fragment.data(), BUFFER_SIZE), ECBOR_ERR_INVALID_END_OF_BUFFER);
+}
+
+TEST(encoder, backpatched_containers)
+{
+    auto encode_document = [](ecbor_encode_context_t* ctx, uint8_t compact) -> void {
+        ecbor_container_t outer, inner;
+        ecbor_item_t one = ecbor_uint(1), two = ecbor_uint(2);
+        ecbor_item_t arr = ecbor_array_token(2);
+        ecbor_item_t indef = ecbor_indefinite_map_token();
+        ecbor_item_t stop = ecbor_stop_code();
+        ecbor_item_t key = ecbor_str("a", 1);
+        ecbor_item_t tag = ecbor_tag(nullptr, 1);
+
+        EXPECT_EQ(ecbor_encode_begin_array(ctx, &outer), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &one), ECBOR_OK);
+        // definite token with its children counts as one item
+        EXPECT_EQ(ecbor_encode(ctx, &arr), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &one), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &two), ECBOR_OK);
+        // so does an indefinite map
+        EXPECT_EQ(ecbor_encode(ctx, &indef), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &key), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode_raw(ctx, (const uint8_t *) "a", 1), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &tag), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &two), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &stop), ECBOR_OK);
+        // and a nested backpatched map
+        EXPECT_EQ(ecbor_encode_begin_map(ctx, &inner), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &key), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode_raw(ctx, (const uint8_t *) "a", 1), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(ctx, &tag), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode_end_container(ctx, compact), ECBOR_ERR_INCOMPLETE_ITEM);
+        EXPECT_EQ(ecbor_encode(ctx, &two), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode_end_container(ctx, compact), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode_end_container(ctx, compact), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode_end_container(ctx, compact), ECBOR_ERR_NO_OPEN_CONTAINER);
+    };
+
+    std::vector<uint8_t> compacted = {
+        0x84, 0x01, 0x82, 0x01, 0x02,
+        0xbf, 0x61, 0x61, 0xc1, 0x02, 0xff,
+        0xa1, 0x61, 0x61, 0xc1, 0x02
+    };
+    std::vector<uint8_t> full = {
+        0x9b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+        0x01, 0x82, 0x01, 0x02,
+        0xbf, 0x61, 0x61, 0xc1, 0x02, 0xff,
+        0xbb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x61, 0x61, 0xc1, 0x02
+    };
+
+    uint8_t buf[64];
+    ecbor_encode_context_t ctx;
+
+    EXPECT_EQ(ecbor_initialize_encode_streamed(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    encode_document(&ctx, 1);
+    EXPECT_EQ(std::vector<uint8_t>(buf, buf + ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx)), compacted);
+
+    EXPECT_EQ(ecbor_initialize_encode_streamed(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    encode_document(&ctx, 0);
+    EXPECT_EQ(std::vector<uint8_t>(buf, buf + ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx)), full);
+
+    // flushing keeps open headers in the buffer
+    uint8_t small[40];
+    std::vector<uint8_t> out;
+    ecbor_item_t prefix = ecbor_str("0123456789", 10);
+    EXPECT_EQ(ecbor_initialize_encode_streamed(&ctx, small, sizeof(small)), ECBOR_OK);
+    EXPECT_EQ(ecbor_set_flush_callback(&ctx, collect_flush, &out), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &prefix), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_raw(&ctx, (const uint8_t *) "0123456789", 10), ECBOR_OK);
+    encode_document(&ctx, 1);
+    EXPECT_EQ(ecbor_flush(&ctx), ECBOR_OK);
+
+    std::vector<uint8_t> expected = { 0x6a, '0', '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    expected.insert(expected.end(), compacted.begin(), compacted.end());
+    EXPECT_EQ(out, expected);
+}
+
+TEST(encoder, deep_nesting)
+{
+    // a chain of single element arrays, with an integer at the bottom
+    auto build_chain = [](std::vector<ecbor_item_t>& items, size_t depth) -> void {
+        items.assign(depth + 1, ecbor_null());
+        items[depth] = ecbor_uint(1);
+        for (size_t i = depth; i > 0; i--) {
+            EXPECT_EQ(ecbor_array(&items[i - 1], &items[i], 1), ECBOR_OK);
+        }
+    };
+
+    std::vector<ecbor_item_t> items;
+    std::vector<uint8_t> buf(2 * ECBOR_MAX_NESTING_DEPTH);
+    ecbor_encode_context_t ctx;
+    size_t size = 0;
+
+    build_chain(items, ECBOR_MAX_NESTING_DEPTH);
+    EXPECT_EQ(ecbor_initialize_encode(&ctx, buf.data(), buf.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &items[0]), ECBOR_OK);
+    EXPECT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), ECBOR_MAX_NESTING_DEPTH + 1u);
+    EXPECT_EQ(buf[0], 0x81);
+    EXPECT_EQ(buf[ECBOR_MAX_NESTING_DEPTH], 0x01);
+    EXPECT_EQ(ecbor_encoded_size(&items[0], &size), ECBOR_OK);
+    EXPECT_EQ(size, ECBOR_MAX_NESTING_DEPTH + 1u);
+
+    build_chain(items, ECBOR_MAX_NESTING_DEPTH + 1);
+    EXPECT_EQ(ecbor_initialize_encode(&ctx, buf.data(), buf.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, &items[0]), ECBOR_ERR_NESTING_TOO_DEEP);
+    EXPECT_EQ(ecbor_encoded_size(&items[0], &size), ECBOR_ERR_NESTING_TOO_DEEP);
+}
+
+TEST(encoder, integer_head_boundaries)
+{
+    const uint64_t values[] = {
+        0, 23, 24, 0xff, 0x100, 0xffff, 0x10000, 0xffffffff,
+        0x100000000ull, std::numeric_limits<uint64_t>::max()
+    };
+    const size_t sizes[] = { 1, 1, 2, 2, 3, 3, 5, 5, 9, 9 };
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        // exact size buffers take the tail path, large ones the wide path
+        for (size_t buffer_size : { sizes[i], (size_t)32 }) {
+            uint8_t buf[32];
+            std::memset(buf, 0xAA, sizeof(buf));
+            ecbor_encode_context_t ctx;
+            ecbor_item_t item = ecbor_uint(values[i]);
+            ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, buffer_size), ECBOR_OK);
+            ASSERT_EQ(ecbor_encode(&ctx, &item), ECBOR_OK);
+            EXPECT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), sizes[i]);
+
+            ecbor_decode_context_t dctx;
+            ecbor_item_t decoded;
+            uint64_t value;
+            ASSERT_EQ(ecbor_initialize_decode(&dctx, buf, sizes[i]), ECBOR_OK);
+            ASSERT_EQ(ecbor_decode(&dctx, &decoded), ECBOR_OK);
+            ASSERT_EQ(ecbor_get_uint64(&decoded, &value), ECBOR_OK);
+            EXPECT_EQ(value, values[i]);
+        }
+    }
+}
+
+TEST(encoder, bulk_arrays)
+{
+    std::vector<int64_t> ints;
+    std::vector<ecbor_item_t> int_items;
+    for (int64_t v : std::vector<int64_t>{ 0, 23, -24, -25, 300, -70000, 5000000000ll,
+                                           std::numeric_limits<int64_t>::min(),
+                                           std::numeric_limits<int64_t>::max() }) {
+        ints.push_back(v);
+        int_items.push_back(ecbor_int(v));
+    }
+    std::vector<double> doubles = { 0.5, -1.25, 1e300 };
+    std::vector<ecbor_item_t> double_items;
+    for (double v : doubles) {
+        double_items.push_back(ecbor_fp64(v));
+    }
+
+    // compact integers and floats match the item tree encoding
+    std::vector<uint8_t> expected(256);
+    ecbor_encode_context_t ctx;
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, expected.data(), expected.size()), ECBOR_OK);
+    ecbor_item_t arr;
+    ASSERT_EQ(ecbor_array(&arr, int_items.data(), int_items.size()), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode(&ctx, &arr), ECBOR_OK);
+    ASSERT_EQ(ecbor_array(&arr, double_items.data(), double_items.size()), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode(&ctx, &arr), ECBOR_OK);
+    expected.resize(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx));
+
+    // exact sized buffer, without slack for wide stores
+    std::vector<uint8_t> buf(expected.size());
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf.data(), buf.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_array_i64(&ctx, ints.data(), ints.size(), 1), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_array_f64(&ctx, doubles.data(), doubles.size()), ECBOR_OK);
+    EXPECT_EQ(buf, expected);
+    EXPECT_EQ(ecbor_encode_array_f64(&ctx, doubles.data(), 1), ECBOR_ERR_INVALID_END_OF_BUFFER);
+
+    // small buffer with a flush callback
+    std::vector<uint8_t> out;
+    uint8_t small[16];
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, small, sizeof(small)), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_flush_callback(&ctx, collect_flush, &out), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_array_i64(&ctx, ints.data(), ints.size(), 1), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_array_f64(&ctx, doubles.data(), doubles.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_flush(&ctx), ECBOR_OK);
+    EXPECT_EQ(out, expected);
+
+    // fixed width elements
+    uint64_t uints[] = { 1, 0x100 };
+    float floats[] = { 1.0f };
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf.data(), buf.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_array_u64(&ctx, uints, 2, 0), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_array_f32(&ctx, floats, 1), ECBOR_OK);
+    std::vector<uint8_t> fixed = {
+        0x82, 0x1b, 0, 0, 0, 0, 0, 0, 0, 1, 0x1b, 0, 0, 0, 0, 0, 0, 1, 0,
+        0x81, 0xfa, 0x3f, 0x80, 0, 0
+    };
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), fixed.size());
+    EXPECT_TRUE(std::memcmp(buf.data(), fixed.data(), fixed.size()) == 0);
+
+    // bulk arrays count as a single child of an open container
+    ecbor_container_t container;
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf.data(), buf.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_begin_array(&ctx, &container), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_array_u64(&ctx, uints, 2, 1), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_end_container(&ctx, 1), ECBOR_OK);
+    std::vector<uint8_t> nested = { 0x81, 0x82, 0x01, 0x19, 0x01, 0x00 };
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), nested.size());
+    EXPECT_TRUE(std::memcmp(buf.data(), nested.data(), nested.size()) == 0);
+}
+
+TEST(encoder, bulk_arrays_fixed_width)
+{
+    // enough elements for several vector blocks and a scalar tail
+    std::vector<uint64_t> uints;
+    std::vector<int64_t> ints;
+    std::vector<float> floats;
+    std::vector<double> doubles;
+    for (size_t i = 0; i < 37; i ++) {
+        uints.push_back(0x0123456789abcdefull * i);
+        ints.push_back((int64_t) (0x0123456789abcdefull * i) * (i % 2 ? -1 : 1));
+        floats.push_back(1.5f * i - 20.0f);
+        doubles.push_back(-1e100 * i + 0.25);
+    }
+    ints[1] = std::numeric_limits<int64_t>::min();
+    ints[2] = std::numeric_limits<int64_t>::max();
+
+    auto check = [](const uint8_t *p, uint8_t head, uint64_t bits, size_t width) {
+        EXPECT_EQ(p[0], head);
+        for (size_t b = 0; b < width; b ++) {
+            EXPECT_EQ(p[1 + b], (uint8_t) (bits >> (8 * (width - 1 - b))));
+        }
+    };
+
+    std::vector<uint8_t> buf(2048);
+    ecbor_encode_context_t ctx;
+    for (size_t count : { (size_t) 37, (size_t) 3, (size_t) 1 }) {
+        ASSERT_EQ(ecbor_initialize_encode(&ctx, buf.data(), buf.size()), ECBOR_OK);
+        ASSERT_EQ(ecbor_encode_array_u64(&ctx, uints.data(), count, 0), ECBOR_OK);
+        ASSERT_EQ(ecbor_encode_array_i64(&ctx, ints.data(), count, 0), ECBOR_OK);
+        ASSERT_EQ(ecbor_encode_array_f32(&ctx, floats.data(), count), ECBOR_OK);
+        ASSERT_EQ(ecbor_encode_array_f64(&ctx, doubles.data(), count), ECBOR_OK);
+        size_t header = (count > 23 ? 2 : 1);
+        ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), 4 * header + count * (9 + 9 + 5 + 9));
+
+        const uint8_t *p = buf.data() + header;
+        for (size_t i = 0; i < count; i ++, p += 9) {
+            check(p, 0x1b, uints[i], 8);
+        }
+        p += header;
+        for (size_t i = 0; i < count; i ++, p += 9) {
+            uint64_t sign = (uint64_t) (ints[i] >> 63);
+            check(p, (uint8_t) (0x1b | (sign & 0x20)), ((uint64_t) ints[i]) ^ sign, 8);
+        }
+        p += header;
+        for (size_t i = 0; i < count; i ++, p += 5) {
+            uint32_t bits;
+            std::memcpy(&bits, &floats[i], sizeof(bits));
+            check(p, 0xfa, bits, 4);
+        }
+        p += header;
+        for (size_t i = 0; i < count; i ++, p += 9) {
+            uint64_t bits;
+            std::memcpy(&bits, &doubles[i], sizeof(bits));
+            check(p, 0xfb, bits, 8);
+        }
+    }
+
+    // output split across flushes matches
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf.data(), buf.size()), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_u64(&ctx, uints.data(), 37, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_i64(&ctx, ints.data(), 37, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_f32(&ctx, floats.data(), 37), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_f64(&ctx, doubles.data(), 37), ECBOR_OK);
+    std::vector<uint8_t> expected(buf.begin(), buf.begin() + ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx));
+
+    std::vector<uint8_t> out;
+    uint8_t small[41];
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, small, sizeof(small)), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_flush_callback(&ctx, collect_flush, &out), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_u64(&ctx, uints.data(), 37, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_i64(&ctx, ints.data(), 37, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_f32(&ctx, floats.data(), 37), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_array_f64(&ctx, doubles.data(), 37), ECBOR_OK);
+    ASSERT_EQ(ecbor_flush(&ctx), ECBOR_OK);
+    EXPECT_EQ(out, expected);
+}
+
+TEST(encoder, template_float_slots)
+{
+    // [<fp32>, <fp64>]
+    uint8_t tmpl[32];
+    ecbor_encode_context_t ctx;
+    ecbor_slot_t single, dbl;
+    ecbor_container_t arr;
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, tmpl, sizeof(tmpl)), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_begin_array(&ctx, &arr), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_slot(&ctx, &single, ECBOR_TYPE_FP32, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_slot(&ctx, &dbl, ECBOR_TYPE_FP64, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_end_container(&ctx, 0), ECBOR_OK);
+    size_t size = ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx);
+
+    auto decoded = [&](const uint8_t *msg, double *a, double *b) {
+        ecbor_decode_context_t dctx;
+        ecbor_item_t items[4];
+        ecbor_item_t *root, *el;
+        float f;
+        ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, msg, size, items, 4), ECBOR_OK);
+        ASSERT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_array_item_ptr(root, 0, &el), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_fp32(el, &f), ECBOR_OK);
+        *a = f;
+        ASSERT_EQ(ecbor_get_array_item_ptr(root, 1, &el), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_fp64(el, b), ECBOR_OK);
+    };
+
+    // doubles narrow into single slots when exact, floats widen into double slots
+    uint8_t msg[32];
+    double a = 0, b = 0;
+    std::memcpy(msg, tmpl, size);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, -0.375), ECBOR_OK);
+    EXPECT_EQ(ecbor_patch_fp32(msg, &dbl, 0.1f), ECBOR_OK);
+    decoded(msg, &a, &b);
+    EXPECT_EQ(a, -0.375);
+    EXPECT_EQ(b, (double) 0.1f);
+
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, (double) std::numeric_limits<float>::max()), ECBOR_OK);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, std::numeric_limits<double>::infinity()), ECBOR_OK);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, std::numeric_limits<double>::quiet_NaN()), ECBOR_OK);
+    decoded(msg, &a, &b);
+    EXPECT_TRUE(std::isnan(a));
+
+    // inexact or out of range values are refused, leaving the slot alone
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, 8.0), ECBOR_OK);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, 0.1), ECBOR_ERR_VALUE_OVERFLOW);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, 1e300), ECBOR_ERR_VALUE_OVERFLOW);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, -1e-300), ECBOR_ERR_VALUE_OVERFLOW);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &single, 1.0 + 1e-12), ECBOR_ERR_VALUE_OVERFLOW);
+    decoded(msg, &a, &b);
+    EXPECT_EQ(a, 8.0);
+}
+
+TEST(encoder, template_slots)
+{
+    // {"id": <uint, 4 bytes>, "t": <int>, "v": <fp32>}
+    uint8_t tmpl[64];
+    ecbor_encode_context_t ctx;
+    ecbor_slot_t id, t, v;
+    ecbor_container_t map;
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, tmpl, sizeof(tmpl)), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_begin_map(&ctx, &map), ECBOR_OK);
+    ecbor_item_t key = ecbor_str("id", 2);
+    ASSERT_EQ(ecbor_encode(&ctx, &key), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_slot(&ctx, &id, ECBOR_TYPE_UINT, 4), ECBOR_OK);
+    key = ecbor_str("t", 1);
+    ASSERT_EQ(ecbor_encode(&ctx, &key), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_slot(&ctx, &t, ECBOR_TYPE_UINT, 0), ECBOR_OK);
+    key = ecbor_str("v", 1);
+    ASSERT_EQ(ecbor_encode(&ctx, &key), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_slot(&ctx, &v, ECBOR_TYPE_FP32, 0), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_end_container(&ctx, 1), ECBOR_ERR_WRONG_MODE);
+    ASSERT_EQ(ecbor_encode_end_container(&ctx, 0), ECBOR_OK);
+    size_t size = ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx);
+    EXPECT_EQ(size, 9u + 3 + 5 + 2 + 9 + 2 + 5);
+
+    EXPECT_EQ(ecbor_encode_slot(&ctx, &v, ECBOR_TYPE_UINT, 3), ECBOR_ERR_INVALID_ADDITIONAL);
+    EXPECT_EQ(ecbor_encode_slot(&ctx, &v, ECBOR_TYPE_FP64, 4), ECBOR_ERR_INVALID_ADDITIONAL);
+    EXPECT_EQ(ecbor_encode_slot(&ctx, &v, ECBOR_TYPE_STR, 0), ECBOR_ERR_INVALID_TYPE);
+
+    // stamp and patch a message
+    uint8_t msg[64];
+    std::memcpy(msg, tmpl, size);
+    EXPECT_EQ(ecbor_patch_uint(msg, &id, 70000), ECBOR_OK);
+    EXPECT_EQ(ecbor_patch_int(msg, &t, -5), ECBOR_OK);
+    EXPECT_EQ(ecbor_patch_fp32(msg, &v, 2.5f), ECBOR_OK);
+    EXPECT_EQ(ecbor_patch_uint(msg, &id, 0x100000000ull), ECBOR_ERR_VALUE_OVERFLOW);
+    EXPECT_EQ(ecbor_patch_fp32(msg, &id, 2.5f), ECBOR_ERR_INVALID_TYPE);
+    EXPECT_EQ(ecbor_patch_fp64(msg, &id, 2.5), ECBOR_ERR_INVALID_TYPE);
+
+    ecbor_decode_context_t dctx;
+    ecbor_item_t items[8];
+    ecbor_item_t *root, *k, *val;
+    uint64_t u;
+    int64_t i;
+    float f;
+    ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, msg, size, items, 8), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_map_item_ptr(root, 0, &k, &val), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_uint64(val, &u), ECBOR_OK);
+    EXPECT_EQ(u, 70000u);
+    ASSERT_EQ(ecbor_get_map_item_ptr(root, 1, &k, &val), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_int64(val, &i), ECBOR_OK);
+    EXPECT_EQ(i, -5);
+    ASSERT_EQ(ecbor_get_map_item_ptr(root, 2, &k, &val), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_fp32(val, &f), ECBOR_OK);
+    EXPECT_EQ(f, 2.5f);
+
+    // sign can be flipped back on the same copy
+    EXPECT_EQ(ecbor_patch_int(msg, &t, 7), ECBOR_OK);
+    EXPECT_EQ(msg[t.offset], 0x1b);
+    EXPECT_EQ(msg[t.offset + 8], 7);
+
+    // slots in nested containers keep enclosing ones from compacting too
+    ecbor_container_t outer, inner;
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, tmpl, sizeof(tmpl)), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_begin_array(&ctx, &outer), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_begin_array(&ctx, &inner), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_slot(&ctx, &id, ECBOR_TYPE_UINT, 1), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_end_container(&ctx, 1), ECBOR_ERR_WRONG_MODE);
+    ASSERT_EQ(ecbor_encode_end_container(&ctx, 0), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode_end_container(&ctx, 1), ECBOR_ERR_WRONG_MODE);
+    ASSERT_EQ(ecbor_encode_end_container(&ctx, 0), ECBOR_OK);
+    EXPECT_EQ(id.offset, 18u);
+}
+
+TEST(encoder, reencode_decoded_tree)
+{
+    // {_ "a": (_ "he", "l"), "b": [1, 2] (1-byte length), "c": 5 (1-byte value)}
+    std::vector<uint8_t> doc = {
+        0xbf, 0x61, 0x61, 0x7f, 0x62, 0x68, 0x65, 0x61, 0x6c, 0xff,
+        0x61, 0x62, 0x98, 0x02, 0x01, 0x02, 0x61, 0x63, 0x18, 0x05, 0xff
+    };
+    ecbor_decode_context_t dctx;
+    ecbor_item_t items[16];
+    ecbor_item_t *root, *key, *value;
+    ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, doc.data(), doc.size(), items, 16), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+
+    // plain encoding refuses indefinite items
+    uint8_t buf[64];
+    ecbor_encode_context_t ctx;
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    EXPECT_EQ(ecbor_encode(&ctx, root), ECBOR_ERR_WONT_ENCODE_INDEFINITE);
+
+    // indefinite items become definite, the untouched array is copied as is
+    ASSERT_EQ(ecbor_get_map_item_ptr(root, 2, &key, &value), ECBOR_OK);
+    value->value.uinteger = 7;
+    ecbor_mark_modified(value);
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    ASSERT_EQ(ecbor_reencode(&ctx, root), ECBOR_OK);
+    std::vector<uint8_t> expected = {
+        0xa3, 0x61, 0x61, 0x63, 0x68, 0x65, 0x6c,
+        0x61, 0x62, 0x98, 0x02, 0x01, 0x02, 0x61, 0x63, 0x07
+    };
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), expected.size());
+    EXPECT_TRUE(std::memcmp(buf, expected.data(), expected.size()) == 0);
+
+    // modified containers are re-encoded
+    ecbor_item_t *element;
+    ASSERT_EQ(ecbor_get_map_item_ptr(root, 1, &key, &value), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_array_item_ptr(value, 1, &element), ECBOR_OK);
+    element->value.uinteger = 3;
+    ecbor_mark_modified(element);
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    ASSERT_EQ(ecbor_reencode(&ctx, root), ECBOR_OK);
+    expected[9] = 0x82;
+    expected[10] = 0x01;
+    expected[11] = 0x03;
+    expected.erase(expected.begin() + 12);
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), expected.size());
+    EXPECT_TRUE(std::memcmp(buf, expected.data(), expected.size()) == 0);
+
+    // fully definite documents are copied verbatim
+    std::vector<uint8_t> definite = { 0xc1, 0x82, 0x19, 0x00, 0x01, 0x61, 0x78 };
+    ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, definite.data(), definite.size(), items, 16), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    ASSERT_EQ(ecbor_reencode(&ctx, root), ECBOR_OK);
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), definite.size());
+    EXPECT_TRUE(std::memcmp(buf, definite.data(), definite.size()) == 0);
+
+    // caching encoded sizes leaves the source sizes alone
+    std::vector<uint8_t> nested = { 0x82, 0x83, 0x01, 0x02, 0x03, 0x63, 0x61, 0x62, 0x63 };
+    size_t cached = 0;
+    ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, nested.data(), nested.size(), items, 16), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+    ASSERT_EQ(ecbor_cache_encoded_size(root, &cached), ECBOR_OK);
+    EXPECT_EQ(cached, nested.size());
+    EXPECT_EQ(root->encoded_size, nested.size());
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    ASSERT_EQ(ecbor_reencode(&ctx, root), ECBOR_OK);
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), nested.size());
+    EXPECT_TRUE(std::memcmp(buf, nested.data(), nested.size()) == 0);
+
+    ASSERT_EQ(ecbor_initialize_encode_streamed(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    EXPECT_EQ(ecbor_reencode(&ctx, root), ECBOR_ERR_WRONG_MODE);
+}
+
+TEST(encoder, reencode_spliced_builder_items)
+{
+    // [1, [2, 3], h'0405']
+    std::vector<uint8_t> doc = { 0x83, 0x01, 0x82, 0x02, 0x03, 0x42, 0x04, 0x05 };
+    ecbor_decode_context_t dctx;
+    ecbor_item_t items[16];
+    ecbor_item_t *root, *first, *inner;
+    ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, doc.data(), doc.size(), items, 16), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_array_item_ptr(root, 0, &first), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_array_item_ptr(root, 1, &inner), ECBOR_OK);
+
+    uint8_t buf[64];
+    ecbor_encode_context_t ctx;
+
+    // builder array written over a decoded one, no mark_modified needed; the
+    // stale source pointer is not followed
+    std::vector<ecbor_item_t> elems = { ecbor_uint(7), ecbor_uint(8), ecbor_uint(9) };
+    ASSERT_EQ(ecbor_array(inner, elems.data(), elems.size()), ECBOR_OK);
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    ASSERT_EQ(ecbor_reencode(&ctx, root), ECBOR_OK);
+    std::vector<uint8_t> expected = { 0x83, 0x01, 0x83, 0x07, 0x08, 0x09, 0x42, 0x04, 0x05 };
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), expected.size());
+    EXPECT_TRUE(std::memcmp(buf, expected.data(), expected.size()) == 0);
+
+    // builder map, made on garbage memory, linked in place of the array
+    ASSERT_EQ(ecbor_initialize_decode_tree(&dctx, doc.data(), doc.size(), items, 16), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&dctx, &root), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_array_item_ptr(root, 0, &first), ECBOR_OK);
+    ASSERT_EQ(ecbor_get_array_item_ptr(root, 1, &inner), ECBOR_OK);
+
+    std::string k_ = "k";
+    std::vector<uint8_t> raw_ = { 0x18, 0x2a };
+    ecbor_item_t map;
+    std::memset(&map, 0xa5, sizeof(map));
+    std::vector<ecbor_item_t> keys = { ecbor_str(k_.c_str(), k_.size()) };
+    std::vector<ecbor_item_t> vals = { ecbor_raw(raw_.data(), raw_.size()) };
+    ASSERT_EQ(ecbor_map(&map, keys.data(), vals.data(), keys.size()), ECBOR_OK);
+    map.next = inner->next;
+    first->next = &map;
+    ASSERT_EQ(ecbor_initialize_encode(&ctx, buf, sizeof(buf)), ECBOR_OK);
+    ASSERT_EQ(ecbor_reencode(&ctx, root), ECBOR_OK);
+    expected = { 0x83, 0x01, 0xa1, 0x61, 0x6b, 0x18, 0x2a, 0x42, 0x04, 0x05 };
+    ASSERT_EQ(ECBOR_GET_ENCODED_BUFFER_SIZE(&ctx), expected.size());
+    EXPECT_TRUE(std::memcmp(buf, expected.data(), expected.size()) == 0);
+
+    // the root was marked as modified on the way
+    EXPECT_EQ(root->size, 0u);
+    EXPECT_EQ(map.parent, root);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor_io.h"
+#include "test_io.h"
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+TEST(file, map_and_decode)
+{
+    const uint8_t cbor[] = { 0x82, 0x01, 0x19, 0x03, 0xe8, 0x63, 'a', 'b', 'c' };
+    temp_file file(cbor, sizeof(cbor));
+
+    ecbor_file_map_t map;
+    ASSERT_EQ(ecbor_map_file(&map, file.c_str(), ECBOR_MAP_SEQUENTIAL | ECBOR_MAP_HUGEPAGES), ECBOR_OK);
+    ASSERT_EQ(map.size, sizeof(cbor));
+    EXPECT_EQ(memcmp(map.data, cbor, sizeof(cbor)), 0);
+
+    ecbor_decode_context_t context;
+    ecbor_item_t item;
+    ASSERT_EQ(ecbor_initialize_decode(&context, map.data, map.size), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(item.type, ECBOR_TYPE_ARRAY);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(item.type, ECBOR_TYPE_STR);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_END_OF_BUFFER);
+
+    EXPECT_EQ(ecbor_advise_file(&map, 5, 100, ECBOR_MAP_WILLNEED), ECBOR_OK);
+    EXPECT_EQ(ecbor_advise_file(&map, 0, 5, ECBOR_MAP_DONTNEED), ECBOR_OK);
+    EXPECT_EQ(ecbor_advise_file(&map, 10, 1, ECBOR_MAP_WILLNEED), ECBOR_ERR_INDEX_OUT_OF_BOUNDS);
+    EXPECT_EQ(ecbor_unmap_file(&map), ECBOR_OK);
+    EXPECT_EQ(map.data, nullptr);
+}
+
+TEST(file, special_files)
+{
+    ecbor_file_map_t map;
+
+    // empty files map to an empty buffer
+    {
+        temp_file empty;
+        ASSERT_EQ(ecbor_map_file(&map, empty.c_str(), 0), ECBOR_OK);
+        EXPECT_EQ(map.size, 0u);
+        EXPECT_NE(map.data, nullptr);
+        EXPECT_EQ(ecbor_unmap_file(&map), ECBOR_OK);
+    }
+
+    // pipes cannot be mapped
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::string fifo = "/proc/self/fd/" + std::to_string(fds[0]);
+    EXPECT_EQ(ecbor_map_file(&map, fifo.c_str(), 0), ECBOR_ERR_CURRENTLY_NOT_SUPPORTED);
+    close(fds[0]);
+    close(fds[1]);
+
+    EXPECT_EQ(ecbor_map_file(&map, "/nonexistent/file", 0), ECBOR_ERR_SYSTEM);
+}
+
+TEST(file, fd_refill)
+{
+    const uint8_t cbor[] = { 0x19, 0x03, 0xe8, 0x63, 'a', 'b', 'c', 0x20 };
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], cbor, sizeof(cbor)), (ssize_t)sizeof(cbor));
+    close(fds[1]);
+
+    uint8_t window[16];
+    ecbor_decode_context_t context;
+    ecbor_item_t item;
+    ASSERT_EQ(ecbor_initialize_decode_streamed(&context, window, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_refill_callback(&context, window, sizeof(window), ecbor_fd_refill, &fds[0]), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(item.value.uinteger, 1000u);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(item.type, ECBOR_TYPE_STR);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_OK);
+    EXPECT_EQ(item.type, ECBOR_TYPE_NINT);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_END_OF_BUFFER);
+    close(fds[0]);
+}
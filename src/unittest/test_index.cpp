@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor_io.h"
+#include "test_io.h"
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// maps of { "id": n, "payload": bytes }, with ids decreasing every 1000 records
+static record_sequence index_records(size_t count)
+{
+    std::vector<uint8_t> payload(64);
+    uint32_t random = 12345;
+    return encode_records(count, [&](ecbor_encode_context_t *context, size_t i) {
+        for (auto &b : payload) {
+            random = random * 1103515245 + 12345;
+            b = (uint8_t)(random >> 16);
+        }
+        ecbor_item_t keys[2] = { ecbor_str("id", 2), ecbor_str("payload", 7) };
+        ecbor_item_t values[2] = { ecbor_int((int64_t)(i % 1000) - (int64_t)(i / 1000)),
+                                   ecbor_bstr(payload.data(), i % payload.size()) };
+        ecbor_item_t map;
+        EXPECT_EQ(ecbor_map(&map, keys, values, 2), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(context, &map), ECBOR_OK);
+    });
+}
+
+static std::vector<char> read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), {});
+}
+
+TEST(index, build_and_seek)
+{
+    const size_t count = 80000;
+    record_sequence seq = index_records(count);
+    ASSERT_GT(seq.data.size(), (size_t)(3 << 20));
+
+    temp_file data_file(seq.data), index_file;
+    std::string data_path = data_file.path();
+    std::string index_path = index_file.path();
+
+    ecbor_item_t key = ecbor_str("id", 2);
+    for (unsigned int threads : { 1u, 3u }) {
+        for (uint64_t stride : { 1ull, 100ull }) {
+            ecbor_index_options_t options = { stride, &key, 1, threads };
+            ASSERT_EQ(ecbor_index_build(data_path.c_str(), index_path.c_str(), &options), ECBOR_OK);
+
+            ecbor_index_t index;
+            ASSERT_EQ(ecbor_index_open(&index, data_path.c_str(), index_path.c_str()), ECBOR_OK);
+            EXPECT_EQ(index.record_count, count);
+            EXPECT_EQ(index.indexed_size, seq.data.size());
+            EXPECT_EQ(index.block_count, (count + stride - 1) / stride);
+
+            for (uint64_t record : { 0ull, 1ull, 99ull, 100ull, 12345ull, 79999ull }) {
+                const uint8_t *data;
+                size_t size;
+                ASSERT_EQ(ecbor_index_get_record(&index, record, &data, &size), ECBOR_OK);
+                EXPECT_EQ((size_t)(data - index.data_map.data), seq.offsets[record]);
+                size_t next = record + 1 < count ? seq.offsets[record + 1] : seq.data.size();
+                EXPECT_EQ(size, next - seq.offsets[record]);
+
+                uint64_t found;
+                ASSERT_EQ(ecbor_index_find_offset(&index, seq.offsets[record], &found), ECBOR_OK);
+                EXPECT_EQ(found, record);
+                if (record > 0) {
+                    ASSERT_EQ(ecbor_index_find_offset(&index, seq.offsets[record] - 1, &found), ECBOR_OK);
+                    EXPECT_EQ(found, record);
+                }
+            }
+            const uint8_t *data;
+            size_t size;
+            uint64_t found;
+            EXPECT_EQ(ecbor_index_get_record(&index, count, &data, &size), ECBOR_ERR_INDEX_OUT_OF_BOUNDS);
+            EXPECT_EQ(ecbor_index_find_offset(&index, seq.data.size(), &found), ECBOR_END_OF_BUFFER);
+
+            // block 10 of stride 100 holds ids 0..99 of the first thousand
+            uint64_t first;
+            size_t offset;
+            int64_t key_min, key_max;
+            ASSERT_EQ(ecbor_index_get_block(&index, stride == 1 ? 1000 : 10, &first, &offset, &key_min, &key_max), ECBOR_OK);
+            EXPECT_EQ(first, 1000u);
+            EXPECT_EQ(offset, seq.offsets[1000]);
+            EXPECT_EQ(key_min, -1);
+            EXPECT_EQ(key_max, stride == 1 ? -1 : 98);
+
+            EXPECT_EQ(ecbor_index_close(&index), ECBOR_OK);
+        }
+    }
+
+    // without a key, entries only hold offsets
+    ecbor_index_options_t options = { 10, nullptr, 0, 0 };
+    ASSERT_EQ(ecbor_index_build(data_path.c_str(), index_path.c_str(), &options), ECBOR_OK);
+    ecbor_index_t index;
+    int64_t key_min;
+    ASSERT_EQ(ecbor_index_open(&index, data_path.c_str(), index_path.c_str()), ECBOR_OK);
+    EXPECT_EQ(ecbor_index_get_block(&index, 0, nullptr, nullptr, &key_min, nullptr), ECBOR_ERR_KEY_NOT_FOUND);
+    EXPECT_EQ(ecbor_index_close(&index), ECBOR_OK);
+}
+
+TEST(index, incremental_update)
+{
+    const size_t count = 60000;
+    record_sequence seq = index_records(count);
+    temp_file data_file, index_file, full_file;
+    std::string data_path = data_file.path();
+    std::string index_path = index_file.path();
+    std::string full_path = full_file.path();
+
+    ecbor_item_t key = ecbor_str("id", 2);
+    ecbor_index_options_t options = { 64, &key, 1, 2 };
+
+    // reference index of the whole file
+    ASSERT_EQ(write(data_file.fd(), seq.data.data(), seq.data.size()), (ssize_t)seq.data.size());
+    ASSERT_EQ(ecbor_index_build(data_path.c_str(), full_path.c_str(), &options), ECBOR_OK);
+    unlink(index_path.c_str());
+
+    // appended in pieces, the last record of each cut in half
+    size_t written = 0;
+    for (size_t cut : { (size_t)1001, (size_t)17017, count }) {
+        size_t end = cut < count ? seq.offsets[cut] + 3 : seq.data.size();
+        std::ofstream out(data_path, std::ios::binary | (written ? std::ios::app : std::ios::trunc));
+        out.write((const char *)seq.data.data() + written, end - written);
+        out.close();
+        written = end;
+
+        ASSERT_EQ(ecbor_index_update(data_path.c_str(), index_path.c_str(), &options), ECBOR_OK);
+        ecbor_index_t index;
+        ASSERT_EQ(ecbor_index_open(&index, data_path.c_str(), index_path.c_str()), ECBOR_OK);
+        EXPECT_EQ(index.record_count, cut);
+        EXPECT_EQ(index.indexed_size, cut < count ? seq.offsets[cut] : seq.data.size());
+        EXPECT_EQ(ecbor_index_close(&index), ECBOR_OK);
+    }
+    EXPECT_EQ(read_file(index_path), read_file(full_path));
+
+    // different options start over
+    options.stride = 32;
+    ASSERT_EQ(ecbor_index_update(data_path.c_str(), index_path.c_str(), &options), ECBOR_OK);
+    ASSERT_EQ(ecbor_index_build(data_path.c_str(), full_path.c_str(), &options), ECBOR_OK);
+    EXPECT_EQ(read_file(index_path), read_file(full_path));
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#ifndef _ECBOR_TEST_IO_H_
+#define _ECBOR_TEST_IO_H_
+
+#include "gtest/gtest.h"
+#include "ecbor.h"
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// CBOR sequence, with the offset of each record
+struct record_sequence {
+    std::vector<uint8_t> data;
+    std::vector<size_t> offsets;
+};
+
+// sequence of <count> records, record i being written by encode_record(context, i)
+template <typename Encode>
+record_sequence encode_records(size_t count, Encode encode_record)
+{
+    record_sequence seq;
+    std::vector<uint8_t> scratch(4096);
+    for (size_t i = 0; i < count; i++) {
+        ecbor_encode_context_t context;
+        EXPECT_EQ(ecbor_initialize_encode(&context, scratch.data(), scratch.size()), ECBOR_OK);
+        encode_record(&context, i);
+        seq.offsets.push_back(seq.data.size());
+        seq.data.insert(seq.data.end(), scratch.begin(),
+                        scratch.begin() + ECBOR_GET_ENCODED_BUFFER_SIZE(&context));
+    }
+    return seq;
+}
+
+// uniquely named file in /tmp, removed when going out of scope
+class temp_file {
+public:
+    temp_file(const uint8_t *data = nullptr, size_t size = 0)
+    {
+        char name[] = "/tmp/ecbor_test_XXXXXX";
+        fd_ = mkstemp(name);
+        EXPECT_GE(fd_, 0);
+        path_ = name;
+        if (size > 0) {
+            EXPECT_EQ(write(fd_, data, size), (ssize_t)size);
+        }
+    }
+
+    explicit temp_file(const std::vector<uint8_t> &data)
+        : temp_file(data.data(), data.size())
+    {
+    }
+
+    ~temp_file()
+    {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        unlink(path_.c_str());
+    }
+
+    temp_file(const temp_file &) = delete;
+    temp_file &operator=(const temp_file &) = delete;
+
+    // descriptor the file was written through, positioned at its end
+    int fd() const { return fd_; }
+    const std::string &path() const { return path_; }
+    const char *c_str() const { return path_.c_str(); }
+
+private:
+    int fd_;
+    std::string path_;
+};
+
+#endif
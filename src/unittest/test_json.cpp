@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor_io.h"
+#include <cmath>
+#include <string>
+#include <vector>
+
+static ecbor_error_t to_json(const std::vector<uint8_t> &cbor, std::string &json,
+                             ecbor_json_tag_policy_t tags = ECBOR_JSON_TAGS_DROP,
+                             ecbor_json_key_policy_t keys = ECBOR_JSON_KEYS_STRINGIFY)
+{
+    static ecbor_json_context_t context;
+    ecbor_decode_context_t input;
+    std::vector<uint8_t> out(1 << 16);
+    size_t size;
+
+    EXPECT_EQ(ecbor_initialize_decode_streamed(&input, cbor.data(), cbor.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_initialize_json(&context, out.data(), out.size()), ECBOR_OK);
+    EXPECT_EQ(ecbor_set_json_policy(&context, tags, keys), ECBOR_OK);
+    ecbor_error_t rc = ecbor_json_transcode(&context, &input);
+    EXPECT_EQ(ecbor_get_json_size(&context, &size), ECBOR_OK);
+    json.assign((const char *)out.data(), size);
+    return rc;
+}
+
+static std::vector<uint8_t> encode(std::vector<ecbor_item_t> items)
+{
+    std::vector<uint8_t> out(1 << 16);
+    ecbor_encode_context_t context;
+    size_t size;
+    EXPECT_EQ(ecbor_initialize_encode(&context, out.data(), out.size()), ECBOR_OK);
+    for (auto &item : items) {
+        EXPECT_EQ(ecbor_encode(&context, &item), ECBOR_OK);
+    }
+    EXPECT_EQ(ecbor_get_encoded_buffer_size(&context, &size), ECBOR_OK);
+    out.resize(size);
+    return out;
+}
+
+TEST(json, scalars)
+{
+    std::string json;
+    ASSERT_EQ(to_json(encode({ ecbor_uint(0), ecbor_uint(18446744073709551615ull), ecbor_int(-1),
+                               ecbor_int(-1234567890123ll), ecbor_bool(1), ecbor_bool(0), ecbor_null(),
+                               ecbor_undefined(), ecbor_fp64(0.1), ecbor_fp64(1.0), ecbor_fp64(-0.0),
+                               ecbor_fp64(1e300), ecbor_fp64(NAN), ecbor_fp32(1.1f), ecbor_fp64(1.0 / 3) }),
+                      json),
+              ECBOR_OK);
+    EXPECT_EQ(json, "0\n18446744073709551615\n-1\n-1234567890123\ntrue\nfalse\nnull\nnull\n0.1\n1.0\n-0.0\n"
+                    "1e+300\nnull\n1.1\n0.3333333333333333\n");
+
+    // -2^64 does not fit any integer type
+    ASSERT_EQ(to_json({ 0x3b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, json), ECBOR_OK);
+    EXPECT_EQ(json, "-18446744073709551616\n");
+}
+
+TEST(json, strings)
+{
+    std::string text = "plain text that is long enough for a vector \"quoted\" \\ tab\t nl\n ctl\x01 end";
+    std::string expected = "\"plain text that is long enough for a vector \\\"quoted\\\" \\\\ tab\\t nl\\n ctl\\u0001 end\"";
+    std::string json;
+    ASSERT_EQ(to_json(encode({ ecbor_str(text.c_str(), text.size()) }), json), ECBOR_OK);
+    EXPECT_EQ(json, expected + "\n");
+
+    // every position of an escape within a vector
+    for (size_t i = 0; i < 40; i++) {
+        std::string s(40, 'x');
+        s[i] = '"';
+        ASSERT_EQ(to_json(encode({ ecbor_str(s.c_str(), s.size()) }), json), ECBOR_OK);
+        std::string escaped;
+        escaped.reserve(s.size() + 4);
+        escaped.append("\"").append(s, 0, i).append("\\\"").append(s, i + 1, std::string::npos).append("\"\n");
+        EXPECT_EQ(json, escaped);
+    }
+
+    // utf-8 passes through
+    ASSERT_EQ(to_json(encode({ ecbor_str("\xc3\xa9\xe2\x82\xac", 5) }), json), ECBOR_OK);
+    EXPECT_EQ(json, "\"\xc3\xa9\xe2\x82\xac\"\n");
+
+    // base64url, unpadded
+    const uint8_t bytes[] = { 0xfb, 0xff, 0xbf, 'a', 'b' };
+    std::vector<ecbor_item_t> bstrs;
+    for (size_t n = 0; n <= 5; n++) {
+        bstrs.push_back(ecbor_bstr(bytes, n));
+    }
+    ASSERT_EQ(to_json(encode(bstrs), json), ECBOR_OK);
+    EXPECT_EQ(json, "\"\"\n\"-w\"\n\"-_8\"\n\"-_-_\"\n\"-_-_YQ\"\n\"-_-_YWI\"\n");
+
+    // indefinite strings, with chunks splitting base64 groups
+    ASSERT_EQ(to_json({ 0x7f, 0x62, 'a', '"', 0x61, 'b', 0xff,
+                        0x5f, 0x41, 0xfb, 0x42, 0xff, 0xbf, 0x41, 'a', 0xff },
+                      json),
+              ECBOR_OK);
+    EXPECT_EQ(json, "\"a\\\"b\"\n\"-_-_YQ\"\n");
+}
+
+TEST(json, containers)
+{
+    ecbor_item_t inner[2] = { ecbor_uint(1), ecbor_str("two", 3) };
+    ecbor_item_t array, empty_array, empty_map, map;
+    ASSERT_EQ(ecbor_array(&array, inner, 2), ECBOR_OK);
+    ASSERT_EQ(ecbor_array(&empty_array, nullptr, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_map(&empty_map, nullptr, nullptr, 0), ECBOR_OK);
+    ecbor_item_t keys[4] = { ecbor_str("a", 1), ecbor_str("b", 1), ecbor_str("c", 1), ecbor_str("d", 1) };
+    ecbor_item_t values[4] = { array, empty_array, empty_map, ecbor_null() };
+    ASSERT_EQ(ecbor_map(&map, keys, values, 4), ECBOR_OK);
+
+    std::string json;
+    ASSERT_EQ(to_json(encode({ map, array }), json), ECBOR_OK);
+    EXPECT_EQ(json, "{\"a\":[1,\"two\"],\"b\":[],\"c\":{},\"d\":null}\n[1,\"two\"]\n");
+
+    // indefinite containers: [_ 1, {_ "k": [_ ]}]
+    ASSERT_EQ(to_json({ 0x9f, 0x01, 0xbf, 0x61, 'k', 0x9f, 0xff, 0xff, 0xff }, json), ECBOR_OK);
+    EXPECT_EQ(json, "[1,{\"k\":[]}]\n");
+
+    // truncated and unbalanced input
+    EXPECT_EQ(to_json({ 0x82, 0x01 }, json), ECBOR_ERR_INVALID_END_OF_BUFFER);
+    EXPECT_EQ(to_json({ 0x9f, 0x01 }, json), ECBOR_ERR_INVALID_END_OF_BUFFER);
+    EXPECT_EQ(to_json({ 0x81, 0xff }, json), ECBOR_ERR_INVALID_STOP_CODE);
+    EXPECT_EQ(to_json({ 0xbf, 0x01, 0xff }, json), ECBOR_ERR_INVALID_STOP_CODE);
+}
+
+TEST(json, policies)
+{
+    // {1: "one", "two": 2, [3]: 3, h'01': 4} and 1(1000)
+    std::vector<uint8_t> map = { 0xa4, 0x01, 0x63, 'o', 'n', 'e', 0x63, 't', 'w', 'o', 0x02,
+                                 0x81, 0x03, 0x03, 0x41, 0x01, 0x04 };
+    std::vector<uint8_t> tagged = { 0xc1, 0x19, 0x03, 0xe8 };
+    std::string json;
+
+    EXPECT_EQ(to_json(map, json), ECBOR_ERR_INVALID_KEY_VALUE_PAIR);
+    map[11] = 0x05; // [3] -> 5
+    map.erase(map.begin() + 12);
+    ASSERT_EQ(to_json(map, json), ECBOR_OK);
+    EXPECT_EQ(json, "{\"1\":\"one\",\"two\":2,\"5\":3,\"AQ\":4}\n");
+    EXPECT_EQ(to_json(map, json, ECBOR_JSON_TAGS_DROP, ECBOR_JSON_KEYS_REJECT), ECBOR_ERR_INVALID_KEY_VALUE_PAIR);
+
+    // skipped pairs may hold containers
+    std::vector<uint8_t> nested = { 0xa3, 0x01, 0x82, 0x01, 0xa1, 0x01, 0x02, 0x61, 'k', 0x80,
+                                    0x82, 0x01, 0x02, 0xbf, 0xff };
+    ASSERT_EQ(to_json(nested, json, ECBOR_JSON_TAGS_DROP, ECBOR_JSON_KEYS_SKIP), ECBOR_OK);
+    EXPECT_EQ(json, "{\"k\":[]}\n");
+
+    ASSERT_EQ(to_json(tagged, json), ECBOR_OK);
+    EXPECT_EQ(json, "1000\n");
+    ASSERT_EQ(to_json(tagged, json, ECBOR_JSON_TAGS_WRAP), ECBOR_OK);
+    EXPECT_EQ(json, "{\"tag\":1,\"value\":1000}\n");
+    EXPECT_EQ(to_json(tagged, json, ECBOR_JSON_TAGS_REJECT), ECBOR_ERR_CURRENTLY_NOT_SUPPORTED);
+
+    // nested tags inside containers
+    ASSERT_EQ(to_json({ 0x82, 0xc1, 0xc2, 0x01, 0x02 }, json, ECBOR_JSON_TAGS_WRAP), ECBOR_OK);
+    EXPECT_EQ(json, "[{\"tag\":1,\"value\":{\"tag\":2,\"value\":1}},2]\n");
+}
+
+static ecbor_error_t append_flush(void *user_data, const uint8_t *data, size_t size)
+{
+    static_cast<std::string*>(user_data)->append((const char *)data, size);
+    return ECBOR_OK;
+}
+
+TEST(json, flush)
+{
+    std::string text(1000, 'q');
+    text[500] = '\n';
+    std::vector<uint8_t> blob(999, 0xab);
+    ecbor_item_t fields[4] = { ecbor_str(text.c_str(), text.size()), ecbor_bstr(blob.data(), blob.size()),
+                               ecbor_fp64(3.25), ecbor_int(-42) };
+    ecbor_item_t array;
+    ASSERT_EQ(ecbor_array(&array, fields, 4), ECBOR_OK);
+    std::vector<uint8_t> cbor = encode({ array, array });
+
+    std::string expected;
+    ASSERT_EQ(to_json(cbor, expected), ECBOR_OK);
+
+    static ecbor_json_context_t context;
+    ecbor_decode_context_t input;
+    uint8_t out[40];
+    std::string flushed;
+    ASSERT_EQ(ecbor_initialize_decode_streamed(&input, cbor.data(), cbor.size()), ECBOR_OK);
+    ASSERT_EQ(ecbor_initialize_json(&context, out, sizeof(out)), ECBOR_OK);
+    EXPECT_EQ(ecbor_json_transcode(&context, &input), ECBOR_ERR_INVALID_END_OF_BUFFER);
+
+    ASSERT_EQ(ecbor_initialize_decode_streamed(&input, cbor.data(), cbor.size()), ECBOR_OK);
+    ASSERT_EQ(ecbor_initialize_json(&context, out, sizeof(out)), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_json_flush_callback(&context, append_flush, &flushed), ECBOR_OK);
+    ASSERT_EQ(ecbor_json_transcode(&context, &input), ECBOR_OK);
+    ASSERT_EQ(ecbor_json_flush(&context), ECBOR_OK);
+    EXPECT_EQ(flushed, expected);
+
+    ASSERT_EQ(ecbor_initialize_json(&context, out, 16), ECBOR_OK);
+    EXPECT_EQ(ecbor_set_json_flush_callback(&context, append_flush, &flushed), ECBOR_ERR_INVALID_END_OF_BUFFER);
+}
+
+static ecbor_error_t from_json(const std::string &json, std::vector<uint8_t> &cbor, size_t *position = nullptr)
+{
+    ecbor_encode_context_t context;
+    size_t size;
+    cbor.resize(1 << 16);
+    EXPECT_EQ(ecbor_initialize_encode(&context, cbor.data(), cbor.size()), ECBOR_OK);
+    ecbor_error_t rc = ecbor_json_encode(&context, (const uint8_t *)json.data(), json.size(), position);
+    EXPECT_EQ(context.container, nullptr);
+    EXPECT_EQ(ecbor_get_encoded_buffer_size(&context, &size), ECBOR_OK);
+    cbor.resize(size);
+    return rc;
+}
+
+TEST(json, parse_scalars)
+{
+    std::vector<uint8_t> cbor;
+    ASSERT_EQ(from_json("0 18446744073709551615 -1 -9223372036854775808 true false null", cbor), ECBOR_OK);
+    EXPECT_EQ(cbor, encode({ ecbor_uint(0), ecbor_uint(18446744073709551615ull), ecbor_int(-1),
+                             ecbor_int(INT64_MIN), ecbor_bool(1), ecbor_bool(0), ecbor_null() }));
+
+    // fractions and exponents are floats, as narrow as exact
+    ASSERT_EQ(from_json("1.5\n0.1\n-0\n1e3\n-2.5E-3\n1e400\n18446744073709551616\n"
+                        "3.14159265358979323846264338327950288\n0.000001", cbor),
+              ECBOR_OK);
+    EXPECT_EQ(cbor, encode({ ecbor_fp32(1.5f), ecbor_fp64(0.1), ecbor_fp32(-0.0f), ecbor_fp32(1000.0f),
+                             ecbor_fp64(-2.5e-3), ecbor_fp32(INFINITY), ecbor_fp32(18446744073709551616.0f),
+                             ecbor_fp64(3.141592653589793), ecbor_fp64(1e-6) }));
+
+    // shortest form round trips through the transcoder
+    std::string json;
+    ASSERT_EQ(from_json("[0.1,1.0,-7,1.1]", cbor), ECBOR_OK);
+    ASSERT_EQ(to_json(cbor, json), ECBOR_OK);
+    EXPECT_EQ(json, "[0.1,1.0,-7,1.1]\n");
+}
+
+TEST(json, parse_strings)
+{
+    std::vector<uint8_t> cbor;
+    std::string text(100, 'x');
+    ASSERT_EQ(from_json("\"" + text + "\" \"\"", cbor), ECBOR_OK);
+    EXPECT_EQ(cbor, encode({ ecbor_str(text.c_str(), text.size()), ecbor_str("", 0) }));
+
+    // escapes, including a surrogate pair
+    std::string expected = "a\"b\\c/\b\f\n\r\t\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80" + text;
+    ASSERT_EQ(from_json("\"a\\\"b\\\\c\\/\\b\\f\\n\\r\\t\\u00e9\\u20AC\\ud83d\\ude00" + text + "\"", cbor), ECBOR_OK);
+    EXPECT_EQ(cbor, encode({ ecbor_str(expected.c_str(), expected.size()) }));
+
+    // every position of an escape within a vector
+    for (size_t i = 0; i < 40; i++) {
+        std::string s(40, 'y');
+        s[i] = '\n';
+        std::string escaped = s.substr(0, i) + "\\n" + s.substr(i + 1);
+        ASSERT_EQ(from_json("\"" + escaped + "\"", cbor), ECBOR_OK);
+        EXPECT_EQ(cbor, encode({ ecbor_str(s.c_str(), s.size()) }));
+    }
+}
+
+TEST(json, parse_containers)
+{
+    std::vector<uint8_t> cbor;
+    std::string input = " { \"a\" : [ 1 , \"two\" ] ,\n\t\"b\":[],\"c\":{},\"d\":null}\n[1,\"two\"]\n";
+    ASSERT_EQ(from_json(input, cbor), ECBOR_OK);
+
+    ecbor_item_t inner[2] = { ecbor_uint(1), ecbor_str("two", 3) };
+    ecbor_item_t array, empty_array, empty_map, map;
+    ASSERT_EQ(ecbor_array(&array, inner, 2), ECBOR_OK);
+    ASSERT_EQ(ecbor_array(&empty_array, nullptr, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_map(&empty_map, nullptr, nullptr, 0), ECBOR_OK);
+    ecbor_item_t keys[4] = { ecbor_str("a", 1), ecbor_str("b", 1), ecbor_str("c", 1), ecbor_str("d", 1) };
+    ecbor_item_t values[4] = { array, empty_array, empty_map, ecbor_null() };
+    ASSERT_EQ(ecbor_map(&map, keys, values, 4), ECBOR_OK);
+    EXPECT_EQ(cbor, encode({ map, array }));
+
+    // headers are as short as the counts allow, also past the inline frames
+    std::string deep = std::string(100, '[') + std::string(100, ']');
+    ASSERT_EQ(from_json(deep, cbor), ECBOR_OK);
+    std::vector<uint8_t> nested(99, 0x81);
+    nested.push_back(0x80);
+    EXPECT_EQ(cbor, nested);
+
+    std::string wide = "[";
+    for (int i = 0; i < 300; i++) {
+        wide += (i ? ",{\"k\":" : "{\"k\":") + std::to_string(i) + "}";
+    }
+    wide += "]";
+    ASSERT_EQ(from_json(wide, cbor), ECBOR_OK);
+    std::string json;
+    ASSERT_EQ(to_json(cbor, json), ECBOR_OK);
+    EXPECT_EQ(json, wide + "\n");
+    EXPECT_EQ(cbor[0], 0x99); // 16 bit count
+}
+
+TEST(json, parse_errors)
+{
+    std::vector<uint8_t> cbor;
+    size_t position;
+    const std::pair<std::string, size_t> invalid[] = {
+        { "[1,]", 3 }, { "{\"a\" 1}", 5 }, { "{1:2}", 1 }, { "[1 2]", 3 }, { "01", 1 },
+        { "1.", 2 }, { "-", 1 }, { "1e", 2 }, { "tru", 0 }, { "truex", 4 }, { "\"abc", 4 },
+        { "\"a\x01\"", 2 }, { "\"\\x\"", 1 }, { "\"\\ud800\"", 7 }, { "\"\\udc00\"", 7 },
+        { "[", 1 }, { "{\"a\":1", 6 }, { "]", 0 }, { "[1}", 2 }, { "nul", 0 },
+    };
+    for (auto &test : invalid) {
+        EXPECT_EQ(from_json(test.first, cbor, &position), ECBOR_ERR_INVALID_SYNTAX) << test.first;
+        EXPECT_EQ(position, test.second) << test.first;
+    }
+
+    EXPECT_EQ(from_json(std::string(ECBOR_MAX_NESTING_DEPTH + 1, '['), cbor), ECBOR_ERR_NESTING_TOO_DEEP);
+
+    // JSON values become children of an open container
+    uint8_t out[32];
+    ecbor_encode_context_t context;
+    ecbor_container_t outer;
+    ASSERT_EQ(ecbor_initialize_encode(&context, out, sizeof(out)), ECBOR_OK);
+    ASSERT_EQ(ecbor_encode_begin_array(&context, &outer), ECBOR_OK);
+    ASSERT_EQ(ecbor_json_encode(&context, (const uint8_t *)"1 [2] 3", 7, nullptr), ECBOR_OK);
+    EXPECT_EQ(ecbor_json_encode(&context, (const uint8_t *)"[\"much too long\"]", 17, nullptr),
+              ECBOR_ERR_INVALID_END_OF_BUFFER);
+    EXPECT_EQ(context.container, &outer);
+
+    ASSERT_EQ(ecbor_initialize_encode_streamed(&context, out, sizeof(out)), ECBOR_OK);
+    EXPECT_EQ(ecbor_json_encode(&context, (const uint8_t *)"1", 1, nullptr), ECBOR_ERR_WRONG_MODE);
+}
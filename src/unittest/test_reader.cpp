@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor_io.h"
+#include "test_io.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+// arrays of [n, "record", bytes]
+static std::vector<uint8_t> reader_records(size_t count)
+{
+    std::vector<uint8_t> blob(100);
+    return encode_records(count, [&](ecbor_encode_context_t *context, size_t i) {
+        // every seventh record is larger than the blocks used below
+        ecbor_item_t fields[3] = {
+            ecbor_uint(i),
+            ecbor_str("record", 6),
+            ecbor_bstr(blob.data(), i % 7 == 0 ? blob.size() : i % 5)
+        };
+        ecbor_item_t array;
+        EXPECT_EQ(ecbor_array(&array, fields, 3), ECBOR_OK);
+        EXPECT_EQ(ecbor_encode(context, &array), ECBOR_OK);
+    }).data;
+}
+
+// reads all windows, checking each holds whole records in order
+static void read_records(int fd, unsigned int flags, size_t block_size, size_t count, unsigned int expected_backend)
+{
+    ecbor_reader_t *reader;
+    ASSERT_EQ(ecbor_reader_open(&reader, fd, block_size, 4, flags), ECBOR_OK);
+
+    unsigned int backend;
+    ASSERT_EQ(ecbor_reader_get_backend(reader, &backend), ECBOR_OK);
+    if (expected_backend == ECBOR_READER_THREAD) {
+        EXPECT_EQ(backend, expected_backend);
+    }
+
+    const uint8_t *window;
+    size_t size, next = 0;
+    ecbor_error_t rc;
+    while ((rc = ecbor_reader_next(reader, &window, &size)) == ECBOR_OK) {
+        ecbor_decode_context_t context;
+        ecbor_item_t record, field;
+        uint64_t seq;
+        ASSERT_GT(size, 0u);
+        ASSERT_EQ(ecbor_initialize_decode(&context, window, size), ECBOR_OK);
+        while (ecbor_decode(&context, &record) == ECBOR_OK) {
+            ASSERT_EQ(ecbor_get_array_item(&record, 0, &field), ECBOR_OK);
+            ASSERT_EQ(ecbor_get_uint64(&field, &seq), ECBOR_OK);
+            EXPECT_EQ(seq, next);
+            next++;
+        }
+        EXPECT_EQ(context.in_position, window + size);
+    }
+    EXPECT_EQ(rc, ECBOR_END_OF_BUFFER);
+    EXPECT_EQ(next, count);
+    EXPECT_EQ(ecbor_reader_close(reader), ECBOR_OK);
+}
+
+TEST(reader, whole_items)
+{
+    const size_t count = 500;
+    std::vector<uint8_t> data = reader_records(count);
+    temp_file file(data);
+    ASSERT_GE(file.fd(), 0);
+
+    for (unsigned int flags : { 0u, (unsigned int)ECBOR_READER_NO_URING }) {
+        for (size_t block_size : { (size_t)16, (size_t)64, (size_t)4096 }) {
+            unsigned int backend = flags ? ECBOR_READER_THREAD : ECBOR_READER_URING;
+            read_records(file.fd(), flags, block_size, count, backend);
+        }
+    }
+
+    // streams are read in order by the worker thread
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    fcntl(fds[1], F_SETPIPE_SZ, (int)data.size());
+    ASSERT_EQ(write(fds[1], data.data(), data.size()), (ssize_t)data.size());
+    close(fds[1]);
+    read_records(fds[0], 0, 64, count, ECBOR_READER_THREAD);
+    close(fds[0]);
+}
+
+TEST(reader, truncated_and_invalid)
+{
+    std::vector<uint8_t> data = reader_records(10);
+    data.resize(data.size() - 1);
+    temp_file file(data);
+    int fd = file.fd();
+    ASSERT_GE(fd, 0);
+
+    // the incomplete last record is handed over on its own
+    ecbor_reader_t *reader;
+    const uint8_t *window;
+    size_t size, total = 0, last = 0;
+    ASSERT_EQ(ecbor_reader_open(&reader, fd, 32, 2, 0), ECBOR_OK);
+    while (ecbor_reader_next(reader, &window, &size) == ECBOR_OK) {
+        total += size;
+        last = size;
+    }
+    EXPECT_EQ(total, data.size());
+
+    ecbor_decode_context_t context;
+    ecbor_item_t item;
+    ASSERT_EQ(ecbor_initialize_decode(&context, data.data() + data.size() - last, last), ECBOR_OK);
+    EXPECT_EQ(ecbor_decode(&context, &item), ECBOR_ERR_INVALID_END_OF_BUFFER);
+    EXPECT_EQ(ecbor_reader_close(reader), ECBOR_OK);
+
+    EXPECT_EQ(ecbor_reader_open(&reader, fd, 8, 2, 0), ECBOR_ERR_INVALID_END_OF_BUFFER);
+    EXPECT_EQ(ecbor_reader_open(&reader, fd, 64, 0, 0), ECBOR_ERR_INDEX_OUT_OF_BOUNDS);
+    EXPECT_EQ(ecbor_reader_open(&reader, -1, 64, 2, 0), ECBOR_ERR_SYSTEM);
+}
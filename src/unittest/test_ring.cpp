@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor_io.h"
+#include <thread>
+#include <unistd.h>
+
+TEST(ring, encode_decode_in_place)
+{
+    ecbor_ring_t producer, consumer;
+    ASSERT_EQ(ecbor_ring_create(&producer, "test", 100), ECBOR_OK);
+    EXPECT_EQ(producer.capacity, 128u);
+    ASSERT_EQ(ecbor_ring_attach(&consumer, dup(producer.fd)), ECBOR_OK);
+
+    const uint8_t *message;
+    size_t size;
+    EXPECT_EQ(ecbor_ring_read(&consumer, &message, &size, 0), ECBOR_END_OF_BUFFER);
+
+    // records of 40 bytes wrap around a 128 byte ring
+    for (uint64_t i = 0; i < 20; i++) {
+        ecbor_encode_context_t context;
+        ASSERT_EQ(ecbor_ring_begin_encode(&producer, &context, 32, 0), ECBOR_OK);
+        ecbor_item_t item = ecbor_uint(i * 1000);
+        ASSERT_EQ(ecbor_encode(&context, &item), ECBOR_OK);
+        ASSERT_EQ(ecbor_ring_end_encode(&producer, &context), ECBOR_OK);
+
+        ASSERT_EQ(ecbor_ring_read(&consumer, &message, &size, 0), ECBOR_OK);
+        ecbor_decode_context_t decode;
+        ecbor_item_t value;
+        uint64_t v;
+        ASSERT_EQ(ecbor_initialize_decode(&decode, message, size), ECBOR_OK);
+        ASSERT_EQ(ecbor_decode(&decode, &value), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_uint64(&value, &v), ECBOR_OK);
+        EXPECT_EQ(v, i * 1000);
+        ASSERT_EQ(ecbor_ring_release(&consumer), ECBOR_OK);
+    }
+
+    // full ring times out, oversized records are rejected
+    uint8_t *slot;
+    ASSERT_EQ(ecbor_ring_reserve(&producer, 60, &slot, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_ring_commit(&producer, 60), ECBOR_OK);
+    ASSERT_EQ(ecbor_ring_reserve(&producer, 60, &slot, 0), ECBOR_OK);
+    ASSERT_EQ(ecbor_ring_commit(&producer, 60), ECBOR_OK);
+    EXPECT_EQ(ecbor_ring_reserve(&producer, 60, &slot, 10), ECBOR_END_OF_BUFFER);
+    EXPECT_EQ(ecbor_ring_commit(&producer, 10), ECBOR_ERR_WRONG_MODE);
+    EXPECT_EQ(ecbor_ring_reserve(&producer, 125, &slot, 0), ECBOR_ERR_INVALID_END_OF_BUFFER);
+
+    EXPECT_EQ(ecbor_ring_close(&consumer), ECBOR_OK);
+    EXPECT_EQ(ecbor_ring_close(&producer), ECBOR_OK);
+}
+
+TEST(ring, producer_consumer)
+{
+    constexpr uint64_t MESSAGES = 100000;
+    ecbor_ring_t producer, consumer;
+    ASSERT_EQ(ecbor_ring_create(&producer, "test", 4096), ECBOR_OK);
+    ASSERT_EQ(ecbor_ring_attach(&consumer, dup(producer.fd)), ECBOR_OK);
+    ASSERT_EQ(ecbor_ring_set_wake_batch(&producer, 16, 64), ECBOR_OK);
+    ASSERT_EQ(ecbor_ring_set_wake_batch(&consumer, 1, 64), ECBOR_OK);
+
+    std::thread writer([&producer]() {
+        for (uint64_t i = 0; i < MESSAGES; i++) {
+            ecbor_encode_context_t context;
+            ecbor_item_t fields[2] = { ecbor_uint(i), ecbor_uint(i * 3) };
+            ecbor_item_t record;
+            ASSERT_EQ(ecbor_array(&record, fields, 2), ECBOR_OK);
+            ASSERT_EQ(ecbor_ring_begin_encode(&producer, &context, 64, -1), ECBOR_OK);
+            ASSERT_EQ(ecbor_encode(&context, &record), ECBOR_OK);
+            ASSERT_EQ(ecbor_ring_end_encode(&producer, &context), ECBOR_OK);
+        }
+        ASSERT_EQ(ecbor_ring_flush(&producer), ECBOR_OK);
+    });
+
+    for (uint64_t i = 0; i < MESSAGES; i++) {
+        const uint8_t *message;
+        size_t size;
+        ASSERT_EQ(ecbor_ring_read(&consumer, &message, &size, -1), ECBOR_OK);
+
+        ecbor_decode_context_t context;
+        ecbor_item_t items[4];
+        ecbor_item_t *root, *first;
+        uint64_t v;
+        ASSERT_EQ(ecbor_initialize_decode_tree(&context, message, size, items, 4), ECBOR_OK);
+        ASSERT_EQ(ecbor_decode_tree(&context, &root), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_array_item_ptr(root, 0, &first), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_uint64(first, &v), ECBOR_OK);
+        ASSERT_EQ(v, i);
+        ASSERT_EQ(ecbor_ring_release(&consumer), ECBOR_OK);
+    }
+    writer.join();
+
+    EXPECT_EQ(ecbor_ring_close(&consumer), ECBOR_OK);
+    EXPECT_EQ(ecbor_ring_close(&producer), ECBOR_OK);
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2021 Vasile Vilvoiu <vasi@vilvoiu.ro>
+ *
+ * libecbor is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+#include "gtest/gtest.h"
+#include "ecbor.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static ecbor_error_t collect_rotate(void *user_data, const uint8_t *buffer, size_t size, uint8_t **next)
+{
+    auto *out = static_cast<std::vector<uint8_t>*>(user_data);
+    out->insert(out->end(), buffer, buffer + size);
+    *next = const_cast<uint8_t*>(buffer);
+    return ECBOR_OK;
+}
+
+static void yield_thread(void *)
+{
+    std::this_thread::yield();
+}
+
+TEST(sequence, single_writer)
+{
+    uint8_t buf[7];
+    std::vector<uint8_t> out;
+    ecbor_sequence_t seq;
+    ASSERT_EQ(ecbor_initialize_sequence(&seq, buf, sizeof(buf), collect_rotate, &out), ECBOR_OK);
+
+    ecbor_item_t item = ecbor_uint(1000);
+    const uint8_t raw[] = { 0x61, 0x78 };
+    EXPECT_EQ(ecbor_sequence_append(&seq, &item), ECBOR_OK);
+    EXPECT_EQ(ecbor_sequence_append_raw(&seq, raw, sizeof(raw)), ECBOR_OK);
+
+    const uint8_t *committed;
+    size_t size;
+    uint32_t generation;
+    EXPECT_EQ(ecbor_sequence_get_committed(&seq, &committed, &size, &generation), ECBOR_OK);
+    EXPECT_EQ(size, 5u);
+    EXPECT_EQ(generation, 0u);
+    EXPECT_TRUE(out.empty());
+
+    // does not fit, rotates
+    EXPECT_EQ(ecbor_sequence_append(&seq, &item), ECBOR_OK);
+    EXPECT_EQ(out.size(), 5u);
+    EXPECT_EQ(ecbor_sequence_flush(&seq), ECBOR_OK);
+    std::vector<uint8_t> expected = { 0x19, 0x03, 0xe8, 0x61, 0x78, 0x19, 0x03, 0xe8 };
+    EXPECT_EQ(out, expected);
+
+    uint8_t large[8] = { 0 };
+    EXPECT_EQ(ecbor_sequence_append_raw(&seq, large, sizeof(large)), ECBOR_ERR_INVALID_END_OF_BUFFER);
+}
+
+TEST(sequence, concurrent_writers)
+{
+    constexpr int THREADS = 4;
+    constexpr uint64_t RECORDS = 2000;
+    uint8_t buf[256];
+    std::vector<uint8_t> out;
+    ecbor_sequence_t seq;
+    ASSERT_EQ(ecbor_initialize_sequence(&seq, buf, sizeof(buf), collect_rotate, &out), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_sequence_yield(&seq, yield_thread, nullptr), ECBOR_OK);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&seq, t]() {
+            for (uint64_t i = 0; i < RECORDS; i++) {
+                ecbor_item_t fields[2] = { ecbor_uint(t), ecbor_uint(i * 1000) };
+                ecbor_item_t record;
+                ASSERT_EQ(ecbor_array(&record, fields, 2), ECBOR_OK);
+                ASSERT_EQ(ecbor_sequence_append(&seq, &record), ECBOR_OK);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(ecbor_sequence_flush(&seq), ECBOR_OK);
+
+    // every record is complete, and each writer's records are in order
+    std::vector<uint64_t> next(THREADS, 0);
+    ecbor_decode_context_t context;
+    std::vector<ecbor_item_t> items(3 * THREADS * RECORDS + 1);
+    ecbor_item_t *root;
+    ASSERT_EQ(ecbor_initialize_decode_tree(&context, out.data(), out.size(), items.data(), items.size()), ECBOR_OK);
+    ASSERT_EQ(ecbor_decode_tree(&context, &root), ECBOR_OK);
+    size_t count = 0;
+    for (ecbor_item_t *record = root; record; record = record->next, count++) {
+        ecbor_item_t *thread, *value;
+        uint64_t t, v;
+        ASSERT_EQ(ecbor_get_array_item_ptr(record, 0, &thread), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_array_item_ptr(record, 1, &value), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_uint64(thread, &t), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_uint64(value, &v), ECBOR_OK);
+        ASSERT_LT(t, (uint64_t)THREADS);
+        EXPECT_EQ(v, next[t] * 1000);
+        next[t]++;
+    }
+    EXPECT_EQ(count, THREADS * RECORDS);
+}
+
+TEST(sequence, committed_prefix)
+{
+    constexpr int THREADS = 4;
+    constexpr uint64_t RECORDS = 2000;
+    uint8_t buf[256];
+    std::vector<uint8_t> out;
+    ecbor_sequence_t seq;
+    ASSERT_EQ(ecbor_initialize_sequence(&seq, buf, sizeof(buf), collect_rotate, &out), ECBOR_OK);
+    ASSERT_EQ(ecbor_set_sequence_yield(&seq, yield_thread, nullptr), ECBOR_OK);
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&seq, t]() {
+            for (uint64_t i = 0; i < RECORDS; i++) {
+                ecbor_item_t fields[2] = { ecbor_uint(t), ecbor_uint(i) };
+                ecbor_item_t record;
+                ASSERT_EQ(ecbor_array(&record, fields, 2), ECBOR_OK);
+                ASSERT_EQ(ecbor_sequence_append(&seq, &record), ECBOR_OK);
+            }
+        });
+    }
+
+    // a reader only ever sees complete records, as long as the generation
+    // did not change while copying them
+    std::thread reader([&]() {
+        while (!done.load()) {
+            const uint8_t *committed;
+            size_t size, check_size;
+            uint32_t generation, check;
+            ASSERT_EQ(ecbor_sequence_get_committed(&seq, &committed, &size, &generation), ECBOR_OK);
+            std::vector<uint8_t> copy(committed, committed + size);
+            ASSERT_EQ(ecbor_sequence_get_committed(&seq, &committed, &check_size, &check), ECBOR_OK);
+            if (check != generation || size == 0) {
+                continue;
+            }
+
+            ecbor_decode_context_t context;
+            ecbor_item_t item;
+            ASSERT_EQ(ecbor_initialize_decode(&context, copy.data(), copy.size()), ECBOR_OK);
+            ecbor_error_t rc;
+            while ((rc = ecbor_decode(&context, &item)) == ECBOR_OK) {
+                ASSERT_TRUE(ECBOR_IS_ARRAY(&item));
+                ASSERT_EQ(ECBOR_GET_LENGTH(&item), 2u);
+            }
+            ASSERT_EQ(rc, ECBOR_END_OF_BUFFER);
+        }
+    });
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    done.store(true);
+    reader.join();
+    ASSERT_EQ(ecbor_sequence_flush(&seq), ECBOR_OK);
+
+    // nothing is lost or duplicated
+    std::vector<uint64_t> count(THREADS, 0);
+    ecbor_decode_context_t context;
+    ecbor_item_t item, field;
+    ASSERT_EQ(ecbor_initialize_decode(&context, out.data(), out.size()), ECBOR_OK);
+    while (ecbor_decode(&context, &item) == ECBOR_OK) {
+        uint64_t t;
+        ASSERT_EQ(ecbor_get_array_item(&item, 0, &field), ECBOR_OK);
+        ASSERT_EQ(ecbor_get_uint64(&field, &t), ECBOR_OK);
+        ASSERT_LT(t, (uint64_t)THREADS);
+        count[t]++;
+    }
+    for (int t = 0; t < THREADS; t++) {
+        EXPECT_EQ(count[t], RECORDS);
+    }
+}
@@ -13,12 +13,21 @@ total_fail=0
 
 run_test() {
   f=$1
-  answer_file=${f%.bin}.answer
   result_file=${f%.bin}.result
 
-  declare -a opts=("" "--tree")
+  declare -a opts=("" "--tree" "--stream" "--diag")
 
   for opt in "${opts[@]}"; do
+    # streamed mode output differs for indefinite containers and errors, and
+    # diagnostic notation is only checked where an answer exists
+    answer_file=${f%.bin}.answer
+    if [ "$opt" == "--stream" ] && [ -f ${f%.bin}.stream.answer ]; then
+      answer_file=${f%.bin}.stream.answer
+    elif [ "$opt" == "--diag" ]; then
+      answer_file=${f%.bin}.diag.answer
+      [ -f $answer_file ] || continue
+    fi
+
     rm -f $result_file
     ../bin/ecbor-describe $opt $f > $result_file 2>/dev/null
     rc=$?
@@ -39,6 +48,58 @@ run_test() {
   done
 }
 
+run_stat_test() {
+  f=$1
+
+  # ecbor-stat accepts what streamed decoding accepts, and accounts for every
+  # byte of the file
+  ../bin/ecbor-describe --stream $f > /dev/null 2>&1
+  expected_rc=$?
+  output=$(../bin/ecbor-stat $f 2>/dev/null)
+  rc=$?
+  bytes=$(echo "$output" | awk '/^bytes/ { print $2 }')
+
+  if [ $rc -ne $expected_rc ] || ( [ $rc -eq 0 ] && [ "$bytes" != "$(stat -c %s $f)" ] ); then
+    fail=$(($fail + 1))
+    status=$FAIL_MSG
+  else
+    pass=$(($pass + 1))
+    status=$PASS_MSG
+  fi
+
+  test_name="$f(ecbor-stat)"
+  machine_indented=$(printf '%-67s' "$test_name")
+  machine_indented=${machine_indented// /.}
+  printf "%s %s\n" "$machine_indented" "$status"
+}
+
+run_query_test() {
+  q=$1
+  result_file=${q%.query}.result
+  answer_file=${q%.query}.answer
+
+  # expression on the first line, options on the second, run over the
+  # records of the same directory
+  expression=$(sed -n 1p $q)
+  options=$(sed -n 2p $q)
+  rm -f $result_file
+  ../bin/ecbor-query $options "$expression" $(dirname $q)/records.bin > $result_file 2>&1
+
+  if [ ! -f $answer_file ] || [ "$(diff $answer_file $result_file 2>/dev/null)" != "" ]; then
+    fail=$(($fail + 1))
+    status=$FAIL_MSG
+  else
+    pass=$(($pass + 1))
+    status=$PASS_MSG
+  fi
+
+  test_name="$q($expression)"
+  machine_indented=$(printf '%-67s' "$test_name")
+  machine_indented=${machine_indented// /.}
+  printf "%s %s\n" "$machine_indented" "$status"
+  diff $answer_file $result_file
+}
+
 # Appendix A tests
 pass=0
 fail=0
@@ -99,6 +160,34 @@ echo "Passed / Failed: ${pass}/${fail}"
 total_pass=$(($total_pass + $pass))
 total_fail=$(($total_fail + $fail))
 
+# Statistics tests
+pass=0
+fail=0
+
+echo ""
+echo "============================== STATISTICS =============================="
+for f in files/appendix_a/*.bin files/error_cases/incomplete/*.bin files/edge_cases/*.bin; do
+  run_stat_test $f
+done
+echo "========================================================================"
+echo "Passed / Failed: ${pass}/${fail}"
+
+total_pass=$(($total_pass + $pass))
+total_fail=$(($total_fail + $fail))
+# Query tests
+pass=0
+fail=0
+
+echo ""
+echo "================================ QUERY ================================="
+for q in files/query/*.query; do
+  run_query_test $q
+done
+echo "========================================================================"
+echo "Passed / Failed: ${pass}/${fail}"
+
+total_pass=$(($total_pass + $pass))
+total_fail=$(($total_fail + $fail))
 
 # Final report
 echo ""